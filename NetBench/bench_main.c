@@ -0,0 +1,369 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "netloopback.h"
+#include "os.h"
+#include "sv_simulation.h"
+#include "sv_server.h"
+#include "bot_client.h"
+#include "bench_replay.h"
+#include "bench_resim.h"
+#include "bench_seek.h"
+
+// ------------------------------------------------------------------
+// bench_main.c: runs the server and a bunch of bots in one process,
+// talking over the in-memory loopback (see netloopback.h) with the
+// clock switched over to a virtual one. nothing ever waits: whenever
+// there's nothing left to do, the clock skips ahead to the next tick
+// or the next datagram that's due. that runs as many ticks per second
+// as the machine can manage, and all the bytes and latencies it reports
+// come out the same on every run, so two builds can be compared by the
+// one number that's actually down to them: how long it all took.
+//
+// usage: NetBench [-clients N] [-ticks N] [-tickrate N] [-latency ms]
+//                 [-pattern idle|random|strafe|spam] [-seed N]
+//                 [-journal path] [-record path]
+//        NetBench -replay capture [-realtime] [-tickrate N]
+//        NetBench -resim journal
+//        NetBench -seek recording
+//
+// with -replay, there are no bots. instead, a capture made with the
+// server's -capture flag gets played back into it (see bench_replay.h).
+// -resim runs just the simulation, off a journal made with -journal
+// here or on the server (see bench_resim.h). -seek jumps around a
+// recording made with -record, here or on the server (see bench_seek.h)
+
+
+// ------------------------------------------------------------------
+// constants
+
+enum { PORT = 4950 };
+
+// ------------------------------------------------------------------
+// reporting
+
+static int Bench_CompareFloats(const void *a, const void *b)
+{
+	float fa = *(const float *)a;
+	float fb = *(const float *)b;
+	return (fa > fb) - (fa < fb);
+}
+
+// sorts the samples
+static float Bench_Percentile(float *samples, size_t count, float percentile)
+{
+	if (count == 0)
+		return 0.0f;
+
+	qsort(samples, count, sizeof(float), Bench_CompareFloats);
+
+	size_t index = (size_t)(percentile*(float)(count - 1) + 0.5f);
+	return samples[index];
+}
+
+// ------------------------------------------------------------------
+// main loop
+
+int main(int argc, char **argv)
+{
+	int    bot_count  = 16;
+	int    tick_count = 12000;
+	int    tickrate   = 120;
+	double latency    = 0.025; // one way, in seconds
+	int    pattern    = BOTPATTERN_RANDOM;
+	uint32_t seed     = 1;
+
+	const char *replay_path  = NULL;
+	const char *resim_path   = NULL;
+	const char *journal_path = NULL;
+	const char *record_path  = NULL;
+	const char *seek_path    = NULL;
+	bool        realtime     = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		char *arg  = argv[i];
+		char *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "-clients") == 0 && next)
+		{
+			bot_count = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-ticks") == 0 && next)
+		{
+			tick_count = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-tickrate") == 0 && next)
+		{
+			tickrate = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-latency") == 0 && next)
+		{
+			latency = atof(next) / 1000.0;
+			i++;
+		}
+		else if (strcmp(arg, "-seed") == 0 && next)
+		{
+			seed = (uint32_t)strtoul(next, NULL, 10);
+			i++;
+		}
+		else if (strcmp(arg, "-replay") == 0 && next)
+		{
+			replay_path = next;
+			i++;
+		}
+		else if (strcmp(arg, "-resim") == 0 && next)
+		{
+			resim_path = next;
+			i++;
+		}
+		else if (strcmp(arg, "-journal") == 0 && next)
+		{
+			journal_path = next;
+			i++;
+		}
+		else if (strcmp(arg, "-record") == 0 && next)
+		{
+			record_path = next;
+			i++;
+		}
+		else if (strcmp(arg, "-seek") == 0 && next)
+		{
+			seek_path = next;
+			i++;
+		}
+		else if (strcmp(arg, "-realtime") == 0)
+		{
+			realtime = true;
+		}
+		else if (strcmp(arg, "-pattern") == 0 && next)
+		{
+			pattern = Bot_PatternFromString(next);
+			if (pattern < 0)
+			{
+				fprintf(stderr, "Unknown pattern '%s'\n", next);
+				return 1;
+			}
+			i++;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown argument '%s'\n", arg);
+		}
+	}
+
+	if (bot_count < 1)   bot_count  = 1;
+	if (tick_count < 1)  tick_count = 1;
+	if (tickrate < 1)    tickrate   = 1;
+	if (latency < 0.0)   latency    = 0.0;
+
+	if (bot_count > LOOPBACK_MAX_SOCKETS - 1)
+		bot_count = LOOPBACK_MAX_SOCKETS - 1;
+
+	if (replay_path)
+		return Bench_Replay(replay_path, realtime, tickrate);
+
+	if (resim_path)
+		return Bench_Resim(resim_path);
+
+	if (seek_path)
+		return Bench_Seek(seek_path);
+
+	// both of these have to happen before anything looks at the time or
+	// creates a socket
+	OS_UseVirtualClock();
+	Loopback_Enable(latency);
+
+	if (SV_Init(PORT, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to initialize the server\n");
+		return 1;
+	}
+
+	double    seconds_per_tick = 1.0 / (double)tickrate;
+	os_time_t tick_duration    = OS_HiresTimeFromSeconds(seconds_per_tick);
+
+	Sim_Init(seconds_per_tick);
+	Sim_SetSeed(seed);
+
+	if (journal_path && Sim_StartJournal(journal_path) != 0)
+		return 1;
+
+	if (record_path && Sim_StartRecording(record_path) != 0)
+		return 1;
+
+	net_addr_t server_address = Net_GetAddr("127.0.0.1", PORT);
+
+	net_context_t net;
+	Net_InitContext(&net, NULL);
+
+	bot_t *bots = calloc((size_t)bot_count, sizeof(bot_t));
+
+	// the bots change direction every so often, which is when they take
+	// a latency sample. this is way more room than they need
+	bot_latency_samples_t latency_samples = {
+		.capacity = (size_t)bot_count*((size_t)tick_count + 1),
+	};
+	latency_samples.samples = calloc(latency_samples.capacity, sizeof(float));
+
+	// how long every tick took for real, in microseconds
+	float *tick_times = calloc((size_t)tick_count, sizeof(float));
+
+	if (!bots || !latency_samples.samples || !tick_times)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("Running %d ticks at %d Hz with %d bots (%s), %.1f ms latency each way\n",
+		   tick_count, tickrate, bot_count, Bot_StringFromPattern((bot_pattern_e)pattern), 1000.0*latency);
+
+	int active_bots = 0;
+	int ticks_run   = 0;
+
+	os_time_t start_time     = OS_GetHiresTime();
+	os_time_t next_tick_time = start_time + tick_duration;
+	os_time_t next_bot_time  = start_time;
+
+	os_time_t real_start_time = OS_GetRealHiresTime();
+
+	while (ticks_run < tick_count)
+	{
+		os_time_t now = OS_GetHiresTime();
+
+		// the bots go first, so their inputs are there for the server to
+		// look at. they join one per tick, so the server doesn't get hit
+		// by all of them at once
+		if (now >= next_bot_time)
+		{
+			if (active_bots < bot_count)
+			{
+				if (Bot_Init(&bots[active_bots], &net, active_bots, (bot_pattern_e)pattern, seed, server_address) != 0)
+				{
+					fprintf(stderr, "Failed to create socket for bot %d, giving up on spawning more\n", active_bots);
+					bot_count = active_bots;
+				}
+				else
+				{
+					active_bots++;
+				}
+			}
+
+			for (int i = 0; i < active_bots; i++)
+			{
+				Bot_Tick(&bots[i], (float)seconds_per_tick, now);
+			}
+
+			next_bot_time += tick_duration;
+		}
+
+		SV_ProcessPackets();
+
+		if (now >= next_tick_time)
+		{
+			os_time_t tick_start_time = OS_GetRealHiresTime();
+
+			Sim_Run((float)seconds_per_tick);
+			SV_SendPings();
+			SV_FlushPackets();
+
+			tick_times[ticks_run++] = (float)(1000000.0*OS_GetSecondsElapsed(tick_start_time, OS_GetRealHiresTime()));
+
+			next_tick_time += tick_duration;
+		}
+
+		for (int i = 0; i < active_bots; i++)
+		{
+			Bot_ReceivePackets(&bots[i], &latency_samples);
+		}
+
+		// skip ahead to whatever happens next. if a datagram is due right
+		// now, the clock stays put and the loop goes around again to get
+		// it delivered
+		os_time_t next_time = (next_tick_time < next_bot_time) ? next_tick_time : next_bot_time;
+
+		os_time_t due_time;
+		if (Loopback_GetNextDueTime(&due_time) && due_time < next_time)
+			next_time = due_time;
+
+		OS_SetVirtualTime(next_time);
+	}
+
+	double real_seconds      = OS_GetSecondsElapsed(real_start_time, OS_GetRealHiresTime());
+	double simulated_seconds = OS_GetSecondsElapsed(start_time, OS_GetHiresTime());
+
+	// ------------------------------------------------------------------
+	// and the results
+
+	bot_stats_t total = { 0 };
+
+	for (int i = 0; i < active_bots; i++)
+	{
+		total.snapshots_received  += bots[i].stats.snapshots_received;
+		total.snapshots_discarded += bots[i].stats.snapshots_discarded;
+	}
+
+	net_stats_t server_stats;
+	SV_GetNetStats(&server_stats);
+
+	net_stats_t bot_stats;
+	Net_GetStats(&net, &bot_stats);
+
+	loopback_stats_t loopback_stats;
+	Loopback_GetStats(&loopback_stats);
+
+	double per_client = 1.0 / (double)(active_bots > 0 ? active_bots : 1);
+
+	printf("\n");
+	printf("simulated %.1f s in %.3f s: %.0f ticks per second, %.1fx real time\n",
+		   simulated_seconds, real_seconds, (double)ticks_run / real_seconds, simulated_seconds / real_seconds);
+
+	printf("tick time:      p50 %7.1f us, p90 %7.1f us, p99 %7.1f us, max %7.1f us\n",
+		   Bench_Percentile(tick_times, (size_t)ticks_run, 0.50f),
+		   Bench_Percentile(tick_times, (size_t)ticks_run, 0.90f),
+		   Bench_Percentile(tick_times, (size_t)ticks_run, 0.99f),
+		   Bench_Percentile(tick_times, (size_t)ticks_run, 1.00f));
+
+	printf("server traffic: %llu bytes in, %llu bytes out (%llu / %llu datagrams)\n",
+		   (unsigned long long)server_stats.totals.bytes_in,   (unsigned long long)server_stats.totals.bytes_out,
+		   (unsigned long long)server_stats.totals.packets_in, (unsigned long long)server_stats.totals.packets_out);
+
+	printf("per client:     %.1f snapshots/s (%u discarded), %.2f kB/s down, %.2f kB/s up\n",
+		   per_client*(double)total.snapshots_received / simulated_seconds, total.snapshots_discarded,
+		   per_client*(double)bot_stats.totals.bytes_in  / simulated_seconds / 1024.0,
+		   per_client*(double)bot_stats.totals.bytes_out / simulated_seconds / 1024.0);
+
+	printf("input latency:  p50 %5.1f ms, p90 %5.1f ms, p99 %5.1f ms (%zu samples)\n",
+		   1000.0f*Bench_Percentile(latency_samples.samples, latency_samples.count, 0.50f),
+		   1000.0f*Bench_Percentile(latency_samples.samples, latency_samples.count, 0.90f),
+		   1000.0f*Bench_Percentile(latency_samples.samples, latency_samples.count, 0.99f),
+		   latency_samples.count);
+
+	printf("loopback:       %llu datagrams, %llu dropped\n",
+		   (unsigned long long)loopback_stats.datagrams_sent, (unsigned long long)loopback_stats.datagrams_dropped);
+
+	for (int i = 0; i < active_bots; i++)
+	{
+		Bot_Close(&bots[i]);
+	}
+
+	Sim_StopJournal();
+	Sim_StopRecording();
+	SV_Exit();
+
+	return 0;
+}
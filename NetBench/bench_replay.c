@@ -0,0 +1,267 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "netloopback.h"
+#include "netcapture.h"
+#include "metrics.h"
+#include "os.h"
+#include "sv_simulation.h"
+#include "sv_server.h"
+#include "bench_replay.h"
+
+// ------------------------------------------------------------------
+// bench_replay.c: the server doesn't know the difference between a
+// captured datagram and a live one, since all it gets to see is what
+// comes out of Net_RecvPacket. the only thing that gets in the way is
+// the connect cookies, which were made with the key of the server that
+// made the capture, so those get waved through.
+
+
+enum { REPLAY_PORT = 4950 };
+
+// every address that shows up in the capture gets its own socket, so
+// the server can tell them apart
+enum { REPLAY_MAX_PEERS = 1024 };
+
+typedef struct replay_peer_t
+{
+	net_addr_t   captured_address;
+	net_socket_t socket;
+} replay_peer_t;
+
+static replay_peer_t g_peers[REPLAY_MAX_PEERS];
+static int           g_peer_count;
+
+static net_context_t g_peer_net;
+
+// returns NULL if there's no room for the peer
+static replay_peer_t *Replay_GetPeer(net_addr_t address)
+{
+	for (int i = 0; i < g_peer_count; i++)
+	{
+		if (Net_AddrMatch(g_peers[i].captured_address, address))
+			return &g_peers[i];
+	}
+
+	if (g_peer_count >= REPLAY_MAX_PEERS)
+		return NULL;
+
+	net_socket_t socket = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
+
+	if (socket.value == INVALID_SOCKET_VALUE)
+		return NULL;
+
+	replay_peer_t *peer = &g_peers[g_peer_count++];
+	peer->captured_address = address;
+	peer->socket           = socket;
+
+	return peer;
+}
+
+// what the server sends to the peers isn't of any interest, but it
+// would pile up if nobody took it out
+static void Replay_DrainPeers(void)
+{
+	alignas(16) char buffer[2048];
+
+	for (int i = 0; i < g_peer_count; i++)
+	{
+		net_addr_t address;
+		while (Net_RecvPacket(&g_peer_net, g_peers[i].socket, buffer, sizeof(buffer), &address) > 0)
+		{
+			// into the void
+		}
+	}
+}
+
+static os_time_t g_start_time;
+static os_time_t g_real_start_time;
+
+// moves the virtual clock to the given time. in realtime mode, waits for
+// the real clock to get there first
+static void Replay_AdvanceTo(os_time_t time, bool realtime)
+{
+	if (realtime)
+	{
+		double target = OS_GetSecondsElapsed(g_start_time, time);
+
+		for (;;)
+		{
+			double remaining = target - OS_GetSecondsElapsed(g_real_start_time, OS_GetRealHiresTime());
+
+			if (remaining <= 0.0)
+				break;
+
+			// sleeping is only so precise, so the last couple of
+			// milliseconds get waited out the busy way
+			if (remaining > 0.002)
+				OS_Sleep((unsigned)(1000.0*remaining) - 1);
+		}
+	}
+
+	OS_SetVirtualTime(time);
+}
+
+int Bench_Replay(const char *path, bool realtime, int tickrate)
+{
+	capture_reader_t reader;
+
+	if (Capture_OpenReader(&reader, path) != 0)
+		return 1;
+
+	capture_datagram_t *datagram = malloc(sizeof(capture_datagram_t));
+
+	if (!datagram)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	OS_UseVirtualClock();
+	Loopback_Enable(0.0);
+
+	if (SV_Init(REPLAY_PORT, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to initialize the server\n");
+		return 1;
+	}
+
+	SV_SetAcceptAnyCookie(true);
+
+	double    seconds_per_tick = 1.0 / (double)tickrate;
+	os_time_t tick_duration    = OS_HiresTimeFromSeconds(seconds_per_tick);
+
+	Sim_Init(seconds_per_tick);
+
+	metrics_histogram_t tick_time = Metrics_RegisterHistogram("replay_tick_time_us");
+
+	Net_InitContext(&g_peer_net, NULL);
+
+	net_addr_t server_address = Net_GetAddr("127.0.0.1", REPLAY_PORT);
+
+	printf("Replaying '%s' at %s speed\n", path, realtime ? "the original" : "maximum");
+
+	uint64_t datagrams_replayed = 0;
+	uint64_t datagrams_ignored  = 0; // from peers that didn't fit
+	uint64_t captured_bytes_out = 0; // what the server sent when the capture was made
+	uint64_t captured_datagrams_out = 0;
+	int      ticks_run = 0;
+
+	g_start_time      = OS_GetHiresTime();
+	g_real_start_time = OS_GetRealHiresTime();
+
+	os_time_t next_tick_time = g_start_time + tick_duration;
+
+	while (Capture_ReadDatagram(&reader, datagram))
+	{
+		if (datagram->direction == NET_DIRECTION_OUT)
+		{
+			captured_bytes_out     += datagram->size;
+			captured_datagrams_out += 1;
+			continue;
+		}
+
+		os_time_t due_time = g_start_time + OS_HiresTimeFromSeconds((double)datagram->time / 1000000.0);
+
+		// the ticks that happened before the datagram arrived
+		while (next_tick_time <= due_time)
+		{
+			Replay_AdvanceTo(next_tick_time, realtime);
+
+			SV_ProcessPackets();
+
+			os_time_t tick_start_time = OS_GetRealHiresTime();
+
+			Sim_Run((float)seconds_per_tick);
+			SV_SendPings();
+			SV_FlushPackets();
+
+			Metrics_RecordTime(tick_time, tick_start_time, OS_GetRealHiresTime());
+
+			Replay_DrainPeers();
+
+			next_tick_time += tick_duration;
+			ticks_run += 1;
+		}
+
+		Replay_AdvanceTo(due_time, realtime);
+
+		replay_peer_t *peer = Replay_GetPeer(datagram->peer);
+
+		if (!peer)
+		{
+			datagrams_ignored += 1;
+			continue;
+		}
+
+		Net_SendPacket(&g_peer_net, peer->socket, server_address, datagram->data, datagram->size);
+		datagrams_replayed += 1;
+
+		// the real server would have picked it up right away
+		SV_ProcessPackets();
+	}
+
+	double real_seconds      = OS_GetSecondsElapsed(g_real_start_time, OS_GetRealHiresTime());
+	double simulated_seconds = OS_GetSecondsElapsed(g_start_time, OS_GetHiresTime());
+
+	// ------------------------------------------------------------------
+	// and the results
+
+	net_stats_t server_stats;
+	SV_GetNetStats(&server_stats);
+
+	metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+
+	if (snapshot)
+		Metrics_GetSnapshot(snapshot);
+
+	printf("\n");
+	printf("replayed %llu datagrams from %d addresses (%llu ignored), %llu index records, %llu bytes skipped\n",
+		   (unsigned long long)datagrams_replayed, g_peer_count, (unsigned long long)datagrams_ignored,
+		   (unsigned long long)reader.index_count, (unsigned long long)reader.skipped_bytes);
+
+	if (real_seconds > 0.0)
+	{
+		printf("simulated %.1f s in %.3f s: %.0f ticks per second, %.1fx real time\n",
+			   simulated_seconds, real_seconds, (double)ticks_run / real_seconds, simulated_seconds / real_seconds);
+	}
+
+	if (snapshot && tick_time.index >= 0)
+	{
+		metrics_histogram_summary_t *summary = &snapshot->histograms[tick_time.index];
+
+		printf("tick time:         p50 %6llu us, p90 %6llu us, p99 %6llu us, max %6llu us\n",
+			   (unsigned long long)summary->p50, (unsigned long long)summary->p90,
+			   (unsigned long long)summary->p99, (unsigned long long)summary->max);
+	}
+
+	printf("server sent:       %llu bytes in %llu datagrams\n",
+		   (unsigned long long)server_stats.totals.bytes_out, (unsigned long long)server_stats.totals.packets_out);
+	printf("when captured:     %llu bytes in %llu datagrams\n",
+		   (unsigned long long)captured_bytes_out, (unsigned long long)captured_datagrams_out);
+
+	free(snapshot);
+	free(datagram);
+
+	Capture_CloseReader(&reader);
+
+	for (int i = 0; i < g_peer_count; i++)
+	{
+		Net_CloseSocket(g_peers[i].socket);
+	}
+
+	SV_Exit();
+
+	return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+// bench_replay.h: plays a capture (see netcapture.h) back into the
+// server, with the server running on the loopback and the virtual clock
+// just like the rest of NetBench. every datagram the server received
+// when the capture was made goes back in at the same point in time, from
+// a socket of its own for every address that sent anything. what the
+// server sends back is thrown away, and only counted.
+//
+// the capture should start with the server, so that every client's
+// handshake is in it. clients that were already connected won't get
+// anywhere.
+
+// goes as fast as it can, unless realtime is set, in which case it
+// takes as long as the capture did. returns the exit code for main
+int Bench_Replay(const char *path, bool realtime, int tickrate);
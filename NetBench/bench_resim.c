@@ -0,0 +1,167 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "metrics.h"
+#include "os.h"
+#include "sv_simulation.h"
+#include "sv_server.h"
+#include "sv_journal.h"
+#include "bench_resim.h"
+
+// ------------------------------------------------------------------
+// bench_resim.c: the records get handed to the simulation in the order
+// they were written. the timeouts are the odd ones out, since they get
+// decided in the middle of a tick, so they're held on to until the tick
+// that they belong to comes along.
+
+
+int Bench_Resim(const char *path)
+{
+	journal_reader_t reader;
+
+	if (Journal_OpenReader(&reader, path) != 0)
+		return 1;
+
+	journal_tick_t *tick = malloc(sizeof(journal_tick_t));
+
+	if (!tick)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	// there are no sockets, but the clients' addresses still get turned
+	// into strings for the log
+	Net_Init();
+
+	double seconds_per_tick = reader.settings.seconds_per_tick;
+
+	Sim_Init(seconds_per_tick);
+	Sim_SetSeed(reader.settings.seed);
+	Sim_SetClientTimeout(reader.settings.client_timeout);
+
+	metrics_histogram_t tick_time = Metrics_RegisterHistogram("resim_tick_time_us");
+
+	printf("Re-simulating '%s' at %.0f Hz, seed %llu\n", path, 1.0 / seconds_per_tick, 
+		   (unsigned long long)reader.settings.seed);
+
+	// a client's timeout timer only fires once per tick
+	journal_event_t timeouts[MAX_CLIENT_COUNT];
+	int             timeout_count = 0;
+
+	int      ticks_run  = 0;
+	int      joins      = 0;
+	int      mismatches = 0;
+	uint32_t first_mismatch = 0;
+
+	os_time_t start_time = OS_GetHiresTime();
+
+	for (;;)
+	{
+		journal_event_t  event;
+		journal_record_e kind = Journal_Read(&reader, &event, tick);
+
+		if (kind == JOURNAL_RECORD_NONE)
+			break;
+
+		switch (kind)
+		{
+			case JOURNAL_RECORD_JOIN:
+			{
+				Sim_ReplayJoin(event.player_id);
+				joins += 1;
+			} break;
+
+			case JOURNAL_RECORD_DISCONNECT:
+			{
+				Sim_ReplayDisconnect(event.player_id);
+			} break;
+
+			case JOURNAL_RECORD_TIMEOUT:
+			{
+				if (timeout_count < MAX_CLIENT_COUNT)
+					timeouts[timeout_count++] = event;
+			} break;
+
+			case JOURNAL_RECORD_TICK:
+			{
+				os_time_t tick_start_time = OS_GetHiresTime();
+
+				uint64_t hash = Sim_ReplayTick((float)seconds_per_tick, tick, timeouts, timeout_count);
+
+				Metrics_RecordTime(tick_time, tick_start_time, OS_GetHiresTime());
+
+				if (hash != tick->hash)
+				{
+					if (mismatches == 0)
+					{
+						first_mismatch = tick->tick;
+						fprintf(stderr, "Tick %u came out different: %016llx instead of %016llx\n", 
+								tick->tick, (unsigned long long)hash, (unsigned long long)tick->hash);
+					}
+
+					mismatches += 1;
+				}
+
+				timeout_count = 0;
+				ticks_run    += 1;
+			} break;
+
+			default: break;
+		}
+	}
+
+	double real_seconds      = OS_GetSecondsElapsed(start_time, OS_GetHiresTime());
+	double simulated_seconds = (double)ticks_run*seconds_per_tick;
+
+	// ------------------------------------------------------------------
+	// and the results
+
+	metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+
+	if (snapshot)
+		Metrics_GetSnapshot(snapshot);
+
+	printf("\n");
+	printf("re-simulated %d ticks with %d joins\n", ticks_run, joins);
+
+	if (real_seconds > 0.0)
+	{
+		printf("simulated %.1f s in %.3f s: %.0f ticks per second, %.1fx real time\n",
+			   simulated_seconds, real_seconds, (double)ticks_run / real_seconds, simulated_seconds / real_seconds);
+	}
+
+	if (snapshot && tick_time.index >= 0)
+	{
+		metrics_histogram_summary_t *summary = &snapshot->histograms[tick_time.index];
+
+		printf("tick time:       p50 %6llu us, p90 %6llu us, p99 %6llu us, max %6llu us\n",
+			   (unsigned long long)summary->p50, (unsigned long long)summary->p90,
+			   (unsigned long long)summary->p99, (unsigned long long)summary->max);
+	}
+
+	if (mismatches == 0)
+		printf("world hashes:    all %d match\n", ticks_run);
+	else
+		printf("world hashes:    %d of %d don't match, starting at tick %u\n", mismatches, ticks_run, first_mismatch);
+
+	free(snapshot);
+	free(tick);
+
+	Journal_CloseReader(&reader);
+
+	Net_Exit();
+
+	return mismatches == 0 ? 0 : 1;
+}
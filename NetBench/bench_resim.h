@@ -0,0 +1,12 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// bench_resim.h: runs the simulation again off a journal (see
+// sv_journal.h), without any network, clients or clock, as fast as it
+// will go. every tick's world hash gets checked against the one in the
+// journal, so this is both the benchmark for the simulation on its own,
+// and the way to find out where a match stopped coming out the same.
+
+// returns the exit code for main, which is 1 if any of the hashes
+// didn't match
+int Bench_Resim(const char *path);
@@ -0,0 +1,191 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "metrics.h"
+#include "os.h"
+#include "recording.h"
+#include "bench_seek.h"
+
+// ------------------------------------------------------------------
+// bench_seek.c: frames get compared by a hash, so playing the recording
+// only has to keep 8 bytes around per tick.
+
+
+enum { SEEK_COUNT = 10000 };
+
+// FNV-1a
+static uint64_t Bench_Hash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+// field by field, since the padding in rec_player_t could be anything
+static uint64_t Bench_HashFrame(const rec_frame_t *frame)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	hash = Bench_Hash(hash, &frame->tick,         sizeof(frame->tick));
+	hash = Bench_Hash(hash, &frame->player_count, sizeof(frame->player_count));
+
+	for (int i = 0; i < frame->player_count; i++)
+	{
+		const rec_player_t *player = &frame->players[i];
+		hash = Bench_Hash(hash, &player->player_id,    sizeof(player->player_id));
+		hash = Bench_Hash(hash, &player->entity.value, sizeof(player->entity.value));
+		hash = Bench_Hash(hash, player->name,          sizeof(player->name));
+	}
+
+	return Bench_Hash(hash, frame->entities, sizeof(frame->entities));
+}
+
+int Bench_Seek(const char *path)
+{
+	rec_reader_t *reader = malloc(sizeof(rec_reader_t));
+
+	if (!reader)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	if (Rec_OpenReader(reader, path) != 0)
+	{
+		free(reader);
+		return 1;
+	}
+
+	uint32_t  tick_count = reader->last_tick - reader->first_tick + 1;
+	uint64_t *hashes     = calloc(tick_count, sizeof(uint64_t));
+	bool     *recorded   = calloc(tick_count, sizeof(bool));
+
+	if (!hashes || !recorded)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(hashes);
+		free(recorded);
+		Rec_CloseReader(reader);
+		free(reader);
+		return 1;
+	}
+
+	printf("'%s': ticks %u to %u at %.0f Hz, %u keyframes, %s\n", path, reader->first_tick, reader->last_tick,
+		   1.0 / reader->seconds_per_tick, reader->keyframe_count, 
+		   reader->indexed ? "indexed" : "no index, had to walk the file");
+
+	// ------------------------------------------------------------------
+	// playing it start to end
+
+	uint32_t frame_count = 0;
+	int      failures    = 0;
+
+	os_time_t start_time = OS_GetHiresTime();
+
+	bool ok = Rec_Seek(reader, reader->first_tick);
+
+	while (ok)
+	{
+		uint32_t index = reader->frame.tick - reader->first_tick;
+
+		if (index < tick_count)
+		{
+			hashes[index]   = Bench_HashFrame(&reader->frame);
+			recorded[index] = true;
+		}
+
+		frame_count += 1;
+
+		ok = Rec_Next(reader);
+	}
+
+	double play_seconds = OS_GetSecondsElapsed(start_time, OS_GetHiresTime());
+
+	// ------------------------------------------------------------------
+	// and jumping around in it
+
+	metrics_histogram_t seek_time = Metrics_RegisterHistogram("seek_time_us");
+
+	uint32_t random_state = 1;
+
+	for (int i = 0; i < SEEK_COUNT; i++)
+	{
+		random_state = random_state*1664525u + 1013904223u;
+
+		uint32_t tick = reader->first_tick + (random_state >> 8) % tick_count;
+
+		os_time_t seek_start_time = OS_GetHiresTime();
+
+		bool seeked = Rec_Seek(reader, tick);
+
+		Metrics_RecordTime(seek_time, seek_start_time, OS_GetHiresTime());
+
+		uint32_t index = reader->frame.tick - reader->first_tick;
+
+		bool same = seeked && reader->frame.tick <= tick && index < tick_count &&
+					recorded[index] && hashes[index] == Bench_HashFrame(&reader->frame);
+
+		if (!same)
+		{
+			if (failures == 0)
+				fprintf(stderr, "Seeking to tick %u landed on tick %u, which isn't what playing got to\n", tick, reader->frame.tick);
+
+			failures += 1;
+		}
+	}
+
+	// ------------------------------------------------------------------
+	// and the results
+
+	metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+
+	if (snapshot)
+		Metrics_GetSnapshot(snapshot);
+
+	double seconds = (double)tick_count*reader->seconds_per_tick;
+
+	printf("\n");
+	printf("file:            %llu bytes, %.0f bytes per second of match, %.1f per frame\n",
+		   (unsigned long long)reader->file.size, seconds > 0.0 ? (double)reader->file.size / seconds : 0.0,
+		   frame_count ? (double)reader->file.size / (double)frame_count : 0.0);
+
+	printf("played:          %u frames (%u missing) in %.3f s\n", frame_count, tick_count - frame_count, play_seconds);
+
+	if (snapshot && seek_time.index >= 0)
+	{
+		metrics_histogram_summary_t *summary = &snapshot->histograms[seek_time.index];
+
+		printf("seek time:       p50 %6llu us, p90 %6llu us, p99 %6llu us, max %6llu us\n",
+			   (unsigned long long)summary->p50, (unsigned long long)summary->p90,
+			   (unsigned long long)summary->p99, (unsigned long long)summary->max);
+	}
+
+	if (failures == 0)
+		printf("seeks:           all %d landed where they should\n", SEEK_COUNT);
+	else
+		printf("seeks:           %d of %d landed somewhere else\n", failures, SEEK_COUNT);
+
+	free(snapshot);
+	free(hashes);
+	free(recorded);
+
+	Rec_CloseReader(reader);
+	free(reader);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// bench_seek.h: jumps around a recording (see recording.h) the way a
+// replay viewer would, and times it. it plays the whole recording from
+// start to end first, and then checks that every seek lands on the same
+// frame that playing it got to, so it doubles as the check that the
+// deltas and the keyframe index agree with each other.
+
+// returns the exit code for main, which is 1 if the recording can't be
+// read, or any seek came out different
+int Bench_Seek(const char *path);
@@ -0,0 +1,427 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <stdalign.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "os.h"
+#include "bot_client.h"
+
+// ------------------------------------------------------------------
+// bot_client.c: implements a headless client that sends scripted or
+// random input to the server and keeps track of what comes back.
+//
+// bots don't go through cl_net.c, because that is built around the
+// single connection of the real client (one global socket, with its
+// own receive thread). instead every bot owns a non-blocking socket,
+// and bot_main.c waits on all of them at once from a single thread.
+
+
+// ------------------------------------------------------------------
+// input patterns
+
+static const char *g_pattern_names[BOTPATTERN_COUNT] = {
+	[BOTPATTERN_IDLE]   = "idle",
+	[BOTPATTERN_RANDOM] = "random",
+	[BOTPATTERN_STRAFE] = "strafe",
+	[BOTPATTERN_SPAM]   = "spam",
+};
+
+int Bot_PatternFromString(const char *name)
+{
+	for (int i = 0; i < BOTPATTERN_COUNT; i++)
+	{
+		if (strcmp(name, g_pattern_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+const char *Bot_StringFromPattern(bot_pattern_e pattern)
+{
+	if (ALWAYS(pattern >= 0 && pattern < BOTPATTERN_COUNT))
+		return g_pattern_names[pattern];
+
+	return "unknown";
+}
+
+// xorshift32, every bot gets its own so runs with the same seed do the 
+// same thing regardless of how many bots there are
+static uint32_t Bot_Random(bot_t *bot)
+{
+	uint32_t x = bot->rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	bot->rng_state = x;
+	return x;
+}
+
+// returns a random float in [0, 1)
+static float Bot_RandomUnilateral(bot_t *bot)
+{
+	return (float)(Bot_Random(bot) >> 8) / (float)(1 << 24);
+}
+
+static uint32_t Bot_ButtonsFromDirection(float dx, float dy)
+{
+	uint32_t result = 0;
+
+	if (dx < -0.3f) result |= NETBTN_LEFT;
+	if (dx >  0.3f) result |= NETBTN_RIGHT;
+	if (dy < -0.3f) result |= NETBTN_UP;
+	if (dy >  0.3f) result |= NETBTN_DOWN;
+
+	return result;
+}
+
+static void Bot_UpdatePattern(bot_t *bot, float dt)
+{
+	bot->pattern_timer -= dt;
+
+	uint32_t movement = bot->btn_down & (NETBTN_LEFT|NETBTN_RIGHT|NETBTN_UP|NETBTN_DOWN);
+	uint32_t shoot    = bot->btn_down & NETBTN_SHOOT;
+
+	switch (bot->pattern)
+	{
+		case BOTPATTERN_IDLE:
+		{
+			movement = 0;
+			shoot    = 0;
+		} break;
+
+		case BOTPATTERN_RANDOM:
+		{
+			if (bot->pattern_timer <= 0.0f)
+			{
+				bot->pattern_timer = 0.2f + 0.8f*Bot_RandomUnilateral(bot);
+				bot->pattern_angle = 6.2831853f*Bot_RandomUnilateral(bot);
+
+				movement = Bot_ButtonsFromDirection(cosf(bot->pattern_angle), sinf(bot->pattern_angle));
+			}
+
+			// shoot, but not every tick, that's what BOTPATTERN_SPAM is for
+			shoot = (Bot_Random(bot) % 16 == 0) ? NETBTN_SHOOT : 0;
+		} break;
+
+		case BOTPATTERN_STRAFE:
+		{
+			if (bot->pattern_timer <= 0.0f)
+			{
+				bot->pattern_timer = 0.5f;
+				movement = (movement == NETBTN_LEFT) ? NETBTN_RIGHT : NETBTN_LEFT;
+			}
+
+			shoot = NETBTN_SHOOT;
+		} break;
+
+		case BOTPATTERN_SPAM:
+		{
+			bot->pattern_angle += 4.0f*dt;
+			movement = Bot_ButtonsFromDirection(cosf(bot->pattern_angle), sinf(bot->pattern_angle));
+
+			// toggling every tick gives a press every other tick
+			shoot ^= NETBTN_SHOOT;
+		} break;
+
+		default:
+		{
+			assert(!"Bot has an invalid input pattern!\n");
+		} break;
+	}
+
+	bot->btn_down = movement|shoot;
+
+	// aim somewhere around the origin, where everybody spawns
+	bot->mouse_x = -150.0f + 300.0f*Bot_RandomUnilateral(bot);
+	bot->mouse_y = -100.0f + 200.0f*Bot_RandomUnilateral(bot);
+}
+
+// ------------------------------------------------------------------
+
+int Bot_Init(bot_t *bot, net_context_t *net, int index, bot_pattern_e pattern, uint32_t seed, net_addr_t server)
+{
+	memset(bot, 0, sizeof(*bot));
+
+	bot->net       = net;
+	bot->server    = server;
+	bot->pattern   = pattern;
+	bot->rng_state = seed ^ (0x9E3779B9u*(uint32_t)(index + 1));
+
+	// xorshift gets stuck on 0
+	if (bot->rng_state == 0)
+		bot->rng_state = 1;
+
+	snprintf(bot->name, sizeof(bot->name), "bot%d", index);
+
+	Fragment_InitReassembler(&bot->reassembler);
+
+	bot->socket = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
+
+	if (bot->socket.value == INVALID_SOCKET_VALUE)
+		return -1;
+
+	// bind explicitly, so the socket can be polled before the first send
+	if (Net_BindSocket(bot->socket, Net_GetPassiveAddr(0)) != 0)
+	{
+		Net_CloseSocket(bot->socket);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void Bot_FlushPackets(bot_t *bot)
+{
+	size_t datagram_size;
+	void *datagram = Bundle_GetDatagram(&bot->send_bundle, &datagram_size);
+
+	if (datagram)
+	{
+		int bytes_sent = Net_SendPacket(bot->net, bot->socket, bot->server, datagram, datagram_size);
+
+		if (bytes_sent > 0)
+			bot->stats.bytes_out += (uint64_t)bytes_sent;
+	}
+
+	Bundle_Clear(&bot->send_bundle);
+}
+
+// bots only ever send small packets, so they always fit in a bundle
+static void Bot_SendPacket(bot_t *bot, const void *packet, size_t packet_size)
+{
+	if (!Bundle_Add(&bot->send_bundle, packet, packet_size))
+	{
+		Bot_FlushPackets(bot);
+		Bundle_Add(&bot->send_bundle, packet, packet_size);
+	}
+}
+
+static void Bot_SendInput(bot_t *bot)
+{
+	net_input_t packet = {
+		.header = {
+			.kind     = NETPACKET_INPUT,
+			.sequence = ++bot->input_sequence,
+		},
+	};
+	NetInput_WritePacket(&bot->input_history, &packet);
+
+	size_t reliable_size = Channel_WriteBlock(&bot->channel, packet.header.sequence, 0.0f,
+											  packet.reliable, sizeof(packet.reliable));
+
+	Bot_SendPacket(bot, &packet, offsetof(net_input_t, reliable) + reliable_size);
+}
+
+void Bot_Disconnect(bot_t *bot)
+{
+	net_msg_disconnect_t message = { .kind = NETMSG_DISCONNECT };
+	Channel_Send(&bot->channel, &message, sizeof(message));
+}
+
+bool Bot_IsDisconnected(bot_t *bot)
+{
+	return Channel_IsIdle(&bot->channel);
+}
+
+void Bot_Close(bot_t *bot)
+{
+	Net_CloseSocket(bot->socket);
+}
+
+static void Bot_SendConnect(bot_t *bot)
+{
+	net_connect_t connect = {
+		.header = {
+			.kind = NETPACKET_CONNECT,
+		},
+		.protocol_id      = NET_PROTOCOL_ID,
+		.protocol_version = NET_PROTOCOL_VERSION,
+		.cookie           = bot->connect_cookie,
+	};
+	memcpy(connect.name, bot->name, sizeof(connect.name));
+
+	Bot_SendPacket(bot, &connect, sizeof(connect));
+}
+
+void Bot_Tick(bot_t *bot, float dt, os_time_t now)
+{
+	uint32_t prev_movement = bot->btn_down & (NETBTN_LEFT|NETBTN_RIGHT|NETBTN_UP|NETBTN_DOWN);
+
+	Bot_UpdatePattern(bot, dt);
+
+	uint32_t movement = bot->btn_down & (NETBTN_LEFT|NETBTN_RIGHT|NETBTN_UP|NETBTN_DOWN);
+
+	// start a new latency probe if the movement direction changed. any probe
+	// still in flight gets abandoned, because the snapshot it was waiting 
+	// for is never going to come anymore
+	if (movement != prev_movement && ENTITY_ID_VALID(bot->entity))
+	{
+		bot->probe_time    = now;
+		bot->probe_dx_sign = !!(movement & NETBTN_RIGHT) - !!(movement & NETBTN_LEFT);
+		bot->probe_dy_sign = !!(movement & NETBTN_DOWN)  - !!(movement & NETBTN_UP);
+	}
+
+	if (!bot->connected)
+	{
+		bot->connect_timer -= dt;
+		if (bot->connect_timer <= 0.0f)
+		{
+			bot->connect_timer += 0.25f;
+
+			Bot_SendConnect(bot);
+		}
+	}
+
+	net_input_frame_t frame = {
+		.btn_down = bot->btn_down,
+		.mouse_x  = bot->mouse_x,
+		.mouse_y  = bot->mouse_y,
+	};
+	NetInput_AddFrame(&bot->input_history, &frame);
+
+	Bot_SendInput(bot);
+	Bot_FlushPackets(bot);
+}
+
+static int Bot_Sign(float x)
+{
+	return (x > 0.0f) - (x < 0.0f);
+}
+
+static void Bot_ProcessWorldState(bot_t *bot, net_world_state_t *packet, os_time_t arrival_time, bot_latency_samples_t *latency_samples)
+{
+	if (!Net_AcceptSequenceNumber(bot->world_state_sequence, packet->header.sequence))
+	{
+		bot->stats.snapshots_discarded += 1;
+		return;
+	}
+
+	bot->world_state_sequence = packet->header.sequence;
+	bot->stats.snapshots_received += 1;
+	bot->connected = true;
+
+	bot->entity = packet->client_id;
+
+	if (!ENTITY_ID_VALID(bot->entity))
+	{
+		// we're dead, so there's nothing to see move
+		bot->probe_time = 0;
+		return;
+	}
+
+	if (bot->probe_time)
+	{
+		net_entity_state_t *state = &packet->world_state[bot->entity.index];
+
+		if (Bot_Sign(state->dx) == bot->probe_dx_sign &&
+			Bot_Sign(state->dy) == bot->probe_dy_sign)
+		{
+			if (latency_samples->count < latency_samples->capacity)
+			{
+				float latency = (float)OS_GetSecondsElapsed(bot->probe_time, arrival_time);
+				latency_samples->samples[latency_samples->count++] = latency;
+			}
+
+			bot->probe_time = 0;
+		}
+	}
+}
+
+static void Bot_ProcessPacket(bot_t *bot, net_header_t *header, size_t packet_size, os_time_t arrival_time, bot_latency_samples_t *latency_samples)
+{
+	if (header->kind == NETPACKET_FRAGMENT)
+	{
+		header = Fragment_Receive(&bot->reassembler, (net_fragment_t *)header, packet_size, arrival_time, &packet_size);
+
+		if (!header || packet_size < sizeof(net_header_t))
+			return;
+	}
+
+	switch (header->kind)
+	{
+		case NETPACKET_PING:
+		{
+			// answer the server's pings like a real client would, so its
+			// round trip time estimates for the bots are meaningful
+			net_ping_t *ping = (net_ping_t *)header;
+
+			if (packet_size >= sizeof(*ping) && !ping->is_reply)
+			{
+				ping->is_reply = 1;
+				Net_SendPacket(bot->net, bot->socket, bot->server, ping, sizeof(*ping));
+			}
+		} break;
+
+		case NETPACKET_CHALLENGE:
+		{
+			// the answer goes out with the next tick's input
+			if (!bot->connected && packet_size >= sizeof(net_challenge_t))
+			{
+				bot->connect_cookie = ((net_challenge_t *)header)->cookie;
+				bot->connect_timer  = 0.0f;
+			}
+		} break;
+
+		case NETPACKET_WORLD_STATE:
+		{
+			if (packet_size < offsetof(net_world_state_t, reliable))
+				break;
+
+			net_world_state_t *packet = (net_world_state_t *)header;
+
+			// out of order world states still count for acks
+			if (Channel_ReadBlock(&bot->channel, packet->header.sequence, packet->reliable, 
+								  packet_size - offsetof(net_world_state_t, reliable)))
+			{
+				// nothing in there is interesting to a bot
+				net_message_t message;
+				while (Channel_Receive(&bot->channel, &message)) {}
+			}
+
+			Bot_ProcessWorldState(bot, packet, arrival_time, latency_samples);
+		} break;
+	}
+}
+
+void Bot_ReceivePackets(bot_t *bot, bot_latency_samples_t *latency_samples)
+{
+	for (;;)
+	{
+		alignas(16) char buffer[8192];
+
+		net_addr_t addr;
+		int byte_count = Net_RecvPacket(bot->net, bot->socket, buffer, sizeof(buffer), &addr);
+
+		if (byte_count <= 0)
+			break;
+
+		os_time_t arrival_time = OS_GetHiresTime();
+
+		if (!Net_AddrMatch(addr, bot->server))
+			continue;
+
+		bot->stats.bytes_in += (uint64_t)byte_count;
+
+		bundle_reader_t reader;
+		Bundle_BeginRead(&reader, buffer, (size_t)byte_count);
+
+		net_header_t *header;
+		size_t packet_size;
+
+		while (Bundle_Next(&reader, &header, &packet_size))
+		{
+			Bot_ProcessPacket(bot, header, packet_size, arrival_time, latency_samples);
+		}
+	}
+}
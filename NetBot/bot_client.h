@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "net.h"
+#include "netinput.h"
+#include "channel.h"
+#include "fragment.h"
+#include "bundle.h"
+#include "os.h"
+
+// ------------------------------------------------------------------
+// bot_client.h: a headless simulated client. it speaks the same
+// protocol as the real client, but there's no window, no rendering
+// and no raylib, so a single process can run thousands of them
+
+// the different ways a bot can drive its input
+typedef enum bot_pattern_e
+{
+	BOTPATTERN_IDLE,   // sends input every tick, but never presses anything
+	BOTPATTERN_RANDOM, // wanders in random directions and shoots at random
+	BOTPATTERN_STRAFE, // strafes left and right while holding down shoot
+	BOTPATTERN_SPAM,   // taps shoot as fast as it can while running in circles
+
+	BOTPATTERN_COUNT,
+} bot_pattern_e;
+
+// returns the pattern for a name like "random", or -1 if there is none
+int Bot_PatternFromString(const char *name);
+const char *Bot_StringFromPattern(bot_pattern_e pattern);
+
+// the stats of a single bot, which get summed up and reset by the 
+// reporting code in bot_main.c
+typedef struct bot_stats_t
+{
+	uint32_t snapshots_received;
+	uint32_t snapshots_discarded; // out of order or duplicate
+
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+} bot_stats_t;
+
+typedef struct bot_t
+{
+	net_context_t *net; // shared by all the bots
+	net_socket_t   socket;
+	net_addr_t     server;
+
+	char name[NET_USERNAME_MAX_SIZE];
+
+	bot_pattern_e pattern;
+	uint32_t      rng_state;
+
+	bool  connected;     // whether the server has sent us a world state yet
+	float connect_timer; // counts down to resending the connect packet until then
+
+	unsigned long long connect_cookie; // from the server's last challenge, 0 until then
+
+	unsigned short      input_sequence;
+	unsigned short      world_state_sequence;
+	net_input_history_t input_history;
+
+	// bots don't care about any of the reliable messages, but they still
+	// need to ack them like a real client, or the server would keep 
+	// resending them forever
+	net_channel_t channel;
+
+	fragment_reassembler_t reassembler; // world states are too big for a single datagram
+	bundle_writer_t        send_bundle; // everything sent in a tick goes out as one datagram
+
+	net_entity_id_t entity; // the entity the server says belongs to us
+
+	// current input state
+	uint32_t btn_down;
+	float    mouse_x, mouse_y;
+	float    pattern_timer; // counts down to the next change in input
+	float    pattern_angle;
+
+	// to measure input-to-snapshot latency, the bot remembers the moment
+	// it changed its movement direction, and waits for a snapshot that 
+	// shows its entity moving that way
+	os_time_t probe_time;    // 0 if there is no probe in flight
+	int       probe_dx_sign;
+	int       probe_dy_sign;
+
+	bot_stats_t stats;
+} bot_t;
+
+// a place for bots to drop their latency measurements, in seconds
+typedef struct bot_latency_samples_t
+{
+	size_t count;
+	size_t capacity;
+	float *samples;
+} bot_latency_samples_t;
+
+// creates the socket for the bot, returns 0 on success
+int  Bot_Init(bot_t *bot, net_context_t *net, int index, bot_pattern_e pattern, uint32_t seed, net_addr_t server);
+void Bot_Close(bot_t *bot);
+
+// queues up a reliable goodbye for the server. the bot has to keep
+// ticking and receiving packets until Bot_IsDisconnected says the
+// server has acked it
+void Bot_Disconnect(bot_t *bot);
+bool Bot_IsDisconnected(bot_t *bot);
+
+// updates the bot's input pattern and sends an input packet
+void Bot_Tick(bot_t *bot, float dt, os_time_t now);
+
+// drains the bot's socket of all pending packets
+void Bot_ReceivePackets(bot_t *bot, bot_latency_samples_t *latency_samples);
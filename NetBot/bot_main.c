@@ -0,0 +1,477 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "os.h"
+#include "spectate.h"
+#include "bot_client.h"
+
+// ------------------------------------------------------------------
+// bot_main.c: entry point for the load generator. it connects a 
+// whole bunch of headless bots to a server and reports on how well
+// the server keeps up with them.
+//
+// usage: NetBot [-server host:port] [-clients N] [-spawn_rate N]
+//               [-pattern idle|random|strafe|spam] [-duration seconds]
+//               [-tickrate N] [-seed N] [-spectate host:port]
+//
+// with -spectate, the bots are spectators of a broadcast (a relay, or
+// the server's -spectate_port) instead, see spectate.h
+
+
+// ------------------------------------------------------------------
+// reporting
+
+static int Bot_CompareFloats(const void *a, const void *b)
+{
+	float fa = *(const float *)a;
+	float fb = *(const float *)b;
+	return (fa > fb) - (fa < fb);
+}
+
+// expects the samples to be sorted
+static float Bot_Percentile(float *samples, size_t count, float percentile)
+{
+	if (count == 0)
+		return 0.0f;
+
+	size_t index = (size_t)(percentile*(float)(count - 1) + 0.5f);
+	return samples[index];
+}
+
+static void Bot_Report(bot_t *bots, int bot_count, bot_latency_samples_t *latency_samples, double interval)
+{
+	bot_stats_t total = { 0 };
+
+	uint32_t fragments_lost = 0; // this one is a running total, it doesn't get reset
+
+	for (int i = 0; i < bot_count; i++)
+	{
+		bot_t *bot = &bots[i];
+
+		fragments_lost += bot->reassembler.stats.fragments_lost;
+
+		total.snapshots_received  += bot->stats.snapshots_received;
+		total.snapshots_discarded += bot->stats.snapshots_discarded;
+		total.bytes_in            += bot->stats.bytes_in;
+		total.bytes_out           += bot->stats.bytes_out;
+
+		memset(&bot->stats, 0, sizeof(bot->stats));
+	}
+
+	if (bot_count == 0 || interval <= 0.0)
+		return;
+
+	double per_client = 1.0 / (double)bot_count;
+
+	qsort(latency_samples->samples, latency_samples->count, sizeof(float), Bot_CompareFloats);
+
+	float p50 = Bot_Percentile(latency_samples->samples, latency_samples->count, 0.50f);
+	float p90 = Bot_Percentile(latency_samples->samples, latency_samples->count, 0.90f);
+	float p99 = Bot_Percentile(latency_samples->samples, latency_samples->count, 0.99f);
+
+	printf("clients: %5d | snapshots/s per client: %6.1f (%u discarded, %u fragments lost in total) | kB/s per client: %7.2f down %6.2f up | input latency (%zu samples): p50 %5.1f ms, p90 %5.1f ms, p99 %5.1f ms\n",
+		   bot_count,
+		   per_client*(double)total.snapshots_received / interval,
+		   total.snapshots_discarded,
+		   fragments_lost,
+		   per_client*(double)total.bytes_in  / interval / 1024.0,
+		   per_client*(double)total.bytes_out / interval / 1024.0,
+		   latency_samples->count,
+		   1000.0f*p50, 1000.0f*p90, 1000.0f*p99);
+
+	latency_samples->count = 0;
+}
+
+// ------------------------------------------------------------------
+// spectators
+
+static void Bot_ReportSpectators(spectate_client_t **spectators, int spectator_count, spectate_stats_t *last_stats, double interval)
+{
+	spectate_stats_t total = { 0 };
+
+	int subscribed = 0;
+
+	for (int i = 0; i < spectator_count; i++)
+	{
+		spectate_stats_t stats;
+		Spectate_GetStats(spectators[i], &stats);
+
+		subscribed += stats.subscribed;
+
+		total.snapshots_received += stats.snapshots_received - last_stats[i].snapshots_received;
+		total.keyframes_received += stats.keyframes_received - last_stats[i].keyframes_received;
+		total.snapshots_stale    += stats.snapshots_stale    - last_stats[i].snapshots_stale;
+		total.snapshots_orphaned += stats.snapshots_orphaned - last_stats[i].snapshots_orphaned;
+
+		total.net.bytes_in_per_second  += stats.net.bytes_in_per_second;
+		total.net.bytes_out_per_second += stats.net.bytes_out_per_second;
+
+		total.fragments.fragments_lost += stats.fragments.fragments_lost;
+
+		last_stats[i] = stats;
+	}
+
+	if (spectator_count == 0 || interval <= 0.0)
+		return;
+
+	double per_spectator = 1.0 / (double)spectator_count;
+
+	printf("spectators: %5d (%5d subscribed) | snapshots/s per spectator: %5.1f (%.2f keyframes, %llu stale, %llu orphaned, %u fragments lost in total) | kB/s per spectator: %6.2f down %5.2f up\n",
+		   spectator_count, subscribed,
+		   per_spectator*(double)total.snapshots_received / interval,
+		   per_spectator*(double)total.keyframes_received / interval,
+		   (unsigned long long)total.snapshots_stale,
+		   (unsigned long long)total.snapshots_orphaned,
+		   total.fragments.fragments_lost,
+		   per_spectator*(double)total.net.bytes_in_per_second  / 1024.0,
+		   per_spectator*(double)total.net.bytes_out_per_second / 1024.0);
+}
+
+static int Bot_RunSpectators(char *host, int port, int spectator_count, int spawn_rate, double duration)
+{
+	spectate_client_t **spectators = calloc((size_t)spectator_count, sizeof(spectate_client_t *));
+	spectate_stats_t   *last_stats = calloc((size_t)spectator_count, sizeof(spectate_stats_t));
+
+	net_poll_set_t poll_set;
+
+	if (!spectators || !last_stats || Net_CreatePollSet(&poll_set, (size_t)spectator_count) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("Connecting %d spectators to %s:%d at %d spectators per second\n", spectator_count, host, port, spawn_rate);
+
+	int active_spectators = 0;
+
+	os_time_t start_time  = OS_GetHiresTime();
+	os_time_t report_time = start_time;
+
+	for (;;)
+	{
+		os_time_t now  = OS_GetHiresTime();
+		double    time = OS_GetSecondsElapsed(start_time, now);
+
+		if (duration > 0.0 && time >= duration)
+			break;
+
+		int target_spectators = (int)(time*(double)spawn_rate) + 1;
+		if (target_spectators > spectator_count)
+			target_spectators = spectator_count;
+
+		while (active_spectators < target_spectators)
+		{
+			spectate_client_t *spectator = Spectate_Connect(host, port, NULL);
+
+			if (!spectator)
+			{
+				fprintf(stderr, "Failed to create socket for spectator %d, giving up on spawning more\n", active_spectators);
+				spectator_count = active_spectators;
+				break;
+			}
+
+			spectators[active_spectators++] = spectator;
+			Net_AddToPollSet(&poll_set, Spectate_GetSocket(spectator));
+		}
+
+		// every spectator gets polled, readable or not, so the keepalives
+		// go out on time
+		Net_Poll(&poll_set, 5);
+
+		for (int i = 0; i < active_spectators; i++)
+			Spectate_Poll(spectators[i]);
+
+		double report_interval = OS_GetSecondsElapsed(report_time, now);
+		if (report_interval >= 1.0)
+		{
+			Bot_ReportSpectators(spectators, active_spectators, last_stats, report_interval);
+			report_time = now;
+		}
+	}
+
+	for (int i = 0; i < active_spectators; i++)
+		Spectate_Disconnect(spectators[i]);
+
+	Net_DestroyPollSet(&poll_set);
+
+	free(spectators);
+	free(last_stats);
+
+	return 0;
+}
+
+// ------------------------------------------------------------------
+// main loop
+
+int main(int argc, char **argv)
+{
+	char *server     = "localhost";
+	int   port       = 4950;
+	int   bot_count  = 16;
+	int   spawn_rate = 100; // bots per second
+	int   tickrate   = 120;
+	int   pattern    = BOTPATTERN_RANDOM;
+	double duration  = 0.0; // 0 runs forever
+	uint32_t seed    = 1;
+
+	char *spectate_host = NULL;
+	int   spectate_port = 4953;
+
+	for (int i = 1; i < argc; i++)
+	{
+		char *arg  = argv[i];
+		char *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "-server") == 0 && next)
+		{
+			for (char *c = next; *c; c++)
+			{
+				if (*c == ':')
+				{
+					*c = 0;
+					port = atoi(c + 1);
+				}
+			}
+			server = next;
+			i++;
+		}
+		else if (strcmp(arg, "-spectate") == 0 && next)
+		{
+			for (char *c = next; *c; c++)
+			{
+				if (*c == ':')
+				{
+					*c = 0;
+					spectate_port = atoi(c + 1);
+				}
+			}
+			spectate_host = next;
+			i++;
+		}
+		else if (strcmp(arg, "-clients") == 0 && next)
+		{
+			bot_count = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-spawn_rate") == 0 && next)
+		{
+			spawn_rate = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-tickrate") == 0 && next)
+		{
+			tickrate = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-duration") == 0 && next)
+		{
+			duration = atof(next);
+			i++;
+		}
+		else if (strcmp(arg, "-seed") == 0 && next)
+		{
+			seed = (uint32_t)strtoul(next, NULL, 10);
+			i++;
+		}
+		else if (strcmp(arg, "-pattern") == 0 && next)
+		{
+			pattern = Bot_PatternFromString(next);
+			if (pattern < 0)
+			{
+				fprintf(stderr, "Unknown pattern '%s'\n", next);
+				return 1;
+			}
+			i++;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown argument '%s'\n", arg);
+		}
+	}
+
+	if (bot_count < 1)   bot_count  = 1;
+	if (spawn_rate < 1)  spawn_rate = 1;
+	if (tickrate < 1)    tickrate   = 1;
+
+	if (Net_Init() != 0)
+	{
+		fprintf(stderr, "Failed to initialize networking\n");
+		return 1;
+	}
+
+	if (spectate_host)
+	{
+		int result = Bot_RunSpectators(spectate_host, spectate_port, bot_count, spawn_rate, duration);
+
+		Net_Exit();
+		return result;
+	}
+
+	net_addr_t server_address = Net_GetAddr(server, port);
+
+	net_context_t net;
+	Net_InitContext(&net, NULL);
+
+	bot_t *bots = calloc((size_t)bot_count, sizeof(bot_t));
+
+	// enough room for every bot to change direction every tick for a couple
+	// of seconds, which is way more than they actually do
+	bot_latency_samples_t latency_samples = {
+		.capacity = (size_t)bot_count*(size_t)tickrate*2,
+	};
+	latency_samples.samples = calloc(latency_samples.capacity, sizeof(float));
+
+	net_poll_set_t poll_set;
+
+	if (!bots || !latency_samples.samples || Net_CreatePollSet(&poll_set, (size_t)bot_count) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("Connecting %d bots (%s) to %s:%d at %d bots per second\n", 
+		   bot_count, Bot_StringFromPattern((bot_pattern_e)pattern), server, port, spawn_rate);
+
+	double seconds_per_tick = 1.0 / (double)tickrate;
+
+	int active_bots = 0;
+
+	os_time_t start_time  = OS_GetHiresTime();
+	os_time_t report_time = start_time;
+
+	double next_tick_time = 0.0;
+
+	for (;;)
+	{
+		os_time_t now = OS_GetHiresTime();
+		double    time = OS_GetSecondsElapsed(start_time, now);
+
+		if (duration > 0.0 && time >= duration)
+			break;
+
+		// ramp up the amount of connected bots, so the server doesn't get 
+		// hit by all of them on the same tick
+
+		int target_bots = (int)(time*(double)spawn_rate) + 1;
+		if (target_bots > bot_count)
+			target_bots = bot_count;
+
+		while (active_bots < target_bots)
+		{
+			bot_t *bot = &bots[active_bots];
+
+			if (Bot_Init(bot, &net, active_bots, (bot_pattern_e)pattern, seed, server_address) != 0)
+			{
+				fprintf(stderr, "Failed to create socket for bot %d, giving up on spawning more\n", active_bots);
+				bot_count = active_bots;
+				break;
+			}
+
+			Net_AddToPollSet(&poll_set, bot->socket);
+			active_bots++;
+		}
+
+		// tick the bots. if we fell behind by a lot, skip ahead instead of
+		// flooding the server with a burst of catch-up inputs
+
+		if (time >= next_tick_time)
+		{
+			if (time - next_tick_time > 4.0*seconds_per_tick)
+				next_tick_time = time;
+
+			for (int i = 0; i < active_bots; i++)
+			{
+				Bot_Tick(&bots[i], (float)seconds_per_tick, now);
+			}
+
+			next_tick_time += seconds_per_tick;
+		}
+
+		// wait for packets until the next tick is due
+
+		int timeout_ms = (int)(1000.0*(next_tick_time - OS_GetSecondsElapsed(start_time, OS_GetHiresTime())));
+		if (timeout_ms < 0)
+			timeout_ms = 0;
+
+		if (Net_Poll(&poll_set, timeout_ms) > 0)
+		{
+			for (int i = 0; i < active_bots; i++)
+			{
+				if (Net_PollSetIsReadable(&poll_set, (size_t)i))
+				{
+					Bot_ReceivePackets(&bots[i], &latency_samples);
+				}
+			}
+		}
+
+		// and report once per second
+
+		now = OS_GetHiresTime();
+
+		double report_interval = OS_GetSecondsElapsed(report_time, now);
+		if (report_interval >= 1.0)
+		{
+			Bot_Report(bots, active_bots, &latency_samples, report_interval);
+			report_time = now;
+		}
+	}
+
+	// say goodbye, and keep the bots going until the server has heard
+	// all of them (or it's taking too long)
+
+	for (int i = 0; i < active_bots; i++)
+	{
+		Bot_Disconnect(&bots[i]);
+	}
+
+	os_time_t goodbye_time = OS_GetHiresTime();
+
+	while (OS_GetSecondsElapsed(goodbye_time, OS_GetHiresTime()) < 1.0)
+	{
+		bool all_disconnected = true;
+
+		for (int i = 0; i < active_bots; i++)
+		{
+			if (!Bot_IsDisconnected(&bots[i]))
+			{
+				all_disconnected = false;
+				Bot_Tick(&bots[i], (float)seconds_per_tick, OS_GetHiresTime());
+			}
+		}
+
+		if (all_disconnected)
+			break;
+
+		if (Net_Poll(&poll_set, 20) > 0)
+		{
+			for (int i = 0; i < active_bots; i++)
+			{
+				if (Net_PollSetIsReadable(&poll_set, (size_t)i))
+				{
+					Bot_ReceivePackets(&bots[i], &latency_samples);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < active_bots; i++)
+	{
+		Bot_Close(&bots[i]);
+	}
+
+	Net_DestroyPollSet(&poll_set);
+	Net_Exit();
+
+	return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
 
@@ -18,6 +19,12 @@
 #include "protocol.h"
 #include "util.h"
 #include "net.h"
+#include "netlink.h"
+#include "netinput.h"
+#include "channel.h"
+#include "os.h"
+#include "recording.h"
+#include "spectate.h"
 #include "cl_client.h"
 #include "cl_net.h"
 
@@ -34,6 +41,8 @@ typedef enum gamestate_e
 {
 	GAMESTATE_MENU,
 	GAMESTATE_WORLD,
+	GAMESTATE_REPLAY,
+	GAMESTATE_SPECTATE,
 } gamestate_e;
 
 static gamestate_e g_gamestate;
@@ -44,6 +53,15 @@ static void Menu_Draw(void);
 static void World_Tick(float dt);
 static void World_Draw(void);
 
+static void Replay_Tick(float dt);
+static void Replay_Draw(void);
+static void Replay_DrawDebug(void);
+
+static void Spectator_Tick(float dt);
+static void Spectator_Draw(void);
+static void Spectator_DrawDebug(void);
+static void Spectator_Leave(void);
+
 // ------------------------------------------------------------------
 // some array of colors used for entities and particles
 
@@ -71,12 +89,15 @@ static Color g_colors[] = {
 // ------------------------------------------------------------------
 // input state
 
-static unsigned short g_input_sequence;
+static unsigned short      g_input_sequence;
+static net_input_history_t g_input_history; // the last few inputs, which get sent along with every input packet
 static uint32_t g_buttons_down;
 static uint32_t g_buttons_pressed;
 static uint32_t g_buttons_released;
 static bool     g_show_debug_info = true;
 
+static float g_seconds_per_tick = 1.0f / 120.0f; // nominal, see CL_Init
+
 // ------------------------------------------------------------------
 // client-side state (if you had split-screen you could have multiple
 // of these cl_player_t things)
@@ -213,10 +234,12 @@ static void CL_SpawnParticleExplosion(float x, float y)
 // ------------------------------------------------------------------
 // main loop and draw function
 
-void CL_Init(void)
+void CL_Init(float seconds_per_tick)
 {
 	// it's GAMESTATE_MENU by default anyway, but you know.
 	g_gamestate = GAMESTATE_MENU;
+
+	g_seconds_per_tick = seconds_per_tick;
 }
 
 void CL_Tick(float dt)
@@ -240,7 +263,20 @@ void CL_Tick(float dt)
 		{
 			World_Tick(dt);
 		} break;
+
+		case GAMESTATE_REPLAY:
+		{
+			Replay_Tick(dt);
+		} break;
+
+		case GAMESTATE_SPECTATE:
+		{
+			Spectator_Tick(dt);
+		} break;
 	}
+
+	// everything sent this tick goes out in one go
+	CL_FlushPackets();
 }
 
 void CL_Draw(void)
@@ -256,6 +292,16 @@ void CL_Draw(void)
 		{
 			World_Draw();
 		} break;
+
+		case GAMESTATE_REPLAY:
+		{
+			Replay_Draw();
+		} break;
+
+		case GAMESTATE_SPECTATE:
+		{
+			Spectator_Draw();
+		} break;
 	}
 }
 
@@ -330,8 +376,297 @@ void Menu_Draw(void)
 // world gamemode
 
 static unsigned short g_world_state_sequence;
+static os_time_t      g_world_state_arrival_time; // when the network thread received the last accepted world state
 
-void World_Tick(float dt)
+// the connect packet keeps getting sent until the server answers with
+// a world state, in case it gets lost
+static bool  g_connected;
+static float g_connect_interval = 0.25f; // in seconds
+static float g_connect_timer;
+
+static unsigned long long g_connect_cookie; // from the server's last challenge, 0 until then
+
+// reliable messages to and from the server, they ride along with
+// input packets and world states
+static net_channel_t g_channel;
+
+// names of the players, by player id. these come in as reliable
+// messages rather than with every world state
+static char g_player_names[MAX_CLIENT_COUNT][NET_USERNAME_MAX_SIZE];
+
+// who shot who, most recent first
+enum { KILL_FEED_SIZE = 4 };
+
+typedef struct cl_kill_feed_entry_t
+{
+	float t; // seconds left to show this for
+	char  text[2*NET_USERNAME_MAX_SIZE + 16];
+} cl_kill_feed_entry_t;
+
+static cl_kill_feed_entry_t g_kill_feed[KILL_FEED_SIZE];
+
+static const char *CL_GetPlayerName(unsigned char player_id)
+{
+	if (player_id < MAX_CLIENT_COUNT && g_player_names[player_id][0])
+		return g_player_names[player_id];
+
+	return "somebody";
+}
+
+static void CL_ProcessMessages(void)
+{
+	net_message_t message;
+	while (Channel_Receive(&g_channel, &message))
+	{
+		switch (message.kind)
+		{
+			case NETMSG_PLAYER_JOINED:
+			{
+				net_msg_player_joined_t *joined = &message.player_joined;
+
+				if (joined->player_id < MAX_CLIENT_COUNT)
+				{
+					memcpy(g_player_names[joined->player_id], joined->name, NET_USERNAME_MAX_SIZE);
+					g_player_names[joined->player_id][NET_USERNAME_MAX_SIZE - 1] = 0;
+				}
+			} break;
+
+			case NETMSG_PLAYER_LEFT:
+			{
+				if (message.player_left.player_id < MAX_CLIENT_COUNT)
+					g_player_names[message.player_left.player_id][0] = 0;
+			} break;
+
+			case NETMSG_KILL:
+			{
+				memmove(&g_kill_feed[1], &g_kill_feed[0], (KILL_FEED_SIZE - 1)*sizeof(g_kill_feed[0]));
+
+				cl_kill_feed_entry_t *entry = &g_kill_feed[0];
+				entry->t = 5.0f;
+				snprintf(entry->text, sizeof(entry->text), "%s obliterated %s", 
+						 CL_GetPlayerName(message.kill.killer_id), CL_GetPlayerName(message.kill.victim_id));
+			} break;
+		}
+	}
+}
+
+static void CL_SendConnect(void)
+{
+	net_connect_t packet = {
+		.header = {
+			.kind = NETPACKET_CONNECT,
+		},
+		.protocol_id      = NET_PROTOCOL_ID,
+		.protocol_version = NET_PROTOCOL_VERSION,
+		.cookie           = g_connect_cookie,
+	};
+	memcpy(packet.name, g_username, sizeof(g_username));
+	CL_SendPacket(&packet);
+}
+
+// ------------------------------------------------------------------
+// connection quality
+
+static net_link_t g_link; // round trip time, jitter and loss of our connection to the server
+
+static float g_ping_interval = 0.1f; // in seconds
+static float g_ping_timer;
+
+// rolling history of the link stats for the debug overlay, one sample
+// per tick
+enum { LINK_HISTORY_SIZE = 256 };
+
+typedef struct cl_link_history_t
+{
+	size_t head;
+	float rtt   [LINK_HISTORY_SIZE];
+	float jitter[LINK_HISTORY_SIZE];
+	float loss  [LINK_HISTORY_SIZE];
+} cl_link_history_t;
+
+static cl_link_history_t g_link_history;
+
+static void CL_SendPing(void)
+{
+	net_ping_t ping = {
+		.header = {
+			.kind = NETPACKET_PING,
+		},
+		.send_time = OS_GetHiresTime(),
+	};
+	CL_SendPacket(&ping);
+}
+
+static void CL_ProcessPing(net_ping_t *ping, os_time_t arrival_time)
+{
+	// pings from the server are answered by the network thread, so anything
+	// that ends up here should be a reply to one of ours
+	if (ping->is_reply)
+	{
+		float rtt = (float)OS_GetSecondsElapsed(ping->send_time, arrival_time);
+		Link_AddRttSample(&g_link, rtt);
+	}
+}
+
+// ------------------------------------------------------------------
+// clock synchronization
+//
+// the client ticks at the same nominal rate as the server, but the two
+// clocks have nothing to do with each other. the server queues our
+// inputs up and takes one off every tick, so if we tick a little too
+// fast the queue keeps growing and our inputs get applied later and
+// later, and if we tick too slow it runs dry. the server tells us how
+// long the input it used for each tick sat in its queue, and we speed
+// our ticks up or slow them down a tiny bit to keep that close to a
+// target, which grows with the jitter on the connection.
+
+static bool      g_clock_synced;
+static uint32_t  g_server_tick;      // the newest server tick we know about
+static os_time_t g_server_tick_time; // when we learned about that tick
+
+static float g_input_lead;        // smoothed version of the lead reported by the server
+static float g_target_input_lead;
+static float g_tick_scale = 1.0f;
+
+// stats about the server's input queue, from the latest world state
+static unsigned short g_input_underflows;
+static unsigned short g_input_overflows;
+
+// tuning
+static float g_min_input_lead       = 0.002f; // always aim to be at least this early, in seconds
+static float g_max_input_lead       = 0.05f;  // but never aim to queue up more than this
+static float g_input_lead_jitter    = 2.0f;   // and add this many times the jitter on top
+static float g_input_lead_smoothing = 0.1f;
+static float g_tick_scale_gain      = 0.01f;  // tick rate adjustment per tick of lead error
+static float g_max_tick_adjustment  = 0.03f;  // never run more than this much faster or slower
+
+static void CL_UpdateClockSync(uint32_t server_tick, float reported_lead, os_time_t arrival_time)
+{
+	float tick = g_seconds_per_tick;
+
+	g_server_tick      = server_tick;
+	g_server_tick_time = arrival_time;
+
+	g_target_input_lead = g_min_input_lead + g_input_lead_jitter*g_link.jitter;
+	if (g_target_input_lead > g_max_input_lead)
+		g_target_input_lead = g_max_input_lead;
+
+	if (!g_clock_synced)
+	{
+		g_input_lead   = reported_lead;
+		g_clock_synced = true;
+	}
+
+	g_input_lead += g_input_lead_smoothing*(reported_lead - g_input_lead);
+
+	// being way off isn't a disaster, the server drops or doubles up 
+	// inputs to keep its queue in check, so no need to do anything more
+	// drastic than nudging the tick rate
+	float error = g_input_lead - g_target_input_lead;
+
+	// if we're early, tick slower, if we're late, tick faster
+	float adjustment = g_tick_scale_gain*error / tick;
+
+	if (adjustment >  g_max_tick_adjustment) adjustment =  g_max_tick_adjustment;
+	if (adjustment < -g_max_tick_adjustment) adjustment = -g_max_tick_adjustment;
+
+	g_tick_scale = 1.0f + adjustment;
+}
+
+// our best guess of the tick the server is on right now
+static float CL_EstimateServerTick(void)
+{
+	if (!g_clock_synced)
+		return 0.0f;
+
+	float since_update = (float)OS_GetSecondsElapsed(g_server_tick_time, OS_GetHiresTime());
+	return (float)g_server_tick + (since_update + 0.5f*g_link.rtt) / g_seconds_per_tick;
+}
+
+float CL_GetTickScale(void)
+{
+	return g_tick_scale;
+}
+
+static void CL_RecordLinkHistory(void)
+{
+	cl_link_history_t *history = &g_link_history;
+
+	history->rtt   [history->head] = g_link.rtt;
+	history->jitter[history->head] = g_link.jitter;
+	history->loss  [history->head] = g_link.loss;
+
+	history->head = (history->head + 1) % LINK_HISTORY_SIZE;
+}
+
+static void CL_SendInput(void)
+{
+	net_input_t packet = {
+		.header = {
+			.kind     = NETPACKET_INPUT,
+			.sequence = ++g_input_sequence,
+		},
+	};
+	NetInput_WritePacket(&g_input_history, &packet);
+
+	size_t reliable_size = Channel_WriteBlock(&g_channel, packet.header.sequence, g_link.rtt, 
+											  packet.reliable, sizeof(packet.reliable));
+
+	CL_SendPacketSized(&packet, offsetof(net_input_t, reliable) + reliable_size);
+}
+
+void CL_Disconnect(void)
+{
+	if (g_gamestate == GAMESTATE_SPECTATE)
+	{
+		Spectator_Leave();
+		return;
+	}
+
+	// if we never made it past the menu, the server doesn't know about us
+	if (g_gamestate != GAMESTATE_WORLD)
+		return;
+
+	net_msg_disconnect_t message = { .kind = NETMSG_DISCONNECT };
+	Channel_Send(&g_channel, &message, sizeof(message));
+
+	// keep sending input packets (carrying the goodbye) until the server
+	// acks it, but don't hang around forever if it doesn't
+	os_time_t start_time = OS_GetHiresTime();
+
+	while (!Channel_IsIdle(&g_channel) &&
+		   OS_GetSecondsElapsed(start_time, OS_GetHiresTime()) < 1.0)
+	{
+		CL_SendInput();
+		CL_FlushPackets();
+
+		OS_Sleep(20);
+
+		for (;;)
+		{
+			cl_packet_t *net_packet = CL_GetNextPacket();
+
+			if (!net_packet)
+				break;
+
+			net_world_state_t *packet = (net_world_state_t *)net_packet->data;
+
+			if (net_packet->size >= offsetof(net_world_state_t, reliable) && 
+				packet->header.kind == NETPACKET_WORLD_STATE)
+			{
+				Channel_ReadBlock(&g_channel, packet->header.sequence, 
+								  packet->reliable, net_packet->size - offsetof(net_world_state_t, reliable));
+			}
+
+			CL_ReleasePacket(net_packet);
+		}
+	}
+}
+
+// ------------------------------------------------------------------
+// shared between the world and replays
+
+static void CL_UpdateCamera(float dt)
 {
 	cl_player_t *client   = &g_client;
 	cl_entity_t *client_e = CL_GetClientEntity();
@@ -366,6 +701,80 @@ void World_Tick(float dt)
 			client->cam_shake = 0.0f;
 		}
 	}
+}
+
+// takes on the entities from the server's world state. entities that
+// are gone blow up, unless effects is false, for when the world jumps
+// somewhere else entirely, like when seeking in a replay
+static void CL_ApplyEntityStates(const net_entity_state_t *states, bool effects)
+{
+	for (size_t i = MIN_ENTITY_INDEX; i < MAX_ENTITY_COUNT; i++)
+	{
+		cl_entity_t              *cl = &g_entities[i];
+		const net_entity_state_t *sv = &states[i];
+
+		if (ENTITY_ID_VALID(cl->id))
+		{
+			if (cl->id.value != sv->id.value)
+			{
+				// there's a different (or no) entity at this index in the
+				// server's packet, so our entity must have been destroyed.
+				cl->id.index = INVALID_ENTITY_INDEX;
+
+				if (effects)
+					CL_SpawnParticleExplosion(cl->x, cl->y);
+			}
+		}
+
+		if (ENTITY_ID_VALID(sv->id))
+		{
+			if (!ENTITY_ID_VALID(cl->id))
+			{
+				// new spawn
+				// fprintf(stderr, "New entity spawned! id: { %d, %d }\n", sv->id.index, sv->id.generation);
+			}
+
+			// update
+			cl->id   = sv->id;
+			cl->x    = sv->x;
+			cl->y    = sv->y;
+			cl->dx   = sv->dx;
+			cl->dy   = sv->dy;
+			cl->size = sv->size;
+			cl->name[0] = 0; // if this entity has a name, it gets updated in the next loop
+		}
+	}
+}
+
+static void CL_UpdateEffects(float dt)
+{
+	// ------------------------------------------------------------------
+	// simulate particles
+
+	for (size_t i = 0; i < MAX_PARTICLE_COUNT; i++)
+	{
+		cl_particle_t *particle = &g_particles[i];
+		if (particle->t > 0.0f)
+		{
+			particle->t -= dt;
+			particle->x += dt*particle->dx;
+			particle->y += dt*particle->dy;
+		}
+	}
+
+	// ------------------------------------------------------------------
+	// fade out the kill feed
+
+	for (size_t i = 0; i < KILL_FEED_SIZE; i++)
+	{
+		if (g_kill_feed[i].t > 0.0f)
+			g_kill_feed[i].t -= dt;
+	}
+}
+
+void World_Tick(float dt)
+{
+	CL_UpdateCamera(dt);
 
 	// ------------------------------------------------------------------
 	// input handling
@@ -396,17 +805,34 @@ void World_Tick(float dt)
 	ToWorldSpace(&g_client, &mouse_x, &mouse_y);
 
 	{
-		net_input_t packet = {
-			.header = {
-				.kind     = NETPACKET_INPUT,
-				.sequence = ++g_input_sequence,
-			},
+		net_input_frame_t frame = {
 			.btn_down = new_buttons,
 			.mouse_x  = mouse_x,
 			.mouse_y  = mouse_y,
 		};
-		memcpy(packet.name, g_username, sizeof(g_username));
-		CL_SendPacket(&packet);
+		NetInput_AddFrame(&g_input_history, &frame);
+
+		CL_SendInput();
+	}
+
+	// ------------------------------------------------------------------
+	// keep an eye on the connection
+
+	if (!g_connected)
+	{
+		g_connect_timer -= dt;
+		if (g_connect_timer <= 0.0f)
+		{
+			g_connect_timer += g_connect_interval;
+			CL_SendConnect();
+		}
+	}
+
+	g_ping_timer -= dt;
+	if (g_ping_timer <= 0.0f)
+	{
+		g_ping_timer += g_ping_interval;
+		CL_SendPing();
 	}
 
 	// ------------------------------------------------------------------
@@ -414,75 +840,94 @@ void World_Tick(float dt)
 
 	for (;;)
 	{
-		net_header_t *header = CL_GetNextPacket();
+		cl_packet_t *net_packet = CL_GetNextPacket();
 		
-		if (!header)
+		if (!net_packet)
 			break;
 
+		net_header_t *header = (net_header_t *)net_packet->data;
+
+		if (net_packet->size < sizeof(*header))
+		{
+			CL_ReleasePacket(net_packet);
+			continue;
+		}
+
 		switch (header->kind)
 		{
+			case NETPACKET_PING:
+			{
+				if (net_packet->size >= sizeof(net_ping_t))
+					CL_ProcessPing((net_ping_t *)header, net_packet->arrival_time);
+			} break;
+
+			case NETPACKET_CHALLENGE:
+			{
+				if (g_connected || net_packet->size < sizeof(net_challenge_t))
+					break;
+
+				// answer right away, no need to wait for the connect timer
+				g_connect_cookie = ((net_challenge_t *)header)->cookie;
+				g_connect_timer  = g_connect_interval;
+				CL_SendConnect();
+			} break;
+
 			case NETPACKET_WORLD_STATE:
 			{
 				net_world_state_t *packet = (net_world_state_t *)header;
 
-				if (Net_AcceptSequenceNumber(g_world_state_sequence, packet->header.sequence))
+				if (net_packet->size < offsetof(net_world_state_t, reliable))
+					break;
+
+				// every world state counts for loss accounting and acks, even the
+				// ones that are too late to be used
+				Link_AddSequence(&g_link, packet->header.sequence);
+
+				if (Channel_ReadBlock(&g_channel, packet->header.sequence, 
+									  packet->reliable, net_packet->size - offsetof(net_world_state_t, reliable)))
 				{
-					g_world_state_sequence = packet->header.sequence;
+					CL_ProcessMessages();
+				}
 
-					g_client.entity = packet->client_id;
-					for (size_t i = MIN_ENTITY_INDEX; i < MAX_ENTITY_COUNT; i++)
-					{
-						cl_entity_t        *cl = &g_entities[i];
-						net_entity_state_t *sv = &packet->world_state[i];
+				int accepted = Net_AcceptSequenceNumber(g_world_state_sequence, packet->header.sequence);
+				Net_RecordSequenceTest(CL_GetNetContext(), accepted);
 
-						if (ENTITY_ID_VALID(cl->id))
-						{
-							if (cl->id.value != sv->id.value)
-							{
-								// there's a different (or no) entity at this index in the
-								// server's packet, so our entity must have been destroyed.
-								cl->id.index = INVALID_ENTITY_INDEX;
-								CL_SpawnParticleExplosion(cl->x, cl->y);
-							}
-						}
+				if (accepted)
+				{
+					g_world_state_sequence = packet->header.sequence;
+					g_world_state_arrival_time = net_packet->arrival_time;
+					g_connected = true;
 
-						if (ENTITY_ID_VALID(sv->id))
-						{
-							if (!ENTITY_ID_VALID(cl->id))
-							{
-								// new spawn
-								// fprintf(stderr, "New entity spawned! id: { %d, %d }\n", sv->id.index, sv->id.generation);
-							}
+					CL_UpdateClockSync(packet->server_tick, packet->input_lead, net_packet->arrival_time);
 
-							// update
-							cl->id   = sv->id;
-							cl->x    = sv->x;
-							cl->y    = sv->y;
-							cl->dx   = sv->dx;
-							cl->dy   = sv->dy;
-							cl->size = sv->size;
-							cl->name[0] = 0; // if this entity has a name, it gets updated in the next loop
-						}
-					}
+					g_input_underflows = packet->input_underflows;
+					g_input_overflows  = packet->input_overflows;
+
+					g_client.entity = packet->client_id;
+					CL_ApplyEntityStates(packet->world_state, true);
 
 					for (size_t i = 0; i < packet->player_count; i++)
 					{
 						net_player_t *net_player = &packet->players[i];
-						if (ENTITY_ID_VALID(net_player->entity))
+						if (ENTITY_ID_VALID(net_player->entity) && net_player->player_id < MAX_CLIENT_COUNT)
 						{
 							cl_entity_t *e = &g_entities[net_player->entity.index];
 
 							if (e->id.generation == net_player->entity.generation)
 							{
-								memcpy(e->name, net_player->name, NET_USERNAME_MAX_SIZE);
+								memcpy(e->name, g_player_names[net_player->player_id], NET_USERNAME_MAX_SIZE);
 							}
 						}
 					}
 				}
 			} break;
 		}
+
+		CL_ReleasePacket(net_packet);
 	}
 
+	CL_RecordLinkHistory();
+
 	// ------------------------------------------------------------------
 	// "simulate" entities
 
@@ -498,19 +943,7 @@ void World_Tick(float dt)
 		e->y += dt*e->dy;
 	}
 
-	// ------------------------------------------------------------------
-	// simulate particles
-
-	for (size_t i = 0; i < MAX_PARTICLE_COUNT; i++)
-	{
-		cl_particle_t *particle = &g_particles[i];
-		if (particle->t > 0.0f)
-		{
-			particle->t -= dt;
-			particle->x += dt*particle->dx;
-			particle->y += dt*particle->dy;
-		}
-	}
+	CL_UpdateEffects(dt);
 }
 
 void World_Draw(void)
@@ -567,14 +1000,470 @@ void World_Draw(void)
 			);
 		}
 	}
+
+	// ------------------------------------------------------------------
+	// draw kill feed
+
+	{
+		int font_height = 18;
+		int y = 12;
+
+		for (size_t i = 0; i < KILL_FEED_SIZE; i++)
+		{
+			cl_kill_feed_entry_t *entry = &g_kill_feed[i];
+
+			if (entry->t <= 0.0f)
+				continue;
+
+			float alpha = entry->t < 1.0f ? entry->t : 1.0f;
+
+			int text_w = MeasureText(entry->text, font_height);
+			DrawText(entry->text, GetScreenWidth() - text_w - 12, y, font_height, Fade(WHITE, alpha));
+
+			y += font_height;
+		}
+	}
+}
+
+// ------------------------------------------------------------------
+// shared between replays and spectating, which both get the world as
+// frames (see recording.h), and have the camera follow somebody around
+
+static int g_follow = -1; // the player id the camera follows, -1 for nobody
+
+static void CL_ApplyFrame(const rec_frame_t *frame, bool effects)
+{
+	CL_ApplyEntityStates(frame->entities, effects);
+
+	g_client.entity.value = 0;
+
+	for (int i = 0; i < frame->player_count; i++)
+	{
+		const rec_player_t *player = &frame->players[i];
+
+		if (ENTITY_ID_VALID(player->entity))
+		{
+			cl_entity_t *e = &g_entities[player->entity.index];
+
+			if (e->id.generation == player->entity.generation)
+				memcpy(e->name, player->name, NET_USERNAME_MAX_SIZE);
+		}
+
+		if (player->player_id == g_follow)
+			g_client.entity = player->entity;
+	}
+}
+
+// the camera moves on to the next player in the frame, or the first
+// one if the one it was following left
+static void CL_FollowNextPlayer(const rec_frame_t *frame)
+{
+	if (frame->player_count == 0)
+	{
+		g_follow = -1;
+		return;
+	}
+
+	int next = 0;
+
+	for (int i = 0; i < frame->player_count; i++)
+	{
+		if (frame->players[i].player_id == g_follow)
+		{
+			next = (i + 1) % frame->player_count;
+			break;
+		}
+	}
+
+	g_follow = frame->players[next].player_id;
+}
+
+// the followed player may have left, in which case somebody else gets
+// followed instead
+static void CL_CheckFollowedPlayer(const rec_frame_t *frame)
+{
+	if (g_follow < 0 || CL_GetClientEntity())
+		return;
+
+	for (int i = 0; i < frame->player_count; i++)
+	{
+		if (frame->players[i].player_id == g_follow)
+			return;
+	}
+
+	CL_FollowNextPlayer(frame);
+}
+
+static const char *CL_GetFollowedName(const rec_frame_t *frame)
+{
+	for (int i = 0; i < frame->player_count; i++)
+	{
+		if (frame->players[i].player_id == g_follow)
+			return frame->players[i].name;
+	}
+
+	return "nobody";
+}
+
+// ------------------------------------------------------------------
+// replay gamemode
+//
+// plays back a recording made with the server's -record flag (see
+// recording.h). there's no server and no network, the world comes out
+// of the file, and any point in it is a keyframe lookup and a handful
+// of deltas away.
+
+static rec_reader_t g_replay;
+
+static double g_replay_position; // in ticks since the start of the recording
+static float  g_replay_speed = 1.0f;
+static bool   g_replay_paused;
+
+static float g_replay_seek_step = 5.0f; // in seconds
+
+static void Replay_ApplyFrame(bool effects)
+{
+	CL_ApplyFrame(&g_replay.frame, effects);
+}
+
+static uint32_t Replay_GetTargetTick(void)
+{
+	return g_replay.first_tick + (uint32_t)g_replay_position;
+}
+
+static void Replay_Seek(double seconds)
+{
+	g_replay_position += seconds / g_replay.seconds_per_tick;
+
+	double end = (double)(g_replay.last_tick - g_replay.first_tick);
+
+	if (g_replay_position < 0.0) g_replay_position = 0.0;
+	if (g_replay_position > end) g_replay_position = end;
+
+	Rec_Seek(&g_replay, Replay_GetTargetTick());
+
+	// jumping somewhere else isn't an explosion, and the camera shouldn't
+	// take the scenic route there either
+	Replay_ApplyFrame(false);
+
+	cl_entity_t *followed = CL_GetClientEntity();
+
+	if (followed)
+	{
+		g_client.cam_x = followed->x;
+		g_client.cam_y = followed->y;
+	}
+}
+
+int CL_StartReplay(const char *path)
+{
+	if (Rec_OpenReader(&g_replay, path) != 0)
+		return -1;
+
+	printf("Playing back '%s': %.1f seconds at %.0f Hz%s\n", path, 
+		   (double)(g_replay.last_tick - g_replay.first_tick + 1)*g_replay.seconds_per_tick,
+		   1.0 / g_replay.seconds_per_tick, g_replay.indexed ? "" : " (no index, it had to be rebuilt)");
+
+	g_gamestate = GAMESTATE_REPLAY;
+
+	g_replay_position = 0.0;
+	CL_FollowNextPlayer(&g_replay.frame);
+	Replay_Seek(0.0);
+
+	return 0;
+}
+
+void Replay_Tick(float dt)
+{
+	// ------------------------------------------------------------------
+	// controls
+
+	if (IsKeyPressed(KEY_SPACE))
+		g_replay_paused = !g_replay_paused;
+
+	if (IsKeyPressed(KEY_UP)   && g_replay_speed < 16.0f)  g_replay_speed *= 2.0f;
+	if (IsKeyPressed(KEY_DOWN) && g_replay_speed > 0.125f) g_replay_speed *= 0.5f;
+
+	if (IsKeyPressed(KEY_TAB))
+	{
+		CL_FollowNextPlayer(&g_replay.frame);
+		Replay_ApplyFrame(false);
+	}
+
+	if (IsKeyPressed(KEY_HOME))
+		Replay_Seek(-(double)g_replay_position*g_replay.seconds_per_tick);
+	else if (IsKeyPressed(KEY_LEFT))
+		Replay_Seek(-g_replay_seek_step);
+	else if (IsKeyPressed(KEY_RIGHT))
+		Replay_Seek(g_replay_seek_step);
+
+	// ------------------------------------------------------------------
+	// playback
+
+	if (!g_replay_paused)
+	{
+		double end = (double)(g_replay.last_tick - g_replay.first_tick);
+
+		g_replay_position += (double)(dt*g_replay_speed) / g_replay.seconds_per_tick;
+
+		if (g_replay_position > end)
+		{
+			g_replay_position = end;
+			g_replay_paused   = true;
+		}
+
+		// going forward a bit is cheaper one delta at a time, and that way
+		// things that die on the way still blow up
+		uint32_t target_tick = Replay_GetTargetTick();
+
+		if (target_tick - g_replay.frame.tick > g_replay.keyframe_interval)
+		{
+			Rec_Seek(&g_replay, target_tick);
+			Replay_ApplyFrame(false);
+		}
+		else
+		{
+			while (g_replay.frame.tick < target_tick && Rec_Next(&g_replay))
+				Replay_ApplyFrame(true);
+		}
+	}
+
+	CL_CheckFollowedPlayer(&g_replay.frame);
+
+	CL_UpdateCamera(dt);
+	CL_UpdateEffects(dt);
+}
+
+void Replay_Draw(void)
+{
+	World_Draw();
+
+	int font_height = 18;
+	int y = GetRenderHeight() - 2*font_height - 12;
+
+	char text[256];
+
+	double seconds       = g_replay_position*g_replay.seconds_per_tick;
+	double total_seconds = (double)(g_replay.last_tick - g_replay.first_tick)*g_replay.seconds_per_tick;
+
+	snprintf(text, sizeof(text), "%d:%02d / %d:%02d   x%g%s   following %s",
+			 (int)seconds / 60, (int)seconds % 60, (int)total_seconds / 60, (int)total_seconds % 60,
+			 (double)g_replay_speed, g_replay_paused ? "   paused" : "", CL_GetFollowedName(&g_replay.frame));
+
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+
+	DrawText("space: pause, left/right: seek, up/down: speed, tab: next player, home: restart", 12, y, 12, LIGHTGRAY);
+}
+
+static void Replay_DrawDebug(void)
+{
+	int font_height = 12;
+	int y = 12;
+
+	char text[256];
+
+	DrawText("press f3 to toggle this information", 12, y, font_height, WHITE);
+	y += 2*font_height;
+
+	snprintf(text, sizeof(text), "replay tick: %u (ticks %u to %u)", g_replay.frame.tick, g_replay.first_tick, g_replay.last_tick);
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+
+	snprintf(text, sizeof(text), "recording: %llu bytes, %u keyframes every %u ticks, %s",
+			 (unsigned long long)g_replay.file.size, g_replay.keyframe_count, g_replay.keyframe_interval,
+			 g_replay.indexed ? "indexed" : "index rebuilt");
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+}
+
+// ------------------------------------------------------------------
+// spectator gamemode
+//
+// watches a match as it happens, through a broadcast (see spectate.h),
+// which is usually a relay rather than the server itself. it looks a
+// lot like a replay, except there's nowhere to go but the present.
+
+static spectate_client_t *g_spectate;
+
+static rec_frame_t g_spectate_frame; // the newest one we got
+static bool        g_spectate_has_frame;
+
+int CL_StartSpectating(char *host, int port, net_impairment_t *impairment)
+{
+	g_spectate = Spectate_Connect(host, port, impairment);
+
+	if (!g_spectate)
+		return -1;
+
+	printf("Spectating %s:%d\n", host, port);
+
+	g_gamestate = GAMESTATE_SPECTATE;
+	return 0;
+}
+
+void Spectator_Leave(void)
+{
+	Spectate_Disconnect(g_spectate);
+	g_spectate = NULL;
+}
+
+void Spectator_Tick(float dt)
+{
+	if (IsKeyPressed(KEY_TAB))
+	{
+		CL_FollowNextPlayer(&g_spectate_frame);
+		CL_ApplyFrame(&g_spectate_frame, false);
+	}
+
+	const rec_frame_t *frame = Spectate_Poll(g_spectate);
+
+	if (frame)
+	{
+		g_spectate_frame = *frame;
+
+		if (!g_spectate_has_frame)
+		{
+			// joining in isn't an explosion either
+			g_spectate_has_frame = true;
+
+			CL_FollowNextPlayer(&g_spectate_frame);
+			CL_ApplyFrame(&g_spectate_frame, false);
+
+			cl_entity_t *followed = CL_GetClientEntity();
+
+			if (followed)
+			{
+				g_client.cam_x = followed->x;
+				g_client.cam_y = followed->y;
+			}
+		}
+		else
+		{
+			CL_ApplyFrame(&g_spectate_frame, true);
+		}
+	}
+	else
+	{
+		// snapshots come in a lot less often than ticks, in between things
+		// keep going the way they were
+		for (size_t i = MIN_ENTITY_INDEX; i < MAX_ENTITY_COUNT; i++)
+		{
+			cl_entity_t *e = &g_entities[i];
+
+			if (ENTITY_ID_VALID(e->id))
+			{
+				e->x += dt*e->dx;
+				e->y += dt*e->dy;
+			}
+		}
+	}
+
+	CL_CheckFollowedPlayer(&g_spectate_frame);
+
+	CL_UpdateCamera(dt);
+	CL_UpdateEffects(dt);
+}
+
+void Spectator_Draw(void)
+{
+	World_Draw();
+
+	int font_height = 18;
+	int y = GetRenderHeight() - 2*font_height - 12;
+
+	char text[256];
+
+	if (g_spectate_has_frame)
+		snprintf(text, sizeof(text), "spectating, following %s", CL_GetFollowedName(&g_spectate_frame));
+	else
+		snprintf(text, sizeof(text), "waiting for the broadcast...");
+
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+
+	DrawText("tab: next player", 12, y, 12, LIGHTGRAY);
+}
+
+static void Spectator_DrawDebug(void)
+{
+	spectate_stats_t stats;
+	Spectate_GetStats(g_spectate, &stats);
+
+	int font_height = 12;
+	int y = 12;
+
+	char text[256];
+
+	DrawText("press f3 to toggle this information", 12, y, font_height, WHITE);
+	y += 2*font_height;
+
+	snprintf(text, sizeof(text), "spectated tick: %u", stats.tick);
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+
+	snprintf(text, sizeof(text), "snapshots: %llu (%llu keyframes, %llu stale, %llu from a frame we didn't have)",
+			 (unsigned long long)stats.snapshots_received, (unsigned long long)stats.keyframes_received,
+			 (unsigned long long)stats.snapshots_stale, (unsigned long long)stats.snapshots_orphaned);
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+
+	snprintf(text, sizeof(text), "bandwidth: %.2f kB/s down, %.2f kB/s up",
+			 (double)stats.net.bytes_in_per_second / 1024.0, (double)stats.net.bytes_out_per_second / 1024.0);
+	DrawText(text, 12, y, font_height, WHITE);
+	y += font_height;
+}
+
+// draws a rolling graph of the samples, oldest on the left. the
+// vertical scale is fixed at max_value so the graph doesn't jump 
+// around, anything above it gets clamped to the top
+static void CL_DrawGraph(int x, int y, int w, int h, float *samples, size_t count, size_t head, float max_value, Color color)
+{
+	DrawRectangle(x, y, w, h, (Color){ 0, 0, 0, 96 });
+
+	float step = (float)w / (float)(count - 1);
+
+	for (size_t i = 1; i < count; i++)
+	{
+		float a = samples[(head + i - 1) % count] / max_value;
+		float b = samples[(head + i    ) % count] / max_value;
+
+		if (a > 1.0f) a = 1.0f;
+		if (b > 1.0f) b = 1.0f;
+
+		int x0 = x + (int)(step*(float)(i - 1));
+		int x1 = x + (int)(step*(float)(i    ));
+		int y0 = y + h - (int)(a*(float)h);
+		int y1 = y + h - (int)(b*(float)h);
+
+		DrawLine(x0, y0, x1, y1, color);
+	}
 }
 
 void CL_DrawDebug(void)
 {
+	// there's no connection to show anything about
+	if (g_gamestate == GAMESTATE_REPLAY)
+	{
+		if (g_show_debug_info)
+			Replay_DrawDebug();
+
+		return;
+	}
+
+	// or at least not a connection to the server
+	if (g_gamestate == GAMESTATE_SPECTATE)
+	{
+		if (g_show_debug_info)
+			Spectator_DrawDebug();
+
+		return;
+	}
+
 	if (g_show_debug_info)
 	{
 		net_stats_t net_stats;
-		Net_GetStats(&net_stats);
+		Net_GetStats(CL_GetNetContext(), &net_stats);
 
 		int font_height = 12;
 		int y = 12;
@@ -608,5 +1497,71 @@ void CL_DrawDebug(void)
 			DrawText(text, 64, y, font_height, WHITE);
 			y += font_height;
 		}
+
+		{
+			float world_state_age = 0.0f;
+			if (g_world_state_arrival_time)
+				world_state_age = (float)OS_GetSecondsElapsed(g_world_state_arrival_time, OS_GetHiresTime());
+
+			snprintf(text, sizeof(text), "last world state: %.01f ms ago, %u packets dropped", 
+					 1000.0f*world_state_age, CL_GetDroppedPacketCount());
+
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+
+			fragment_stats_t fragments = CL_GetFragmentStats();
+
+			snprintf(text, sizeof(text), "fragments: %u received, %u lost, %u duplicate, %u packets timed out, %u evicted",
+					 fragments.fragments_received, fragments.fragments_lost, fragments.fragments_duplicate,
+					 fragments.packets_timed_out, fragments.packets_evicted);
+
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+		}
+
+		{
+			snprintf(text, sizeof(text), "server tick: ~%.01f, input lead: %.01f ms (target %.01f ms), tick rate: %+.01f%%",
+					 CL_EstimateServerTick(), 1000.0f*g_input_lead, 1000.0f*g_target_input_lead, 100.0f*(1.0f / g_tick_scale - 1.0f));
+
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+
+			snprintf(text, sizeof(text), "server input queue: %u underflows, %u overflows",
+					 (unsigned int)g_input_underflows, (unsigned int)g_input_overflows);
+
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+		}
+
+		{
+			int graph_w = 256;
+			int graph_h = 32;
+
+			cl_link_history_t *history = &g_link_history;
+
+			y += font_height;
+
+			snprintf(text, sizeof(text), "rtt: %.01f ms (min %.01f ms)", 1000.0f*g_link.rtt, 1000.0f*g_link.rtt_min);
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+
+			CL_DrawGraph(12, y, graph_w, graph_h, history->rtt, LINK_HISTORY_SIZE, history->head, 0.25f, GREEN);
+			y += graph_h + font_height / 2;
+
+			snprintf(text, sizeof(text), "jitter: %.01f ms", 1000.0f*g_link.jitter);
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+
+			CL_DrawGraph(12, y, graph_w, graph_h, history->jitter, LINK_HISTORY_SIZE, history->head, 0.05f, YELLOW);
+			y += graph_h + font_height / 2;
+
+			snprintf(text, sizeof(text), "loss: %.01f%% (%u lost, %u late, %u duplicated)", 
+					 100.0f*g_link.loss, g_link.total_lost, g_link.total_late, g_link.total_duplicates);
+			DrawText(text, 12, y, font_height, WHITE);
+			y += font_height;
+
+			CL_DrawGraph(12, y, graph_w, graph_h, history->loss, LINK_HISTORY_SIZE, history->head, 0.25f, RED);
+			y += graph_h + font_height / 2;
+		}
 	}
 }
\ No newline at end of file
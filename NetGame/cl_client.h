@@ -4,11 +4,35 @@
 // cl_client.h: main functions that implement the client's
 // functionality
 
-void CL_Init(void);
+typedef struct net_impairment_t net_impairment_t;
+
+// seconds_per_tick is the nominal duration of a tick, which should
+// match the server's
+void CL_Init(float seconds_per_tick);
+
+// plays back a recording (see recording.h) instead of joining a
+// server, networking doesn't need to be initialized for it. returns 0
+// on success
+int CL_StartReplay(const char *path);
+
+// watches a match through a broadcast (see spectate.h) instead of
+// joining it. networking has to be initialized, but not with
+// CL_NetInit, there's no server connection. returns 0 on success
+int CL_StartSpectating(char *host, int port, net_impairment_t *impairment);
+
+// tells the server (or the broadcast) we're leaving, and waits
+// (briefly) for it to hear us. call this before shutting down
+// networking
+void CL_Disconnect(void);
 
 // per-tick simulation
 void CL_Tick(float dt);
 
+// the client speeds its ticks up or slows them down a tiny bit to stay
+// in step with the server. the time between ticks should be multiplied
+// by this
+float CL_GetTickScale(void);
+
 // per-frame drawing
 void CL_Draw(void);
 
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 
 // ------------------------------------------------------------------
 // external includes
@@ -15,6 +17,7 @@
 
 #include "os.h"
 #include "util.h"
+#include "profiler.h"
 #include "cl_net.h"
 #include "cl_client.h"
 
@@ -43,17 +46,63 @@
 
 static const int g_tickrate = 120;
 
+// frames that take longer than this (in seconds) count as a hitch, and
+// get a trace written out if -trace_overruns is passed
+static const double g_frame_budget = 1.0 / 30.0;
+
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
-
 	char *server = "localhost";
 	int   port   = 4950;
 
-	if (argc == 2)
+	bool trace_overruns = false;
+
+	char *replay_path = NULL;
+
+	char *spectate_host = NULL;
+	int   spectate_port = 4953;
+
+	net_impair_settings_t impair_settings = { 0 };
+
+	for (int i = 1; i < argc; i++)
 	{
-		char *arg = argv[1];
+		char *arg = argv[i];
+
+		if (strcmp(arg, "-trace_overruns") == 0)
+		{
+			trace_overruns = true;
+			continue;
+		}
+
+		// plays back a recording made with the server's -record flag,
+		// rather than connecting to anything, see recording.h
+		if (strcmp(arg, "-replay") == 0 && i + 1 < argc)
+		{
+			replay_path = argv[++i];
+			continue;
+		}
+
+		// watches a match through a relay (NetRelay), or the server's
+		// -spectate_port, rather than joining it, see spectate.h
+		if (strcmp(arg, "-spectate") == 0 && i + 1 < argc)
+		{
+			spectate_host = argv[++i];
+
+			for (char *c = spectate_host; *c; c++)
+			{
+				if (*c == ':')
+				{
+					*c = 0;
+					spectate_port = atoi(c + 1);
+				}
+			}
+			continue;
+		}
+
+		// makes the network worse on purpose, see netimpair.h
+		if (Impair_ParseArg(&impair_settings, argc, argv, &i))
+			continue;
+
 		for (char *c = arg; *c; c++)
 		{
 			if (*c == ':')
@@ -65,7 +114,25 @@ int main(int argc, char **argv)
 		server = arg;
 	}
 
-	if (CL_NetInit(server, port) != 0)
+	Profiler_Init("netclient");
+	Profiler_SetThreadName("main");
+	Profiler_SetOverrunCapture(trace_overruns, 2.0);
+
+	Impair_PrintSettings(&impair_settings);
+
+	net_impairment_t *impairment = Impair_Create(&impair_settings);
+
+	// replays don't need the network at all, and spectators don't need
+	// the connection to the server
+	bool connect = !replay_path && !spectate_host;
+
+	if (connect && CL_NetInit(server, port, impairment) != 0)
+	{
+		fprintf(stderr, "Failed to initialize networking subsystem\n");
+		return 1;
+	}
+
+	if (spectate_host && Net_Init() != 0)
 	{
 		fprintf(stderr, "Failed to initialize networking subsystem\n");
 		return 1;
@@ -77,27 +144,59 @@ int main(int argc, char **argv)
 
 	InitWindow(800, 600, "NetClient");
 
-	CL_Init();
-
 	float tick_timer = 0.0f;
 	float seconds_per_tick = 1.0f / (float)g_tickrate;
 
+	CL_Init(seconds_per_tick);
+
+	if (replay_path && CL_StartReplay(replay_path) != 0)
+	{
+		CloseWindow();
+		return 1;
+	}
+
+	if (spectate_host && CL_StartSpectating(spectate_host, spectate_port, impairment) != 0)
+	{
+		CloseWindow();
+		return 1;
+	}
+
 	while (!WindowShouldClose())
 	{
 		float dt  = GetFrameTime();
 		int   fps = GetFPS(); 
 
+		// the simulation always steps by the same amount, but how often that
+		// happens gets adjusted to keep in sync with the server's clock
+		float tick_interval = seconds_per_tick*CL_GetTickScale();
+
+		os_time_t frame_start_time = OS_GetHiresTime();
+		TIMED_BLOCK_BEGIN(Frame);
+
 		tick_timer += dt;
-		while (tick_timer > seconds_per_tick)
+		while (tick_timer > tick_interval)
 		{
-			tick_timer -= seconds_per_tick;
+			tick_timer -= tick_interval;
+
+			TIMED_BLOCK_BEGIN(CL_Tick);
 			CL_Tick(seconds_per_tick);
+			TIMED_BLOCK_END(CL_Tick);
 		}
 
+		TIMED_BLOCK_BEGIN(CL_Draw);
 		BeginDrawing();
 		CL_Draw();
 		CL_DrawDebug();
+		TIMED_BLOCK_END(CL_Draw);
+
+		// this is where the vsync wait happens, usually
+		TIMED_BLOCK_BEGIN(EndDrawing);
 		EndDrawing();
+		TIMED_BLOCK_END(EndDrawing);
+
+		TIMED_BLOCK_END(Frame);
+
+		Profiler_EndFrame(OS_GetSecondsElapsed(frame_start_time, OS_GetHiresTime()), g_frame_budget);
 
 		char title[256];
 		snprintf(title, sizeof(title), "NetClient: frametime %.02f ms (%d fps)", 1000.0f*dt, fps);
@@ -107,13 +206,20 @@ int main(int argc, char **argv)
 
 	CloseWindow();
 
-	CL_SendPacket(&(net_header_t) { NETPACKET_CLIENT_DISCONNECTED });
+	CL_Disconnect();
 
-	if (CL_NetExit() != 0)
+	if (connect && CL_NetExit() != 0)
 	{
 		fprintf(stderr, "Failed to shut down networking subsystem\n");
 		return 1;
 	}
 
+	if (spectate_host)
+		Net_Exit();
+
+	Impair_Destroy(impairment);
+
+	Profiler_Exit();
+
 	return 0;
 }
\ No newline at end of file
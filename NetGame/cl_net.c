@@ -2,6 +2,8 @@
 // standard library includes
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdalign.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -13,7 +15,11 @@
 
 #include "cl_net.h"
 #include "net.h"
+#include "fragment.h"
+#include "bundle.h"
 #include "os.h"
+#include "util.h"
+#include "profiler.h"
 
 // ------------------------------------------------------------------
 // cl_net.c: wraps interacting with sockets to more purpose-built
@@ -27,18 +33,154 @@
 
 
 // ------------------------------------------------------------------
-// initialization and uninitialization
+// the network thread
+//
+// packets are received on a separate thread that does nothing but
+// block on the socket. that way every packet gets timestamped the
+// moment it comes in, rather than whenever the next client tick gets
+// around to looking at the socket.
+// the packets get handed over to the main thread through a single-
+// producer single-consumer ring of preallocated packet buffers, so 
+// there's no allocating going on. datagrams are read into a buffer of
+// the network thread's own and taken apart in place, and only the
+// packets the main thread cares about get copied into the ring.
+
+enum { PACKET_QUEUE_SIZE = 64 }; // must be a power of two
+
+static cl_packet_t g_packet_queue[PACKET_QUEUE_SIZE];
+
+static volatile uint32_t g_packet_queue_write; // only advanced by the network thread
+static volatile uint32_t g_packet_queue_read;  // only advanced by the main thread
+static volatile uint32_t g_packets_dropped;
+
+static volatile uint32_t g_net_thread_running;
+static os_thread_t g_net_thread;
+
+// the network thread wakes up at least this often to check whether it 
+// should shut down
+enum { NET_THREAD_RECV_TIMEOUT_MS = 100 };
+
+// only touched by the network thread, apart from the stats
+static fragment_reassembler_t g_reassembler;
+
+// only touched by the network thread
+static alignas(16) char g_receive_buffer[CL_MAX_PACKET_SIZE];
+
+// shared by the network thread and the main thread, which is fine
+// since its counters are atomic
+static net_context_t g_net;
 
 static net_socket_t g_socket = { INVALID_SOCKET_VALUE };
 static net_addr_t g_sv_address;
 
-int CL_NetInit(char *server_address, int port)
+static void CL_PushPacket(const void *data, size_t size, os_time_t arrival_time)
+{
+	uint32_t write = g_packet_queue_write;
+	uint32_t read  = OS_AtomicLoad32(&g_packet_queue_read);
+
+	if (write - read >= PACKET_QUEUE_SIZE)
+	{
+		OS_AtomicAdd32(&g_packets_dropped, 1);
+		return;
+	}
+
+	cl_packet_t *packet = &g_packet_queue[write % PACKET_QUEUE_SIZE];
+
+	memcpy(packet->data, data, size);
+	packet->arrival_time = arrival_time;
+	packet->size         = size;
+
+	// publish the packet to the main thread
+	OS_AtomicStore32(&g_packet_queue_write, write + 1);
+}
+
+static void CL_ProcessReceivedPacket(net_header_t *header, size_t packet_size, os_time_t arrival_time)
+{
+	// pings from the server get answered right here, so that the server's
+	// round trip time measurement doesn't include however long it takes 
+	// the main thread to get around to it
+	if (header->kind == NETPACKET_PING && packet_size >= sizeof(net_ping_t))
+	{
+		net_ping_t *ping = (net_ping_t *)header;
+
+		if (!ping->is_reply)
+		{
+			ping->is_reply = 1;
+			Net_SendPacket(&g_net, g_socket, g_sv_address, ping, sizeof(*ping));
+			return;
+		}
+	}
+
+	// fragments get put back together right here too, the main thread
+	// only ever sees whole packets
+	if (header->kind == NETPACKET_FRAGMENT)
+	{
+		size_t whole_packet_size;
+		void *whole_packet = Fragment_Receive(&g_reassembler, (net_fragment_t *)header, packet_size, 
+											  arrival_time, &whole_packet_size);
+
+		if (whole_packet)
+			CL_PushPacket(whole_packet, whole_packet_size, arrival_time);
+
+		return;
+	}
+
+	CL_PushPacket(header, packet_size, arrival_time);
+}
+
+static int CL_NetThreadProc(void *userdata)
+{
+	(void)userdata;
+
+	Profiler_SetThreadName("network");
+
+	while (OS_AtomicLoad32(&g_net_thread_running))
+	{
+		net_addr_t addr;
+		int byte_count = Net_RecvPacket(&g_net, g_socket, g_receive_buffer, sizeof(g_receive_buffer), &addr);
+
+		os_time_t arrival_time = OS_GetHiresTime();
+
+		if (byte_count <= 0) // timed out, or some error that's not worth giving up over
+			continue;
+
+		if (!Net_AddrMatch(addr, g_sv_address)) // if it's not the server, I'm not listening!
+			continue;
+
+		TIMED_BLOCK_BEGIN(CL_ProcessDatagram);
+
+		bundle_reader_t reader;
+		Bundle_BeginRead(&reader, g_receive_buffer, (size_t)byte_count);
+
+		net_header_t *header;
+		size_t packet_size;
+
+		while (Bundle_Next(&reader, &header, &packet_size))
+		{
+			CL_ProcessReceivedPacket(header, packet_size, arrival_time);
+		}
+
+		TIMED_BLOCK_END(CL_ProcessDatagram);
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------
+// initialization and uninitialization
+
+int CL_NetInit(char *server_address, int port, net_impairment_t *impairment)
 {
 	if (Net_Init() != 0)
 		return -1;
 
+	Net_InitContext(&g_net, impairment);
+
 	g_sv_address = Net_GetAddr(server_address, port);
-	g_socket = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
+
+	// the socket is blocking, because the network thread is happy to sit
+	// and wait for packets
+	g_socket = Net_CreateSocket(0);
 
 	if (g_socket.value == INVALID_SOCKET_VALUE)
 	{
@@ -46,16 +188,47 @@ int CL_NetInit(char *server_address, int port)
 		return -1;
 	}
 
+	// normally the socket gets implicitly bound by the first send, but the
+	// network thread might start receiving before then, which is an error
+	// on an unbound socket
+	if (Net_BindSocket(g_socket, Net_GetPassiveAddr(0)) != 0)
+	{
+		fprintf(stderr, "failed to bind socket\n");
+		return -1;
+	}
+
+	if (Net_SetReceiveTimeout(g_socket, NET_THREAD_RECV_TIMEOUT_MS) != 0)
+	{
+		fprintf(stderr, "failed to set socket receive timeout\n");
+		return -1;
+	}
+
 	char server_string[NETADDR_STR_SIZE];
 	Net_StringFromNetAddr(server_string, sizeof(server_string), g_sv_address);
 
 	printf("Server: %s:%d\n", server_string, port);
 
+	Fragment_InitReassembler(&g_reassembler);
+
+	OS_AtomicStore32(&g_net_thread_running, 1);
+
+	g_net_thread = OS_CreateThread(CL_NetThreadProc, NULL);
+	if (!g_net_thread.value)
+	{
+		fprintf(stderr, "failed to start network thread\n");
+		return -1;
+	}
+
 	return 0;
 }
 
 int CL_NetExit(void)
 {
+	OS_AtomicStore32(&g_net_thread_running, 0);
+	OS_JoinThread(g_net_thread);
+
+	Net_CloseSocket(g_socket);
+
 	if (Net_Exit() != 0)
 		return -1;
 
@@ -65,25 +238,71 @@ int CL_NetExit(void)
 // ------------------------------------------------------------------
 // send and receive packets
 
-void CL_SendPacketSized(void *packet, size_t packet_size)
+// only touched by the main thread
+static bundle_writer_t g_send_bundle;
+
+void CL_FlushPackets(void)
 {
-	Net_SendPacket(g_socket, g_sv_address, packet, packet_size);
+	size_t datagram_size;
+	void *datagram = Bundle_GetDatagram(&g_send_bundle, &datagram_size);
+
+	if (datagram)
+		Net_SendPacket(&g_net, g_socket, g_sv_address, datagram, datagram_size);
+
+	Bundle_Clear(&g_send_bundle);
 }
 
-enum { MAX_PACKET_SIZE = 8192 };
-static alignas(16) char g_packet_buffer[MAX_PACKET_SIZE];
+void CL_SendPacketSized(void *packet, size_t packet_size)
+{
+	if (packet_size > BUNDLE_MAX_PACKET_SIZE)
+	{
+		CL_FlushPackets();
+		Net_SendPacket(&g_net, g_socket, g_sv_address, packet, packet_size);
+		return;
+	}
+
+	if (!Bundle_Add(&g_send_bundle, packet, packet_size))
+	{
+		CL_FlushPackets();
+		Bundle_Add(&g_send_bundle, packet, packet_size);
+	}
+}
 
-net_header_t *CL_GetNextPacket(void)
+cl_packet_t *CL_GetNextPacket(void)
 {
-	net_addr_t addr;
-	int byte_count = Net_RecvPacket(g_socket, g_packet_buffer, sizeof(g_packet_buffer), &addr);
+	uint32_t read  = g_packet_queue_read;
+	uint32_t write = OS_AtomicLoad32(&g_packet_queue_write);
 
-	if (byte_count <= 0)
+	if (read == write)
 		return NULL;
 
-	if (!Net_AddrMatch(addr, g_sv_address)) // if it's not the server, I'm not listening!
-		return NULL; 
+	return &g_packet_queue[read % PACKET_QUEUE_SIZE];
+}
+
+void CL_ReleasePacket(cl_packet_t *packet)
+{
+	uint32_t read = g_packet_queue_read;
 
-	net_header_t *header = (net_header_t *)g_packet_buffer;
-	return header;
+	// packets have to be released in the order they were received
+	if (ALWAYS(packet == &g_packet_queue[read % PACKET_QUEUE_SIZE]))
+	{
+		OS_AtomicStore32(&g_packet_queue_read, read + 1);
+	}
+}
+
+unsigned CL_GetDroppedPacketCount(void)
+{
+	return OS_AtomicLoad32(&g_packets_dropped);
+}
+
+fragment_stats_t CL_GetFragmentStats(void)
+{
+	// the network thread could be in the middle of updating these, but 
+	// for showing them on screen that doesn't matter
+	return g_reassembler.stats;
+}
+
+net_context_t *CL_GetNetContext(void)
+{
+	return &g_net;
 }
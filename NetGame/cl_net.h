@@ -1,9 +1,19 @@
 #pragma once
 
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stddef.h>
+#include <stdalign.h>
+
 // ------------------------------------------------------------------
 // internal includes
 
 #include "protocol.h"
+#include "os.h"
+#include "fragment.h"
+#include "net.h"
+#include "netimpair.h"
 
 // ------------------------------------------------------------------
 // cl_net.h: interface for accessing networking in the client's
@@ -13,17 +23,46 @@
 
 // ------------------------------------------------------------------
 
-int CL_NetInit(char *server, int port);
+enum { CL_MAX_PACKET_SIZE = 8192 };
+
+// a packet as received by the network thread
+typedef struct cl_packet_t
+{
+	os_time_t arrival_time; // OS_GetHiresTime() from the moment the packet came in
+	size_t    size;         // the amount of bytes in data
+
+	alignas(16) char data[CL_MAX_PACKET_SIZE];
+} cl_packet_t;
+
+// also starts up the network thread that receives packets from the
+// server in the background. the impairment is normally NULL, see
+// netimpair.h
+int CL_NetInit(char *server, int port, net_impairment_t *impairment);
 int CL_NetExit(void);
 
+// packets get bundled up and only go out once CL_FlushPackets is 
+// called, which should be once per tick
 void CL_SendPacketSized(void *packet, size_t packet_size);
+void CL_FlushPackets(void);
 
 // this macro is nice, but be aware of the fact that it has `packet`
 // in there twice, so don't put any calls that should happen only
 // once in the compound literal (if you're using a compound literal)
 #define CL_SendPacket(packet) CL_SendPacketSized(packet, sizeof(*(packet)))
 
-// reuses a global buffer, so be careful about not calling it if you
-// were still looking at the previous packet, or from multiple
-// threads
-net_header_t *CL_GetNextPacket(void);
+// returns the oldest packet received by the network thread that has
+// not been released yet, or NULL if there are none. the packet stays
+// valid until you pass it to CL_ReleasePacket, which you have to do 
+// before you can get the next one. only call these from one thread
+cl_packet_t *CL_GetNextPacket(void);
+void         CL_ReleasePacket(cl_packet_t *packet);
+
+// returns the amount of packets the network thread had to throw away
+// because the main thread wasn't keeping up
+unsigned CL_GetDroppedPacketCount(void);
+
+// returns how the reassembly of fragmented packets is going
+fragment_stats_t CL_GetFragmentStats(void);
+
+// the context all of the client's packets go through, for its stats
+net_context_t *CL_GetNetContext(void);
@@ -0,0 +1,140 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "bundle.h"
+
+// ------------------------------------------------------------------
+// bundle.c: the size of each packet comes right before it, at an 
+// offset that is 4 past a multiple of 8, so the packet itself starts
+// on a multiple of 8.
+
+
+enum { PACKET_PREFIX_SIZE = 4 };
+
+// where the next packet prefix goes after a packet that ends here
+static size_t Bundle_NextPrefixOffset(size_t packet_end)
+{
+	return ((packet_end + PACKET_PREFIX_SIZE + 7) & ~(size_t)7) - PACKET_PREFIX_SIZE;
+}
+
+bool Bundle_Add(bundle_writer_t *bundle, const void *packet, size_t packet_size)
+{
+	if (bundle->packet_count == 0)
+	{
+		net_header_t header = { .kind = NETPACKET_BUNDLE };
+		memcpy(bundle->data, &header, sizeof(header));
+
+		bundle->size = sizeof(header);
+		bundle->end  = sizeof(header);
+	}
+
+	if (bundle->size + PACKET_PREFIX_SIZE + packet_size > sizeof(bundle->data))
+		return false;
+
+	unsigned short size_prefix[2] = { (unsigned short)packet_size, 0 };
+	memcpy(&bundle->data[bundle->size], size_prefix, sizeof(size_prefix));
+	memcpy(&bundle->data[bundle->size + PACKET_PREFIX_SIZE], packet, packet_size);
+
+	bundle->end  = bundle->size + PACKET_PREFIX_SIZE + packet_size;
+	bundle->size = Bundle_NextPrefixOffset(bundle->end);
+
+	bundle->packet_count += 1;
+
+	return true;
+}
+
+void *Bundle_GetDatagram(bundle_writer_t *bundle, size_t *datagram_size)
+{
+	switch (bundle->packet_count)
+	{
+		case 0:
+		{
+			*datagram_size = 0;
+			return NULL;
+		}
+
+		case 1:
+		{
+			// no point in the bundle overhead for a single packet
+			size_t offset = sizeof(net_header_t) + PACKET_PREFIX_SIZE;
+
+			*datagram_size = bundle->end - offset;
+			return &bundle->data[offset];
+		}
+
+		default:
+		{
+			*datagram_size = bundle->end;
+			return bundle->data;
+		}
+	}
+}
+
+void Bundle_Clear(bundle_writer_t *bundle)
+{
+	bundle->packet_count = 0;
+	bundle->size         = 0;
+	bundle->end          = 0;
+}
+
+void Bundle_BeginRead(bundle_reader_t *reader, void *datagram, size_t datagram_size)
+{
+	reader->base      = datagram;
+	reader->at        = datagram;
+	reader->end       = reader->base + datagram_size;
+	reader->is_bundle = false;
+
+	if (datagram_size >= sizeof(net_header_t) && ((net_header_t *)datagram)->kind == NETPACKET_BUNDLE)
+	{
+		reader->is_bundle = true;
+		reader->at       += sizeof(net_header_t);
+	}
+}
+
+bool Bundle_Next(bundle_reader_t *reader, net_header_t **packet, size_t *packet_size)
+{
+	size_t remaining = (size_t)(reader->end - reader->at);
+
+	if (!reader->is_bundle)
+	{
+		if (remaining < sizeof(net_header_t))
+			return false;
+
+		*packet      = (net_header_t *)reader->at;
+		*packet_size = remaining;
+
+		reader->at = reader->end;
+		return true;
+	}
+
+	if (remaining < PACKET_PREFIX_SIZE)
+		return false;
+
+	unsigned short size;
+	memcpy(&size, reader->at, sizeof(size));
+
+	unsigned char *data = reader->at + PACKET_PREFIX_SIZE;
+
+	if (size < sizeof(net_header_t) || size > remaining - PACKET_PREFIX_SIZE)
+	{
+		reader->at = reader->end;
+		return false;
+	}
+
+	*packet      = (net_header_t *)data;
+	*packet_size = size;
+
+	size_t next = Bundle_NextPrefixOffset((size_t)(data - reader->base) + size);
+
+	if (next > (size_t)(reader->end - reader->base))
+		next = (size_t)(reader->end - reader->base);
+
+	reader->at = reader->base + next;
+	return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+
+// ------------------------------------------------------------------
+// bundle.h: packs several packets into one datagram. instead of
+// sending every packet the moment it's ready, they get added to a
+// bundle, and the bundle gets sent once per tick (or when it's full).
+// a tick's world state, ping and ping reply then cost one UDP/IP
+// header and one system call instead of three.
+//
+// a bundle is a net_header_t of kind NETPACKET_BUNDLE, followed by
+// packets that each look like:
+//
+//     unsigned short size;
+//     unsigned short padding;
+//     unsigned char  packet[size]; padded so that the next packet
+//                                  starts on an 8 byte boundary
+//
+// every packet inside starts 8 byte aligned (as long as the datagram
+// does), so they can be read right where they are. a bundle with only
+// one packet in it gets sent as just that packet.
+
+typedef struct bundle_writer_t
+{
+	int    packet_count;
+	size_t size; // where the next packet's size goes
+	size_t end;  // the end of the last packet, without padding
+
+	alignas(16) unsigned char data[NET_MAX_DATAGRAM_SIZE];
+} bundle_writer_t;
+
+typedef struct bundle_reader_t
+{
+	unsigned char *base;
+	unsigned char *at;
+	unsigned char *end;
+	bool           is_bundle;
+} bundle_reader_t;
+
+// the biggest packet that fits in a bundle. anything bigger has to
+// be sent on its own
+enum { BUNDLE_MAX_PACKET_SIZE = NET_MAX_DATAGRAM_SIZE - 8 };
+
+// adds a packet to the bundle. returns false if it doesn't fit, in
+// which case the bundle has to be sent first
+bool Bundle_Add(bundle_writer_t *bundle, const void *packet, size_t packet_size);
+
+// returns the datagram to send, or NULL if the bundle is empty. it's
+// valid until the next Bundle_Add or Bundle_Clear
+void *Bundle_GetDatagram(bundle_writer_t *bundle, size_t *datagram_size);
+void  Bundle_Clear(bundle_writer_t *bundle);
+
+// iterates the packets in a received datagram in place. a datagram
+// that isn't a bundle just gives back itself
+void Bundle_BeginRead(bundle_reader_t *reader, void *datagram, size_t datagram_size);
+
+// returns false when there are no more packets, or the rest of the
+// bundle is garbage
+bool Bundle_Next(bundle_reader_t *reader, net_header_t **packet, size_t *packet_size);
@@ -0,0 +1,329 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "channel.h"
+
+// ------------------------------------------------------------------
+// channel.c: the acking works the same way as in plenty of games: each
+// side remembers which of the other side's packets it received, and
+// sends back the newest sequence plus a bitfield for the 32 before it,
+// in every packet. that means a single ack has 33 chances to make it
+// across. the sender remembers which messages went into which packet,
+// so an acked packet means acked messages.
+
+
+enum { RELIABLE_HEADER_SIZE = 8 };
+enum { MESSAGE_HEADER_SIZE  = 3 };
+
+// messages get resent at most this often, even if the round trip time
+// is tiny or unknown
+static const float g_min_resend_delay = 0.05f;
+
+void Channel_Init(net_channel_t *channel)
+{
+	memset(channel, 0, sizeof(*channel));
+}
+
+bool Channel_Send(net_channel_t *channel, const void *message, size_t size)
+{
+	if (NEVER(size == 0 || size > NET_MAX_MESSAGE_SIZE))
+		return false;
+
+	unsigned short in_flight = (unsigned short)(channel->next_send_id - channel->oldest_unacked_id);
+
+	if (in_flight >= CHANNEL_WINDOW_SIZE)
+	{
+		channel->messages_dropped += 1;
+		return false;
+	}
+
+	unsigned short id = channel->next_send_id++;
+
+	channel_message_t *slot = &channel->send_queue[id % CHANNEL_WINDOW_SIZE];
+	slot->in_use         = true;
+	slot->acked          = false;
+	slot->id             = id;
+	slot->size           = (unsigned char)size;
+	slot->last_send_time = 0;
+	memcpy(slot->data, message, size);
+
+	channel->messages_sent += 1;
+
+	return true;
+}
+
+bool Channel_IsIdle(net_channel_t *channel)
+{
+	return channel->oldest_unacked_id == channel->next_send_id;
+}
+
+// ------------------------------------------------------------------
+// acks
+
+static void Channel_AckPacket(net_channel_t *channel, unsigned short sequence)
+{
+	channel_sent_packet_t *packet = &channel->sent_packets[sequence % CHANNEL_SENT_PACKET_COUNT];
+
+	if (!packet->valid || packet->sequence != sequence)
+		return;
+
+	for (int i = 0; i < packet->message_count; i++)
+	{
+		unsigned short id = packet->message_ids[i];
+
+		channel_message_t *message = &channel->send_queue[id % CHANNEL_WINDOW_SIZE];
+
+		if (message->in_use && message->id == id)
+			message->acked = true;
+	}
+
+	packet->valid = false;
+
+	// free up the window, messages can get acked out of order so this
+	// only moves up to the oldest one that's still waiting
+	while (channel->oldest_unacked_id != channel->next_send_id)
+	{
+		channel_message_t *message = &channel->send_queue[channel->oldest_unacked_id % CHANNEL_WINDOW_SIZE];
+
+		if (!message->acked)
+			break;
+
+		message->in_use = false;
+		channel->oldest_unacked_id += 1;
+	}
+}
+
+static void Channel_RecordReceived(net_channel_t *channel, unsigned short sequence)
+{
+	if (!channel->has_received)
+	{
+		channel->has_received = true;
+		channel->ack          = sequence;
+		channel->ack_bits     = 0;
+		return;
+	}
+
+	int delta = (short)(sequence - channel->ack);
+
+	if (delta > 0)
+	{
+		// the old ack becomes bit delta - 1
+		channel->ack_bits = (delta < 32) ? (channel->ack_bits << delta) : 0;
+
+		if (delta - 1 < 32)
+			channel->ack_bits |= 1u << (delta - 1);
+
+		channel->ack = sequence;
+	}
+	else if (delta < 0)
+	{
+		int bit = -delta - 1;
+
+		if (bit < 32)
+			channel->ack_bits |= 1u << bit;
+	}
+}
+
+// ------------------------------------------------------------------
+// reading and writing the reliable block
+
+static float Channel_GetResendDelay(float rtt)
+{
+	float resend_delay = 1.25f*rtt;
+	if (resend_delay < g_min_resend_delay)
+		resend_delay = g_min_resend_delay;
+
+	return resend_delay;
+}
+
+// whether the message should go in the next block, because it hasn't
+// been sent yet, or hasn't been acked for too long
+static bool Channel_IsDue(const channel_message_t *message, os_time_t now, float resend_delay)
+{
+	if (!message->in_use || message->acked)
+		return false;
+
+	if (message->last_send_time &&
+		OS_GetSecondsElapsed(message->last_send_time, now) < resend_delay)
+		return false;
+
+	return true;
+}
+
+size_t Channel_GetBlockSize(net_channel_t *channel, float rtt, size_t block_capacity)
+{
+	if (NEVER(block_capacity < RELIABLE_HEADER_SIZE))
+		return 0;
+
+	os_time_t now          = OS_GetHiresTime();
+	float     resend_delay = Channel_GetResendDelay(rtt);
+
+	size_t at            = RELIABLE_HEADER_SIZE;
+	int    message_count = 0;
+
+	// has to pick the same messages as Channel_WriteBlock
+	for (unsigned short id = channel->oldest_unacked_id; id != channel->next_send_id; id++)
+	{
+		if (message_count >= CHANNEL_MAX_MESSAGES_PER_PACKET)
+			break;
+
+		channel_message_t *message = &channel->send_queue[id % CHANNEL_WINDOW_SIZE];
+
+		if (!Channel_IsDue(message, now, resend_delay))
+			continue;
+
+		if (at + MESSAGE_HEADER_SIZE + message->size > block_capacity)
+			break;
+
+		at            += MESSAGE_HEADER_SIZE + message->size;
+		message_count += 1;
+	}
+
+	return at;
+}
+
+size_t Channel_WriteBlock(net_channel_t *channel, unsigned short packet_sequence, float rtt,
+						  unsigned char *block, size_t block_capacity)
+{
+	if (NEVER(block_capacity < RELIABLE_HEADER_SIZE))
+		return 0;
+
+	os_time_t now          = OS_GetHiresTime();
+	float     resend_delay = Channel_GetResendDelay(rtt);
+
+	channel_sent_packet_t *sent_packet = &channel->sent_packets[packet_sequence % CHANNEL_SENT_PACKET_COUNT];
+	sent_packet->valid         = false;
+	sent_packet->sequence      = packet_sequence;
+	sent_packet->message_count = 0;
+
+	size_t at = RELIABLE_HEADER_SIZE;
+
+	for (unsigned short id = channel->oldest_unacked_id; id != channel->next_send_id; id++)
+	{
+		if (sent_packet->message_count >= CHANNEL_MAX_MESSAGES_PER_PACKET)
+			break;
+
+		channel_message_t *message = &channel->send_queue[id % CHANNEL_WINDOW_SIZE];
+
+		if (!Channel_IsDue(message, now, resend_delay))
+			continue;
+
+		if (at + MESSAGE_HEADER_SIZE + message->size > block_capacity)
+			break;
+
+		memcpy(&block[at], &message->id, sizeof(message->id));
+		block[at + 2] = message->size;
+		memcpy(&block[at + MESSAGE_HEADER_SIZE], message->data, message->size);
+
+		at += MESSAGE_HEADER_SIZE + message->size;
+
+		if (message->last_send_time)
+			channel->messages_resent += 1;
+
+		message->last_send_time = now;
+
+		sent_packet->message_ids[sent_packet->message_count++] = id;
+	}
+
+	sent_packet->valid = (sent_packet->message_count > 0);
+
+	unsigned short message_count = (unsigned short)sent_packet->message_count;
+	unsigned short ack           = channel->has_received ? channel->ack : 0;
+	uint32_t       ack_bits      = channel->has_received ? channel->ack_bits : 0;
+
+	// before anything arrives this acks packet 0, which is harmless since
+	// sequences start at 1
+	memcpy(&block[0], &ack,           sizeof(ack));
+	memcpy(&block[2], &message_count, sizeof(message_count));
+	memcpy(&block[4], &ack_bits,      sizeof(ack_bits));
+
+	return at;
+}
+
+bool Channel_ReadBlock(net_channel_t *channel, unsigned short packet_sequence,
+					   const unsigned char *block, size_t block_size)
+{
+	if (block_size < RELIABLE_HEADER_SIZE)
+		return false;
+
+	Channel_RecordReceived(channel, packet_sequence);
+
+	unsigned short ack;
+	unsigned short message_count;
+	uint32_t       ack_bits;
+
+	memcpy(&ack,           &block[0], sizeof(ack));
+	memcpy(&message_count, &block[2], sizeof(message_count));
+	memcpy(&ack_bits,      &block[4], sizeof(ack_bits));
+
+	channel->peer_ack      = ack;
+	channel->peer_ack_bits = ack_bits;
+
+	Channel_AckPacket(channel, ack);
+
+	for (int i = 0; i < 32; i++)
+	{
+		if (ack_bits & (1u << i))
+			Channel_AckPacket(channel, (unsigned short)(ack - 1 - i));
+	}
+
+	size_t at = RELIABLE_HEADER_SIZE;
+
+	for (int i = 0; i < message_count; i++)
+	{
+		if (at + MESSAGE_HEADER_SIZE > block_size)
+			return false;
+
+		unsigned short id;
+		memcpy(&id, &block[at], sizeof(id));
+
+		unsigned char size = block[at + 2];
+
+		if (size == 0 || size > NET_MAX_MESSAGE_SIZE || at + MESSAGE_HEADER_SIZE + size > block_size)
+			return false;
+
+		const unsigned char *data = &block[at + MESSAGE_HEADER_SIZE];
+		at += MESSAGE_HEADER_SIZE + size;
+
+		// anything outside the window has either been delivered already, or
+		// the sender is confused
+		int delta = (short)(id - channel->next_receive_id);
+
+		if (delta < 0 || delta >= CHANNEL_WINDOW_SIZE)
+			continue;
+
+		channel_message_t *message = &channel->receive_queue[id % CHANNEL_WINDOW_SIZE];
+
+		if (message->in_use && message->id == id)
+			continue;
+
+		message->in_use = true;
+		message->id     = id;
+		message->size   = size;
+		memcpy(message->data, data, size);
+	}
+
+	return true;
+}
+
+size_t Channel_Receive(net_channel_t *channel, net_message_t *result)
+{
+	channel_message_t *message = &channel->receive_queue[channel->next_receive_id % CHANNEL_WINDOW_SIZE];
+
+	if (!message->in_use || message->id != channel->next_receive_id)
+		return 0;
+
+	memset(result, 0, sizeof(*result));
+	memcpy(result->data, message->data, message->size);
+
+	message->in_use = false;
+	channel->next_receive_id += 1;
+
+	return message->size;
+}
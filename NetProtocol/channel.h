@@ -0,0 +1,122 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+#include "os.h"
+
+// ------------------------------------------------------------------
+// channel.h: a reliable, ordered channel for small messages, for the
+// things that happen rarely but must not get lost, like players
+// joining or leaving. it doesn't send any packets of its own, instead
+// it fills in the reliable block at the end of the packets that get
+// sent every tick anyway, and acks the other side's messages using the
+// sequence numbers those packets already have.
+//
+// the reliable block looks like this:
+//
+//     unsigned short ack;           newest packet sequence received from the other side
+//     unsigned short message_count;
+//     unsigned int   ack_bits;      bit n is set if packet ack - 1 - n was received too
+//
+// followed by message_count messages of:
+//
+//     unsigned short id;            messages get delivered in order of their id
+//     unsigned char  size;
+//     unsigned char  data[size];
+//
+// messages that haven't been acked get sent again every round trip
+// or so, until they are.
+
+// the amount of messages that can be in flight (sent, but not acked)
+enum { CHANNEL_WINDOW_SIZE = 64 }; // must be a power of two
+
+// the amount of messages that fit in one packet
+enum { CHANNEL_MAX_MESSAGES_PER_PACKET = 8 };
+
+// the amount of sent packets we remember the messages of, to know
+// which messages an ack is for
+enum { CHANNEL_SENT_PACKET_COUNT = 64 }; // must be a power of two
+
+typedef struct channel_message_t
+{
+	bool           in_use;
+	bool           acked;
+	unsigned short id;
+	unsigned char  size;
+	os_time_t      last_send_time; // 0 if never sent
+	unsigned char  data[NET_MAX_MESSAGE_SIZE];
+} channel_message_t;
+
+typedef struct channel_sent_packet_t
+{
+	bool           valid;
+	unsigned short sequence;
+	int            message_count;
+	unsigned short message_ids[CHANNEL_MAX_MESSAGES_PER_PACKET];
+} channel_sent_packet_t;
+
+typedef struct net_channel_t
+{
+	// sending side
+	unsigned short        next_send_id;
+	unsigned short        oldest_unacked_id;
+	channel_message_t     send_queue  [CHANNEL_WINDOW_SIZE];
+	channel_sent_packet_t sent_packets[CHANNEL_SENT_PACKET_COUNT];
+
+	// receiving side
+	unsigned short    next_receive_id;
+	channel_message_t receive_queue[CHANNEL_WINDOW_SIZE];
+
+	// acks for the other side
+	bool           has_received;
+	unsigned short ack;
+	uint32_t       ack_bits;
+
+	// the other side's acks for our packets, from the last block read.
+	// these cover all of our packets, not just the ones with messages in
+	// them, so they're handy for working out loss
+	unsigned short peer_ack;
+	uint32_t       peer_ack_bits;
+
+	// stats
+	uint32_t messages_sent;
+	uint32_t messages_resent;
+	uint32_t messages_dropped; // Channel_Send calls that failed because the window was full
+} net_channel_t;
+
+void Channel_Init(net_channel_t *channel);
+
+// queues up a message. returns false if it can't be sent, because it
+// is too big, or because too many messages are still waiting on acks
+bool Channel_Send(net_channel_t *channel, const void *message, size_t size);
+
+// returns whether every message sent so far has been acked
+bool Channel_IsIdle(net_channel_t *channel);
+
+// returns how many bytes Channel_WriteBlock would write if it was
+// called right now, without sending anything
+size_t Channel_GetBlockSize(net_channel_t *channel, float rtt, size_t block_capacity);
+
+// fills in the reliable block of a packet about to be sent with the
+// given sequence number. rtt decides how long to wait before sending
+// an unacked message again. returns the amount of bytes written
+size_t Channel_WriteBlock(net_channel_t *channel, unsigned short packet_sequence, float rtt,
+						  unsigned char *block, size_t block_capacity);
+
+// processes the reliable block of a received packet. returns false if
+// the block is garbage. call this for every packet that arrives, even
+// the ones that are too old to be used otherwise
+bool Channel_ReadBlock(net_channel_t *channel, unsigned short packet_sequence,
+					   const unsigned char *block, size_t block_size);
+
+// gets the next message in order, if it has arrived. returns its size,
+// or 0 if there is none
+size_t Channel_Receive(net_channel_t *channel, net_message_t *message);
@@ -0,0 +1,218 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "fragment.h"
+
+// ------------------------------------------------------------------
+// fragment.c: reassembly works out of a small fixed pool of slots,
+// each big enough for the biggest packet there can be, so nothing
+// ever gets allocated and a flood of junk fragments can't make us use
+// any more memory than that.
+
+
+enum { FRAGMENT_HEADER_SIZE = offsetof(net_fragment_t, data) };
+
+// ------------------------------------------------------------------
+// sending side
+
+int Fragment_GetCount(size_t packet_size)
+{
+	if (packet_size <= NET_MAX_DATAGRAM_SIZE)
+		return 1;
+
+	return (int)((packet_size + NET_FRAGMENT_DATA_SIZE - 1) / NET_FRAGMENT_DATA_SIZE);
+}
+
+size_t Fragment_Write(net_fragment_t *fragment, unsigned short packet_id, int fragment_index,
+					  const void *packet, size_t packet_size)
+{
+	int fragment_count = Fragment_GetCount(packet_size);
+
+	if (NEVER(fragment_count > NET_MAX_FRAGMENT_COUNT || fragment_index >= fragment_count))
+		return 0;
+
+	size_t offset = (size_t)fragment_index*NET_FRAGMENT_DATA_SIZE;
+	size_t size   = packet_size - offset;
+
+	if (size > NET_FRAGMENT_DATA_SIZE)
+		size = NET_FRAGMENT_DATA_SIZE;
+
+	fragment->header.kind     = NETPACKET_FRAGMENT;
+	fragment->header.sequence = 0;
+	fragment->packet_id       = packet_id;
+	fragment->fragment_index  = (unsigned char)fragment_index;
+	fragment->fragment_count  = (unsigned char)fragment_count;
+
+	memcpy(fragment->data, (const unsigned char *)packet + offset, size);
+
+	return FRAGMENT_HEADER_SIZE + size;
+}
+
+// ------------------------------------------------------------------
+// receiving side
+
+void Fragment_InitReassembler(fragment_reassembler_t *reassembler)
+{
+	memset(reassembler, 0, sizeof(*reassembler));
+	reassembler->timeout = 0.5;
+}
+
+static int Fragment_CountMissing(fragment_slot_t *slot)
+{
+	return slot->fragment_count - slot->received_count;
+}
+
+static bool Fragment_WasCompleted(fragment_reassembler_t *reassembler, unsigned short packet_id)
+{
+	for (int i = 0; i < reassembler->completed_count; i++)
+	{
+		if (reassembler->completed_ids[i] == packet_id)
+			return true;
+	}
+
+	return false;
+}
+
+static fragment_slot_t *Fragment_GetSlot(fragment_reassembler_t *reassembler, const net_fragment_t *fragment, os_time_t arrival_time)
+{
+	fragment_slot_t *free_slot   = NULL;
+	fragment_slot_t *oldest_slot = NULL;
+
+	for (size_t i = 0; i < FRAGMENT_SLOT_COUNT; i++)
+	{
+		fragment_slot_t *slot = &reassembler->slots[i];
+
+		if (slot->in_use &&
+			slot->packet_id      == fragment->packet_id &&
+			slot->fragment_count == fragment->fragment_count)
+		{
+			return slot;
+		}
+
+		if (!slot->in_use)
+		{
+			if (!free_slot)
+				free_slot = slot;
+		}
+		else if (!oldest_slot || slot->first_arrival_time < oldest_slot->first_arrival_time)
+		{
+			oldest_slot = slot;
+		}
+	}
+
+	fragment_slot_t *slot = free_slot;
+
+	if (!slot)
+	{
+		slot = oldest_slot;
+
+		reassembler->stats.packets_evicted += 1;
+		reassembler->stats.fragments_lost  += (uint32_t)Fragment_CountMissing(slot);
+	}
+
+	slot->in_use             = true;
+	slot->packet_id          = fragment->packet_id;
+	slot->fragment_count     = fragment->fragment_count;
+	slot->received_count     = 0;
+	slot->received_mask      = 0;
+	slot->size               = 0;
+	slot->first_arrival_time = arrival_time;
+
+	return slot;
+}
+
+void *Fragment_Receive(fragment_reassembler_t *reassembler, const net_fragment_t *fragment, size_t fragment_size,
+					   os_time_t arrival_time, size_t *packet_size)
+{
+	fragment_stats_t *stats = &reassembler->stats;
+
+	// throw away anything that's been waiting around for too long. doing
+	// it here means it only happens when fragments are coming in, but if
+	// they aren't, nobody's waiting on the slots anyway
+
+	for (size_t i = 0; i < FRAGMENT_SLOT_COUNT; i++)
+	{
+		fragment_slot_t *slot = &reassembler->slots[i];
+
+		if (slot->in_use && OS_GetSecondsElapsed(slot->first_arrival_time, arrival_time) > reassembler->timeout)
+		{
+			slot->in_use = false;
+
+			stats->packets_timed_out += 1;
+			stats->fragments_lost    += (uint32_t)Fragment_CountMissing(slot);
+		}
+	}
+
+	// make sure the fragment makes sense
+
+	if (fragment_size <= FRAGMENT_HEADER_SIZE)
+	{
+		stats->fragments_invalid += 1;
+		return NULL;
+	}
+
+	int    index     = fragment->fragment_index;
+	int    count     = fragment->fragment_count;
+	size_t data_size = fragment_size - FRAGMENT_HEADER_SIZE;
+
+	bool is_last = (index == count - 1);
+
+	if (count < 1 || count > NET_MAX_FRAGMENT_COUNT || index >= count ||
+		data_size > NET_FRAGMENT_DATA_SIZE ||
+		(!is_last && data_size != NET_FRAGMENT_DATA_SIZE))
+	{
+		stats->fragments_invalid += 1;
+		return NULL;
+	}
+
+	stats->fragments_received += 1;
+
+	// a straggler from a packet that's already been put together
+	if (Fragment_WasCompleted(reassembler, fragment->packet_id))
+	{
+		stats->fragments_duplicate += 1;
+		return NULL;
+	}
+
+	// and slot it in
+
+	fragment_slot_t *slot = Fragment_GetSlot(reassembler, fragment, arrival_time);
+
+	if (slot->received_mask & (1u << index))
+	{
+		stats->fragments_duplicate += 1;
+		return NULL;
+	}
+
+	memcpy(&slot->data[(size_t)index*NET_FRAGMENT_DATA_SIZE], fragment->data, data_size);
+
+	if (is_last)
+		slot->size = (size_t)index*NET_FRAGMENT_DATA_SIZE + data_size;
+
+	slot->received_mask  |= 1u << index;
+	slot->received_count += 1;
+
+	if (slot->received_count < slot->fragment_count)
+		return NULL;
+
+	// that was the last one. the slot is free again, but the data stays
+	// put until the next call
+
+	slot->in_use = false;
+	stats->packets_completed += 1;
+
+	reassembler->completed_ids[reassembler->next_completed] = slot->packet_id;
+	reassembler->next_completed = (reassembler->next_completed + 1) % FRAGMENT_COMPLETED_COUNT;
+
+	if (reassembler->completed_count < FRAGMENT_COMPLETED_COUNT)
+		reassembler->completed_count += 1;
+
+	*packet_size = slot->size;
+	return slot->data;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+#include "os.h"
+
+// ------------------------------------------------------------------
+// fragment.h: splits packets that are too big for a single datagram
+// into NETPACKET_FRAGMENTs, and puts them back together on the other
+// end. we could let IP do this for us, but then a lost fragment just
+// silently takes the whole packet with it. doing it ourselves means
+// we can see how many fragments get lost, and we decide how big our
+// datagrams get.
+
+// how many packets can be in the middle of being put back together
+// at once. if a new one comes in while they're all taken, the oldest
+// one gets thrown away
+enum { FRAGMENT_SLOT_COUNT = 4 };
+
+// how many of the most recently completed packets get remembered, so a
+// late duplicate of one of their fragments doesn't start the packet
+// over in a slot of its own (and push out one that's still coming in)
+enum { FRAGMENT_COMPLETED_COUNT = 16 };
+
+typedef struct fragment_slot_t
+{
+	bool           in_use;
+	unsigned short packet_id;
+	int            fragment_count;
+	int            received_count;
+	uint32_t       received_mask;   // bit n is set if fragment n has arrived
+	size_t         size;            // known once the last fragment arrives
+	os_time_t      first_arrival_time;
+
+	alignas(16) unsigned char data[NET_MAX_FRAGMENT_COUNT*NET_FRAGMENT_DATA_SIZE];
+} fragment_slot_t;
+
+typedef struct fragment_stats_t
+{
+	uint32_t fragments_received;
+	uint32_t fragments_duplicate;
+	uint32_t fragments_invalid;
+	uint32_t fragments_lost;     // fragments that never showed up for packets that got thrown away
+
+	uint32_t packets_completed;
+	uint32_t packets_timed_out;  // thrown away because the rest of it took too long
+	uint32_t packets_evicted;    // thrown away to make room for a newer one
+} fragment_stats_t;
+
+typedef struct fragment_reassembler_t
+{
+	double timeout; // in seconds, how long to wait for the rest of a packet
+
+	fragment_slot_t slots[FRAGMENT_SLOT_COUNT];
+
+	// a ring of the packet ids of the last few completed packets
+	int            completed_count;
+	int            next_completed;
+	unsigned short completed_ids[FRAGMENT_COMPLETED_COUNT];
+
+	fragment_stats_t stats;
+} fragment_reassembler_t;
+
+// ------------------------------------------------------------------
+// sending side
+
+// returns how many fragments a packet of this size needs, 1 if it
+// fits in a single datagram and doesn't need fragmenting at all
+int Fragment_GetCount(size_t packet_size);
+
+// fills in one fragment of the packet, returns the amount of bytes of
+// the fragment that need to be sent
+size_t Fragment_Write(net_fragment_t *fragment, unsigned short packet_id, int fragment_index,
+					  const void *packet, size_t packet_size);
+
+// ------------------------------------------------------------------
+// receiving side
+
+void Fragment_InitReassembler(fragment_reassembler_t *reassembler);
+
+// takes in a received fragment. if that was the last missing piece of
+// its packet, returns the whole packet, which stays valid until the
+// next call. otherwise returns NULL
+void *Fragment_Receive(fragment_reassembler_t *reassembler, const net_fragment_t *fragment, size_t fragment_size,
+					   os_time_t arrival_time, size_t *packet_size);
@@ -0,0 +1,549 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "logger.h"
+
+// ------------------------------------------------------------------
+// logger.c: the ring is a bounded queue where every cell has its own
+// sequence number, which says whether the cell is ready to be written
+// or ready to be read, and for which trip around the ring. producers
+// claim a cell by bumping the write position with a compare exchange,
+// and hand it over by bumping the cell's sequence. there's only ever
+// one consumer, the logger thread, so reading needs no atomics beyond
+// looking at the sequence.
+//
+// the arguments get pulled out with va_arg by going through the format
+// string, the same way printf would, and the logger thread goes through
+// it again to format them one conversion at a time with snprintf.
+
+
+enum { LOG_MAX_ARGS     = 12 };
+enum { LOG_STRING_SPACE = 96 };
+
+typedef enum log_arg_kind_e
+{
+	LOGARG_NONE, // the end of the format, or something we can't handle
+	LOGARG_INT,
+	LOGARG_LONG,
+	LOGARG_LONG_LONG,
+	LOGARG_SIZE,
+	LOGARG_DOUBLE,
+	LOGARG_STRING,
+	LOGARG_POINTER,
+} log_arg_kind_e;
+
+typedef union log_arg_t
+{
+	long long   i;
+	size_t      z;
+	double      f;
+	const void *p;
+	size_t      string; // offset into the record's strings
+} log_arg_t;
+
+typedef struct log_record_t
+{
+	const char *format;
+	log_level_e level;
+	int         arg_count;
+	size_t      string_size;
+	log_arg_t   args[LOG_MAX_ARGS];
+	char        strings[LOG_STRING_SPACE];
+} log_record_t;
+
+typedef struct log_cell_t
+{
+	volatile uint32_t sequence;
+	log_record_t      record;
+} log_cell_t;
+
+static log_cell_t        g_cells[LOG_RING_SIZE];
+static volatile uint32_t g_write_position;
+static uint32_t          g_read_position; // only the logger thread touches this
+
+static volatile uint32_t g_log_running;
+static os_thread_t       g_log_thread;
+static os_time_t         g_start_time;
+
+static volatile uint64_t g_written;
+static volatile uint64_t g_dropped;
+static volatile uint64_t g_suppressed;
+
+// ------------------------------------------------------------------
+// going through format strings
+
+typedef struct log_spec_t
+{
+	const char    *start;      // the '%'
+	const char    *end;        // one past the conversion character
+	int            star_count; // width and precision given as arguments, they come first
+	log_arg_kind_e kind;
+} log_spec_t;
+
+// finds the next conversion in the format, and returns false if there
+// are no more. "%%" doesn't count as one
+static bool Log_NextSpec(const char *at, log_spec_t *spec)
+{
+	for (;;)
+	{
+		at = strchr(at, '%');
+
+		if (!at)
+			return false;
+
+		if (at[1] != '%')
+			break;
+
+		at += 2;
+	}
+
+	spec->start      = at;
+	spec->star_count = 0;
+	spec->kind       = LOGARG_NONE;
+
+	at += 1;
+
+	while (*at && strchr("-+ #0", *at))
+		at++;
+
+	if (*at == '*') { spec->star_count += 1; at++; }
+	while (*at >= '0' && *at <= '9') at++;
+
+	if (*at == '.')
+	{
+		at++;
+		if (*at == '*') { spec->star_count += 1; at++; }
+		while (*at >= '0' && *at <= '9') at++;
+	}
+
+	log_arg_kind_e int_kind = LOGARG_INT;
+
+	if      (at[0] == 'h')                                  { at += (at[1] == 'h') ? 2 : 1; }
+	else if (at[0] == 'l' && at[1] == 'l')                  { at += 2; int_kind = LOGARG_LONG_LONG; }
+	else if (at[0] == 'l')                                  { at += 1; int_kind = LOGARG_LONG; }
+	else if (at[0] == 'z')                                  { at += 1; int_kind = LOGARG_SIZE; }
+	else if (at[0] == 'I' && at[1] == '6' && at[2] == '4') { at += 3; int_kind = LOGARG_LONG_LONG; }
+
+	switch (*at)
+	{
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		{
+			spec->kind = int_kind;
+		} break;
+
+		case 'f': case 'F': case 'g': case 'G': case 'e': case 'E': case 'a': case 'A':
+		{
+			spec->kind = LOGARG_DOUBLE;
+		} break;
+
+		case 's':
+		{
+			// wide strings would need more work than they're worth
+			spec->kind = (int_kind == LOGARG_INT) ? LOGARG_STRING : LOGARG_NONE;
+		} break;
+
+		case 'p':
+		{
+			spec->kind = LOGARG_POINTER;
+		} break;
+	}
+
+	spec->end = *at ? at + 1 : at;
+
+	return spec->kind != LOGARG_NONE;
+}
+
+// ------------------------------------------------------------------
+// packing records
+
+static void Log_PackString(log_record_t *record, log_arg_t *arg, const char *string)
+{
+	if (!string)
+		string = "(null)";
+
+	// the last byte is always left as 0, for strings that don't fit at all
+	size_t space = LOG_STRING_SPACE - 1 - record->string_size;
+
+	if (space == 0)
+	{
+		arg->string = LOG_STRING_SPACE - 1;
+		return;
+	}
+
+	size_t size = strlen(string);
+
+	if (size > space - 1)
+		size = space - 1;
+
+	arg->string = record->string_size;
+
+	memcpy(&record->strings[record->string_size], string, size);
+	record->strings[record->string_size + size] = 0;
+
+	record->string_size += size + 1;
+}
+
+static void Log_PackRecord(log_record_t *record, log_level_e level, const char *format, va_list args)
+{
+	record->format      = format;
+	record->level       = level;
+	record->arg_count   = 0;
+	record->string_size = 0;
+	record->strings[LOG_STRING_SPACE - 1] = 0;
+
+	log_spec_t spec;
+	const char *at = format;
+
+	while (Log_NextSpec(at, &spec))
+	{
+		if (record->arg_count + spec.star_count + 1 > LOG_MAX_ARGS)
+			break;
+
+		for (int i = 0; i < spec.star_count; i++)
+			record->args[record->arg_count++].i = va_arg(args, int);
+
+		log_arg_t *arg = &record->args[record->arg_count++];
+
+		switch (spec.kind)
+		{
+			case LOGARG_INT:       arg->i = va_arg(args, int);         break;
+			case LOGARG_LONG:      arg->i = va_arg(args, long);        break;
+			case LOGARG_LONG_LONG: arg->i = va_arg(args, long long);   break;
+			case LOGARG_SIZE:      arg->z = va_arg(args, size_t);      break;
+			case LOGARG_DOUBLE:    arg->f = va_arg(args, double);      break;
+			case LOGARG_POINTER:   arg->p = va_arg(args, void *);      break;
+			case LOGARG_STRING:    Log_PackString(record, arg, va_arg(args, const char *)); break;
+			default: break;
+		}
+
+		at = spec.end;
+	}
+}
+
+// ------------------------------------------------------------------
+// formatting records
+
+typedef struct log_line_t
+{
+	size_t size;
+	char   data[1024];
+} log_line_t;
+
+static void Log_Append(log_line_t *line, const char *format, ...)
+{
+	size_t space = sizeof(line->data) - line->size;
+
+	va_list args;
+	va_start(args, format);
+	int count = vsnprintf(&line->data[line->size], space, format, args);
+	va_end(args);
+
+	if (count > 0)
+		line->size += ((size_t)count < space) ? (size_t)count : space - 1;
+}
+
+static void Log_AppendText(log_line_t *line, const char *text, size_t size)
+{
+	size_t space = sizeof(line->data) - 1 - line->size;
+
+	if (size > space)
+		size = space;
+
+	memcpy(&line->data[line->size], text, size);
+	line->size += size;
+	line->data[line->size] = 0;
+}
+
+// appends the text between conversions, where "%%" means "%"
+static void Log_AppendLiteral(log_line_t *line, const char *text, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		Log_AppendText(line, &text[i], 1);
+
+		if (text[i] == '%' && i + 1 < size && text[i + 1] == '%')
+			i++;
+	}
+}
+
+static void Log_FormatRecord(const log_record_t *record, log_line_t *line)
+{
+	line->size    = 0;
+	line->data[0] = 0;
+
+	log_spec_t spec;
+	const char *at  = record->format;
+	int         arg = 0;
+
+	while (Log_NextSpec(at, &spec) && arg + spec.star_count + 1 <= record->arg_count)
+	{
+		Log_AppendLiteral(line, at, (size_t)(spec.start - at));
+
+		// snprintf gets the conversion on its own, with any stars replaced
+		// by the width or precision they stood for
+		log_line_t conversion = { 0 };
+
+		for (const char *c = spec.start; c < spec.end; c++)
+		{
+			if (*c == '*')
+				Log_Append(&conversion, "%d", (int)record->args[arg++].i);
+			else
+				Log_AppendText(&conversion, c, 1);
+		}
+
+		const log_arg_t *value = &record->args[arg++];
+
+		// every kind gets turned back into the type it came in as
+		switch (spec.kind)
+		{
+			case LOGARG_INT:       Log_Append(line, conversion.data, (int)value->i);                   break;
+			case LOGARG_LONG:      Log_Append(line, conversion.data, (long)value->i);                  break;
+			case LOGARG_LONG_LONG: Log_Append(line, conversion.data, value->i);                        break;
+			case LOGARG_SIZE:      Log_Append(line, conversion.data, value->z);                        break;
+			case LOGARG_DOUBLE:    Log_Append(line, conversion.data, value->f);                        break;
+			case LOGARG_POINTER:   Log_Append(line, conversion.data, value->p);                        break;
+			case LOGARG_STRING:    Log_Append(line, conversion.data, &record->strings[value->string]); break;
+			default: break;
+		}
+
+		at = spec.end;
+	}
+
+	// whatever is left, or everything after something we couldn't handle
+	Log_AppendLiteral(line, at, strlen(at));
+}
+
+static void Log_WriteRecord(const log_record_t *record)
+{
+	log_line_t line;
+	Log_FormatRecord(record, &line);
+
+	fputs(line.data, record->level == LOG_LEVEL_ERROR ? stderr : stdout);
+}
+
+// ------------------------------------------------------------------
+// the ring
+
+static bool Log_Push(const log_record_t *record)
+{
+	uint32_t position = OS_AtomicLoad32(&g_write_position);
+
+	for (;;)
+	{
+		log_cell_t *cell = &g_cells[position & (LOG_RING_SIZE - 1)];
+
+		uint32_t sequence = OS_AtomicLoad32(&cell->sequence);
+		int32_t  diff     = (int32_t)(sequence - position);
+
+		if (diff == 0)
+		{
+			// the cell is free, try to claim it
+			uint32_t previous = OS_AtomicCompareExchange32(&g_write_position, position, position + 1);
+
+			if (previous == position)
+			{
+				cell->record = *record;
+				OS_AtomicStore32(&cell->sequence, position + 1);
+				return true;
+			}
+
+			position = previous;
+		}
+		else if (diff < 0)
+		{
+			// the logger thread hasn't gotten to this one yet, so we're full
+			return false;
+		}
+		else
+		{
+			// somebody else got here first
+			position = OS_AtomicLoad32(&g_write_position);
+		}
+	}
+}
+
+static bool Log_Pop(log_record_t *record)
+{
+	log_cell_t *cell = &g_cells[g_read_position & (LOG_RING_SIZE - 1)];
+
+	uint32_t sequence = OS_AtomicLoad32(&cell->sequence);
+
+	if (sequence != g_read_position + 1)
+		return false;
+
+	*record = cell->record;
+
+	// ready to be written again, on the next trip around
+	OS_AtomicStore32(&cell->sequence, g_read_position + LOG_RING_SIZE);
+	g_read_position += 1;
+
+	return true;
+}
+
+// ------------------------------------------------------------------
+// the logger thread
+
+static int Log_ThreadProc(void *userdata)
+{
+	(void)userdata;
+
+	uint64_t reported_dropped = 0;
+
+	for (;;)
+	{
+		// checked before draining, so that everything that got in before
+		// Log_Exit still gets written
+		bool running = OS_AtomicLoad32(&g_log_running) != 0;
+
+		log_record_t record;
+		uint64_t     written = 0;
+
+		while (Log_Pop(&record))
+		{
+			Log_WriteRecord(&record);
+			written += 1;
+		}
+
+		uint64_t dropped = OS_AtomicLoad64(&g_dropped);
+
+		if (dropped != reported_dropped)
+		{
+			fprintf(stderr, "(%llu log messages dropped, the log couldn't keep up)\n",
+					(unsigned long long)(dropped - reported_dropped));
+
+			reported_dropped = dropped;
+		}
+
+		if (written > 0)
+		{
+			OS_AtomicAdd64(&g_written, written);
+
+			fflush(stdout);
+			fflush(stderr);
+		}
+
+		if (!running)
+			break;
+
+		if (written == 0)
+			OS_Sleep(5);
+	}
+
+	return 0;
+}
+
+int Log_Init(void)
+{
+	for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+		g_cells[i].sequence = i;
+
+	g_write_position = 0;
+	g_read_position  = 0;
+	g_start_time     = OS_GetHiresTime();
+
+	OS_AtomicStore32(&g_log_running, 1);
+
+	g_log_thread = OS_CreateThread(Log_ThreadProc, NULL);
+	if (!g_log_thread.value)
+	{
+		OS_AtomicStore32(&g_log_running, 0);
+		fprintf(stderr, "Log_Init: failed to start logger thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void Log_Exit(void)
+{
+	if (!OS_AtomicLoad32(&g_log_running))
+		return;
+
+	OS_AtomicStore32(&g_log_running, 0);
+	OS_JoinThread(g_log_thread);
+}
+
+// ------------------------------------------------------------------
+// logging
+
+// the site's own format gets printed as is after this, so it looks
+// something like "(12 more suppressed) %s obliterated %s!"
+static const char *g_suppressed_format = "(%u more suppressed) %s";
+
+static void Log_Submit(log_record_t *record)
+{
+	if (!OS_AtomicLoad32(&g_log_running))
+	{
+		Log_WriteRecord(record);
+		OS_AtomicAdd64(&g_written, 1);
+		return;
+	}
+
+	if (!Log_Push(record))
+		OS_AtomicAdd64(&g_dropped, 1);
+}
+
+static void Log_SubmitFormat(log_level_e level, const char *format, ...)
+{
+	log_record_t record;
+
+	va_list args;
+	va_start(args, format);
+	Log_PackRecord(&record, level, format, args);
+	va_end(args);
+
+	Log_Submit(&record);
+}
+
+void Log_Write(log_site_t *site, log_level_e level, const char *format, ...)
+{
+	// rate limiting. threads logging from the same site at the same time
+	// can race on this, but the worst that happens is that a message or
+	// two too many gets through
+	uint32_t window = (uint32_t)OS_GetSecondsElapsed(g_start_time, OS_GetHiresTime());
+
+	if (site->window != window)
+	{
+		OS_AtomicStore32(&site->window, window);
+		OS_AtomicStore32(&site->count, 0);
+
+		uint32_t suppressed = OS_AtomicLoad32(&site->suppressed);
+
+		if (suppressed > 0)
+		{
+			OS_AtomicAdd32(&site->suppressed, 0u - suppressed);
+			Log_SubmitFormat(level, g_suppressed_format, suppressed, format);
+		}
+	}
+
+	if (OS_AtomicAdd32(&site->count, 1) > LOG_SITE_MESSAGES_PER_SECOND)
+	{
+		OS_AtomicAdd32(&site->suppressed, 1);
+		OS_AtomicAdd64(&g_suppressed, 1);
+		return;
+	}
+
+	log_record_t record;
+
+	va_list args;
+	va_start(args, format);
+	Log_PackRecord(&record, level, format, args);
+	va_end(args);
+
+	Log_Submit(&record);
+}
+
+void Log_GetStats(log_stats_t *stats)
+{
+	stats->written    = OS_AtomicLoad64(&g_written);
+	stats->dropped    = OS_AtomicLoad64(&g_dropped);
+	stats->suppressed = OS_AtomicLoad64(&g_suppressed);
+}
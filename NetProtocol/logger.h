@@ -0,0 +1,74 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+
+// ------------------------------------------------------------------
+// logger.h: printf-style logging that never makes the caller wait on
+// a terminal or a pipe. logging a message doesn't format anything, it
+// just puts the format string (which doubles as the message's id) and
+// the raw arguments into a fixed-size record, and drops that into a
+// lock-free ring. a background thread takes the records out, formats
+// them and writes them out.
+//
+//     LOG_INFO("%s obliterated %s!\n", killer->name, victim->name);
+//
+// the format string has to be a string literal, since it gets looked
+// at after the call returns. string arguments get copied into the
+// record, and cut off if they don't fit.
+//
+// when the ring is full, messages get dropped and counted rather than
+// waited on. on top of that every LOG_ call site can only log so many
+// messages per second, so one spammy message can't crowd out the rest.
+// the background thread reports how many got dropped or suppressed.
+
+typedef enum log_level_e
+{
+	LOG_LEVEL_INFO,  // goes to stdout
+	LOG_LEVEL_ERROR, // goes to stderr
+} log_level_e;
+
+// how many messages a single call site gets to log per second
+enum { LOG_SITE_MESSAGES_PER_SECOND = 20 };
+
+// the records in the ring, must be a power of two
+enum { LOG_RING_SIZE = 1024 };
+
+// the rate limiting state of a call site, the LOG_ macros make one of
+// these for every place they're used
+typedef struct log_site_t
+{
+	volatile uint32_t window;     // the second the count is for
+	volatile uint32_t count;      // messages logged in that second
+	volatile uint32_t suppressed; // messages not logged since the last report
+} log_site_t;
+
+#define LOG_INFO(...)  do { static log_site_t log_site_; Log_Write(&log_site_, LOG_LEVEL_INFO,  __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) do { static log_site_t log_site_; Log_Write(&log_site_, LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+
+// starts the background thread. messages logged before this (or after
+// Log_Exit) get written right away instead, on the calling thread
+int  Log_Init(void);
+
+// writes out everything that's still in the ring, and stops the thread
+void Log_Exit(void);
+
+// use the LOG_ macros instead, unless you have your own site
+void Log_Write(log_site_t *site, log_level_e level, const char *format, ...);
+
+typedef struct log_stats_t
+{
+	uint64_t written;
+	uint64_t dropped;    // because the ring was full
+	uint64_t suppressed; // because their call site was logging too much
+} log_stats_t;
+
+void Log_GetStats(log_stats_t *stats);
@@ -0,0 +1,302 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+#include <math.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "metrics.h"
+
+// ------------------------------------------------------------------
+// metrics.c: each thread finds its own block through a thread local
+// pointer, and writes to it without any synchronization at all. the
+// only thing the reader has going for it is that the fields are
+// volatile and 64 bit stores don't tear on x64, so it sees every
+// number either before or after an update, never half of one. the
+// buckets and the count of a histogram can disagree a little for the
+// same reason, so the percentiles go by the buckets only.
+
+
+typedef struct metrics_histogram_data_t
+{
+	volatile uint64_t count;
+	volatile uint64_t sum;
+	volatile uint64_t min;
+	volatile uint64_t max;
+	volatile uint32_t buckets[HISTOGRAM_BUCKET_COUNT];
+} metrics_histogram_data_t;
+
+typedef struct metrics_thread_t
+{
+	volatile uint64_t        counters  [METRICS_MAX_COUNTERS];
+	metrics_histogram_data_t histograms[METRICS_MAX_HISTOGRAMS];
+} metrics_thread_t;
+
+static const char *g_counter_names  [METRICS_MAX_COUNTERS];
+static const char *g_histogram_names[METRICS_MAX_HISTOGRAMS];
+
+static volatile uint32_t g_counter_count;
+static volatile uint32_t g_histogram_count;
+
+static metrics_thread_t  g_threads[METRICS_MAX_THREADS];
+static volatile uint32_t g_thread_count;
+
+// threads past METRICS_MAX_THREADS all share this one, which never
+// gets read. it's a mess, but a harmless one
+static metrics_thread_t  g_overflow_thread;
+
+static THREAD_LOCAL metrics_thread_t *g_this_thread;
+
+// ------------------------------------------------------------------
+// registering
+
+metrics_counter_t Metrics_RegisterCounter(const char *name)
+{
+	metrics_counter_t result = { -1 };
+
+	uint32_t index = OS_AtomicAdd32(&g_counter_count, 1) - 1;
+
+	if (NEVER(index >= METRICS_MAX_COUNTERS))
+		return result;
+
+	g_counter_names[index] = name;
+
+	result.index = (int)index;
+	return result;
+}
+
+metrics_histogram_t Metrics_RegisterHistogram(const char *name)
+{
+	metrics_histogram_t result = { -1 };
+
+	uint32_t index = OS_AtomicAdd32(&g_histogram_count, 1) - 1;
+
+	if (NEVER(index >= METRICS_MAX_HISTOGRAMS))
+		return result;
+
+	g_histogram_names[index] = name;
+
+	result.index = (int)index;
+	return result;
+}
+
+// ------------------------------------------------------------------
+// buckets
+
+static int Metrics_FindHighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+// magnitude 0 holds the values below HISTOGRAM_SUB_BUCKET_COUNT one by
+// one, after that magnitude m holds the values with their highest bit
+// at m + HISTOGRAM_SUB_BUCKET_BITS - 1, in buckets that are 2^(m - 1)
+// wide
+static int Metrics_GetBucketIndex(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKET_COUNT)
+		return (int)value;
+
+	int highest_bit = Metrics_FindHighestBit(value);
+	int magnitude   = highest_bit - HISTOGRAM_SUB_BUCKET_BITS + 1;
+
+	if (magnitude >= HISTOGRAM_MAGNITUDE_COUNT)
+		return HISTOGRAM_BUCKET_COUNT - 1;
+
+	int sub_bucket = (int)(value >> (highest_bit - HISTOGRAM_SUB_BUCKET_BITS)) - HISTOGRAM_SUB_BUCKET_COUNT;
+
+	return magnitude*HISTOGRAM_SUB_BUCKET_COUNT + sub_bucket;
+}
+
+static uint64_t Metrics_GetBucketHighestValue(int index)
+{
+	int magnitude  = index / HISTOGRAM_SUB_BUCKET_COUNT;
+	int sub_bucket = index % HISTOGRAM_SUB_BUCKET_COUNT;
+
+	if (magnitude == 0)
+		return (uint64_t)sub_bucket;
+
+	int      shift  = magnitude - 1;
+	uint64_t lowest = (uint64_t)(HISTOGRAM_SUB_BUCKET_COUNT + sub_bucket) << shift;
+
+	return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+// ------------------------------------------------------------------
+// recording
+
+static metrics_thread_t *Metrics_GetThread(void)
+{
+	metrics_thread_t *thread = g_this_thread;
+
+	if (!thread)
+	{
+		uint32_t index = OS_AtomicAdd32(&g_thread_count, 1) - 1;
+
+		thread = (index < METRICS_MAX_THREADS) ? &g_threads[index] : &g_overflow_thread;
+		g_this_thread = thread;
+	}
+
+	return thread;
+}
+
+void Metrics_Add(metrics_counter_t counter, uint64_t amount)
+{
+	if ((unsigned)counter.index >= METRICS_MAX_COUNTERS)
+		return;
+
+	metrics_thread_t *thread = Metrics_GetThread();
+	thread->counters[counter.index] += amount;
+}
+
+void Metrics_Record(metrics_histogram_t histogram, uint64_t value)
+{
+	if ((unsigned)histogram.index >= METRICS_MAX_HISTOGRAMS)
+		return;
+
+	metrics_thread_t *thread = Metrics_GetThread();
+	metrics_histogram_data_t *data = &thread->histograms[histogram.index];
+
+	if (data->count == 0 || value < data->min)
+		data->min = value;
+
+	if (value > data->max)
+		data->max = value;
+
+	data->buckets[Metrics_GetBucketIndex(value)] += 1;
+	data->sum   += value;
+	data->count += 1;
+}
+
+void Metrics_RecordTime(metrics_histogram_t histogram, os_time_t start, os_time_t end)
+{
+	double microseconds = 1000000.0*OS_GetSecondsElapsed(start, end);
+
+	if (microseconds < 0.0)
+		microseconds = 0.0;
+
+	Metrics_Record(histogram, (uint64_t)microseconds);
+}
+
+// ------------------------------------------------------------------
+// reading
+
+static uint64_t Metrics_GetPercentile(const uint64_t *buckets, uint64_t total, double percentile)
+{
+	// the rank of the value we're after, counting from 1
+	uint64_t rank = (uint64_t)ceil(percentile*(double)total);
+
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+
+	for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++)
+	{
+		seen += buckets[i];
+
+		if (seen >= rank)
+			return Metrics_GetBucketHighestValue(i);
+	}
+
+	return 0;
+}
+
+static void Metrics_SummarizeHistogram(int index, uint32_t thread_count, metrics_histogram_summary_t *summary)
+{
+	uint64_t buckets[HISTOGRAM_BUCKET_COUNT] = { 0 };
+	uint64_t total = 0;
+
+	memset(summary, 0, sizeof(*summary));
+	summary->name = g_histogram_names[index];
+
+	for (uint32_t i = 0; i < thread_count; i++)
+	{
+		metrics_histogram_data_t *data = &g_threads[i].histograms[index];
+
+		uint64_t count = data->count;
+
+		if (count == 0)
+			continue;
+
+		uint64_t min = data->min;
+		uint64_t max = data->max;
+
+		if (summary->count == 0 || min < summary->min)
+			summary->min = min;
+
+		if (max > summary->max)
+			summary->max = max;
+
+		summary->count += count;
+		summary->sum   += data->sum;
+
+		for (int j = 0; j < HISTOGRAM_BUCKET_COUNT; j++)
+		{
+			uint32_t bucket = data->buckets[j];
+
+			buckets[j] += bucket;
+			total      += bucket;
+		}
+	}
+
+	if (total == 0)
+		return;
+
+	summary->p50  = Metrics_GetPercentile(buckets, total, 0.5);
+	summary->p90  = Metrics_GetPercentile(buckets, total, 0.9);
+	summary->p99  = Metrics_GetPercentile(buckets, total, 0.99);
+	summary->p999 = Metrics_GetPercentile(buckets, total, 0.999);
+
+	// the bucket's highest value can be past the highest value that was
+	// actually recorded
+	if (summary->p50  > summary->max) summary->p50  = summary->max;
+	if (summary->p90  > summary->max) summary->p90  = summary->max;
+	if (summary->p99  > summary->max) summary->p99  = summary->max;
+	if (summary->p999 > summary->max) summary->p999 = summary->max;
+}
+
+void Metrics_GetSnapshot(metrics_snapshot_t *snapshot)
+{
+	uint32_t counter_count   = OS_AtomicLoad32(&g_counter_count);
+	uint32_t histogram_count = OS_AtomicLoad32(&g_histogram_count);
+	uint32_t thread_count    = OS_AtomicLoad32(&g_thread_count);
+
+	if (counter_count > METRICS_MAX_COUNTERS)
+		counter_count = METRICS_MAX_COUNTERS;
+
+	if (histogram_count > METRICS_MAX_HISTOGRAMS)
+		histogram_count = METRICS_MAX_HISTOGRAMS;
+
+	if (thread_count > METRICS_MAX_THREADS)
+		thread_count = METRICS_MAX_THREADS;
+
+	snapshot->counter_count   = (int)counter_count;
+	snapshot->histogram_count = (int)histogram_count;
+
+	for (uint32_t i = 0; i < counter_count; i++)
+	{
+		metrics_counter_value_t *counter = &snapshot->counters[i];
+		counter->name  = g_counter_names[i];
+		counter->value = 0;
+
+		for (uint32_t j = 0; j < thread_count; j++)
+			counter->value += g_threads[j].counters[i];
+	}
+
+	for (uint32_t i = 0; i < histogram_count; i++)
+		Metrics_SummarizeHistogram((int)i, thread_count, &snapshot->histograms[i]);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+
+// ------------------------------------------------------------------
+// metrics.h: counters and latency histograms that are cheap enough to
+// update from the hottest of paths. every thread that records anything
+// gets its own block of counters and histograms, which only it ever
+// writes to, so recording is a couple of plain adds with no atomics or
+// locks involved. Metrics_GetSnapshot adds the blocks of all threads
+// together whenever somebody wants to look at the numbers.
+//
+// the histograms are HDR-style: every power of two is split up into
+// HISTOGRAM_SUB_BUCKET_COUNT linear buckets, so a value is always
+// known to within about 3%, whether it's 40 microseconds or 4 seconds,
+// and the percentiles come out just as precise.
+//
+// metrics get registered once by name at startup, which hands back the
+// handle to record them with:
+//
+//     static metrics_histogram_t g_tick_time;
+//     g_tick_time = Metrics_RegisterHistogram("tick_time_us");
+//     ...
+//     Metrics_RecordTime(g_tick_time, start, OS_GetHiresTime());
+
+enum { METRICS_MAX_COUNTERS   = 32 };
+enum { METRICS_MAX_HISTOGRAMS = 16 };
+
+// the amount of threads that can record metrics. a thread takes up a
+// block the first time it records anything, and keeps it forever
+enum { METRICS_MAX_THREADS = 8 };
+
+enum { HISTOGRAM_SUB_BUCKET_BITS   = 5 };
+enum { HISTOGRAM_SUB_BUCKET_COUNT  = 1 << HISTOGRAM_SUB_BUCKET_BITS };
+enum { HISTOGRAM_MAGNITUDE_COUNT   = 36 }; // values up to 2^40, anything bigger gets clamped
+enum { HISTOGRAM_BUCKET_COUNT      = HISTOGRAM_MAGNITUDE_COUNT*HISTOGRAM_SUB_BUCKET_COUNT };
+
+typedef struct metrics_counter_t
+{
+	int index;
+} metrics_counter_t;
+
+typedef struct metrics_histogram_t
+{
+	int index;
+} metrics_histogram_t;
+
+typedef struct metrics_counter_value_t
+{
+	const char *name;
+	uint64_t    value;
+} metrics_counter_value_t;
+
+typedef struct metrics_histogram_summary_t
+{
+	const char *name;
+
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+
+	// the highest value in the bucket the percentile falls in, so they
+	// can be a bit too high, but never too low
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+} metrics_histogram_summary_t;
+
+typedef struct metrics_snapshot_t
+{
+	int                         counter_count;
+	metrics_counter_value_t     counters[METRICS_MAX_COUNTERS];
+
+	int                         histogram_count;
+	metrics_histogram_summary_t histograms[METRICS_MAX_HISTOGRAMS];
+} metrics_snapshot_t;
+
+// ------------------------------------------------------------------
+// registering
+
+// the name has to stay around forever, it's meant for string literals.
+// register everything before starting any threads that record it.
+// returns a handle with an index of -1 if there's no room left, which
+// can still be recorded to, it just doesn't do anything
+metrics_counter_t   Metrics_RegisterCounter(const char *name);
+metrics_histogram_t Metrics_RegisterHistogram(const char *name);
+
+// ------------------------------------------------------------------
+// recording, these can be called from any thread
+
+void Metrics_Add(metrics_counter_t counter, uint64_t amount);
+void Metrics_Record(metrics_histogram_t histogram, uint64_t value);
+
+// records the time between two OS_GetHiresTime timestamps, in
+// microseconds
+void Metrics_RecordTime(metrics_histogram_t histogram, os_time_t start, os_time_t end);
+
+// ------------------------------------------------------------------
+// reading
+
+// adds up all threads' counters and histograms. everything is counted
+// since startup. it's fine to call this while other threads are still
+// recording, it just might miss whatever they're recording right then
+void Metrics_GetSnapshot(metrics_snapshot_t *snapshot);
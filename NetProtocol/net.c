@@ -2,9 +2,10 @@
 // standard library and OS includes
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <assert.h>
-#include <stdalign.h>
 
 #include <WinSock2.h>
 #include <WS2tcpip.h>
@@ -19,6 +20,9 @@
 #include "os.h"
 #include "util.h"
 #include "net.h"
+#include "netimpair.h"
+#include "netcapture.h"
+#include "netloopback.h"
 #include "nettypes.h"
 
 // ------------------------------------------------------------------
@@ -52,20 +56,8 @@ static inline void Net_SockAddrFromAddr(struct sockaddr_in *sock_addr, net_addr_
 	sock_addr->sin_addr.s_addr = net_addr->addr;
 }
 
-typedef enum net_stat_direction_e
-{
-	NETSTAT_INBOUND,
-	NETSTAT_OUTBOUND,
-} net_stat_direction_e;
-
-static void Net_RecordSequenceTest(int accepted);
-static void Net_RecordPacketStat(net_stat_direction_e direction, int size);
-
 // ------------------------------------------------------------------
 
-enum { PACKET_BUFFER_SIZE = INT16_MAX };
-static alignas(16) char g_packet_buffer[PACKET_BUFFER_SIZE];
-
 int Net_Init(void)
 {
 	// winsock needs to be initialized before use
@@ -102,7 +94,6 @@ int Net_AcceptSequenceNumber(unsigned short prev, unsigned short next)
 	int wrapped = (prev_in_last_third && next_in_first_third);
 	int result  = next > prev || wrapped;
 
-	Net_RecordSequenceTest(result);
 	return result;
 }
 
@@ -230,6 +221,9 @@ net_addr_t Net_GetAddr(char *address, int port)
 
 net_socket_t Net_CreateSocket(int flags)
 {
+	if (Loopback_IsEnabled())
+		return Loopback_CreateSocket();
+
 	net_socket_t sock = { INVALID_SOCKET };
 
 	// I am hardcoding this to only create IPv4 UDP sockets because
@@ -257,11 +251,20 @@ net_socket_t Net_CreateSocket(int flags)
 
 void Net_CloseSocket(net_socket_t sock)
 {
+	if (Loopback_IsSocket(sock))
+	{
+		Loopback_CloseSocket(sock);
+		return;
+	}
+
 	closesocket(sock.value);
 }
 
 int Net_BindSocket(net_socket_t sock, net_addr_t addr)
 {
+	if (Loopback_IsSocket(sock))
+		return Loopback_BindSocket(sock, addr);
+
 	struct sockaddr_in sockaddr;
 	Net_SockAddrFromAddr(&sockaddr, &addr);
 
@@ -281,8 +284,29 @@ int Net_BindSocket(net_socket_t sock, net_addr_t addr)
 	return 0;
 }
 
+int Net_SetReceiveTimeout(net_socket_t sock, unsigned milliseconds)
+{
+	// loopback sockets never wait
+	if (Loopback_IsSocket(sock))
+		return 0;
+
+	// winsock takes a DWORD in milliseconds here, unlike the struct timeval
+	// that the BSD socket API wants
+	DWORD timeout = (DWORD)milliseconds;
+	if (setsockopt(sock.value, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) != 0)
+	{
+		OS_PError("Net_SetReceiveTimeout: setsockopt (SO_RCVTIMEO)");
+		return -1;
+	}
+
+	return 0;
+}
+
 int Net_GetMaxMessageSize(net_socket_t sock)
 {
+	if (Loopback_IsSocket(sock))
+		return LOOPBACK_MAX_DATAGRAM_SIZE;
+
 	int max_message_size;
 	int max_message_size_size = sizeof(max_message_size);
 
@@ -295,12 +319,24 @@ int Net_GetMaxMessageSize(net_socket_t sock)
 	return max_message_size;
 }
 
-int Net_SendPacket(net_socket_t sock, net_addr_t addr, void *packet, size_t packet_size)
+static int Net_SendPacketDirect(net_context_t *ctx, net_socket_t sock, net_addr_t addr, const void *packet, size_t packet_size)
 {
-	struct sockaddr_in sock_addr;
-	Net_SockAddrFromAddr(&sock_addr, &addr);
+	int byte_count;
 
-	int byte_count = sendto(sock.value, packet, (int)packet_size, 0, (struct sockaddr *)&sock_addr, sizeof(sock_addr));
+	if (Loopback_IsSocket(sock))
+	{
+		byte_count = Loopback_SendPacket(sock, addr, packet, packet_size);
+
+		if (byte_count == -1)
+			return -1;
+	}
+	else
+	{
+		struct sockaddr_in sock_addr;
+		Net_SockAddrFromAddr(&sock_addr, &addr);
+
+		byte_count = sendto(sock.value, packet, (int)packet_size, 0, (struct sockaddr *)&sock_addr, sizeof(sock_addr));
+	}
 
 	if (byte_count == -1)
 	{
@@ -310,20 +346,34 @@ int Net_SendPacket(net_socket_t sock, net_addr_t addr, void *packet, size_t pack
 		}
 		else
 		{
-			OS_PError("Net_SendPacket");
+			OS_PError("Net_SendPacketDirect");
 			return -1;
 		}
 	}
 
-	Net_RecordPacketStat(NETSTAT_OUTBOUND, byte_count);
+	OS_AtomicAdd64(&ctx->counters.bytes_out,   (uint64_t)byte_count);
+	OS_AtomicAdd64(&ctx->counters.packets_out, 1);
 
 	return byte_count;
 }
 
-int Net_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr)
+static int Net_RecvPacketDirect(net_context_t *ctx, net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr)
 {
 	if (NEVER(buffer_size > INT_MAX)) buffer_size = INT_MAX;
 
+	if (Loopback_IsSocket(sock))
+	{
+		int byte_count = Loopback_RecvPacket(sock, buffer, buffer_size, addr);
+
+		if (byte_count > 0)
+		{
+			OS_AtomicAdd64(&ctx->counters.bytes_in,   (uint64_t)byte_count);
+			OS_AtomicAdd64(&ctx->counters.packets_in, 1);
+		}
+
+		return byte_count;
+	}
+
 	struct sockaddr_storage their_address;
 	int address_size = sizeof(their_address);
 
@@ -334,6 +384,7 @@ int Net_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr
 		switch (WSAGetLastError())
 		{
 			case WSAEWOULDBLOCK:
+			case WSAETIMEDOUT:
 			{
 				// all good
 				return 0;
@@ -341,14 +392,15 @@ int Net_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr
 
 			default:
 			{
-				OS_PError("Net_RecvPacket");
+				OS_PError("Net_RecvPacketDirect");
 				// not good
 				return -1;
 			} break;
 		}
 	}
 
-	Net_RecordPacketStat(NETSTAT_INBOUND, byte_count);
+	OS_AtomicAdd64(&ctx->counters.bytes_in,   (uint64_t)byte_count);
+	OS_AtomicAdd64(&ctx->counters.packets_in, 1);
 
 	Net_AddrFromSockAddr(addr, (struct sockaddr_in *)&their_address);
 
@@ -356,115 +408,400 @@ int Net_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr
 }
 
 // ------------------------------------------------------------------
-// recording network related stats
+// impaired sending and receiving, see netimpair.h
 
-static float g_stat_sample_window = 1.0f; 
-
-typedef struct net_stat_bucket_t
+// returns 1 if the socket has something to receive, 0 if nothing came
+// in within the timeout, or -1 on error
+static int Net_WaitReadable(net_socket_t sock, int timeout_ms)
 {
-	int tested_packets;
-	int accepted_packets;
+	if (Loopback_IsSocket(sock))
+		return Loopback_IsReadable(sock);
 
-	int inbound_bytes;
-	int outbound_bytes;
+	WSAPOLLFD fd = {
+		.fd     = sock.value,
+		.events = POLLRDNORM,
+	};
 
-	float actual_time;
-} net_stat_bucket_t;
+	int result = WSAPoll(&fd, 1, timeout_ms);
 
-enum { NET_STATS_BUCKET_COUNT = 30 };
+	if (result == SOCKET_ERROR)
+	{
+		OS_PError("Net_WaitReadable: WSAPoll");
+		return -1;
+	}
 
-static size_t g_stat_bucket_index;
-static os_time_t g_stat_last_bucket_time;
-static net_stat_bucket_t g_stat_buckets[NET_STATS_BUCKET_COUNT];
+	return result > 0;
+}
 
-void Net_GetStats(net_stats_t *stats)
+// sends out whatever packets are done being delayed. this happens on
+// every send and receive, so how late a packet goes out depends on how
+// often the program sends or receives anything. the server does that
+// all the time, the client's network thread at least every time it
+// receives something
+static void Net_FlushImpaired(net_context_t *ctx, os_time_t now)
 {
-	int accepted_packets = 0;
-	int tested_packets   = 0;
+	net_impair_packet_t packet;
 
-	int inbound_bytes  = 0;
-	int outbound_bytes = 0;
-
-	int total_samples = 0;
+	while (Impair_Pop(ctx->impairment, NET_DIRECTION_OUT, now, NULL, &packet))
+	{
+		Net_SendPacketDirect(ctx, packet.sock, packet.addr, packet.data, packet.size);
+		Impair_FreePacket(ctx->impairment, &packet);
+	}
+}
 
-	float actual_time = 0.0f;
+static int Net_RecvPacketImpaired(net_context_t *ctx, net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr)
+{
+	net_impairment_t *impairment = ctx->impairment;
 
-	for (size_t i = 0; i < NET_STATS_BUCKET_COUNT; i++)
+	for (;;)
 	{
-		net_stat_bucket_t *bucket = &g_stat_buckets[i];
+		os_time_t now = OS_GetHiresTime();
+
+		Net_FlushImpaired(ctx, now);
 
-		if (bucket->tested_packets > 0 ||
-			bucket->inbound_bytes  > 0 ||
-			bucket->outbound_bytes > 0)
+		net_impair_packet_t packet;
+
+		if (Impair_Pop(impairment, NET_DIRECTION_IN, now, &sock, &packet))
 		{
-			total_samples += 1;
+			size_t size = (packet.size < buffer_size) ? packet.size : buffer_size;
 
-			accepted_packets += bucket->accepted_packets;
-			tested_packets   += bucket->tested_packets;
+			memcpy(buffer, packet.data, size);
+			*addr = packet.addr;
 
-			inbound_bytes  += bucket->inbound_bytes;
-			outbound_bytes += bucket->outbound_bytes;
+			Impair_FreePacket(impairment, &packet);
+			return (int)size;
+		}
 
-			actual_time += bucket->actual_time;
+		os_time_t due_time;
+
+		if (!Impair_GetNextDueTime(impairment, NET_DIRECTION_IN, &sock, &due_time))
+		{
+			// nothing is on its way, so this waits (or doesn't) the same way
+			// it would without the impairment
+			int byte_count = Net_RecvPacketDirect(ctx, sock, buffer, buffer_size, addr);
+
+			if (byte_count <= 0)
+				return byte_count;
+
+			Impair_Push(impairment, NET_DIRECTION_IN, OS_GetHiresTime(), sock, *addr, buffer, (size_t)byte_count);
+		}
+		else
+		{
+			// something is on its way, so don't wait on the socket for longer
+			// than a millisecond. that's a bit of a compromise: the client's
+			// network thread would rather wait until the packet is due, but
+			// the server doesn't want to wait at all. a millisecond doesn't
+			// burn the first's CPU, nor does it hold up the second for long
+			int readable = Net_WaitReadable(sock, (due_time > now) ? 1 : 0);
+
+			if (readable < 0)
+				return -1;
+
+			if (readable)
+			{
+				int byte_count = Net_RecvPacketDirect(ctx, sock, buffer, buffer_size, addr);
+
+				if (byte_count < 0)
+					return byte_count;
+
+				if (byte_count > 0)
+					Impair_Push(impairment, NET_DIRECTION_IN, OS_GetHiresTime(), sock, *addr, buffer, (size_t)byte_count);
+			}
+			else if (due_time > OS_GetHiresTime())
+			{
+				return 0;
+			}
 		}
 	}
+}
 
-	stats->packets_accepted_ratio = 0.0f;
+int Net_SendPacket(net_context_t *ctx, net_socket_t sock, net_addr_t addr, void *packet, size_t packet_size)
+{
+	if (ctx->capture)
+		Capture_Write(ctx->capture, NET_DIRECTION_OUT, addr, packet, packet_size);
+
+	if (!ctx->impairment)
+		return Net_SendPacketDirect(ctx, sock, addr, packet, packet_size);
 
-	if (tested_packets > 0)
-		stats->packets_accepted_ratio = (float)accepted_packets / (float)tested_packets;
+	os_time_t now = OS_GetHiresTime();
 
-	if (actual_time == 0.0f)
-		actual_time = 1.0f;
+	Impair_Push(ctx->impairment, NET_DIRECTION_OUT, now, sock, addr, packet, packet_size);
+	Net_FlushImpaired(ctx, now);
 
-	stats->bytes_in_per_second  = (float)inbound_bytes  / actual_time;
-	stats->bytes_out_per_second = (float)outbound_bytes / actual_time;
+	// as far as the caller can tell, it went out fine
+	return (int)packet_size;
 }
 
-static net_stat_bucket_t *Net_GetStatBucket(void)
+int Net_RecvPacket(net_context_t *ctx, net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr)
 {
-	if (g_stat_last_bucket_time == 0)
-		g_stat_last_bucket_time = OS_GetHiresTime();
+	int byte_count;
+
+	if (!ctx->impairment)
+		byte_count = Net_RecvPacketDirect(ctx, sock, buffer, buffer_size, addr);
+	else
+		byte_count = Net_RecvPacketImpaired(ctx, sock, buffer, buffer_size, addr);
+
+	if (byte_count > 0 && ctx->capture)
+		Capture_Write(ctx->capture, NET_DIRECTION_IN, *addr, buffer, (size_t)byte_count);
+
+	return byte_count;
+}
+
+// ------------------------------------------------------------------
+// TCP
 
-	os_time_t current_time = OS_GetHiresTime();
-	double time_elapsed = OS_GetSecondsElapsed(g_stat_last_bucket_time, current_time);
+net_socket_t Net_CreateListenSocket(net_addr_t addr)
+{
+	net_socket_t sock = { socket(AF_INET, SOCK_STREAM, 0) };
 
-	net_stat_bucket_t *bucket = &g_stat_buckets[g_stat_bucket_index];
+	if (sock.value == INVALID_SOCKET)
+	{
+		OS_PError("Net_CreateListenSocket: socket");
+		return sock;
+	}
 
-	float bucket_time = g_stat_sample_window / (float)NET_STATS_BUCKET_COUNT;
-	if (time_elapsed > bucket_time)
+	u_long mode = 1;
+	if (ioctlsocket(sock.value, FIONBIO, &mode) != 0)
 	{
-		bucket->actual_time = (float)time_elapsed;
+		OS_PError("Net_CreateListenSocket: ioctlsocket (FIONBIO)");
+		closesocket(sock.value);
+		return (net_socket_t) { INVALID_SOCKET_VALUE };
+	}
 
-		size_t offset = (size_t)(time_elapsed / bucket_time);
+	struct sockaddr_in sockaddr;
+	Net_SockAddrFromAddr(&sockaddr, &addr);
 
-		g_stat_last_bucket_time = current_time;
-		g_stat_bucket_index     = (g_stat_bucket_index + offset) % NET_STATS_BUCKET_COUNT;
+	if (bind(sock.value, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == SOCKET_ERROR)
+	{
+		OS_PError("Net_CreateListenSocket: bind");
+		closesocket(sock.value);
+		return (net_socket_t) { INVALID_SOCKET_VALUE };
+	}
 
-		bucket = &g_stat_buckets[g_stat_bucket_index];
-		memset(bucket, 0, sizeof(*bucket));
+	if (listen(sock.value, SOMAXCONN) == SOCKET_ERROR)
+	{
+		OS_PError("Net_CreateListenSocket: listen");
+		closesocket(sock.value);
+		return (net_socket_t) { INVALID_SOCKET_VALUE };
 	}
 
-	return bucket;
+	return sock;
 }
 
-static void Net_RecordSequenceTest(int accepted)
+net_socket_t Net_AcceptConnection(net_socket_t listen_sock, net_addr_t *addr, unsigned timeout_ms)
 {
-	net_stat_bucket_t *bucket = Net_GetStatBucket();
+	struct sockaddr_in their_address;
+	int address_size = sizeof(their_address);
+
+	net_socket_t sock = { accept(listen_sock.value, (struct sockaddr *)&their_address, &address_size) };
+
+	if (sock.value == INVALID_SOCKET)
+	{
+		if (WSAGetLastError() != WSAEWOULDBLOCK)
+			OS_PError("Net_AcceptConnection: accept");
+
+		return sock;
+	}
+
+	Net_AddrFromSockAddr(addr, &their_address);
+
+	// accepted sockets inherit being non-blocking from the listen socket
+	u_long mode = 0;
+	DWORD  timeout = (DWORD)timeout_ms;
+
+	if (ioctlsocket(sock.value, FIONBIO, &mode) != 0 ||
+		setsockopt(sock.value, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) != 0 ||
+		setsockopt(sock.value, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout)) != 0)
+	{
+		OS_PError("Net_AcceptConnection: setting up the socket");
+		closesocket(sock.value);
+		return (net_socket_t) { INVALID_SOCKET_VALUE };
+	}
+
+	return sock;
+}
+
+int Net_SendStream(net_socket_t sock, const void *data, size_t size)
+{
+	const char *at = data;
+
+	while (size > 0)
+	{
+		int chunk_size = (size > INT_MAX) ? INT_MAX : (int)size;
+		int byte_count = send(sock.value, at, chunk_size, 0);
+
+		if (byte_count == SOCKET_ERROR)
+			return -1;
+
+		at   += byte_count;
+		size -= (size_t)byte_count;
+	}
+
+	return 0;
+}
+
+int Net_RecvStream(net_socket_t sock, void *buffer, size_t buffer_size)
+{
+	if (NEVER(buffer_size > INT_MAX)) buffer_size = INT_MAX;
+
+	int byte_count = recv(sock.value, buffer, (int)buffer_size, 0);
+
+	if (byte_count == SOCKET_ERROR)
+		return -1;
+
+	return byte_count;
+}
+
+// ------------------------------------------------------------------
+// waiting on many sockets at once
+
+int Net_CreatePollSet(net_poll_set_t *set, size_t capacity)
+{
+	memset(set, 0, sizeof(*set));
+
+	set->fds = calloc(capacity, sizeof(WSAPOLLFD));
+	if (!set->fds)
+		return -1;
+
+	set->capacity = capacity;
+	return 0;
+}
+
+void Net_DestroyPollSet(net_poll_set_t *set)
+{
+	free(set->fds);
+	memset(set, 0, sizeof(*set));
+}
+
+int Net_AddToPollSet(net_poll_set_t *set, net_socket_t sock)
+{
+	if (set->count >= set->capacity)
+		return -1;
+
+	WSAPOLLFD *fd = &((WSAPOLLFD *)set->fds)[set->count];
+	fd->fd     = sock.value;
+	fd->events = POLLRDNORM;
+
+	return (int)set->count++;
+}
+
+int Net_Poll(net_poll_set_t *set, int timeout_ms)
+{
+	if (Loopback_IsEnabled())
+	{
+		// nothing to wait on, just see what's there. that only works out if
+		// every socket in the set is a loopback one
+		int readable_count = 0;
+
+		for (size_t i = 0; i < set->count; i++)
+		{
+			WSAPOLLFD *fd = &((WSAPOLLFD *)set->fds)[i];
+
+			fd->revents = Loopback_IsReadable((net_socket_t) { fd->fd }) ? POLLRDNORM : 0;
+			readable_count += (fd->revents != 0);
+		}
+
+		return readable_count;
+	}
+
+	// WSAPoll considers an empty set an error
+	if (set->count == 0)
+	{
+		OS_Sleep(timeout_ms > 0 ? (unsigned)timeout_ms : 0);
+		return 0;
+	}
+
+	int result = WSAPoll((WSAPOLLFD *)set->fds, (ULONG)set->count, timeout_ms);
+
+	if (result == SOCKET_ERROR)
+	{
+		OS_PError("Net_Poll: WSAPoll");
+		return -1;
+	}
+
+	return result;
+}
+
+int Net_PollSetIsReadable(net_poll_set_t *set, size_t index)
+{
+	if (NEVER(index >= set->count))
+		return 0;
+
+	WSAPOLLFD *fd = &((WSAPOLLFD *)set->fds)[index];
+
+	// errors and hangups are reported as readable too, so that the next
+	// receive on the socket gets to report what went wrong
+	return (fd->revents & (POLLRDNORM|POLLERR|POLLHUP)) != 0;
+}
+
+// ------------------------------------------------------------------
+// recording network related stats
+//
+// the counters only ever go up, and get added to atomically from 
+// whichever thread sends or receives. Net_GetStats turns them into
+// rates by looking at how much they went up since it last looked
+
+static float g_stat_sample_window = 0.5f; // in seconds
+
+void Net_InitContext(net_context_t *ctx, struct net_impairment_t *impairment)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->impairment = impairment;
+}
+
+void Net_RecordSequenceTest(net_context_t *ctx, int accepted)
+{
+	OS_AtomicAdd64(&ctx->counters.sequences_tested, 1);
 
 	if (accepted)
-		bucket->accepted_packets += 1;
+		OS_AtomicAdd64(&ctx->counters.sequences_accepted, 1);
+}
 
-	bucket->tested_packets += 1;
+static net_counters_t Net_LoadCounters(net_context_t *ctx)
+{
+	net_counters_t result = {
+		.bytes_in           = OS_AtomicLoad64(&ctx->counters.bytes_in),
+		.bytes_out          = OS_AtomicLoad64(&ctx->counters.bytes_out),
+		.packets_in         = OS_AtomicLoad64(&ctx->counters.packets_in),
+		.packets_out        = OS_AtomicLoad64(&ctx->counters.packets_out),
+		.sequences_tested   = OS_AtomicLoad64(&ctx->counters.sequences_tested),
+		.sequences_accepted = OS_AtomicLoad64(&ctx->counters.sequences_accepted),
+	};
+	return result;
 }
 
-void Net_RecordPacketStat(net_stat_direction_e direction, int size)
+void Net_GetStats(net_context_t *ctx, net_stats_t *stats)
 {
-	net_stat_bucket_t *bucket = Net_GetStatBucket();
+	os_time_t      now      = OS_GetHiresTime();
+	net_counters_t counters = Net_LoadCounters(ctx);
+
+	if (ctx->sample_time == 0)
+	{
+		ctx->sample_time = now;
+		ctx->sample      = counters;
+	}
+
+	float elapsed = (float)OS_GetSecondsElapsed(ctx->sample_time, now);
 
-	if (direction == NETSTAT_INBOUND)
-		bucket->inbound_bytes  += size;
+	if (elapsed >= g_stat_sample_window)
+	{
+		net_counters_t *prev  = &ctx->sample;
+		net_stats_t    *rates = &ctx->rates;
+
+		uint64_t tested   = counters.sequences_tested   - prev->sequences_tested;
+		uint64_t accepted = counters.sequences_accepted - prev->sequences_accepted;
+
+		// if nothing got tested, the last ratio is as good a guess as any
+		if (tested > 0)
+			rates->packets_accepted_ratio = (float)accepted / (float)tested;
+
+		rates->bytes_in_per_second  = (float)(counters.bytes_in  - prev->bytes_in)  / elapsed;
+		rates->bytes_out_per_second = (float)(counters.bytes_out - prev->bytes_out) / elapsed;
+
+		ctx->sample_time = now;
+		ctx->sample      = counters;
+	}
 
-	if (direction == NETSTAT_OUTBOUND)
-		bucket->outbound_bytes += size;
+	*stats = ctx->rates;
+	stats->totals = counters;
 }
@@ -4,6 +4,12 @@
 // standard library includes
 
 #include <stddef.h> // uintptr_t
+#include <stdint.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "os.h"
 
 // ------------------------------------------------------------------
 // net.h: abstraction of the socket API to simplify application code
@@ -28,6 +34,72 @@ typedef struct net_socket_t
 // signed ints on linux, if one were to port this code
 #define INVALID_SOCKET_VALUE (uintptr_t)(~0) 
 
+typedef enum net_direction_e
+{
+	NET_DIRECTION_OUT, // what we send
+	NET_DIRECTION_IN,  // what we receive
+	NET_DIRECTION_COUNT,
+} net_direction_e;
+
+// ------------------------------------------------------------------
+// contexts
+//
+// sending and receiving goes through a context, which keeps the stats
+// for whatever sockets are used with it. that way there's no global
+// state, and different parts of a program (or different servers in one
+// process) can keep their numbers apart. the counters are atomic, so a
+// context can be shared between threads, like the client's network
+// thread and main thread
+
+typedef struct net_counters_t
+{
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t packets_in;
+	uint64_t packets_out;
+	uint64_t sequences_tested;   // see Net_RecordSequenceTest
+	uint64_t sequences_accepted;
+} net_counters_t;
+
+typedef struct net_stats_t
+{
+	float packets_accepted_ratio;
+	float bytes_in_per_second;
+	float bytes_out_per_second;
+
+	net_counters_t totals; // since the context was created
+} net_stats_t;
+
+typedef struct net_context_t
+{
+	volatile net_counters_t counters; // only ever added to
+
+	// only touched by Net_GetStats, to turn the counters into rates
+	os_time_t      sample_time;
+	net_counters_t sample;
+	net_stats_t    rates;
+
+	// if set, everything sent or received through the context gets
+	// dropped, delayed and so on first, see netimpair.h
+	struct net_impairment_t *impairment;
+
+	// if set, everything sent or received through the context gets
+	// written to a capture file, see netcapture.h
+	struct net_capture_t *capture;
+} net_context_t;
+
+// the impairment can be NULL, and the context doesn't own it
+void Net_InitContext(net_context_t *ctx, struct net_impairment_t *impairment);
+
+// to be called with the result of Net_AcceptSequenceNumber for the
+// stream of packets that the acceptance ratio in the stats is about
+void Net_RecordSequenceTest(net_context_t *ctx, int accepted);
+
+// returns stats about the network usage of the context. the rates are
+// averaged over the last half second or so. only call this from one
+// thread at a time
+void Net_GetStats(net_context_t *ctx, net_stats_t *stats);
+
 // ------------------------------------------------------------------
 
 // must be called before using any of the other Net functions
@@ -65,21 +137,69 @@ net_socket_t Net_CreateSocket(int flags);
 void         Net_CloseSocket(net_socket_t sock);
 int          Net_BindSocket(net_socket_t sock, net_addr_t addr);
 
+// for blocking sockets, makes Net_RecvPacket give up and return 0 if
+// nothing arrived within the given time. returns 0 on success
+int Net_SetReceiveTimeout(net_socket_t sock, unsigned milliseconds);
+
 // returns the maximum packet size possible over the socket
 int Net_GetMaxMessageSize(net_socket_t sock);
 
 // sends a packet, returns the amount of bytes sent or -1 on error
-int Net_SendPacket(net_socket_t sock, net_addr_t addr, void *packet, size_t packet_size);
+int Net_SendPacket(net_context_t *ctx, net_socket_t sock, net_addr_t addr, void *packet, size_t packet_size);
 
-// receives a packet, returns the amount of bytes received or -1 on error
-int Net_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr);
+// receives a packet, returns the amount of bytes received or -1 on error.
+// returns 0 if there was nothing to receive (non-blocking sockets) or
+// the receive timed out (blocking sockets with a receive timeout)
+int Net_RecvPacket(net_context_t *ctx, net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr);
 
-typedef struct net_stats_t
+// ------------------------------------------------------------------
+// TCP
+//
+// everything above is about UDP, which is what the game runs on. these
+// are for the odd thing on the side that wants a plain old stream,
+// like the server's admin endpoint. they don't go through a context,
+// since they have nothing to do with the game's traffic
+
+// creates a non-blocking TCP socket that listens for connections on
+// the given address. returns a socket with INVALID_SOCKET_VALUE on error
+net_socket_t Net_CreateListenSocket(net_addr_t addr);
+
+// accepts a connection waiting on a listen socket. returns a socket
+// with INVALID_SOCKET_VALUE if there wasn't one. the new socket is
+// blocking, but sends and receives on it give up after timeout_ms
+net_socket_t Net_AcceptConnection(net_socket_t listen_sock, net_addr_t *addr, unsigned timeout_ms);
+
+// sends all of the data, returns 0 on success or -1 on error
+int Net_SendStream(net_socket_t sock, const void *data, size_t size);
+
+// receives whatever has arrived, waiting for something if there's
+// nothing yet. returns the amount of bytes received, 0 if the other
+// side closed the connection, or -1 on error or timeout
+int Net_RecvStream(net_socket_t sock, void *buffer, size_t buffer_size);
+
+// ------------------------------------------------------------------
+
+// a set of sockets that can be waited on all at once, which is useful
+// when you have a lot of them to keep an eye on
+typedef struct net_poll_set_t
 {
-	float packets_accepted_ratio;
-	float bytes_in_per_second;
-	float bytes_out_per_second;
-} net_stats_t;
+	size_t count;
+	size_t capacity;
+	void  *fds; // platform specific
+} net_poll_set_t;
+
+// returns 0 on success, -1 on error
+int  Net_CreatePollSet(net_poll_set_t *set, size_t capacity);
+void Net_DestroyPollSet(net_poll_set_t *set);
+
+// returns the index of the socket in the set, or -1 if it is full
+int Net_AddToPollSet(net_poll_set_t *set, net_socket_t sock);
+
+// waits until at least one socket in the set has something to receive
+// or the timeout expires. returns the number of readable sockets, 0 on
+// timeout or -1 on error
+int Net_Poll(net_poll_set_t *set, int timeout_ms);
 
-// returns stats about the network usage
-void Net_GetStats(net_stats_t *stats);
+// returns 1 if the socket at this index was readable in the last call
+// to Net_Poll, 0 otherwise
+int Net_PollSetIsReadable(net_poll_set_t *set, size_t index);
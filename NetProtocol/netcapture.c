@@ -0,0 +1,348 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "netcapture.h"
+
+// ------------------------------------------------------------------
+// netcapture.c: records get put together in a little buffer and then
+// handed to stdio, which gets a big buffer of its own, so most writes
+// are just a copy. the lock is there for the client, which sends from
+// two threads.
+
+
+struct net_capture_t
+{
+	volatile uint32_t lock;
+
+	FILE     *file;
+	os_time_t start_time;
+
+	uint64_t  datagram_count;
+	uint64_t  offset;            // where the next record goes
+	uint64_t  last_index_offset; // 0 if there hasn't been one yet
+	os_time_t last_index_time;
+};
+
+// how much stdio buffers up before it writes to the file
+enum { CAPTURE_FILE_BUFFER_SIZE = 1 << 20 };
+
+// ------------------------------------------------------------------
+// little-endian packing
+
+static unsigned char *Capture_Put16(unsigned char *at, uint16_t value)
+{
+	at[0] = (unsigned char)(value);
+	at[1] = (unsigned char)(value >> 8);
+	return at + 2;
+}
+
+static unsigned char *Capture_Put32(unsigned char *at, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		at[i] = (unsigned char)(value >> 8*i);
+	return at + 4;
+}
+
+static unsigned char *Capture_Put64(unsigned char *at, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		at[i] = (unsigned char)(value >> 8*i);
+	return at + 8;
+}
+
+static uint16_t Capture_Get16(const unsigned char *at)
+{
+	return (uint16_t)(at[0] | (at[1] << 8));
+}
+
+static uint32_t Capture_Get32(const unsigned char *at)
+{
+	uint32_t result = 0;
+	for (int i = 0; i < 4; i++)
+		result |= (uint32_t)at[i] << 8*i;
+	return result;
+}
+
+static uint64_t Capture_Get64(const unsigned char *at)
+{
+	uint64_t result = 0;
+	for (int i = 0; i < 8; i++)
+		result |= (uint64_t)at[i] << 8*i;
+	return result;
+}
+
+// ------------------------------------------------------------------
+// writing
+
+static void Capture_Lock(net_capture_t *capture)
+{
+	while (OS_AtomicCompareExchange32(&capture->lock, 0, 1) != 0)
+		OS_Sleep(0);
+}
+
+static void Capture_Unlock(net_capture_t *capture)
+{
+	OS_AtomicStore32(&capture->lock, 0);
+}
+
+static uint64_t Capture_GetTime(net_capture_t *capture, os_time_t now)
+{
+	return (uint64_t)(1000000.0*OS_GetSecondsElapsed(capture->start_time, now));
+}
+
+// the lock has to be held
+static void Capture_WriteIndex(net_capture_t *capture, os_time_t now)
+{
+	unsigned char record[CAPTURE_INDEX_SIZE] = { 0 };
+
+	unsigned char *at = record;
+	*at = CAPTURE_RECORD_INDEX;
+	at += 4;
+	at = Capture_Put32(at, CAPTURE_INDEX_MAGIC);
+	at = Capture_Put64(at, Capture_GetTime(capture, now));
+	at = Capture_Put64(at, capture->datagram_count);
+	at = Capture_Put64(at, capture->last_index_offset);
+
+	// no flushing, this happens on the hot path with the lock held. the
+	// buffer goes out when it fills up, and at Capture_Destroy
+	fwrite(record, 1, sizeof(record), capture->file);
+
+	capture->last_index_offset = capture->offset;
+	capture->last_index_time   = now;
+	capture->offset           += sizeof(record);
+}
+
+net_capture_t *Capture_Create(const char *path)
+{
+	net_capture_t *capture = calloc(1, sizeof(net_capture_t));
+
+	if (!capture)
+		return NULL;
+
+	capture->file = fopen(path, "wb");
+
+	if (!capture->file)
+	{
+		fprintf(stderr, "Capture_Create: failed to open '%s' for writing\n", path);
+		free(capture);
+		return NULL;
+	}
+
+	setvbuf(capture->file, NULL, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+	unsigned char header[CAPTURE_HEADER_SIZE];
+
+	unsigned char *at = header;
+	at = Capture_Put32(at, CAPTURE_MAGIC);
+	at = Capture_Put32(at, CAPTURE_VERSION);
+	at = Capture_Put64(at, (uint64_t)time(NULL));
+
+	fwrite(header, 1, sizeof(header), capture->file);
+
+	capture->offset     = sizeof(header);
+	capture->start_time = OS_GetHiresTime();
+
+	capture->last_index_time = capture->start_time;
+
+	return capture;
+}
+
+void Capture_Destroy(net_capture_t *capture)
+{
+	if (!capture)
+		return;
+
+	Capture_WriteIndex(capture, OS_GetHiresTime());
+	fclose(capture->file);
+
+	free(capture);
+}
+
+void Capture_Write(net_capture_t *capture, net_direction_e direction, net_addr_t peer, const void *data, size_t size)
+{
+	if (NEVER(size > UINT16_MAX))
+		return;
+
+	unsigned char record[CAPTURE_DATAGRAM_HEADER_SIZE];
+
+	unsigned char *at = record;
+	*at++ = CAPTURE_RECORD_DATAGRAM;
+	*at++ = (unsigned char)direction;
+	at = Capture_Put16(at, (uint16_t)size);
+	memcpy(at, &peer.addr, 4); at += 4;
+	memcpy(at, &peer.port, 2); at += 2;
+
+	Capture_Lock(capture);
+
+	// the time is taken under the lock, so the records are in order even
+	// if two threads race to write them
+	os_time_t now = OS_GetHiresTime();
+	Capture_Put64(at, Capture_GetTime(capture, now));
+
+	fwrite(record, 1, sizeof(record), capture->file);
+	fwrite(data, 1, size, capture->file);
+
+	capture->offset         += sizeof(record) + size;
+	capture->datagram_count += 1;
+
+	if (OS_GetSecondsElapsed(capture->last_index_time, now) >= CAPTURE_INDEX_INTERVAL)
+		Capture_WriteIndex(capture, now);
+
+	Capture_Unlock(capture);
+}
+
+// ------------------------------------------------------------------
+// reading
+
+int Capture_OpenReader(capture_reader_t *reader, const char *path)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->file = fopen(path, "rb");
+
+	if (!reader->file)
+	{
+		fprintf(stderr, "Capture_OpenReader: failed to open '%s'\n", path);
+		return -1;
+	}
+
+	unsigned char header[CAPTURE_HEADER_SIZE];
+
+	if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+		Capture_Get32(&header[0]) != CAPTURE_MAGIC)
+	{
+		fprintf(stderr, "Capture_OpenReader: '%s' isn't a capture\n", path);
+		Capture_CloseReader(reader);
+		return -1;
+	}
+
+	uint32_t version = Capture_Get32(&header[4]);
+
+	if (version != CAPTURE_VERSION)
+	{
+		fprintf(stderr, "Capture_OpenReader: '%s' is version %u, but we only know version %d\n", path, version, CAPTURE_VERSION);
+		Capture_CloseReader(reader);
+		return -1;
+	}
+
+	reader->start_time = Capture_Get64(&header[8]);
+
+	return 0;
+}
+
+void Capture_CloseReader(capture_reader_t *reader)
+{
+	if (reader->file)
+		fclose(reader->file);
+
+	reader->file = NULL;
+}
+
+// skips ahead to just past the magic of the next index record, returns
+// false if there isn't one
+static bool Capture_FindIndex(capture_reader_t *reader)
+{
+	uint32_t window = 0;
+
+	for (;;)
+	{
+		int c = fgetc(reader->file);
+
+		if (c == EOF)
+			return false;
+
+		reader->skipped_bytes += 1;
+
+		window = (window >> 8) | ((uint32_t)c << 24);
+
+		if (window == CAPTURE_INDEX_MAGIC)
+			return true;
+	}
+}
+
+bool Capture_ReadDatagram(capture_reader_t *reader, capture_datagram_t *datagram)
+{
+	if (!reader->file)
+		return false;
+
+	for (;;)
+	{
+		int kind = fgetc(reader->file);
+
+		if (kind == EOF)
+			return false;
+
+		if (kind == CAPTURE_RECORD_DATAGRAM)
+		{
+			unsigned char record[CAPTURE_DATAGRAM_HEADER_SIZE - 1];
+
+			if (fread(record, 1, sizeof(record), reader->file) != sizeof(record))
+				return false;
+
+			datagram->direction = (net_direction_e)record[0];
+			datagram->size      = Capture_Get16(&record[1]);
+			datagram->time      = Capture_Get64(&record[9]);
+
+			datagram->peer.family = 2; // AF_INET, it's all IPv4
+			memcpy(&datagram->peer.addr, &record[3], 4);
+			memcpy(&datagram->peer.port, &record[7], 2);
+
+			if (datagram->direction < NET_DIRECTION_COUNT)
+			{
+				if (fread(datagram->data, 1, datagram->size, reader->file) != datagram->size)
+					return false;
+
+				return true;
+			}
+
+			// that's not a datagram after all, so look for solid ground
+			reader->skipped_bytes += sizeof(record) + 1;
+
+			if (!Capture_FindIndex(reader))
+				return false;
+		}
+		else if (kind == CAPTURE_RECORD_INDEX)
+		{
+			unsigned char record[CAPTURE_INDEX_SIZE - 1];
+
+			if (fread(record, 1, sizeof(record), reader->file) != sizeof(record))
+				return false;
+
+			if (Capture_Get32(&record[3]) == CAPTURE_INDEX_MAGIC)
+			{
+				reader->index_count += 1;
+				continue;
+			}
+
+			reader->skipped_bytes += sizeof(record) + 1;
+
+			if (!Capture_FindIndex(reader))
+				return false;
+		}
+		else
+		{
+			reader->skipped_bytes += 1;
+
+			if (!Capture_FindIndex(reader))
+				return false;
+		}
+
+		// found the magic of an index record, which has the rest of it
+		// still to come
+		unsigned char rest[CAPTURE_INDEX_SIZE - 8];
+
+		if (fread(rest, 1, sizeof(rest), reader->file) != sizeof(rest))
+			return false;
+
+		reader->index_count += 1;
+	}
+}
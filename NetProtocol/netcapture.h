@@ -0,0 +1,112 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+#include "net.h"
+
+// ------------------------------------------------------------------
+// netcapture.h: a record of every datagram that went through a context,
+// for when something went wrong and nobody knows what the traffic
+// looked like. when a context has a capture, Net_SendPacket and
+// Net_RecvPacket write every datagram they hand over to it into the
+// capture file. for sending, that happens before any impairment (see
+// netimpair.h). for receiving, it happens after.
+//
+// the file is only ever appended to, and the writes are buffered. every
+// second an index record goes in. nothing flushes the buffer along the
+// way, since the writes happen on whatever thread is sending or
+// receiving, so if the program dies, whatever was still in the buffer
+// is lost. all numbers are little-endian:
+//
+//     file header:  u32 magic 'NCAP', u32 version, u64 start time (unix seconds)
+//
+//     datagram:     u8 kind (1), u8 direction (net_direction_e), u16 size,
+//                   u32 peer address, u16 peer port (both in network byte order),
+//                   u64 time (microseconds since the capture started),
+//                   followed by size bytes of payload
+//
+//     index:        u8 kind (2), u8 padding[3], u32 magic 'NIDX',
+//                   u64 time, u64 datagrams written before this record,
+//                   u64 file offset of the previous index record (0 if none)
+//
+// the index records are there so a reader can find its footing in a
+// file that got cut off or mangled in the middle, by looking for their
+// magic, and so it can walk back from the end to get at a point in time
+// without reading everything before it.
+
+#define CAPTURE_MAGIC       0x5041434Eu // "NCAP"
+#define CAPTURE_INDEX_MAGIC 0x5844494Eu // "NIDX"
+
+enum { CAPTURE_VERSION = 1 };
+
+enum
+{
+	CAPTURE_HEADER_SIZE          = 16,
+	CAPTURE_DATAGRAM_HEADER_SIZE = 18,
+	CAPTURE_INDEX_SIZE           = 32,
+};
+
+typedef enum capture_record_kind_e
+{
+	CAPTURE_RECORD_DATAGRAM = 1,
+	CAPTURE_RECORD_INDEX    = 2,
+} capture_record_kind_e;
+
+// how often an index record goes in, in seconds
+#define CAPTURE_INDEX_INTERVAL 1.0
+
+// ------------------------------------------------------------------
+// writing
+
+typedef struct net_capture_t net_capture_t;
+
+// opens the file for writing, returns NULL on failure. to capture a
+// context's traffic, put the capture into its capture field
+net_capture_t *Capture_Create(const char *path);
+
+// writes out the last index record and closes the file
+void Capture_Destroy(net_capture_t *capture);
+
+// safe to call from multiple threads
+void Capture_Write(net_capture_t *capture, net_direction_e direction, net_addr_t peer, const void *data, size_t size);
+
+// ------------------------------------------------------------------
+// reading
+
+typedef struct capture_reader_t
+{
+	FILE    *file;
+	uint64_t start_time; // unix seconds
+
+	uint64_t index_count;   // index records read so far
+	uint64_t skipped_bytes; // bytes that didn't make sense, and got skipped looking for an index record
+} capture_reader_t;
+
+typedef struct capture_datagram_t
+{
+	net_direction_e direction;
+	net_addr_t      peer;
+	uint64_t        time; // microseconds since the capture started
+	size_t          size;
+
+	unsigned char data[65536];
+} capture_datagram_t;
+
+// returns 0 on success, or -1 if the file can't be opened or isn't a
+// capture
+int  Capture_OpenReader(capture_reader_t *reader, const char *path);
+void Capture_CloseReader(capture_reader_t *reader);
+
+// reads the next datagram, stepping over the index records. returns
+// false at the end of the file, including when the last record was
+// cut off
+bool Capture_ReadDatagram(capture_reader_t *reader, capture_datagram_t *datagram);
@@ -0,0 +1,644 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "netimpair.h"
+
+// ------------------------------------------------------------------
+// netimpair.c: every direction has its own queue of packets that are
+// on their way, each with the time it's due. with a few dozen clients
+// and a bit of latency that's easily a couple thousand packets, so the
+// queue keeps them in a min-heap on their due time, one per socket
+// (the client receives on two sockets, and only ever wants the next
+// packet for one of them). finding the next packet due means looking
+// at the top of each socket's heap.
+//
+// the packets' contents go into fixed size slots, carved out of chunks
+// that are allocated as the queue needs them and never move, so pushing
+// a packet usually doesn't allocate anything. the odd packet that's
+// too big for a slot gets allocated by itself.
+//
+// the bandwidth limit works like a link that can only carry so many
+// bytes per second: a packet can't start going out before the one in
+// front of it is done, and then takes its size over the bandwidth to
+// go out itself. its latency starts counting after that.
+
+
+typedef struct impair_packet_t
+{
+	os_time_t    due_time;
+	uint64_t     order; // so packets due at the same time come out in the order they went in
+	net_socket_t sock;
+	net_addr_t   addr;
+	size_t       size;
+	void        *data;
+} impair_packet_t;
+
+// the sockets that can share an impairment, which is never many
+enum { IMPAIR_MAX_LANES = 8 };
+
+// the heaps start out this big, and double when they fill up
+enum { IMPAIR_INITIAL_CAPACITY = 256 };
+
+// packets up to this size go in a slot, bigger ones get allocated
+enum { IMPAIR_SLOT_SIZE = 2048 };
+enum { IMPAIR_SLOTS_PER_CHUNK = 256 };
+
+// the packets on their way to (or from) one socket
+typedef struct impair_lane_t
+{
+	bool         in_use;
+	net_socket_t sock;
+
+	size_t           count;
+	size_t           capacity;
+	impair_packet_t *heap; // ordered by due time, then order
+} impair_lane_t;
+
+typedef struct impair_queue_t
+{
+	net_impair_config_t config;
+
+	uint64_t  random_state;
+	uint64_t  next_order;
+	os_time_t link_free_time; // when the link is done with the packets it was given
+
+	size_t        count; // in all of the lanes
+	impair_lane_t lanes[IMPAIR_MAX_LANES];
+
+	net_impair_stats_t stats;
+} impair_queue_t;
+
+// a free slot, the slots that are in use hold a packet's data instead
+typedef struct impair_slot_t
+{
+	struct impair_slot_t *next;
+} impair_slot_t;
+
+struct net_impairment_t
+{
+	volatile uint32_t lock;
+	impair_queue_t    queues[NET_DIRECTION_COUNT];
+
+	impair_slot_t  *free_slots;
+	size_t          chunk_count;
+	unsigned char **chunks;
+};
+
+// ------------------------------------------------------------------
+// settings
+
+// returns the option with that name, and what its value on the
+// command line has to be multiplied with to get the units it's in
+static float *Impair_GetOption(net_impair_config_t *config, const char *name, float *scale)
+{
+	if (strcmp(name, "loss") == 0)      { *scale = 0.01f;   return &config->loss;      }
+	if (strcmp(name, "duplicate") == 0) { *scale = 0.01f;   return &config->duplicate; }
+	if (strcmp(name, "reorder") == 0)   { *scale = 0.01f;   return &config->reorder;   }
+	if (strcmp(name, "latency") == 0)   { *scale = 0.001f;  return &config->latency;   }
+	if (strcmp(name, "jitter") == 0)    { *scale = 0.001f;  return &config->jitter;    }
+	if (strcmp(name, "bandwidth") == 0) { *scale = 1000.0f; return &config->bandwidth; }
+
+	return NULL;
+}
+
+bool Impair_ParseArg(net_impair_settings_t *settings, int argc, char **argv, int *i)
+{
+	const char *arg = argv[*i];
+
+	if (strncmp(arg, "-impair_", 8) != 0 || *i + 1 >= argc)
+		return false;
+
+	const char *name  = arg + 8;
+	const char *value = argv[*i + 1];
+
+	if (strcmp(name, "seed") == 0)
+	{
+		settings->seed = strtoull(value, NULL, 10);
+	}
+	else
+	{
+		int first = 0;
+		int last  = NET_DIRECTION_COUNT - 1;
+
+		if (strncmp(name, "out_", 4) == 0)
+		{
+			first = last = NET_DIRECTION_OUT;
+			name += 4;
+		}
+		else if (strncmp(name, "in_", 3) == 0)
+		{
+			first = last = NET_DIRECTION_IN;
+			name += 3;
+		}
+
+		for (int direction = first; direction <= last; direction++)
+		{
+			float  scale;
+			float *option = Impair_GetOption(&settings->directions[direction], name, &scale);
+
+			if (!option)
+				return false;
+
+			*option = scale*(float)atof(value);
+		}
+	}
+
+	settings->enabled = true;
+	*i += 1;
+
+	return true;
+}
+
+void Impair_PrintSettings(const net_impair_settings_t *settings)
+{
+	if (!settings->enabled)
+		return;
+
+	static const char *names[NET_DIRECTION_COUNT] = { "outgoing", "incoming" };
+
+	for (int direction = 0; direction < NET_DIRECTION_COUNT; direction++)
+	{
+		const net_impair_config_t *config = &settings->directions[direction];
+
+		char bandwidth[32] = "unlimited";
+
+		if (config->bandwidth > 0.0f)
+			snprintf(bandwidth, sizeof(bandwidth), "%.1f KB/s", config->bandwidth / 1000.0f);
+
+		printf("Impairing %s traffic: %.1f%% loss, %.1f%% duplicated, %.1f%% reordered, %.0f +- %.0f ms latency, %s bandwidth\n",
+			   names[direction], 100.0f*config->loss, 100.0f*config->duplicate, 100.0f*config->reorder,
+			   1000.0f*config->latency, 1000.0f*config->jitter, bandwidth);
+	}
+
+	printf("Impairment seed: %llu (pass -impair_seed %llu to get the same dice rolls again)\n",
+		   (unsigned long long)settings->seed, (unsigned long long)settings->seed);
+}
+
+// ------------------------------------------------------------------
+// creating and destroying
+
+net_impairment_t *Impair_Create(const net_impair_settings_t *settings)
+{
+	if (!settings->enabled)
+		return NULL;
+
+	net_impairment_t *impairment = calloc(1, sizeof(net_impairment_t));
+
+	if (!impairment)
+	{
+		fprintf(stderr, "Impair_Create: out of memory\n");
+		return NULL;
+	}
+
+	for (int direction = 0; direction < NET_DIRECTION_COUNT; direction++)
+	{
+		impair_queue_t *queue = &impairment->queues[direction];
+		queue->config = settings->directions[direction];
+
+		// both directions get their own dice, so one direction's traffic
+		// doesn't change what happens to the other's
+		queue->random_state = settings->seed ^ (0x9E3779B97F4A7C15ull*(uint64_t)(direction + 1));
+	}
+
+	return impairment;
+}
+
+void Impair_Destroy(net_impairment_t *impairment)
+{
+	if (!impairment)
+		return;
+
+	static const char *names[NET_DIRECTION_COUNT] = { "outgoing", "incoming" };
+
+	for (int direction = 0; direction < NET_DIRECTION_COUNT; direction++)
+	{
+		impair_queue_t     *queue = &impairment->queues[direction];
+		net_impair_stats_t *stats = &queue->stats;
+
+		printf("Impaired %s traffic: %llu passed, %llu dropped, %llu overflowed the link, %llu duplicated, %llu reordered\n",
+			   names[direction], (unsigned long long)stats->passed, (unsigned long long)stats->dropped,
+			   (unsigned long long)stats->overflowed, (unsigned long long)stats->duplicated,
+			   (unsigned long long)stats->reordered);
+
+		if (stats->queue_full > 0)
+		{
+			printf("Impaired %s traffic: %llu more got dropped because the impairment's queue was full, which isn't part of the impairment\n",
+				   names[direction], (unsigned long long)stats->queue_full);
+		}
+
+		for (int i = 0; i < IMPAIR_MAX_LANES; i++)
+		{
+			impair_lane_t *lane = &queue->lanes[i];
+
+			// the ones in slots go with the chunks
+			for (size_t j = 0; j < lane->count; j++)
+			{
+				if (lane->heap[j].size > IMPAIR_SLOT_SIZE)
+					free(lane->heap[j].data);
+			}
+
+			free(lane->heap);
+		}
+	}
+
+	for (size_t i = 0; i < impairment->chunk_count; i++)
+		free(impairment->chunks[i]);
+
+	free(impairment->chunks);
+	free(impairment);
+}
+
+// ------------------------------------------------------------------
+// the queues are shared between threads (the client sends from two of
+// them), but only ever held on to for a moment, so a spin lock will do
+
+static void Impair_Lock(net_impairment_t *impairment)
+{
+	while (OS_AtomicCompareExchange32(&impairment->lock, 0, 1) != 0)
+		OS_Sleep(0);
+}
+
+static void Impair_Unlock(net_impairment_t *impairment)
+{
+	OS_AtomicStore32(&impairment->lock, 0);
+}
+
+void Impair_GetStats(net_impairment_t *impairment, net_direction_e direction, net_impair_stats_t *stats)
+{
+	Impair_Lock(impairment);
+	*stats = impairment->queues[direction].stats;
+	Impair_Unlock(impairment);
+}
+
+// ------------------------------------------------------------------
+// rolling the dice
+
+// splitmix64
+static uint64_t Impair_Random(impair_queue_t *queue)
+{
+	uint64_t z = (queue->random_state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// returns a number from 0 up to (but not including) 1
+static float Impair_RandomUnit(impair_queue_t *queue)
+{
+	return (float)(Impair_Random(queue) >> 40)*(1.0f / (float)(1 << 24));
+}
+
+static bool Impair_Chance(impair_queue_t *queue, float chance)
+{
+	// the dice get rolled even if the chance is 0, so that turning one
+	// option on or off doesn't change the rolls for the others
+	return Impair_RandomUnit(queue) < chance;
+}
+
+
+// ------------------------------------------------------------------
+// the packets' data, the lock has to be held for all of these
+
+static bool Impair_AddChunk(net_impairment_t *impairment)
+{
+	unsigned char **chunks = realloc(impairment->chunks, (impairment->chunk_count + 1)*sizeof(*chunks));
+
+	if (!chunks)
+		return false;
+
+	impairment->chunks = chunks;
+
+	unsigned char *chunk = malloc((size_t)IMPAIR_SLOTS_PER_CHUNK*IMPAIR_SLOT_SIZE);
+
+	if (!chunk)
+		return false;
+
+	impairment->chunks[impairment->chunk_count++] = chunk;
+
+	for (int i = 0; i < IMPAIR_SLOTS_PER_CHUNK; i++)
+	{
+		impair_slot_t *slot = (impair_slot_t *)&chunk[(size_t)i*IMPAIR_SLOT_SIZE];
+		slot->next = impairment->free_slots;
+		impairment->free_slots = slot;
+	}
+
+	return true;
+}
+
+static void *Impair_AllocData(net_impairment_t *impairment, size_t size)
+{
+	if (size > IMPAIR_SLOT_SIZE)
+		return malloc(size);
+
+	if (!impairment->free_slots && !Impair_AddChunk(impairment))
+		return NULL;
+
+	impair_slot_t *slot = impairment->free_slots;
+	impairment->free_slots = slot->next;
+
+	return slot;
+}
+
+static void Impair_FreeData(net_impairment_t *impairment, void *data, size_t size)
+{
+	if (size > IMPAIR_SLOT_SIZE)
+	{
+		free(data);
+		return;
+	}
+
+	impair_slot_t *slot = data;
+	slot->next = impairment->free_slots;
+	impairment->free_slots = slot;
+}
+
+// ------------------------------------------------------------------
+// the heaps, the lock has to be held for all of these too
+
+static bool Impair_IsBefore(const impair_packet_t *a, const impair_packet_t *b)
+{
+	return a->due_time < b->due_time || (a->due_time == b->due_time && a->order < b->order);
+}
+
+static impair_lane_t *Impair_GetLane(impair_queue_t *queue, net_socket_t sock, bool create)
+{
+	impair_lane_t *free_lane = NULL;
+
+	for (int i = 0; i < IMPAIR_MAX_LANES; i++)
+	{
+		impair_lane_t *lane = &queue->lanes[i];
+
+		if (lane->in_use && lane->sock.value == sock.value)
+			return lane;
+
+		if (!lane->in_use && !free_lane)
+			free_lane = lane;
+	}
+
+	if (create && free_lane)
+	{
+		free_lane->in_use = true;
+		free_lane->sock   = sock;
+		return free_lane;
+	}
+
+	return NULL;
+}
+
+static bool Impair_HeapPush(impair_lane_t *lane, const impair_packet_t *packet)
+{
+	if (lane->count == lane->capacity)
+	{
+		size_t capacity = lane->capacity ? 2*lane->capacity : IMPAIR_INITIAL_CAPACITY;
+
+		impair_packet_t *heap = realloc(lane->heap, capacity*sizeof(*heap));
+
+		if (!heap)
+			return false;
+
+		lane->heap     = heap;
+		lane->capacity = capacity;
+	}
+
+	size_t index = lane->count++;
+
+	while (index > 0)
+	{
+		size_t parent = (index - 1) / 2;
+
+		if (!Impair_IsBefore(packet, &lane->heap[parent]))
+			break;
+
+		lane->heap[index] = lane->heap[parent];
+		index = parent;
+	}
+
+	lane->heap[index] = *packet;
+	return true;
+}
+
+static void Impair_HeapPop(impair_lane_t *lane)
+{
+	impair_packet_t last = lane->heap[--lane->count];
+
+	size_t index = 0;
+
+	for (;;)
+	{
+		size_t child = 2*index + 1;
+
+		if (child >= lane->count)
+			break;
+
+		if (child + 1 < lane->count && Impair_IsBefore(&lane->heap[child + 1], &lane->heap[child]))
+			child += 1;
+
+		if (!Impair_IsBefore(&lane->heap[child], &last))
+			break;
+
+		lane->heap[index] = lane->heap[child];
+		index = child;
+	}
+
+	if (lane->count > 0)
+		lane->heap[index] = last;
+}
+
+// returns the lane (for the socket, if it isn't NULL) with the packet
+// that's due first, or NULL if there aren't any
+static impair_lane_t *Impair_FindNext(impair_queue_t *queue, const net_socket_t *sock)
+{
+	if (sock)
+	{
+		impair_lane_t *lane = Impair_GetLane(queue, *sock, false);
+		return (lane && lane->count > 0) ? lane : NULL;
+	}
+
+	impair_lane_t *result = NULL;
+
+	for (int i = 0; i < IMPAIR_MAX_LANES; i++)
+	{
+		impair_lane_t *lane = &queue->lanes[i];
+
+		if (lane->count == 0)
+			continue;
+
+		if (!result || Impair_IsBefore(&lane->heap[0], &result->heap[0]))
+			result = lane;
+	}
+
+	return result;
+}
+
+// ------------------------------------------------------------------
+// the queues
+
+void Impair_Push(net_impairment_t *impairment, net_direction_e direction, os_time_t now,
+				 net_socket_t sock, net_addr_t addr, const void *data, size_t size)
+{
+	bool first_full = false;
+
+	Impair_Lock(impairment);
+
+	impair_queue_t      *queue  = &impairment->queues[direction];
+	net_impair_config_t *config = &queue->config;
+
+	bool lose      = Impair_Chance(queue, config->loss);
+	bool duplicate = Impair_Chance(queue, config->duplicate);
+
+	if (lose)
+	{
+		queue->stats.dropped += 1;
+	}
+	else
+	{
+		int copies = duplicate ? 2 : 1;
+
+		for (int copy = 0; copy < copies; copy++)
+		{
+			// every copy gets its own delay, so the duplicate doesn't always
+			// arrive right behind the original
+			float jitter  = config->jitter*(2.0f*Impair_RandomUnit(queue) - 1.0f);
+			bool  reorder = Impair_Chance(queue, config->reorder);
+
+			os_time_t sent_time = now;
+
+			if (config->bandwidth > 0.0f)
+			{
+				if (queue->link_free_time < now)
+					queue->link_free_time = now;
+
+				if (OS_GetSecondsElapsed(now, queue->link_free_time) > IMPAIR_MAX_QUEUE_DELAY)
+				{
+					queue->stats.overflowed += 1;
+					continue;
+				}
+
+				queue->link_free_time += OS_HiresTimeFromSeconds((double)size / (double)config->bandwidth);
+				sent_time = queue->link_free_time;
+			}
+
+			float delay = config->latency + jitter;
+
+			if (delay < 0.0f)
+				delay = 0.0f;
+
+			if (reorder)
+				delay += IMPAIR_REORDER_DELAY;
+
+			// from here on, a packet that gets dropped is the impairment's own
+			// fault, not something it's simulating
+			impair_lane_t *lane = NULL;
+			void *copy_data     = NULL;
+
+			if (queue->count < IMPAIR_MAX_QUEUED)
+				lane = Impair_GetLane(queue, sock, true);
+
+			if (lane)
+				copy_data = Impair_AllocData(impairment, size);
+
+			impair_packet_t packet = {
+				.due_time = sent_time + OS_HiresTimeFromSeconds(delay),
+				.order    = queue->next_order++,
+				.sock     = sock,
+				.addr     = addr,
+				.size     = size,
+				.data     = copy_data,
+			};
+
+			if (!copy_data || !Impair_HeapPush(lane, &packet))
+			{
+				if (copy_data)
+					Impair_FreeData(impairment, copy_data, size);
+
+				first_full = (queue->stats.queue_full == 0);
+				queue->stats.queue_full += 1;
+				continue;
+			}
+
+			memcpy(copy_data, data, size);
+			queue->count += 1;
+
+			if (reorder)
+				queue->stats.reordered += 1;
+
+			if (copy > 0)
+				queue->stats.duplicated += 1;
+		}
+	}
+
+	Impair_Unlock(impairment);
+
+	if (first_full)
+		fprintf(stderr, "Impair_Push: the queue is full, from now on some packets get dropped that the impairment didn't mean to drop\n");
+}
+
+bool Impair_Pop(net_impairment_t *impairment, net_direction_e direction, os_time_t now,
+				const net_socket_t *sock, net_impair_packet_t *result)
+{
+	bool found = false;
+
+	Impair_Lock(impairment);
+
+	impair_queue_t *queue = &impairment->queues[direction];
+	impair_lane_t  *lane  = Impair_FindNext(queue, sock);
+
+	if (lane && lane->heap[0].due_time <= now)
+	{
+		impair_packet_t *packet = &lane->heap[0];
+
+		result->sock = packet->sock;
+		result->addr = packet->addr;
+		result->size = packet->size;
+		result->data = packet->data;
+
+		Impair_HeapPop(lane);
+
+		queue->count        -= 1;
+		queue->stats.passed += 1;
+
+		found = true;
+	}
+
+	Impair_Unlock(impairment);
+
+	return found;
+}
+
+void Impair_FreePacket(net_impairment_t *impairment, net_impair_packet_t *packet)
+{
+	Impair_Lock(impairment);
+	Impair_FreeData(impairment, packet->data, packet->size);
+	Impair_Unlock(impairment);
+
+	packet->data = NULL;
+}
+
+bool Impair_GetNextDueTime(net_impairment_t *impairment, net_direction_e direction,
+						   const net_socket_t *sock, os_time_t *due_time)
+{
+	bool found = false;
+
+	Impair_Lock(impairment);
+
+	impair_queue_t *queue = &impairment->queues[direction];
+	impair_lane_t  *lane  = Impair_FindNext(queue, sock);
+
+	if (lane)
+	{
+		*due_time = lane->heap[0].due_time;
+		found = true;
+	}
+
+	Impair_Unlock(impairment);
+
+	return found;
+}
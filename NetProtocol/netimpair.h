@@ -0,0 +1,122 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+#include "net.h"
+
+// ------------------------------------------------------------------
+// netimpair.h: makes the network worse on purpose. when a context has
+// an impairment, Net_SendPacket and Net_RecvPacket don't hand packets
+// straight to (or from) the socket, they first go through a queue that
+// drops, delays, duplicates and reorders them, and squeezes them
+// through a link with limited bandwidth. that's what clumsy does from
+// the outside, except this works anywhere, and since the dice are
+// seeded, the same traffic gets the same treatment every time.
+//
+// the two directions are set up separately, because real connections
+// rarely are equally bad both ways.
+
+typedef struct net_impair_config_t
+{
+	float loss;      // chance of a packet getting dropped, 0 to 1
+	float duplicate; // chance of a packet arriving twice
+	float reorder;   // chance of a packet getting held back, so the ones after it overtake it
+	float latency;   // in seconds, added to every packet
+	float jitter;    // in seconds, the latency goes up or down by up to this much
+	float bandwidth; // in bytes per second, 0 for unlimited
+} net_impair_config_t;
+
+typedef struct net_impair_settings_t
+{
+	bool     enabled; // set once any of the options is given
+	uint64_t seed;
+	net_impair_config_t directions[NET_DIRECTION_COUNT];
+} net_impair_settings_t;
+
+// how long a held back packet gets held back for, on top of its latency
+#define IMPAIR_REORDER_DELAY 0.02f
+
+// packets that would have to wait longer than this for the bandwidth
+// limited link get dropped, like a router with a full queue would
+#define IMPAIR_MAX_QUEUE_DELAY 0.25f
+
+// how many packets can be on their way in one direction at a time. the
+// queue grows as it needs to, up to this. that's enough for thousands
+// of clients' worth of traffic at a few hundred milliseconds of latency,
+// anything past it gets dropped, and counted as queue_full
+enum { IMPAIR_MAX_QUEUED = 1 << 16 };
+
+typedef struct net_impair_stats_t
+{
+	uint64_t passed;     // packets that made it through
+	uint64_t dropped;    // lost on purpose
+	uint64_t overflowed; // lost because the link was too full
+	uint64_t duplicated;
+	uint64_t reordered;
+
+	// lost because the impairment itself ran out of room (or memory). this
+	// isn't part of the impairment, if it's not 0, the loss isn't what was
+	// asked for
+	uint64_t queue_full;
+} net_impair_stats_t;
+
+typedef struct net_impairment_t net_impairment_t;
+
+// looks at argv[*i], and if it's one of the impairment options, takes
+// it (and its value) and returns true. the options are:
+//
+//     -impair_loss <percent>       -impair_latency <ms>
+//     -impair_duplicate <percent>  -impair_jitter <ms>
+//     -impair_reorder <percent>    -impair_bandwidth <kilobytes per second>
+//     -impair_seed <number>
+//
+// which apply to both directions, unless "impair" is followed by "_out"
+// or "_in", as in -impair_in_loss 5
+bool Impair_ParseArg(net_impair_settings_t *settings, int argc, char **argv, int *i);
+
+// prints what the settings are going to do to the traffic
+void Impair_PrintSettings(const net_impair_settings_t *settings);
+
+// returns NULL if the settings aren't enabled, or on failure. destroying
+// it prints what it did to the traffic
+net_impairment_t *Impair_Create(const net_impair_settings_t *settings);
+void              Impair_Destroy(net_impairment_t *impairment);
+
+void Impair_GetStats(net_impairment_t *impairment, net_direction_e direction, net_impair_stats_t *stats);
+
+// ------------------------------------------------------------------
+// the queues, as used by net.c. all of these are safe to call from
+// multiple threads
+
+// rolls the dice for a packet, and queues it up zero, one or two times
+void Impair_Push(net_impairment_t *impairment, net_direction_e direction, os_time_t now,
+				 net_socket_t sock, net_addr_t addr, const void *data, size_t size);
+
+typedef struct net_impair_packet_t
+{
+	net_socket_t sock;
+	net_addr_t   addr;
+	size_t       size;
+	void        *data; // give it back with Impair_FreePacket
+} net_impair_packet_t;
+
+// takes out the packet that's been due the longest, if there is one.
+// if sock isn't NULL, only packets for that socket count. returns
+// false if nothing is due yet
+bool Impair_Pop(net_impairment_t *impairment, net_direction_e direction, os_time_t now,
+				const net_socket_t *sock, net_impair_packet_t *packet);
+
+void Impair_FreePacket(net_impairment_t *impairment, net_impair_packet_t *packet);
+
+// gets the time the next packet (for the socket, if it isn't NULL) is
+// due, which can be in the past. returns false if there aren't any
+bool Impair_GetNextDueTime(net_impairment_t *impairment, net_direction_e direction,
+						   const net_socket_t *sock, os_time_t *due_time);
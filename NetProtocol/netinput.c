@@ -0,0 +1,92 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+#include <math.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "netinput.h"
+
+// ------------------------------------------------------------------
+// netinput.c: the buttons are sent as the newest button state plus a
+// xor delta per older frame, and the mouse positions get quantized to
+// shorts. that makes six frames of input smaller than the single frame
+// (and username) the input packet used to carry.
+
+
+static short NetInput_QuantizeMouse(float x)
+{
+	float q = roundf(x*(float)NET_MOUSE_PRECISION);
+
+	// the mouse can't really be that far away from anything
+	// interesting, so clamping is fine
+	if (q >  32767.0f) q =  32767.0f;
+	if (q < -32768.0f) q = -32768.0f;
+
+	return (short)q;
+}
+
+static float NetInput_DequantizeMouse(short q)
+{
+	return (float)q / (float)NET_MOUSE_PRECISION;
+}
+
+void NetInput_AddFrame(net_input_history_t *history, const net_input_frame_t *frame)
+{
+	history->frames[history->head] = *frame;
+	history->head = (history->head + 1) % NET_INPUT_HISTORY_COUNT;
+
+	if (history->count < NET_INPUT_HISTORY_COUNT)
+		history->count += 1;
+}
+
+void NetInput_WritePacket(const net_input_history_t *history, net_input_t *packet)
+{
+	assert(history->count > 0);
+
+	packet->frame_count = (unsigned char)history->count;
+
+	uint32_t prev_btn_down = 0;
+
+	for (int i = 0; i < history->count; i++)
+	{
+		// walk backwards from the newest frame
+		int index = (history->head - 1 - i + NET_INPUT_HISTORY_COUNT) % NET_INPUT_HISTORY_COUNT;
+		const net_input_frame_t *frame = &history->frames[index];
+
+		if (i == 0)
+			packet->btn_down = (unsigned char)frame->btn_down;
+		else
+			packet->btn_deltas[i - 1] = (unsigned char)(prev_btn_down ^ frame->btn_down);
+
+		prev_btn_down = frame->btn_down;
+
+		packet->mouse_x[i] = NetInput_QuantizeMouse(frame->mouse_x);
+		packet->mouse_y[i] = NetInput_QuantizeMouse(frame->mouse_y);
+	}
+}
+
+int NetInput_ReadPacket(const net_input_t *packet, net_input_frame_t frames[NET_INPUT_HISTORY_COUNT])
+{
+	int frame_count = packet->frame_count;
+
+	if (frame_count < 1 || frame_count > NET_INPUT_HISTORY_COUNT)
+		return 0;
+
+	uint32_t btn_down = packet->btn_down;
+
+	for (int i = 0; i < frame_count; i++)
+	{
+		if (i > 0)
+			btn_down ^= packet->btn_deltas[i - 1];
+
+		frames[i].btn_down = btn_down;
+		frames[i].mouse_x  = NetInput_DequantizeMouse(packet->mouse_x[i]);
+		frames[i].mouse_y  = NetInput_DequantizeMouse(packet->mouse_y[i]);
+	}
+
+	return frame_count;
+}
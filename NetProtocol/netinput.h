@@ -0,0 +1,43 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+
+// ------------------------------------------------------------------
+// netinput.h: packs the most recent input frames into an input packet
+// and unpacks them again. the sender keeps a short history of its
+// inputs, and every packet carries all of it, so a lost packet or two
+// doesn't lose any button presses, the next packet that does make it
+// has them too.
+
+// a single tick's worth of input
+typedef struct net_input_frame_t
+{
+	uint32_t btn_down;
+	float    mouse_x, mouse_y;
+} net_input_frame_t;
+
+// the sender side history of recent input frames
+typedef struct net_input_history_t
+{
+	int               count;
+	int               head;  // where the next frame goes
+	net_input_frame_t frames[NET_INPUT_HISTORY_COUNT];
+} net_input_history_t;
+
+// to be called once per tick with that tick's input
+void NetInput_AddFrame(net_input_history_t *history, const net_input_frame_t *frame);
+
+// fills in everything but the header of the packet from the history
+void NetInput_WritePacket(const net_input_history_t *history, net_input_t *packet);
+
+// unpacks the frames of a received packet, newest first. returns the
+// amount of frames, which is 0 if the packet is garbage
+int NetInput_ReadPacket(const net_input_t *packet, net_input_frame_t frames[NET_INPUT_HISTORY_COUNT]);
@@ -0,0 +1,167 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+#include <math.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "netlink.h"
+
+// ------------------------------------------------------------------
+// netlink.c: the estimators are the usual suspects. the round trip 
+// time is smoothed the same way TCP does it (RFC 6298) and the jitter
+// the same way RTP does it (RFC 3550), except that RTP applies it to
+// one-way transit times and we apply it to round trip times, because
+// we don't have synchronized clocks.
+
+
+// the smoothing factors, as suggested by the RFCs
+static const float g_rtt_alpha    = 1.0f / 8.0f;
+static const float g_jitter_alpha = 1.0f / 16.0f;
+
+// the loss ratio gets folded into the smoothed value once every this
+// many packets, so it isn't too jumpy
+enum { LOSS_WINDOW_SIZE = 64 };
+static const float g_loss_alpha = 1.0f / 4.0f;
+
+void Link_Init(net_link_t *link)
+{
+	memset(link, 0, sizeof(*link));
+}
+
+void Link_AddRttSample(net_link_t *link, float rtt)
+{
+	if (rtt < 0.0f)
+		rtt = 0.0f;
+
+	if (link->rtt_sample_count == 0)
+	{
+		link->rtt     = rtt;
+		link->rtt_min = rtt;
+		link->jitter  = 0.5f*rtt;
+	}
+	else
+	{
+		float difference = fabsf(rtt - link->rtt_last);
+
+		link->rtt    += g_rtt_alpha*(rtt - link->rtt);
+		link->jitter += g_jitter_alpha*(difference - link->jitter);
+
+		if (link->rtt_min > rtt)
+			link->rtt_min = rtt;
+	}
+
+	link->rtt_last = rtt;
+	link->rtt_sample_count += 1;
+}
+
+static void Link_CountLoss(net_link_t *link, uint32_t received, uint32_t lost)
+{
+	link->window_received += received;
+	link->window_lost     += lost;
+
+	link->total_received += received;
+	link->total_lost     += lost;
+
+	uint32_t window_total = link->window_received + link->window_lost;
+	if (window_total >= LOSS_WINDOW_SIZE)
+	{
+		float window_loss = (float)link->window_lost / (float)window_total;
+		link->loss += g_loss_alpha*(window_loss - link->loss);
+
+		link->window_received = 0;
+		link->window_lost     = 0;
+	}
+}
+
+void Link_AddSequence(net_link_t *link, unsigned short sequence)
+{
+	if (!link->has_sequence)
+	{
+		link->has_sequence     = true;
+		link->highest_sequence = sequence;
+		link->received_mask    = 1;
+		link->tracked_count    = 1;
+
+		Link_CountLoss(link, 1, 0);
+		return;
+	}
+
+	// the signed difference deals with wrapping
+	short delta = (short)(sequence - link->highest_sequence);
+
+	if (delta > 0)
+	{
+		// every slot that gets pushed out of the mask without having been
+		// received is a lost packet. slots from before the first packet we
+		// saw don't count, those were never sent as far as we're concerned
+		uint32_t lost = 0;
+
+		if (delta >= 64)
+		{
+			for (int i = 0; i < (int)link->tracked_count; i++)
+			{
+				if (!(link->received_mask & (1ull << i)))
+					lost += 1;
+			}
+
+			// and the packets that we skipped over entirely
+			lost += (uint32_t)(delta - 64);
+
+			link->received_mask = 0;
+		}
+		else
+		{
+			for (int i = 64 - delta; i < (int)link->tracked_count; i++)
+			{
+				if (!(link->received_mask & (1ull << i)))
+					lost += 1;
+			}
+
+			link->received_mask <<= delta;
+		}
+
+		link->received_mask   |= 1;
+		link->highest_sequence = sequence;
+
+		link->tracked_count += (uint32_t)delta;
+		if (link->tracked_count > 64)
+			link->tracked_count = 64;
+
+		Link_CountLoss(link, 1, lost);
+	}
+	else
+	{
+		int age = -delta;
+
+		if (age >= 64)
+		{
+			// too late, this one has already been written off as lost
+			return;
+		}
+
+		if (age >= (int)link->tracked_count)
+		{
+			// sent before the first packet we saw, it was never counted
+			// either way, so leave it at that
+			return;
+		}
+
+		uint64_t bit = 1ull << age;
+
+		if (link->received_mask & bit)
+		{
+			link->total_duplicates += 1;
+		}
+		else
+		{
+			link->received_mask |= bit;
+			link->total_late    += 1;
+
+			Link_CountLoss(link, 1, 0);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+// netlink.h: keeps track of the quality of the link to the other end
+// of a connection: round trip time, jitter and packet loss. this is
+// used on both the client and the server, each side feeds it with 
+// the round trip times it measured from pings and with the sequence
+// numbers of the packets it receives from the other side.
+
+typedef struct net_link_t
+{
+	// round trip time estimation, all in seconds
+
+	int   rtt_sample_count;
+	float rtt;          // exponentially weighted moving average of the round trip time
+	float rtt_min;      // lowest round trip time ever seen, a decent estimate of the "real" latency
+	float rtt_last;     // the most recent sample
+	float jitter;       // smoothed difference between consecutive round trip times
+
+	// packet loss accounting from gaps in the sequence numbers
+
+	bool           has_sequence;
+	unsigned short highest_sequence;
+	uint64_t       received_mask; // bit n is set if highest_sequence - n was received
+	uint32_t       tracked_count; // how many bits of received_mask are from the first sequence on, up to 64
+
+	uint32_t window_received; // packets that made it within the current window
+	uint32_t window_lost;     // packets that fell off the end of the received mask without showing up
+
+	float loss; // smoothed ratio of lost packets, 0 to 1
+
+	uint32_t total_received;
+	uint32_t total_lost;
+	uint32_t total_late;       // arrived out of order, but still in time to not count as lost
+	uint32_t total_duplicates;
+} net_link_t;
+
+void Link_Init(net_link_t *link);
+
+// to be called with each new round trip time measurement, in seconds
+void Link_AddRttSample(net_link_t *link, float rtt);
+
+// to be called with the sequence number of every received packet of
+// a single stream (so not mixing world state and ping sequence numbers).
+// a packet only counts as lost once it is so far behind the newest
+// one that it can't just be late anymore, so loss shows up with a 
+// small delay, but reordering doesn't get mistaken for loss
+void Link_AddSequence(net_link_t *link, unsigned short sequence);
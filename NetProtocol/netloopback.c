@@ -0,0 +1,384 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "netloopback.h"
+
+// ------------------------------------------------------------------
+// netloopback.c: a socket is a queue of datagrams, oldest first. since
+// every datagram takes the same time to arrive, that's also the order
+// they're due in. sockets get found by their port, which is all that
+// tells them apart, every one of them lives at 127.0.0.1.
+//
+// ports are kept in network byte order, the same way net_addr_t has
+// them, so they can go straight from an address to the lookup table.
+
+
+// what AF_INET is, without dragging in winsock for it
+enum { LOOPBACK_ADDRESS_FAMILY = 2 };
+
+// 127.0.0.1 in network byte order
+#define LOOPBACK_ADDRESS 0x0100007Fu
+
+// where the ports that get handed out to sockets that were bound to
+// port 0 (or never bound at all) start, as suggested by IANA
+enum { LOOPBACK_FIRST_EPHEMERAL_PORT = 49152 };
+
+typedef struct loopback_datagram_t
+{
+	struct loopback_datagram_t *next;
+
+	os_time_t  due_time;
+	net_addr_t from;
+	size_t     size;
+
+	// followed by the data
+} loopback_datagram_t;
+
+typedef struct loopback_socket_t
+{
+	uint16_t port; // 0 until it's bound, in network byte order
+
+	loopback_datagram_t *first;
+	loopback_datagram_t *last;
+	size_t               queued_bytes;
+} loopback_socket_t;
+
+static bool      g_enabled;
+static os_time_t g_latency;
+
+// sockets are their index in here plus LOOPBACK_SOCKET_BASE, which
+// keeps them apart from the real sockets the TCP functions hand out
+static loopback_socket_t *g_sockets[LOOPBACK_MAX_SOCKETS];
+static size_t             g_socket_limit; // no sockets at or past this index
+
+// from a port to the index of the socket that's bound to it plus one,
+// or 0 if none is
+static uint16_t g_port_sockets[65536];
+static uint32_t g_next_ephemeral_port = LOOPBACK_FIRST_EPHEMERAL_PORT;
+
+static loopback_stats_t g_stats;
+
+// the sockets could be shared between threads, like real ones can,
+// though nothing holds on to the lock for long
+static volatile uint32_t g_lock;
+
+static void Loopback_Lock(void)
+{
+	while (OS_AtomicCompareExchange32(&g_lock, 0, 1) != 0)
+		OS_Sleep(0);
+}
+
+static void Loopback_Unlock(void)
+{
+	OS_AtomicStore32(&g_lock, 0);
+}
+
+static uint16_t Loopback_SwapBytes16(uint32_t value)
+{
+	return (uint16_t)(((value & 0xFF) << 8) | ((value >> 8) & 0xFF));
+}
+
+void Loopback_Enable(double latency)
+{
+	g_enabled = true;
+	g_latency = OS_HiresTimeFromSeconds(latency);
+}
+
+bool Loopback_IsEnabled(void)
+{
+	return g_enabled;
+}
+
+bool Loopback_IsSocket(net_socket_t sock)
+{
+	return sock.value >= LOOPBACK_SOCKET_BASE && sock.value < LOOPBACK_SOCKET_BASE + LOOPBACK_MAX_SOCKETS;
+}
+
+void Loopback_GetStats(loopback_stats_t *stats)
+{
+	Loopback_Lock();
+	*stats = g_stats;
+	Loopback_Unlock();
+}
+
+// ------------------------------------------------------------------
+// internal functions, the lock has to be held for all of these
+
+static loopback_socket_t *Loopback_GetSocket(net_socket_t sock)
+{
+	if (!Loopback_IsSocket(sock))
+		return NULL;
+
+	return g_sockets[sock.value - LOOPBACK_SOCKET_BASE];
+}
+
+// returns 0 if every port is taken
+static uint16_t Loopback_FindFreePort(void)
+{
+	uint32_t port_count = 65536 - LOOPBACK_FIRST_EPHEMERAL_PORT;
+
+	for (uint32_t i = 0; i < port_count; i++)
+	{
+		uint32_t port = g_next_ephemeral_port;
+
+		g_next_ephemeral_port += 1;
+		if (g_next_ephemeral_port > 65535)
+			g_next_ephemeral_port = LOOPBACK_FIRST_EPHEMERAL_PORT;
+
+		uint16_t key = Loopback_SwapBytes16(port);
+
+		if (!g_port_sockets[key])
+			return key;
+	}
+
+	return 0;
+}
+
+static int Loopback_Bind(size_t index, loopback_socket_t *socket, uint16_t port)
+{
+	if (socket->port)
+		return -1;
+
+	if (port == 0)
+		port = Loopback_FindFreePort();
+
+	if (port == 0 || g_port_sockets[port])
+		return -1;
+
+	socket->port         = port;
+	g_port_sockets[port] = (uint16_t)(index + 1);
+
+	return 0;
+}
+
+// ------------------------------------------------------------------
+// sockets
+
+net_socket_t Loopback_CreateSocket(void)
+{
+	net_socket_t sock = { INVALID_SOCKET_VALUE };
+
+	loopback_socket_t *socket = calloc(1, sizeof(loopback_socket_t));
+
+	if (!socket)
+		return sock;
+
+	Loopback_Lock();
+
+	for (size_t i = 0; i < LOOPBACK_MAX_SOCKETS; i++)
+	{
+		if (!g_sockets[i])
+		{
+			g_sockets[i] = socket;
+			sock.value   = LOOPBACK_SOCKET_BASE + i;
+
+			if (g_socket_limit < i + 1)
+				g_socket_limit = i + 1;
+
+			break;
+		}
+	}
+
+	Loopback_Unlock();
+
+	if (sock.value == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "Loopback_CreateSocket: out of sockets\n");
+		free(socket);
+	}
+
+	return sock;
+}
+
+void Loopback_CloseSocket(net_socket_t sock)
+{
+	Loopback_Lock();
+
+	loopback_socket_t *socket = Loopback_GetSocket(sock);
+
+	if (socket)
+	{
+		g_sockets[sock.value - LOOPBACK_SOCKET_BASE] = NULL;
+
+		if (socket->port)
+			g_port_sockets[socket->port] = 0;
+	}
+
+	Loopback_Unlock();
+
+	if (socket)
+	{
+		for (loopback_datagram_t *datagram = socket->first; datagram;)
+		{
+			loopback_datagram_t *next = datagram->next;
+			free(datagram);
+			datagram = next;
+		}
+
+		free(socket);
+	}
+}
+
+int Loopback_BindSocket(net_socket_t sock, net_addr_t addr)
+{
+	int result = -1;
+
+	Loopback_Lock();
+
+	loopback_socket_t *socket = Loopback_GetSocket(sock);
+
+	if (socket)
+		result = Loopback_Bind(sock.value - LOOPBACK_SOCKET_BASE, socket, addr.port);
+
+	Loopback_Unlock();
+
+	return result;
+}
+
+int Loopback_SendPacket(net_socket_t sock, net_addr_t addr, const void *packet, size_t packet_size)
+{
+	if (packet_size > LOOPBACK_MAX_DATAGRAM_SIZE)
+		return -1;
+
+	loopback_datagram_t *datagram = malloc(sizeof(loopback_datagram_t) + packet_size);
+
+	if (!datagram)
+		return -1;
+
+	datagram->next     = NULL;
+	datagram->due_time = OS_GetHiresTime() + g_latency;
+	datagram->size     = packet_size;
+
+	memcpy(datagram + 1, packet, packet_size);
+
+	Loopback_Lock();
+
+	loopback_socket_t *socket = Loopback_GetSocket(sock);
+
+	// like a real socket, sending from one that isn't bound yet binds it
+	// to some free port
+	if (!socket || (!socket->port && Loopback_Bind(sock.value - LOOPBACK_SOCKET_BASE, socket, 0) != 0))
+	{
+		Loopback_Unlock();
+		free(datagram);
+		return -1;
+	}
+
+	datagram->from = (net_addr_t){
+		.family = LOOPBACK_ADDRESS_FAMILY,
+		.port   = socket->port,
+		.addr   = LOOPBACK_ADDRESS,
+	};
+
+	g_stats.datagrams_sent += 1;
+
+	uint16_t           target_index = g_port_sockets[addr.port];
+	loopback_socket_t *target       = target_index ? g_sockets[target_index - 1] : NULL;
+
+	if (!target || target->queued_bytes + packet_size > LOOPBACK_RECEIVE_BUFFER_SIZE)
+	{
+		g_stats.datagrams_dropped += 1;
+		free(datagram);
+	}
+	else
+	{
+		if (target->last)
+			target->last->next = datagram;
+		else
+			target->first = datagram;
+
+		target->last = datagram;
+		target->queued_bytes += packet_size;
+	}
+
+	Loopback_Unlock();
+
+	// the datagram is gone either way, as far as the sender can tell
+	return (int)packet_size;
+}
+
+int Loopback_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr)
+{
+	loopback_datagram_t *datagram = NULL;
+
+	Loopback_Lock();
+
+	loopback_socket_t *socket = Loopback_GetSocket(sock);
+
+	if (!socket)
+	{
+		Loopback_Unlock();
+		return -1;
+	}
+
+	if (socket->first && socket->first->due_time <= OS_GetHiresTime())
+	{
+		datagram = socket->first;
+
+		socket->first = datagram->next;
+		if (!socket->first)
+			socket->last = NULL;
+
+		socket->queued_bytes -= datagram->size;
+	}
+
+	Loopback_Unlock();
+
+	if (!datagram)
+		return 0;
+
+	size_t size = (datagram->size < buffer_size) ? datagram->size : buffer_size;
+
+	memcpy(buffer, datagram + 1, size);
+	*addr = datagram->from;
+
+	free(datagram);
+
+	return (int)size;
+}
+
+bool Loopback_IsReadable(net_socket_t sock)
+{
+	bool result = false;
+
+	Loopback_Lock();
+
+	loopback_socket_t *socket = Loopback_GetSocket(sock);
+
+	if (socket && socket->first)
+		result = socket->first->due_time <= OS_GetHiresTime();
+
+	Loopback_Unlock();
+
+	return result;
+}
+
+bool Loopback_GetNextDueTime(os_time_t *due_time)
+{
+	bool found = false;
+
+	Loopback_Lock();
+
+	for (size_t i = 0; i < g_socket_limit; i++)
+	{
+		loopback_socket_t *socket = g_sockets[i];
+
+		if (socket && socket->first && (!found || socket->first->due_time < *due_time))
+		{
+			*due_time = socket->first->due_time;
+			found = true;
+		}
+	}
+
+	Loopback_Unlock();
+
+	return found;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+#include "net.h"
+
+// ------------------------------------------------------------------
+// netloopback.h: a stand-in for UDP that never leaves the process.
+// once it's enabled, the UDP sockets net.h hands out aren't real
+// sockets anymore, and datagrams sent to one of them get put straight
+// into its receive queue. everything else about net.h stays the same,
+// so a server and any number of clients can run in one process, talk
+// to each other exactly like they would over the network, but without
+// the kernel getting a say in how long anything takes.
+//
+// a datagram is due a fixed latency after it was sent, by the time of
+// OS_GetHiresTime. paired up with the virtual clock (OS_UseVirtualClock)
+// that makes the whole thing deterministic: the same program sends the
+// same bytes and sees the same latencies every time.
+//
+// receiving never blocks, a blocking socket acts like it timed out if
+// there's nothing there. the TCP functions aren't affected.
+
+// what Net_GetMaxMessageSize returns, same as for real UDP
+enum { LOOPBACK_MAX_DATAGRAM_SIZE = 65507 };
+
+// how many bytes a socket's receive queue can hold, any more get
+// dropped, like they would by a real socket
+enum { LOOPBACK_RECEIVE_BUFFER_SIZE = 1 << 20 };
+
+enum { LOOPBACK_MAX_SOCKETS = 4096 };
+
+// the value of the first loopback socket, the rest follow. windows
+// hands out much smaller values for real sockets
+#define LOOPBACK_SOCKET_BASE (uintptr_t)0x4C000000
+
+// switches net.h over to the loopback. has to happen before any
+// sockets are created, and there's no switching back. the latency is
+// in seconds, one way
+void Loopback_Enable(double latency);
+bool Loopback_IsEnabled(void);
+
+// whether this is one of the loopback's sockets, rather than a real one
+bool Loopback_IsSocket(net_socket_t sock);
+
+// gets the time the next datagram in any socket's queue is due, which
+// can be in the past. returns false if there aren't any, so a program
+// that's moving the virtual clock along can skip ahead to that
+bool Loopback_GetNextDueTime(os_time_t *due_time);
+
+typedef struct loopback_stats_t
+{
+	uint64_t datagrams_sent;
+	uint64_t datagrams_dropped; // because the receive queue was full, or nobody was bound to the port
+} loopback_stats_t;
+
+void Loopback_GetStats(loopback_stats_t *stats);
+
+// ------------------------------------------------------------------
+// the sockets, as used by net.c. these behave like their net.h
+// counterparts
+
+net_socket_t Loopback_CreateSocket(void);
+void         Loopback_CloseSocket(net_socket_t sock);
+int          Loopback_BindSocket(net_socket_t sock, net_addr_t addr);
+int          Loopback_SendPacket(net_socket_t sock, net_addr_t addr, const void *packet, size_t packet_size);
+int          Loopback_RecvPacket(net_socket_t sock, void *buffer, size_t buffer_size, net_addr_t *addr);
+
+// whether a datagram is due in the socket's receive queue
+bool Loopback_IsReadable(net_socket_t sock);
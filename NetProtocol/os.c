@@ -14,6 +14,9 @@
 // and this stops it from including less often used headers
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <bcrypt.h>
+
+#pragma comment(lib, "bcrypt.lib")
 
 // ------------------------------------------------------------------
 // internal includes
@@ -31,7 +34,18 @@
 
 static LARGE_INTEGER g_qpcfreq;
 
+static volatile uint32_t g_virtual_clock;
+static volatile uint64_t g_virtual_time;
+
 os_time_t OS_GetHiresTime(void)
+{
+    if (g_virtual_clock)
+        return OS_AtomicLoad64(&g_virtual_time);
+
+    return OS_GetRealHiresTime();
+}
+
+os_time_t OS_GetRealHiresTime(void)
 {
     if (g_qpcfreq.QuadPart == 0)
     {
@@ -52,6 +66,29 @@ double OS_GetSecondsElapsed(os_time_t start, os_time_t end)
 	return ((double)end - (double)start) / (double)(g_qpcfreq.QuadPart);
 }
 
+os_time_t OS_HiresTimeFromSeconds(double seconds)
+{
+    // make sure the frequency has been queried
+    if (g_qpcfreq.QuadPart == 0)
+        OS_GetHiresTime();
+
+    return (os_time_t)(seconds*(double)g_qpcfreq.QuadPart);
+}
+
+void OS_UseVirtualClock(void)
+{
+    // the virtual clock starts at a real time, rather than at 0, because
+    // 0 is used to mean "never" in a bunch of places
+    g_virtual_time = OS_GetRealHiresTime();
+    OS_AtomicStore32(&g_virtual_clock, 1);
+}
+
+void OS_SetVirtualTime(os_time_t time)
+{
+    if (ALWAYS(g_virtual_clock) && time > g_virtual_time)
+        g_virtual_time = time;
+}
+
 // ------------------------------------------------------------------
 // error reporting
 
@@ -230,6 +267,25 @@ int OS_StartProcess(char *command)
     return result;
 }
 
+// ------------------------------------------------------------------
+// random numbers
+
+int OS_GetRandomBytes(void *buffer, size_t size)
+{
+    if (size > 0xFFFFFFFF)
+        return -1;
+
+    NTSTATUS status = BCryptGenRandom(NULL, (PUCHAR)buffer, (ULONG)size, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+
+    if (!BCRYPT_SUCCESS(status))
+    {
+        fprintf(stderr, "OS_GetRandomBytes: BCryptGenRandom failed (0x%08lx)\n", (unsigned long)status);
+        return -1;
+    }
+
+    return 0;
+}
+
 // ------------------------------------------------------------------
 // zzz...
 
@@ -237,3 +293,220 @@ void OS_Sleep(unsigned milliseconds)
 {
     Sleep((DWORD)milliseconds);
 }
+
+
+// ------------------------------------------------------------------
+// memory mapped files
+
+os_mapped_file_t OS_MapFile(const char *path)
+{
+    os_mapped_file_t result = { 0 };
+
+    // FILE_SHARE_WRITE, so a recording can be looked at while the server
+    // is still writing it
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, 
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        OS_PError("OS_MapFile: CreateFileA");
+        return result;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+    {
+        // empty files can't be mapped
+        CloseHandle(file);
+        return result;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (!mapping)
+    {
+        OS_PError("OS_MapFile: CreateFileMappingA");
+        CloseHandle(file);
+        return result;
+    }
+
+    const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!data)
+    {
+        OS_PError("OS_MapFile: MapViewOfFile");
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return result;
+    }
+
+    result.data           = data;
+    result.size           = (size_t)size.QuadPart;
+    result.file_handle    = (uintptr_t)file;
+    result.mapping_handle = (uintptr_t)mapping;
+
+    return result;
+}
+
+void OS_UnmapFile(os_mapped_file_t *file)
+{
+    if (!file->data)
+        return;
+
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE)file->mapping_handle);
+    CloseHandle((HANDLE)file->file_handle);
+
+    memset(file, 0, sizeof(*file));
+}
+
+
+// ------------------------------------------------------------------
+// threads
+
+// CreateThread wants a DWORD WINAPI (LPVOID) function, so the actual
+// procedure and its userdata get smuggled through this
+typedef struct os_thread_start_t
+{
+    os_thread_proc_t proc;
+    void *userdata;
+} os_thread_start_t;
+
+static DWORD WINAPI OS_ThreadTrampoline(LPVOID param)
+{
+    os_thread_start_t start = *(os_thread_start_t *)param;
+    HeapFree(GetProcessHeap(), 0, param);
+
+    return (DWORD)start.proc(start.userdata);
+}
+
+os_thread_t OS_CreateThread(os_thread_proc_t proc, void *userdata)
+{
+    os_thread_t result = { 0 };
+
+    os_thread_start_t *start = HeapAlloc(GetProcessHeap(), 0, sizeof(*start));
+    if (!start)
+        return result;
+
+    start->proc     = proc;
+    start->userdata = userdata;
+
+    HANDLE handle = CreateThread(NULL, 0, OS_ThreadTrampoline, start, 0, NULL);
+    if (!handle)
+    {
+        OS_PError("OS_CreateThread: CreateThread");
+        HeapFree(GetProcessHeap(), 0, start);
+        return result;
+    }
+
+    result.value = (uintptr_t)handle;
+    return result;
+}
+
+void OS_JoinThread(os_thread_t thread)
+{
+    if (!thread.value)
+        return;
+
+    WaitForSingleObject((HANDLE)thread.value, INFINITE);
+    CloseHandle((HANDLE)thread.value);
+}
+
+// ------------------------------------------------------------------
+// semaphores
+
+os_semaphore_t OS_CreateSemaphore(uint32_t initial_count)
+{
+    os_semaphore_t result = { 0 };
+
+    HANDLE handle = CreateSemaphoreA(NULL, (LONG)initial_count, MAXLONG, NULL);
+    if (!handle)
+    {
+        OS_PError("OS_CreateSemaphore: CreateSemaphoreA");
+        return result;
+    }
+
+    result.value = (uintptr_t)handle;
+    return result;
+}
+
+void OS_DestroySemaphore(os_semaphore_t semaphore)
+{
+    if (semaphore.value)
+        CloseHandle((HANDLE)semaphore.value);
+}
+
+void OS_WaitSemaphore(os_semaphore_t semaphore, unsigned timeout)
+{
+    WaitForSingleObject((HANDLE)semaphore.value, (DWORD)timeout);
+}
+
+void OS_SignalSemaphore(os_semaphore_t semaphore)
+{
+    ReleaseSemaphore((HANDLE)semaphore.value, 1, NULL);
+}
+
+// ------------------------------------------------------------------
+// quitting
+
+static volatile uint32_t g_quit_requested;
+
+// gets called on a thread of its own, whenever ctrl+c gets pressed
+static BOOL WINAPI OS_ConsoleCtrlHandler(DWORD ctrl_type)
+{
+    if (ctrl_type != CTRL_C_EVENT && ctrl_type != CTRL_BREAK_EVENT)
+        return FALSE;
+
+    // the second time around, let the default handler kill the process
+    if (OS_AtomicLoad32(&g_quit_requested))
+        return FALSE;
+
+    OS_AtomicStore32(&g_quit_requested, 1);
+    return TRUE;
+}
+
+void OS_CatchQuit(void)
+{
+    if (!SetConsoleCtrlHandler(OS_ConsoleCtrlHandler, TRUE))
+        OS_PError("SetConsoleCtrlHandler failed");
+}
+
+bool OS_QuitRequested(void)
+{
+    return OS_AtomicLoad32(&g_quit_requested) != 0;
+}
+
+// ------------------------------------------------------------------
+// atomics
+
+uint32_t OS_AtomicLoad32(volatile uint32_t *value)
+{
+    // adding zero is a cheap way to get a load with a full barrier
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG *)value, 0);
+}
+
+void OS_AtomicStore32(volatile uint32_t *value, uint32_t new_value)
+{
+    InterlockedExchange((volatile LONG *)value, (LONG)new_value);
+}
+
+uint32_t OS_AtomicAdd32(volatile uint32_t *value, uint32_t addend)
+{
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG *)value, (LONG)addend) + addend;
+}
+
+uint32_t OS_AtomicCompareExchange32(volatile uint32_t *value, uint32_t expected, uint32_t desired)
+{
+    return (uint32_t)InterlockedCompareExchange((volatile LONG *)value, (LONG)desired, (LONG)expected);
+}
+
+uint64_t OS_AtomicLoad64(volatile uint64_t *value)
+{
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)value, 0);
+}
+
+uint64_t OS_AtomicAdd64(volatile uint64_t *value, uint64_t addend)
+{
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)addend) + addend;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 typedef uint64_t os_time_t;
 
@@ -12,6 +14,24 @@ os_time_t OS_GetHiresTime(void);
 // seconds
 double   OS_GetSecondsElapsed(os_time_t start, os_time_t end);
 
+// turns a duration in seconds into the units of OS_GetHiresTime, so
+// it can be added to a timestamp
+os_time_t OS_HiresTimeFromSeconds(double seconds);
+
+// switches OS_GetHiresTime over to a virtual clock, which starts out
+// at the current time but only moves when it's told to. everything that
+// keeps time with OS_GetHiresTime then runs on simulated time, which is
+// how a benchmark can run a minute of game in a second, and get the
+// exact same timings on every run. there's no switching back
+void OS_UseVirtualClock(void);
+
+// moves the virtual clock forward to the given time, never backwards
+void OS_SetVirtualTime(os_time_t time);
+
+// the real time, even while the virtual clock is in use. for measuring
+// how long things actually took
+os_time_t OS_GetRealHiresTime(void);
+
 // prints the last error code (GetLastError() on win32) with the passed
 // in message
 void OS_PError(char *message);
@@ -23,5 +43,92 @@ int OS_Execute(char *command, int *exit_code);
 // starts a process and returns immediately
 int OS_StartProcess(char *command);
 
+// fills the buffer with cryptographically secure random bytes from
+// the OS, for keys and such. returns 0 on success
+int OS_GetRandomBytes(void *buffer, size_t size);
+
 // sleep... zzz...
 void OS_Sleep(unsigned milliseconds);
+
+// ------------------------------------------------------------------
+// memory mapped files
+
+typedef struct os_mapped_file_t
+{
+	const void *data; // NULL if the file couldn't be mapped
+	size_t      size;
+
+	uintptr_t file_handle;
+	uintptr_t mapping_handle;
+} os_mapped_file_t;
+
+// maps the whole file into memory for reading. the mapping sees the file
+// as it was when it got mapped, a file that's still being written to
+// has to be mapped again to see what got added since
+os_mapped_file_t OS_MapFile(const char *path);
+void             OS_UnmapFile(os_mapped_file_t *file);
+
+
+// ------------------------------------------------------------------
+// threads
+
+typedef struct os_thread_t
+{
+	uintptr_t value;
+} os_thread_t;
+
+typedef int (*os_thread_proc_t)(void *userdata);
+
+// starts a new thread running proc(userdata). returns a thread with
+// a value of 0 on failure
+os_thread_t OS_CreateThread(os_thread_proc_t proc, void *userdata);
+
+// waits for the thread to return and cleans up after it
+void OS_JoinThread(os_thread_t thread);
+
+// ------------------------------------------------------------------
+// semaphores, for a thread to sleep on until another thread has work
+// for it
+
+typedef struct os_semaphore_t
+{
+	uintptr_t value;
+} os_semaphore_t;
+
+// returns a semaphore with a value of 0 on failure
+os_semaphore_t OS_CreateSemaphore(uint32_t initial_count);
+void           OS_DestroySemaphore(os_semaphore_t semaphore);
+
+// waits until the count is above zero and takes one off it, or until
+// the timeout (in milliseconds) is up, whichever comes first
+void OS_WaitSemaphore(os_semaphore_t semaphore, unsigned timeout);
+
+// adds one to the count, waking up a thread that's waiting on it
+void OS_SignalSemaphore(os_semaphore_t semaphore);
+
+// ------------------------------------------------------------------
+// quitting
+
+// catches ctrl+c (and ctrl+break), so that the program gets a chance to
+// shut down properly rather than just being killed. pressing it again
+// while it's shutting down does kill it
+void OS_CatchQuit(void);
+
+// whether ctrl+c has been pressed since OS_CatchQuit
+bool OS_QuitRequested(void);
+
+// ------------------------------------------------------------------
+// atomics, all of these act as full memory barriers
+
+uint32_t OS_AtomicLoad32(volatile uint32_t *value);
+void     OS_AtomicStore32(volatile uint32_t *value, uint32_t new_value);
+
+// returns the value after the addition
+uint32_t OS_AtomicAdd32(volatile uint32_t *value, uint32_t addend);
+
+// sets value to desired if it is equal to expected. returns the value
+// from before, so it worked if that's equal to expected
+uint32_t OS_AtomicCompareExchange32(volatile uint32_t *value, uint32_t expected, uint32_t desired);
+
+uint64_t OS_AtomicLoad64(volatile uint64_t *value);
+uint64_t OS_AtomicAdd64(volatile uint64_t *value, uint64_t addend);
@@ -0,0 +1,427 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "profiler.h"
+
+// ------------------------------------------------------------------
+// profiler.c: each ring only ever gets written by its own thread, which
+// bumps the write count after the zone is in place. capturing a trace
+// copies the zones out of every ring from the newest one backwards,
+// and then checks the write counts again: any zone that the ring's
+// thread could have overwritten in the meantime gets thrown away.
+//
+// the timestamp counter's frequency isn't known up front, so it gets
+// worked out whenever a trace is captured, by comparing how far it and
+// OS_GetHiresTime went since Profiler_Init.
+
+
+typedef struct profiler_zone_t
+{
+	const char *name;
+	uint64_t    start;
+	uint64_t    end;
+} profiler_zone_t;
+
+typedef struct profiler_thread_t
+{
+	const char *name;
+
+	volatile uint32_t write_count;
+	profiler_zone_t   zones[PROFILER_RING_SIZE];
+} profiler_thread_t;
+
+static const char *g_program_name = "profile";
+static uint64_t    g_init_timestamp;
+static os_time_t   g_init_time;
+
+static profiler_thread_t *volatile g_threads[PROFILER_MAX_THREADS];
+static volatile uint32_t           g_thread_count;
+
+static THREAD_LOCAL profiler_thread_t *g_this_thread;
+static THREAD_LOCAL bool               g_this_thread_failed; // out of threads or memory, so it doesn't get recorded
+
+uint64_t Profiler_ReadTimestamp(void)
+{
+	return __rdtsc();
+}
+
+// ------------------------------------------------------------------
+// recording
+
+static profiler_thread_t *Profiler_GetThread(void)
+{
+	profiler_thread_t *thread = g_this_thread;
+
+	if (!thread && !g_this_thread_failed)
+	{
+		uint32_t index = OS_AtomicAdd32(&g_thread_count, 1) - 1;
+
+		if (index < PROFILER_MAX_THREADS)
+			thread = calloc(1, sizeof(profiler_thread_t));
+
+		if (!thread)
+		{
+			g_this_thread_failed = true;
+			return NULL;
+		}
+
+		g_this_thread    = thread;
+		g_threads[index] = thread;
+	}
+
+	return thread;
+}
+
+void Profiler_SetThreadName(const char *name)
+{
+	profiler_thread_t *thread = Profiler_GetThread();
+
+	if (thread)
+		thread->name = name;
+}
+
+void Profiler_RecordZone(const char *name, uint64_t start, uint64_t end)
+{
+	profiler_thread_t *thread = Profiler_GetThread();
+
+	if (!thread)
+		return;
+
+	uint32_t index = thread->write_count;
+
+	profiler_zone_t *zone = &thread->zones[index & (PROFILER_RING_SIZE - 1)];
+	zone->name  = name;
+	zone->start = start;
+	zone->end   = end;
+
+	thread->write_count = index + 1;
+}
+
+// ------------------------------------------------------------------
+// capturing
+
+typedef struct profiler_capture_zone_t
+{
+	profiler_zone_t zone;
+	int             thread_index;
+} profiler_capture_zone_t;
+
+typedef struct profiler_capture_t
+{
+	char path[256];
+
+	double   ticks_per_second;
+	uint64_t base_timestamp; // the start of the capture window, which is 0 in the trace
+
+	const char *thread_names[PROFILER_MAX_THREADS];
+
+	size_t                   zone_count;
+	profiler_capture_zone_t *zones;
+} profiler_capture_t;
+
+// only one capture gets written at a time, by the writer thread, which
+// sleeps until there's one to write. the zones get copied into a buffer
+// big enough for every ring. both get set up the first time captures
+// get turned on, so that the slow frame doesn't have to get any slower
+// to capture itself, and so programs that never capture don't pay
+static volatile uint32_t  g_capture_busy;
+static volatile uint32_t  g_capture_running;
+static bool               g_capture_failed; // couldn't set up the writer, don't keep trying
+static os_thread_t        g_capture_thread;
+static os_semaphore_t     g_capture_wakeup;
+static profiler_capture_t g_capture;
+static int                g_capture_count;
+
+static bool      g_overrun_capture;
+static double    g_overrun_capture_seconds = 2.0;
+static double    g_overrun_cooldown        = 10.0; // in seconds, the least amount of time between two overrun traces
+static os_time_t g_last_overrun_capture_time;
+
+static void Profiler_WriteCapture(profiler_capture_t *capture)
+{
+	FILE *file = fopen(capture->path, "w");
+
+	if (!file)
+	{
+		fprintf(stderr, "Profiler: failed to open '%s' for writing\n", capture->path);
+	}
+	else
+	{
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+		for (int i = 0; i < PROFILER_MAX_THREADS; i++)
+		{
+			if (capture->thread_names[i])
+			{
+				fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+						i, capture->thread_names[i]);
+			}
+		}
+
+		double microseconds_per_tick = 1000000.0 / capture->ticks_per_second;
+
+		for (size_t i = 0; i < capture->zone_count; i++)
+		{
+			profiler_capture_zone_t *zone = &capture->zones[i];
+
+			double start    = microseconds_per_tick*(double)(zone->zone.start - capture->base_timestamp);
+			double duration = microseconds_per_tick*(double)(zone->zone.end - zone->zone.start);
+
+			fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+					zone->zone.name, zone->thread_index, start, duration,
+					(i + 1 < capture->zone_count) ? "," : "");
+		}
+
+		fprintf(file, "]}\n");
+		fclose(file);
+
+		printf("Profiler: wrote %zu zones to '%s'\n", capture->zone_count, capture->path);
+	}
+}
+
+static int Profiler_WriterProc(void *userdata)
+{
+	profiler_capture_t *capture = userdata;
+
+	for (;;)
+	{
+		// checked before writing, so that a capture that was handed over
+		// before Profiler_Exit still gets finished
+		bool running = OS_AtomicLoad32(&g_capture_running) != 0;
+
+		if (OS_AtomicLoad32(&g_capture_busy))
+		{
+			Profiler_WriteCapture(capture);
+			OS_AtomicStore32(&g_capture_busy, 0);
+		}
+
+		if (!running)
+			break;
+
+		OS_WaitSemaphore(g_capture_wakeup, 1000);
+	}
+
+	return 0;
+}
+
+static bool Profiler_StartWriter(void)
+{
+	if (g_capture_thread.value)
+		return true;
+
+	if (g_capture_failed)
+		return false;
+
+	// room for every zone in every ring, about 16 megabytes
+	g_capture.zones = malloc((size_t)PROFILER_MAX_THREADS*PROFILER_RING_SIZE*sizeof(profiler_capture_zone_t));
+
+	if (g_capture.zones)
+		g_capture_wakeup = OS_CreateSemaphore(0);
+
+	if (g_capture_wakeup.value)
+	{
+		OS_AtomicStore32(&g_capture_running, 1);
+		g_capture_thread = OS_CreateThread(Profiler_WriterProc, &g_capture);
+	}
+
+	if (!g_capture_thread.value)
+	{
+		fprintf(stderr, "Profiler: failed to set up the trace writer, traces won't be written\n");
+
+		OS_AtomicStore32(&g_capture_running, 0);
+
+		if (g_capture_wakeup.value)
+			OS_DestroySemaphore(g_capture_wakeup);
+
+		g_capture_wakeup.value = 0;
+
+		free(g_capture.zones);
+		g_capture.zones = NULL;
+
+		g_capture_failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void Profiler_Init(const char *program_name)
+{
+	g_program_name   = program_name;
+	g_init_timestamp = Profiler_ReadTimestamp();
+	g_init_time      = OS_GetHiresTime();
+}
+
+void Profiler_Exit(void)
+{
+	g_overrun_capture = false;
+
+	if (!g_capture_thread.value)
+		return;
+
+	OS_AtomicStore32(&g_capture_running, 0);
+	OS_SignalSemaphore(g_capture_wakeup);
+	OS_JoinThread(g_capture_thread);
+
+	OS_DestroySemaphore(g_capture_wakeup);
+
+	g_capture_thread.value = 0;
+	g_capture_wakeup.value = 0;
+
+	free(g_capture.zones);
+	g_capture.zones = NULL;
+}
+
+// copies out the zones of one thread that ended after the cutoff,
+// returns how many it copied
+static size_t Profiler_CopyZones(profiler_thread_t *thread, int thread_index, uint64_t cutoff,
+								 profiler_capture_zone_t *zones, size_t capacity)
+{
+	uint32_t write_count = thread->write_count;
+	uint32_t available   = (write_count < PROFILER_RING_SIZE) ? write_count : PROFILER_RING_SIZE;
+
+	size_t count = 0;
+
+	// newest first, so the zones that are most likely to be overwritten
+	// while this runs come last
+	for (uint32_t i = 0; i < available && count < capacity; i++)
+	{
+		uint32_t index = write_count - 1 - i;
+		profiler_zone_t *zone = &thread->zones[index & (PROFILER_RING_SIZE - 1)];
+
+		if (zone->end < cutoff)
+			break;
+
+		zones[count].zone         = *zone;
+		zones[count].thread_index = thread_index;
+		count += 1;
+	}
+
+	// the thread kept going while we were copying. once it used up the
+	// free slots, it started overwriting our oldest zones. the one extra
+	// is for the zone it might have been in the middle of writing
+	uint32_t written    = thread->write_count - write_count + 1;
+	uint32_t free_slots = PROFILER_RING_SIZE - available;
+
+	if (written > free_slots)
+	{
+		uint32_t lost = written - free_slots;
+		size_t   safe = (available > lost) ? available - lost : 0;
+
+		if (count > safe)
+			count = safe;
+	}
+
+	return count;
+}
+
+bool Profiler_CaptureTrace(double capture_seconds)
+{
+	if (!Profiler_StartWriter())
+		return false;
+
+	if (OS_AtomicLoad32(&g_capture_busy))
+		return false;
+
+	uint64_t  now_timestamp = Profiler_ReadTimestamp();
+	os_time_t now           = OS_GetHiresTime();
+
+	double seconds_since_init = OS_GetSecondsElapsed(g_init_time, now);
+
+	if (seconds_since_init < 0.05)
+		return false;
+
+	profiler_capture_t *capture = &g_capture;
+
+	capture->ticks_per_second = (double)(now_timestamp - g_init_timestamp) / seconds_since_init;
+
+	uint64_t window = (uint64_t)(capture_seconds*capture->ticks_per_second);
+	uint64_t cutoff = (window < now_timestamp - g_init_timestamp) ? now_timestamp - window : g_init_timestamp;
+
+	capture->base_timestamp = cutoff;
+
+	memset(capture->thread_names, 0, sizeof(capture->thread_names));
+
+	uint32_t thread_count = OS_AtomicLoad32(&g_thread_count);
+
+	if (thread_count > PROFILER_MAX_THREADS)
+		thread_count = PROFILER_MAX_THREADS;
+
+	size_t capacity = (size_t)thread_count*PROFILER_RING_SIZE;
+
+	capture->zone_count = 0;
+
+	for (uint32_t i = 0; i < thread_count; i++)
+	{
+		profiler_thread_t *thread = g_threads[i];
+
+		if (!thread)
+			continue;
+
+		capture->thread_names[i] = thread->name ? thread->name : "unnamed";
+
+		capture->zone_count += Profiler_CopyZones(thread, (int)i, cutoff,
+												  &capture->zones[capture->zone_count],
+												  capacity - capture->zone_count);
+	}
+
+	// zones that started before the window still get shown in full
+	for (size_t i = 0; i < capture->zone_count; i++)
+	{
+		if (capture->zones[i].zone.start < capture->base_timestamp)
+			capture->base_timestamp = capture->zones[i].zone.start;
+	}
+
+	snprintf(capture->path, sizeof(capture->path), "%s_trace_%d.json", g_program_name, g_capture_count++);
+
+	OS_AtomicStore32(&g_capture_busy, 1);
+	OS_SignalSemaphore(g_capture_wakeup);
+
+	return true;
+}
+
+void Profiler_SetOverrunCapture(bool enabled, double capture_seconds)
+{
+	g_overrun_capture         = enabled;
+	g_overrun_capture_seconds = capture_seconds;
+
+	// ahead of time, rather than in the middle of the first slow frame
+	if (enabled && !Profiler_StartWriter())
+		g_overrun_capture = false;
+}
+
+void Profiler_EndFrame(double frame_seconds, double budget_seconds)
+{
+	if (!g_overrun_capture || frame_seconds <= budget_seconds)
+		return;
+
+	os_time_t now = OS_GetHiresTime();
+
+	if (g_last_overrun_capture_time &&
+		OS_GetSecondsElapsed(g_last_overrun_capture_time, now) < g_overrun_cooldown)
+	{
+		return;
+	}
+
+	if (Profiler_CaptureTrace(g_overrun_capture_seconds))
+	{
+		g_last_overrun_capture_time = now;
+
+		printf("Profiler: a frame took %.2f ms out of %.2f ms, writing '%s'\n",
+			   1000.0*frame_seconds, 1000.0*budget_seconds, g_capture.path);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+
+// ------------------------------------------------------------------
+// profiler.h: a tiny always-on profiler. zones get marked with a pair
+// of macros:
+//
+//     TIMED_BLOCK_BEGIN(Sim_Run);
+//     Sim_Run(dt);
+//     TIMED_BLOCK_END(Sim_Run);
+//
+// which read the CPU's timestamp counter at both ends and put the zone
+// into a ring buffer that belongs to the calling thread. the rings
+// hold the last few seconds of zones at all times, so when a frame
+// takes too long, the frame itself (and what led up to it) is already
+// recorded, and gets written out as a chrome trace, which can be
+// opened with chrome://tracing or https://ui.perfetto.dev
+//
+// building with PROFILER_ENABLED defined as 0 turns the macros into
+// nothing at all.
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+// zones per thread. at a few thousand zones per second this covers
+// more than enough time to see what led up to a slow frame
+enum { PROFILER_RING_SIZE = 1 << 16 }; // must be a power of two
+
+enum { PROFILER_MAX_THREADS = 8 };
+
+// ------------------------------------------------------------------
+
+#if PROFILER_ENABLED
+
+#define TIMED_BLOCK_BEGIN(name) uint64_t timed_block_##name = Profiler_ReadTimestamp()
+#define TIMED_BLOCK_END(name) Profiler_RecordZone(#name, timed_block_##name, Profiler_ReadTimestamp())
+
+#else
+
+#define TIMED_BLOCK_BEGIN(name)
+#define TIMED_BLOCK_END(name)
+
+#endif
+
+// the name goes into the file names of the traces, like
+// "netserver_trace_3.json"
+void Profiler_Init(const char *program_name);
+
+// finishes writing the trace that's being written, if there is one, and
+// stops the writer thread
+void Profiler_Exit(void);
+
+// shows up as the thread's name in the trace, the name has to stay
+// around forever
+void Profiler_SetThreadName(const char *name);
+
+uint64_t Profiler_ReadTimestamp(void);
+
+// the name has to stay around forever, it's meant for string literals
+void Profiler_RecordZone(const char *name, uint64_t start, uint64_t end);
+
+// turns writing out traces of slow frames on or off. a trace covers
+// the last capture_seconds before the end of the slow frame. it only
+// writes one at a time, and not more often than every few seconds, so
+// a server that's permanently overloaded doesn't fill up the disk.
+// turning it on sets up the writer thread and its buffer (about 16
+// megabytes), which stay around until Profiler_Exit
+void Profiler_SetOverrunCapture(bool enabled, double capture_seconds);
+
+// to be called at the end of every frame (or tick) with how long it
+// took, and how long it should have taken at most
+void Profiler_EndFrame(double frame_seconds, double budget_seconds);
+
+// writes out a trace of the last capture_seconds right away, on the
+// writer thread, which gets set up first if it hasn't been yet. returns
+// false if one is already being written
+bool Profiler_CaptureTrace(double capture_seconds);
@@ -10,12 +10,20 @@
 // the receiving code know how to interpret the rest of the message
 typedef enum net_packet_e
 {
-	// a ping to the server get responded to with another ping
+	// pings get sent both ways, and are sent straight back by
+	// whoever receives them so the sender can measure the round
+	// trip time
 	NETPACKET_PING,
 
-	// this gets sent to the server from the client if they
-	// (willingly) disconnect
-	NETPACKET_CLIENT_DISCONNECTED,
+	// this gets sent to the server from the client when it wants
+	// to join, and keeps getting sent until the first world state
+	// comes back
+	NETPACKET_CONNECT,
+
+	// the server's answer to a connect packet without a valid cookie.
+	// the client has to send the cookie back in its connect packets
+	// before the server will let it in
+	NETPACKET_CHALLENGE,
 
 	// this is the input state of the client, the main means
 	// in which the client tells the server about its intentions
@@ -24,8 +32,53 @@ typedef enum net_packet_e
 	// this is the packet that the server sends back to the client
 	// to let it know about the entities in the game world
 	NETPACKET_WORLD_STATE,
+
+	// packets too big to fit in a single datagram get split up into
+	// these, and put back together on the other end, see fragment.h
+	NETPACKET_FRAGMENT,
+
+	// several packets packed into a single datagram, so that they share
+	// the UDP/IP header and the system call, see bundle.h
+	NETPACKET_BUNDLE,
+
+	// a spectator asking for snapshots of the world, which it keeps
+	// sending for as long as it wants them. these double as the acks for
+	// the snapshots, see spectate.h
+	NETPACKET_SPECTATE,
+
+	// the world as a spectator gets to see it, which is usually a delta
+	// from a snapshot the spectator said it already has, see spectate.h
+	NETPACKET_SNAPSHOT,
 } net_packet_e;
 
+// reliable messages don't get packets of their own, they ride along at
+// the end of input packets (client to server) and world state packets
+// (server to client), see channel.h. these are the kinds of messages
+typedef enum net_message_e
+{
+	// the server tells everyone about a player joining or changing
+	// their name, and tells a new client about everybody that is
+	// already there
+	NETMSG_PLAYER_JOINED,
+
+	// the server tells everyone about a player leaving
+	NETMSG_PLAYER_LEFT,
+
+	// the server tells everyone who shot who
+	NETMSG_KILL,
+
+	// the client tells the server it's (willingly) leaving
+	NETMSG_DISCONNECT,
+} net_message_e;
+
+// connect packets carry these, and the server ignores any that don't
+// match its own. bump the version whenever the packets change
+enum 
+{ 
+	NET_PROTOCOL_ID      = 0x4E47414D, // "NGAM"
+	NET_PROTOCOL_VERSION = 2,
+};
+
 // this is the header that needs to be in front of all packets
 typedef struct net_header_t
 {
@@ -33,6 +86,45 @@ typedef struct net_header_t
 	unsigned short sequence; // the sequence number can be used to discard (or re-order) out-of-order packets
 } net_header_t;
 
+// no datagram we send is bigger than this, to stay clear of IP
+// fragmentation on pretty much any network path
+enum { NET_MAX_DATAGRAM_SIZE = 1200 };
+
+// a packet gets split into at most this many fragments, which puts
+// the biggest packet at 8kB
+enum 
+{ 
+	NET_FRAGMENT_DATA_SIZE = 1024,
+	NET_MAX_FRAGMENT_COUNT = 8,
+};
+
+// this is the packet associated with NETPACKET_FRAGMENT. the data is
+// a slice of the original packet, header and all. the last fragment
+// of a packet is usually shorter, only the part of data that's used
+// gets sent
+typedef struct net_fragment_t
+{
+	net_header_t header;
+
+	unsigned short packet_id;      // which packet this is a fragment of, counts up per packet
+	unsigned char  fragment_index;
+	unsigned char  fragment_count;
+
+	unsigned char data[NET_FRAGMENT_DATA_SIZE];
+} net_fragment_t;
+
+// this is the packet associated with NETPACKET_PING. the receiver of a
+// ping sends it back unchanged apart from setting is_reply, so the
+// send_time comes back to the sender, who is the only one that can
+// make sense of it
+typedef struct net_ping_t
+{
+	net_header_t header;
+
+	unsigned int       is_reply;
+	unsigned long long send_time; // the sender's OS_GetHiresTime() when the ping was sent
+} net_ping_t;
+
 // these are the input button states the client could send to
 // the server
 typedef enum net_button_e
@@ -47,22 +139,123 @@ typedef enum net_button_e
 
 enum { NET_USERNAME_MAX_SIZE = 32 };
 
-// this is the packet associated with NETPACKET_INPUT
-typedef struct net_input_t
+// players get an id that stays the same for as long as they're 
+// connected, which reliable messages use to refer to them
+enum { NET_INVALID_PLAYER_ID = 0xFF };
+
+// the biggest a single reliable message can be, and the most space
+// reliable messages (and acks) can take up at the end of a packet
+enum 
+{ 
+	NET_MAX_MESSAGE_SIZE    = 64, 
+	NET_RELIABLE_BLOCK_SIZE = 512,
+};
+
+// every reliable message starts with its kind
+typedef struct net_msg_player_joined_t
+{
+	unsigned char kind;
+	unsigned char player_id;
+	char name[NET_USERNAME_MAX_SIZE];
+} net_msg_player_joined_t;
+
+typedef struct net_msg_player_left_t
+{
+	unsigned char kind;
+	unsigned char player_id;
+} net_msg_player_left_t;
+
+typedef struct net_msg_kill_t
+{
+	unsigned char kind;
+	unsigned char killer_id;
+	unsigned char victim_id;
+} net_msg_kill_t;
+
+typedef struct net_msg_disconnect_t
+{
+	unsigned char kind;
+} net_msg_disconnect_t;
+
+typedef union net_message_t
+{
+	unsigned char kind;
+
+	net_msg_player_joined_t player_joined;
+	net_msg_player_left_t   player_left;
+	net_msg_kill_t          kill;
+	net_msg_disconnect_t    disconnect;
+
+	unsigned char data[NET_MAX_MESSAGE_SIZE];
+} net_message_t;
+
+// this is the packet associated with NETPACKET_CONNECT
+typedef struct net_connect_t
 {
-	// all packets start with the header
 	net_header_t header;
 
+	unsigned int   protocol_id;      // NET_PROTOCOL_ID
+	unsigned short protocol_version; // NET_PROTOCOL_VERSION
+	unsigned short padding;
+
+	// 0 until the server has sent us a challenge, then whatever cookie
+	// came with the most recent one
+	unsigned long long cookie;
+
 	// the username of the client
 	char name[NET_USERNAME_MAX_SIZE];
+} net_connect_t;
+
+// this is the packet associated with NETPACKET_CHALLENGE. the cookie
+// is a hash of the client's address, keyed with a secret only the
+// server knows, so the server can check it without having to remember
+// handing it out. the challenge is smaller than the connect packet it
+// answers, so nobody can use the server to flood a spoofed address
+// with more traffic than they send themselves
+typedef struct net_challenge_t
+{
+	net_header_t header;
 
-	// bitmask of held down buttons
-	int btn_down;
+	unsigned int       padding;
+	unsigned long long cookie;
+} net_challenge_t;
 
-	// mouse position in world space (the server doesn't have a concept
-	// of screenspace)
-	float mouse_x;
-	float mouse_y;
+// every input packet repeats this many of the most recent input 
+// frames, so the server can fill in the frames of lost packets
+enum { NET_INPUT_HISTORY_COUNT = 6 };
+
+// mouse positions are sent in fixed point with this many steps per
+// world unit
+enum { NET_MOUSE_PRECISION = 4 };
+
+// this is the packet associated with NETPACKET_INPUT. the frames are 
+// ordered newest first, and the sequence number in the header is that
+// of the newest frame, so frame i has sequence number sequence - i.
+// see netinput.h for packing and unpacking these
+typedef struct net_input_t
+{
+	// all packets start with the header
+	net_header_t header;
+
+	// how many of the frames below are valid, 1 to NET_INPUT_HISTORY_COUNT
+	unsigned char frame_count;
+
+	// bitmask of held down buttons of the newest frame
+	unsigned char btn_down;
+
+	// the buttons of frame i + 1 are the buttons of frame i xor'd with
+	// btn_deltas[i], buttons don't change very often so these are 
+	// mostly 0
+	unsigned char btn_deltas[NET_INPUT_HISTORY_COUNT - 1];
+
+	// mouse positions in world space (the server doesn't have a concept
+	// of screenspace), see NET_MOUSE_PRECISION
+	short mouse_x[NET_INPUT_HISTORY_COUNT];
+	short mouse_y[NET_INPUT_HISTORY_COUNT];
+
+	// acks and reliable messages for the server, only the part of this
+	// that's actually used gets sent
+	unsigned char reliable[NET_RELIABLE_BLOCK_SIZE];
 } net_input_t;
 
 // to indicate a dead/invalid entity, we reserve the 0th index
@@ -92,11 +285,12 @@ typedef union net_entity_id_t
 
 enum { MAX_CLIENT_COUNT = 32 };
 
-// this tells the client what players are connected to the server
+// this tells the client which entity belongs to which player, the
+// names of the players come in through NETMSG_PLAYER_JOINED
 typedef struct net_player_t
 {
-	char name[NET_USERNAME_MAX_SIZE];
 	net_entity_id_t entity;
+	unsigned char   player_id;
 } net_player_t;
 
 typedef struct net_entity_state_t
@@ -107,7 +301,7 @@ typedef struct net_entity_state_t
 	float size;             // 24
 } net_entity_state_t;
 
-// this packet comes to 4236 bytes, which will likely be fragmented into 3 separate IP packets,
+// this packet comes to 3352 bytes (plus reliable messages), so it gets sent as 4 fragments.
 // if any one of those fragments is lost, all of the packet is discarded.
 // so this is not the best way to send a big state update!
 // of course, we only need to send updates for entities that actually exist... exercise for the
@@ -120,5 +314,24 @@ typedef struct net_world_state_t
 	net_player_t players[MAX_CLIENT_COUNT];
 
 	net_entity_id_t client_id;
+
+	// the tick this world state is the result of
+	unsigned int server_tick;
+
+	// how many seconds the input used for this tick spent waiting in the
+	// server's input queue, negative if the queue ran dry. the client uses
+	// this to speed up or slow down its ticks to keep its inputs arriving
+	// just in time
+	float input_lead;
+
+	// how often the server's input queue for this client has run dry or
+	// had to catch up by consuming two inputs in one tick (these wrap)
+	unsigned short input_underflows;
+	unsigned short input_overflows;
+
 	net_entity_state_t world_state[MAX_ENTITY_COUNT];
+
+	// acks and reliable messages for the client, only the part of this
+	// that's actually used gets sent
+	unsigned char reliable[NET_RELIABLE_BLOCK_SIZE];
 } net_world_state_t;
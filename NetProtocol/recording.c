@@ -0,0 +1,524 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "recording.h"
+
+// ------------------------------------------------------------------
+// recording.c: the codec and the reader. the reader never copies the
+// file, it decodes right out of the mapping, and the only thing it
+// allocates is the keyframe index.
+
+
+enum { REC_ENTITY_FIELD_COUNT = 6 };
+
+static const rec_frame_t g_empty_frame;
+
+static unsigned char *Rec_Put(unsigned char *at, const void *value, size_t size)
+{
+	memcpy(at, value, size);
+	return at + size;
+}
+
+// the fields of an entity, as raw bits so that comparing them doesn't
+// get tripped up by -0 or NaNs
+static void Rec_GetFields(const net_entity_state_t *state, uint32_t fields[REC_ENTITY_FIELD_COUNT])
+{
+	memcpy(fields, state, REC_ENTITY_FIELD_COUNT*sizeof(uint32_t));
+}
+
+static void Rec_SetFields(net_entity_state_t *state, const uint32_t fields[REC_ENTITY_FIELD_COUNT])
+{
+	memcpy(state, fields, REC_ENTITY_FIELD_COUNT*sizeof(uint32_t));
+}
+
+static const rec_player_t *Rec_FindPlayer(const rec_player_t *players, int player_count, unsigned char player_id)
+{
+	for (int i = 0; i < player_count; i++)
+	{
+		if (players[i].player_id == player_id)
+			return &players[i];
+	}
+
+	return NULL;
+}
+
+// ------------------------------------------------------------------
+// encoding
+
+size_t Rec_EncodeFrame(const rec_frame_t *from, const rec_frame_t *to, unsigned char *buffer, size_t buffer_size)
+{
+	// checking once up front beats checking every field
+	if (buffer_size < REC_MAX_FRAME_SIZE)
+		return 0;
+
+	if (NEVER(to->player_count < 0 || to->player_count > MAX_CLIENT_COUNT))
+		return 0;
+
+	if (!from)
+		from = &g_empty_frame;
+
+	unsigned char *at = buffer;
+	at = Rec_Put(at, &to->tick, sizeof(to->tick));
+	*at++ = (unsigned char)to->player_count;
+
+	for (int i = 0; i < to->player_count; i++)
+	{
+		const rec_player_t *player = &to->players[i];
+		const rec_player_t *before = Rec_FindPlayer(from->players, from->player_count, player->player_id);
+
+		bool send_name = !before || memcmp(before->name, player->name, NET_USERNAME_MAX_SIZE) != 0;
+
+		*at++ = player->player_id;
+		*at++ = send_name ? REC_PLAYER_NAME : 0;
+		at = Rec_Put(at, &player->entity.value, sizeof(player->entity.value));
+
+		if (send_name)
+			at = Rec_Put(at, player->name, NET_USERNAME_MAX_SIZE);
+	}
+
+	unsigned char *changed = at;
+	memset(changed, 0, MAX_ENTITY_COUNT/8);
+	at += MAX_ENTITY_COUNT/8;
+
+	for (int i = 0; i < MAX_ENTITY_COUNT; i++)
+	{
+		uint32_t old_fields[REC_ENTITY_FIELD_COUNT];
+		uint32_t new_fields[REC_ENTITY_FIELD_COUNT];
+		Rec_GetFields(&from->entities[i], old_fields);
+		Rec_GetFields(&to->entities[i], new_fields);
+
+		unsigned char field_mask = 0;
+
+		for (int field = 0; field < REC_ENTITY_FIELD_COUNT; field++)
+		{
+			if (old_fields[field] != new_fields[field])
+				field_mask |= (unsigned char)(1 << field);
+		}
+
+		if (!field_mask)
+			continue;
+
+		changed[i / 8] |= (unsigned char)(1 << (i % 8));
+
+		*at++ = field_mask;
+
+		for (int field = 0; field < REC_ENTITY_FIELD_COUNT; field++)
+		{
+			if (field_mask & (1 << field))
+				at = Rec_Put(at, &new_fields[field], sizeof(new_fields[field]));
+		}
+	}
+
+	return (size_t)(at - buffer);
+}
+
+// ------------------------------------------------------------------
+// decoding
+
+typedef struct rec_cursor_t
+{
+	const unsigned char *at;
+	const unsigned char *end;
+	bool ok; // false once something got read past the end
+} rec_cursor_t;
+
+static void Rec_Get(rec_cursor_t *cursor, void *value, size_t size)
+{
+	if (!cursor->ok || (size_t)(cursor->end - cursor->at) < size)
+	{
+		memset(value, 0, size);
+		cursor->ok = false;
+		return;
+	}
+
+	memcpy(value, cursor->at, size);
+	cursor->at += size;
+}
+
+static unsigned char Rec_GetByte(rec_cursor_t *cursor)
+{
+	unsigned char result;
+	Rec_Get(cursor, &result, sizeof(result));
+	return result;
+}
+
+bool Rec_DecodeFrame(rec_frame_t *frame, rec_record_kind_e kind, const unsigned char *data, size_t size)
+{
+	rec_cursor_t cursor = { .at = data, .end = data + size, .ok = true };
+
+	if (kind == REC_RECORD_KEYFRAME)
+		*frame = g_empty_frame;
+	else if (kind != REC_RECORD_DELTA)
+		return false;
+
+	Rec_Get(&cursor, &frame->tick, sizeof(frame->tick));
+
+	int player_count = Rec_GetByte(&cursor);
+
+	if (player_count > MAX_CLIENT_COUNT)
+		return false;
+
+	// names only come in when they're new, the rest come from the frame
+	// before
+	rec_player_t old_players[MAX_CLIENT_COUNT];
+	int          old_player_count = frame->player_count;
+	memcpy(old_players, frame->players, sizeof(old_players));
+
+	for (int i = 0; i < player_count; i++)
+	{
+		rec_player_t *player = &frame->players[i];
+
+		player->player_id = Rec_GetByte(&cursor);
+
+		unsigned char flags = Rec_GetByte(&cursor);
+		Rec_Get(&cursor, &player->entity.value, sizeof(player->entity.value));
+
+		if (flags & REC_PLAYER_NAME)
+		{
+			Rec_Get(&cursor, player->name, NET_USERNAME_MAX_SIZE);
+			player->name[NET_USERNAME_MAX_SIZE - 1] = 0;
+		}
+		else
+		{
+			const rec_player_t *before = Rec_FindPlayer(old_players, old_player_count, player->player_id);
+
+			if (before)
+				memcpy(player->name, before->name, NET_USERNAME_MAX_SIZE);
+			else
+				memset(player->name, 0, NET_USERNAME_MAX_SIZE);
+		}
+	}
+
+	frame->player_count = player_count;
+
+	unsigned char changed[MAX_ENTITY_COUNT/8];
+	Rec_Get(&cursor, changed, sizeof(changed));
+
+	for (int i = 0; i < MAX_ENTITY_COUNT && cursor.ok; i++)
+	{
+		if (!(changed[i / 8] & (1 << (i % 8))))
+			continue;
+
+		unsigned char field_mask = Rec_GetByte(&cursor);
+
+		uint32_t fields[REC_ENTITY_FIELD_COUNT];
+		Rec_GetFields(&frame->entities[i], fields);
+
+		for (int field = 0; field < REC_ENTITY_FIELD_COUNT; field++)
+		{
+			if (field_mask & (1 << field))
+				Rec_Get(&cursor, &fields[field], sizeof(fields[field]));
+		}
+
+		Rec_SetFields(&frame->entities[i], fields);
+	}
+
+	return cursor.ok && cursor.at == cursor.end;
+}
+
+// ------------------------------------------------------------------
+// reading
+
+typedef struct rec_record_t
+{
+	rec_record_kind_e    kind;
+	const unsigned char *payload;
+	size_t               payload_size;
+	uint64_t             next_offset;
+} rec_record_t;
+
+// false if there's no whole record at the offset
+static bool Rec_GetRecord(const rec_reader_t *reader, uint64_t offset, rec_record_t *record)
+{
+	const unsigned char *data = reader->file.data;
+	size_t               size = reader->file.size;
+
+	if (offset > size || size - (size_t)offset < REC_RECORD_HEADER_SIZE)
+		return false;
+
+	const unsigned char *header = data + (size_t)offset;
+
+	uint32_t payload_size;
+	memcpy(&payload_size, header, sizeof(payload_size));
+
+	size_t payload_offset = (size_t)offset + REC_RECORD_HEADER_SIZE;
+
+	if (size - payload_offset < payload_size)
+		return false;
+
+	record->kind         = (rec_record_kind_e)header[4];
+	record->payload      = data + payload_offset;
+	record->payload_size = payload_size;
+	record->next_offset  = payload_offset + payload_size;
+
+	return true;
+}
+
+static bool Rec_IsFrame(const rec_record_t *record)
+{
+	return (record->kind == REC_RECORD_KEYFRAME || record->kind == REC_RECORD_DELTA) &&
+		   record->payload_size >= sizeof(uint32_t);
+}
+
+static uint32_t Rec_GetFrameTick(const rec_record_t *record)
+{
+	uint32_t tick;
+	memcpy(&tick, record->payload, sizeof(tick));
+	return tick;
+}
+
+static bool Rec_ReadIndex(rec_reader_t *reader)
+{
+	const unsigned char *data = reader->file.data;
+	size_t               size = reader->file.size;
+
+	if (size < REC_HEADER_SIZE + REC_FOOTER_SIZE)
+		return false;
+
+	uint64_t index_offset;
+	uint32_t magic;
+	memcpy(&index_offset, data + size - REC_FOOTER_SIZE,     sizeof(index_offset));
+	memcpy(&magic,        data + size - REC_FOOTER_SIZE + 8, sizeof(magic));
+
+	rec_record_t record;
+
+	if (magic != REC_END_MAGIC || !Rec_GetRecord(reader, index_offset, &record) || record.kind != REC_RECORD_INDEX)
+		return false;
+
+	if (record.payload_size < REC_INDEX_HEADER_SIZE)
+		return false;
+
+	uint32_t first_tick, last_tick, keyframe_count;
+	memcpy(&first_tick,     record.payload + 0, sizeof(first_tick));
+	memcpy(&last_tick,      record.payload + 4, sizeof(last_tick));
+	memcpy(&keyframe_count, record.payload + 8, sizeof(keyframe_count));
+
+	if (keyframe_count == 0 || record.payload_size != REC_INDEX_HEADER_SIZE + (size_t)keyframe_count*sizeof(uint64_t))
+		return false;
+
+	reader->keyframes = malloc((size_t)keyframe_count*sizeof(uint64_t));
+
+	if (!reader->keyframes)
+		return false;
+
+	memcpy(reader->keyframes, record.payload + REC_INDEX_HEADER_SIZE, (size_t)keyframe_count*sizeof(uint64_t));
+
+	reader->first_tick     = first_tick;
+	reader->last_tick      = last_tick;
+	reader->base_slot      = first_tick / reader->keyframe_interval;
+	reader->keyframe_count = keyframe_count;
+
+	return true;
+}
+
+// for files without an index: walks every record, which only has to
+// look at the record headers, and the ticks of the keyframes
+static bool Rec_BuildIndex(rec_reader_t *reader)
+{
+	uint32_t capacity = 0;
+
+	rec_record_t record;
+
+	for (uint64_t offset = REC_HEADER_SIZE; Rec_GetRecord(reader, offset, &record); offset = record.next_offset)
+	{
+		if (record.kind == REC_RECORD_INDEX)
+			break;
+
+		if (!Rec_IsFrame(&record))
+			continue;
+
+		uint32_t tick = Rec_GetFrameTick(&record);
+
+		// deltas from before the first keyframe have nothing to go off
+		if (reader->keyframe_count == 0 && record.kind != REC_RECORD_KEYFRAME)
+			continue;
+
+		reader->last_tick = tick;
+
+		if (record.kind != REC_RECORD_KEYFRAME)
+			continue;
+
+		uint32_t slot = tick / reader->keyframe_interval;
+
+		if (reader->keyframe_count == 0)
+		{
+			reader->first_tick = tick;
+			reader->base_slot  = slot;
+		}
+
+		if (slot < reader->base_slot + reader->keyframe_count)
+			continue; // a second keyframe in the same interval
+
+		uint32_t count = slot - reader->base_slot + 1;
+
+		if (count > capacity)
+		{
+			uint32_t new_capacity = capacity ? capacity : 64;
+			while (new_capacity < count)
+				new_capacity *= 2;
+
+			uint64_t *keyframes = realloc(reader->keyframes, (size_t)new_capacity*sizeof(uint64_t));
+
+			if (!keyframes)
+				return false;
+
+			reader->keyframes = keyframes;
+			capacity          = new_capacity;
+		}
+
+		// intervals that got skipped over fall back on the keyframe before
+		while (reader->keyframe_count + 1 < count)
+		{
+			reader->keyframes[reader->keyframe_count] = reader->keyframes[reader->keyframe_count - 1];
+			reader->keyframe_count += 1;
+		}
+
+		reader->keyframes[reader->keyframe_count++] = offset;
+	}
+
+	return reader->keyframe_count > 0;
+}
+
+int Rec_OpenReader(rec_reader_t *reader, const char *path)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->file = OS_MapFile(path);
+
+	if (!reader->file.data)
+	{
+		fprintf(stderr, "Rec_OpenReader: failed to open '%s'\n", path);
+		return -1;
+	}
+
+	uint32_t magic   = 0;
+	uint32_t version = 0;
+
+	if (reader->file.size >= REC_HEADER_SIZE)
+	{
+		const unsigned char *header = reader->file.data;
+		memcpy(&magic,                     header + 0,  sizeof(magic));
+		memcpy(&version,                   header + 4,  sizeof(version));
+		memcpy(&reader->seconds_per_tick,  header + 8,  sizeof(reader->seconds_per_tick));
+		memcpy(&reader->keyframe_interval, header + 16, sizeof(reader->keyframe_interval));
+		memcpy(&reader->start_time,        header + 24, sizeof(reader->start_time));
+	}
+
+	if (magic != REC_MAGIC)
+	{
+		fprintf(stderr, "Rec_OpenReader: '%s' isn't a recording\n", path);
+		Rec_CloseReader(reader);
+		return -1;
+	}
+
+	if (version != REC_VERSION)
+	{
+		fprintf(stderr, "Rec_OpenReader: '%s' is version %u, but we only know version %d\n", path, version, REC_VERSION);
+		Rec_CloseReader(reader);
+		return -1;
+	}
+
+	if (reader->seconds_per_tick <= 0.0 || reader->keyframe_interval == 0)
+	{
+		fprintf(stderr, "Rec_OpenReader: '%s' has a bogus header\n", path);
+		Rec_CloseReader(reader);
+		return -1;
+	}
+
+	reader->indexed = Rec_ReadIndex(reader);
+
+	if (!reader->indexed && !Rec_BuildIndex(reader))
+	{
+		fprintf(stderr, "Rec_OpenReader: '%s' has no frames in it\n", path);
+		Rec_CloseReader(reader);
+		return -1;
+	}
+
+	if (!Rec_Seek(reader, reader->first_tick))
+	{
+		fprintf(stderr, "Rec_OpenReader: '%s' has a broken first keyframe\n", path);
+		Rec_CloseReader(reader);
+		return -1;
+	}
+
+	return 0;
+}
+
+void Rec_CloseReader(rec_reader_t *reader)
+{
+	OS_UnmapFile(&reader->file);
+
+	free(reader->keyframes);
+	reader->keyframes = NULL;
+}
+
+bool Rec_Seek(rec_reader_t *reader, uint32_t tick)
+{
+	if (tick < reader->first_tick) tick = reader->first_tick;
+	if (tick > reader->last_tick)  tick = reader->last_tick;
+
+	uint32_t slot = tick / reader->keyframe_interval - reader->base_slot;
+
+	if (slot >= reader->keyframe_count)
+		slot = reader->keyframe_count - 1;
+
+	rec_record_t record;
+
+	if (!Rec_GetRecord(reader, reader->keyframes[slot], &record) || record.kind != REC_RECORD_KEYFRAME)
+		return false;
+
+	// when the start of an interval got dropped, its keyframe is from
+	// later on, and the tick is in the interval before
+	while (slot > 0 && Rec_IsFrame(&record) && Rec_GetFrameTick(&record) > tick)
+	{
+		slot -= 1;
+
+		if (!Rec_GetRecord(reader, reader->keyframes[slot], &record) || record.kind != REC_RECORD_KEYFRAME)
+			return false;
+	}
+
+	if (!Rec_DecodeFrame(&reader->frame, record.kind, record.payload, record.payload_size))
+		return false;
+
+	reader->next_offset = record.next_offset;
+
+	// then the deltas up to the tick
+	while (Rec_GetRecord(reader, reader->next_offset, &record) && record.kind != REC_RECORD_INDEX)
+	{
+		if (Rec_IsFrame(&record))
+		{
+			if (Rec_GetFrameTick(&record) > tick)
+				break;
+
+			if (!Rec_DecodeFrame(&reader->frame, record.kind, record.payload, record.payload_size))
+				return false;
+		}
+
+		reader->next_offset = record.next_offset;
+	}
+
+	return true;
+}
+
+bool Rec_Next(rec_reader_t *reader)
+{
+	rec_record_t record;
+
+	while (Rec_GetRecord(reader, reader->next_offset, &record) && record.kind != REC_RECORD_INDEX)
+	{
+		reader->next_offset = record.next_offset;
+
+		if (Rec_IsFrame(&record))
+			return Rec_DecodeFrame(&reader->frame, record.kind, record.payload, record.payload_size);
+	}
+
+	return false;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+#include "protocol.h"
+
+// ------------------------------------------------------------------
+// recording.h: the authoritative world, as the server had it after
+// every tick, written down so a match can be watched back later, or
+// while it's still going, from any point in it.
+//
+// every so often (REC_KEYFRAME_SECONDS) there's a keyframe with the
+// whole world in it, and the ticks in between are deltas from the tick
+// before, which only have the entity fields that changed. when the
+// recording gets closed, an index with the file offset of every
+// keyframe goes on the end, so getting to a tick is a lookup in the
+// index, and decoding at most one keyframe's worth of deltas. a file
+// that never got its index (the server died, or it's still being
+// written) still works, the reader builds the index itself by walking
+// the records.
+//
+// the format is meant to be read straight out of a memory mapping
+// (see OS_MapFile), so there's no compression or anything else that
+// has to be undone before a record can be looked at. like the journal,
+// it's in native byte order:
+//
+//     file header:  u32 magic 'NREC', u32 version, f64 seconds per tick,
+//                   u32 keyframe interval (in ticks), u32 padding,
+//                   u64 start time (unix seconds)
+//
+//     record:       u32 payload size, u8 kind (rec_record_kind_e),
+//                   u8 padding[3], followed by the payload
+//
+//     key/delta:    u32 tick, u8 player count, and for every player:
+//                       u8 player id, u8 flags (REC_PLAYER_NAME if the
+//                       name follows), i32 entity id, char name[32]
+//                   u8 changed[16], a bit for every entity slot with
+//                   something that changed, and for every one of those:
+//                       u8 fields (rec_field_e), followed by the 4 byte
+//                       value of every field that changed, in order
+//
+//     index:        u32 first tick, u32 last tick, u32 keyframe count,
+//                   u32 padding, followed by a u64 file offset for every
+//                   keyframe interval from first tick / interval on. an
+//                   interval without a keyframe of its own (because
+//                   frames got dropped) gets the one before it
+//
+//     footer:       u64 file offset of the index record, u32 magic
+//                   'NEND', u32 padding. only there if the index is too
+//
+// a keyframe is just a delta from an empty world. names only go in when
+// a player shows up, or their name changed.
+
+#define REC_MAGIC     0x4345524Eu // "NREC"
+#define REC_END_MAGIC 0x444E454Eu // "NEND"
+
+enum { REC_VERSION = 1 };
+
+enum
+{
+	REC_HEADER_SIZE        = 32,
+	REC_RECORD_HEADER_SIZE = 8,
+	REC_INDEX_HEADER_SIZE  = 16,
+	REC_FOOTER_SIZE        = 16,
+};
+
+typedef enum rec_record_kind_e
+{
+	REC_RECORD_KEYFRAME = 1,
+	REC_RECORD_DELTA    = 2,
+	REC_RECORD_INDEX    = 3,
+} rec_record_kind_e;
+
+typedef enum rec_field_e
+{
+	REC_FIELD_ID   = 1 << 0,
+	REC_FIELD_X    = 1 << 1,
+	REC_FIELD_Y    = 1 << 2,
+	REC_FIELD_DX   = 1 << 3,
+	REC_FIELD_DY   = 1 << 4,
+	REC_FIELD_SIZE = 1 << 5,
+} rec_field_e;
+
+enum { REC_PLAYER_NAME = 1 << 0 };
+
+// the biggest a key or delta can get: every player with a name, and
+// every field of every entity
+enum
+{
+	REC_MAX_FRAME_SIZE = 4 + 1 + MAX_CLIENT_COUNT*(1 + 1 + 4 + NET_USERNAME_MAX_SIZE) +
+						 MAX_ENTITY_COUNT/8 + MAX_ENTITY_COUNT*(1 + 6*4),
+};
+
+// how much time goes between keyframes, which is also the most that
+// has to be decoded to get to any tick
+#define REC_KEYFRAME_SECONDS 1.0
+
+typedef struct rec_player_t
+{
+	unsigned char   player_id;
+	net_entity_id_t entity;
+	char            name[NET_USERNAME_MAX_SIZE];
+} rec_player_t;
+
+// the world after one tick. entity slots that are empty are all zeroes
+typedef struct rec_frame_t
+{
+	uint32_t tick;
+
+	int          player_count;
+	rec_player_t players[MAX_CLIENT_COUNT];
+
+	net_entity_state_t entities[MAX_ENTITY_COUNT];
+} rec_frame_t;
+
+// ------------------------------------------------------------------
+// the codec, which the writer (sv_recorder.h) and the reader share
+
+// encodes the difference between from and to into the buffer, which
+// should be REC_MAX_FRAME_SIZE bytes. from is NULL for a keyframe.
+// returns the size, or 0 if it didn't fit
+size_t Rec_EncodeFrame(const rec_frame_t *from, const rec_frame_t *to, unsigned char *buffer, size_t buffer_size);
+
+// applies an encoded frame to the frame it was a delta from, or to any
+// frame at all for a keyframe. returns false if it didn't make sense
+bool Rec_DecodeFrame(rec_frame_t *frame, rec_record_kind_e kind, const unsigned char *data, size_t size);
+
+// ------------------------------------------------------------------
+// reading
+
+typedef struct rec_reader_t
+{
+	os_mapped_file_t file;
+
+	double   seconds_per_tick;
+	uint32_t keyframe_interval;
+	uint64_t start_time; // unix seconds
+
+	uint32_t first_tick;
+	uint32_t last_tick;
+
+	uint32_t  base_slot;      // first_tick / keyframe_interval
+	uint32_t  keyframe_count;
+	uint64_t *keyframes;      // file offsets, one for every keyframe interval
+
+	bool     indexed;     // false if the index had to be built by walking the file
+	uint64_t next_offset; // the record after the current frame
+
+	rec_frame_t frame; // the current frame
+} rec_reader_t;
+
+// maps the file and gets the index ready. returns 0 on success, or -1
+// if the file can't be opened, isn't a recording, or has no frames in it
+int  Rec_OpenReader(rec_reader_t *reader, const char *path);
+void Rec_CloseReader(rec_reader_t *reader);
+
+// makes the current frame the last one recorded at or before the tick,
+// clamped to the ticks in the recording. returns false if the file is
+// broken somewhere along the way
+bool Rec_Seek(rec_reader_t *reader, uint32_t tick);
+
+// moves on to the next recorded frame. returns false at the end of the
+// recording
+bool Rec_Next(rec_reader_t *reader);
@@ -0,0 +1,75 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "siphash.h"
+
+// ------------------------------------------------------------------
+// siphash.c: straight from the paper (Aumasson and Bernstein, 2012).
+// 2 rounds per 8 byte block, 4 rounds at the end.
+
+
+static inline uint64_t SipHash_Rotate(uint64_t x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static inline void SipHash_Round(uint64_t v[4])
+{
+	v[0] += v[1]; v[1] = SipHash_Rotate(v[1], 13); v[1] ^= v[0]; v[0] = SipHash_Rotate(v[0], 32);
+	v[2] += v[3]; v[3] = SipHash_Rotate(v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = SipHash_Rotate(v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = SipHash_Rotate(v[1], 17); v[1] ^= v[2]; v[2] = SipHash_Rotate(v[2], 32);
+}
+
+uint64_t SipHash_Compute(const siphash_key_t *key, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+
+	uint64_t v[4] = {
+		key->k0 ^ 0x736f6d6570736575ull,
+		key->k1 ^ 0x646f72616e646f6dull,
+		key->k0 ^ 0x6c7967656e657261ull,
+		key->k1 ^ 0x7465646279746573ull,
+	};
+
+	size_t block_count = size / 8;
+
+	for (size_t i = 0; i < block_count; i++)
+	{
+		// the blocks are little endian, which is what we're running on anyway
+		uint64_t m;
+		memcpy(&m, &bytes[8*i], sizeof(m));
+
+		v[3] ^= m;
+		SipHash_Round(v);
+		SipHash_Round(v);
+		v[0] ^= m;
+	}
+
+	// the last block has whatever is left over, and the size in the top byte
+	uint64_t last = (uint64_t)(size & 0xFF) << 56;
+
+	size_t left_over = size % 8;
+	for (size_t i = 0; i < left_over; i++)
+	{
+		last |= (uint64_t)bytes[8*block_count + i] << (8*i);
+	}
+
+	v[3] ^= last;
+	SipHash_Round(v);
+	SipHash_Round(v);
+	v[0] ^= last;
+
+	v[2] ^= 0xFF;
+	SipHash_Round(v);
+	SipHash_Round(v);
+	SipHash_Round(v);
+	SipHash_Round(v);
+
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ------------------------------------------------------------------
+// siphash.h: SipHash-2-4, a fast keyed hash for short inputs. anyone
+// who doesn't know the key can't predict or forge its output, which
+// makes it good for things like handing out cookies that only we can
+// check, without having to remember anything about who we gave them to.
+
+typedef struct siphash_key_t
+{
+	uint64_t k0, k1;
+} siphash_key_t;
+
+uint64_t SipHash_Compute(const siphash_key_t *key, const void *data, size_t size);
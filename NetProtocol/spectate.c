@@ -0,0 +1,390 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "os.h"
+#include "spectate.h"
+
+// ------------------------------------------------------------------
+// spectate.c: the spectator keeps the frames it got in a ring, so it
+// can decode deltas from any of the recent ones. it only ever tells
+// the broadcast about the newest, which is always in there.
+
+
+struct spectate_client_t
+{
+	net_context_t net;
+	net_socket_t  socket;
+	net_addr_t    address;
+
+	unsigned long long cookie;
+
+	fragment_reassembler_t reassembler;
+
+	// the acks for the snapshots we got, like the peer_ack fields in
+	// net_channel_t
+	bool           has_ack;
+	unsigned short ack;
+	uint32_t       ack_bits;
+
+	// the newest snapshot's send_time, and when it got here
+	unsigned long long echo_time;
+	os_time_t          echo_arrival_time;
+
+	os_time_t last_send_time;
+	os_time_t last_receive_time;
+	bool      snapshot_since_send; // acks are owed
+
+	uint32_t    frame_count;  // how many of the frames are in use
+	uint32_t    newest_frame; // index of the newest one
+	bool        has_new_frame;
+	rec_frame_t frames[SPECTATE_HISTORY_SIZE];
+
+	rec_frame_t scratch; // where a snapshot gets decoded before it makes it into the ring
+
+	spectate_stats_t stats;
+};
+
+enum { SPECTATE_MAX_PACKET_SIZE = 8192 };
+
+static void Spectate_SendSpectate(spectate_client_t *client, unsigned short flags, os_time_t now)
+{
+	net_spectate_t packet = {
+		.header = {
+			.kind = NETPACKET_SPECTATE,
+		},
+		.protocol_id      = NET_PROTOCOL_ID,
+		.protocol_version = NET_PROTOCOL_VERSION,
+		.flags            = flags,
+		.cookie           = client->cookie,
+	};
+
+	if (client->has_ack)
+	{
+		packet.flags   |= SPECTATE_HAS_ACKS;
+		packet.ack      = client->ack;
+		packet.ack_bits = client->ack_bits;
+	}
+
+	if (client->frame_count > 0)
+	{
+		packet.flags        |= SPECTATE_HAS_BASELINE;
+		packet.baseline_tick = client->frames[client->newest_frame].tick;
+	}
+
+	if (client->echo_time)
+	{
+		packet.echo_time = client->echo_time;
+		packet.hold_time = (unsigned int)(1000000.0*OS_GetSecondsElapsed(client->echo_arrival_time, now));
+	}
+
+	Net_SendPacket(&client->net, client->socket, client->address, &packet, sizeof(packet));
+
+	client->last_send_time      = now;
+	client->snapshot_since_send = false;
+}
+
+// forgets everything, for when the broadcast went away and whatever
+// comes next has nothing to do with what we had
+static void Spectate_Reset(spectate_client_t *client)
+{
+	client->cookie        = 0;
+	client->has_ack       = false;
+	client->echo_time     = 0;
+	client->frame_count   = 0;
+	client->newest_frame  = 0;
+	client->has_new_frame = false;
+
+	client->stats.subscribed = false;
+
+	Fragment_InitReassembler(&client->reassembler);
+}
+
+// ------------------------------------------------------------------
+
+spectate_client_t *Spectate_Connect(char *host, int port, struct net_impairment_t *impairment)
+{
+	spectate_client_t *client = calloc(1, sizeof(spectate_client_t));
+
+	if (!client)
+		return NULL;
+
+	Net_InitContext(&client->net, impairment);
+
+	client->address = Net_GetAddr(host, port);
+	client->socket  = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
+
+	if (client->socket.value == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "Spectate_Connect: failed to create socket\n");
+		free(client);
+		return NULL;
+	}
+
+	// bind explicitly, so the socket can be polled before the first send
+	if (Net_BindSocket(client->socket, Net_GetPassiveAddr(0)) != 0)
+	{
+		fprintf(stderr, "Spectate_Connect: failed to bind socket\n");
+		Net_CloseSocket(client->socket);
+		free(client);
+		return NULL;
+	}
+
+	Spectate_Reset(client);
+
+	os_time_t now = OS_GetHiresTime();
+
+	client->last_receive_time = now;
+	Spectate_SendSpectate(client, 0, now);
+
+	return client;
+}
+
+void Spectate_Disconnect(spectate_client_t *client)
+{
+	if (!client)
+		return;
+
+	// if this gets lost, the broadcast figures it out eventually
+	Spectate_SendSpectate(client, SPECTATE_LEAVING, OS_GetHiresTime());
+
+	Net_CloseSocket(client->socket);
+	free(client);
+}
+
+net_socket_t Spectate_GetSocket(spectate_client_t *client)
+{
+	return client->socket;
+}
+
+void Spectate_GetStats(spectate_client_t *client, spectate_stats_t *stats)
+{
+	Net_GetStats(&client->net, &client->stats.net);
+	client->stats.fragments = client->reassembler.stats;
+
+	*stats = client->stats;
+}
+
+// ------------------------------------------------------------------
+// receiving
+
+static void Spectate_Ack(spectate_client_t *client, unsigned short sequence)
+{
+	if (!client->has_ack)
+	{
+		client->has_ack  = true;
+		client->ack      = sequence;
+		client->ack_bits = 0;
+		return;
+	}
+
+	int distance = (short)(sequence - client->ack);
+
+	if (distance > 0)
+	{
+		// the old newest one becomes a bit, along with the gap before it
+		if (distance > 32)
+			client->ack_bits = 0;
+		else
+			client->ack_bits = (distance == 32 ? 0 : client->ack_bits << distance) | (1u << (distance - 1));
+
+		client->ack = sequence;
+	}
+	else if (distance < 0 && distance >= -32)
+	{
+		client->ack_bits |= 1u << (-distance - 1);
+	}
+}
+
+static const rec_frame_t *Spectate_FindFrame(spectate_client_t *client, uint32_t tick)
+{
+	for (uint32_t i = 0; i < client->frame_count; i++)
+	{
+		if (client->frames[i].tick == tick)
+			return &client->frames[i];
+	}
+
+	return NULL;
+}
+
+static const rec_frame_t *Spectate_GetOldestFrame(spectate_client_t *client)
+{
+	if (client->frame_count < SPECTATE_HISTORY_SIZE)
+		return &client->frames[0];
+
+	return &client->frames[(client->newest_frame + 1) % SPECTATE_HISTORY_SIZE];
+}
+
+static void Spectate_ProcessSnapshot(spectate_client_t *client, net_snapshot_t *snapshot, size_t packet_size, os_time_t now)
+{
+	if (packet_size < offsetof(net_snapshot_t, data))
+		return;
+
+	Spectate_Ack(client, snapshot->header.sequence);
+
+	client->snapshot_since_send = true;
+	client->stats.snapshots_received += 1;
+
+	// the round trip time is measured on the newest one
+	if (client->ack == snapshot->header.sequence)
+	{
+		client->echo_time         = snapshot->send_time;
+		client->echo_arrival_time = now;
+	}
+
+	rec_record_kind_e kind = (rec_record_kind_e)snapshot->kind;
+
+	uint32_t newest_tick = client->frames[client->newest_frame].tick;
+
+	if (client->frame_count > 0 && (int32_t)(snapshot->tick - newest_tick) <= 0)
+	{
+		// a keyframe from before anything we still have means the other end
+		// started over (after a restart, say), so we do too
+		if (kind == REC_RECORD_KEYFRAME && 
+			(int32_t)(snapshot->tick - Spectate_GetOldestFrame(client)->tick) < 0)
+		{
+			client->frame_count  = 0;
+			client->newest_frame = 0;
+		}
+		else
+		{
+			client->stats.snapshots_stale += 1;
+			return;
+		}
+	}
+
+	if (kind == REC_RECORD_DELTA)
+	{
+		const rec_frame_t *baseline = Spectate_FindFrame(client, snapshot->baseline_tick);
+
+		if (!baseline)
+		{
+			client->stats.snapshots_orphaned += 1;
+			return;
+		}
+
+		client->scratch = *baseline;
+	}
+	else if (kind == REC_RECORD_KEYFRAME)
+	{
+		client->stats.keyframes_received += 1;
+	}
+	else
+	{
+		return;
+	}
+
+	size_t data_size = packet_size - offsetof(net_snapshot_t, data);
+
+	if (!Rec_DecodeFrame(&client->scratch, kind, snapshot->data, data_size) ||
+		client->scratch.tick != snapshot->tick)
+	{
+		return;
+	}
+
+	// the oldest frame makes way
+	if (client->frame_count > 0)
+		client->newest_frame = (client->newest_frame + 1) % SPECTATE_HISTORY_SIZE;
+
+	if (client->frame_count < SPECTATE_HISTORY_SIZE)
+		client->frame_count += 1;
+
+	client->frames[client->newest_frame] = client->scratch;
+	client->has_new_frame = true;
+
+	client->stats.subscribed = true;
+	client->stats.tick       = snapshot->tick;
+}
+
+static void Spectate_ProcessDatagram(spectate_client_t *client, char *buffer, size_t buffer_size, os_time_t now)
+{
+	if (buffer_size < sizeof(net_header_t))
+		return;
+
+	net_header_t *header = (net_header_t *)buffer;
+
+	switch (header->kind)
+	{
+		case NETPACKET_CHALLENGE:
+		{
+			if (buffer_size < sizeof(net_challenge_t))
+				break;
+
+			net_challenge_t *challenge = (net_challenge_t *)header;
+
+			// ask again right away, now with the cookie
+			client->cookie = challenge->cookie;
+			Spectate_SendSpectate(client, 0, now);
+		} break;
+
+		case NETPACKET_FRAGMENT:
+		{
+			size_t packet_size;
+			void  *packet = Fragment_Receive(&client->reassembler, (net_fragment_t *)header, buffer_size, now, &packet_size);
+
+			if (packet && packet_size >= sizeof(net_header_t) &&
+				((net_header_t *)packet)->kind == NETPACKET_SNAPSHOT)
+			{
+				Spectate_ProcessSnapshot(client, packet, packet_size, now);
+			}
+		} break;
+
+		case NETPACKET_SNAPSHOT:
+		{
+			Spectate_ProcessSnapshot(client, (net_snapshot_t *)header, buffer_size, now);
+		} break;
+	}
+}
+
+const rec_frame_t *Spectate_Poll(spectate_client_t *client)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	for (;;)
+	{
+		alignas(16) char buffer[SPECTATE_MAX_PACKET_SIZE];
+
+		net_addr_t address;
+		int result = Net_RecvPacket(&client->net, client->socket, buffer, sizeof(buffer), &address);
+
+		if (result <= 0)
+			break;
+
+		// nobody else has any business sending us things
+		if (!Net_AddrMatch(address, client->address))
+			continue;
+
+		client->last_receive_time = now;
+
+		Spectate_ProcessDatagram(client, buffer, (size_t)result, now);
+	}
+
+	if (OS_GetSecondsElapsed(client->last_receive_time, now) > SPECTATE_TIMEOUT)
+	{
+		// keeps asking, but as if for the first time
+		if (client->stats.subscribed)
+			Spectate_Reset(client);
+
+		client->last_receive_time = now;
+	}
+
+	if (client->snapshot_since_send ||
+		OS_GetSecondsElapsed(client->last_send_time, now) >= SPECTATE_KEEPALIVE_INTERVAL)
+	{
+		Spectate_SendSpectate(client, 0, now);
+	}
+
+	if (!client->has_new_frame)
+		return NULL;
+
+	client->has_new_frame = false;
+	return &client->frames[client->newest_frame];
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+#include "recording.h"
+#include "net.h"
+#include "fragment.h"
+
+// ------------------------------------------------------------------
+// spectate.h: watching a match without being in it. a spectator isn't
+// a client of the game server, it subscribes to a broadcast (see
+// sv_broadcast.h), which can be the server itself, or a relay that is
+// subscribed to the server, or to another relay, and so on. that way
+// the game server only ever has a handful of relays to send to, and
+// the relays take care of everyone else.
+//
+// a spectator starts by sending NETPACKET_SPECTATE, gets a challenge
+// back with a cookie in it like a client connecting to the server
+// does, and from then on gets sent snapshots for as long as it keeps
+// sending spectate packets with that cookie. every spectate packet
+// acks the snapshots that came in, and says which tick is the newest
+// one the spectator has, which is what the next snapshot can be a
+// delta from. snapshots are encoded exactly like the frames of a
+// recording (see recording.h), so a snapshot is either a keyframe, or
+// a delta from the frame the spectator said it has.
+//
+// this file has the packets, and the spectator's end of things.
+
+// a spectator keeps this many of the most recent frames around, any of
+// which a snapshot that's still on its way could be a delta from
+enum { SPECTATE_HISTORY_SIZE = 32 };
+
+// spectators send a spectate packet whenever snapshots came in, but at
+// least this often (in seconds) when they didn't, to stay subscribed
+#define SPECTATE_KEEPALIVE_INTERVAL 0.25
+
+// a spectator that hasn't been heard from in this many seconds gets
+// dropped, and a spectator that hasn't heard anything in this long
+// starts over from scratch
+#define SPECTATE_TIMEOUT 5.0
+
+enum
+{
+	SPECTATE_HAS_BASELINE = 1 << 0, // baseline_tick is a tick we have
+	SPECTATE_LEAVING      = 1 << 1, // we're done, stop sending
+	SPECTATE_HAS_ACKS     = 1 << 2, // ack and ack_bits are snapshots we got
+};
+
+// this is the packet associated with NETPACKET_SPECTATE
+typedef struct net_spectate_t
+{
+	net_header_t header;
+
+	unsigned int   protocol_id;      // NET_PROTOCOL_ID
+	unsigned short protocol_version; // NET_PROTOCOL_VERSION
+	unsigned short flags;
+
+	// 0 until a challenge came back, like net_connect_t
+	unsigned long long cookie;
+
+	// the sequence of the newest snapshot we got, and a bit for every one
+	// of the 32 before it, bit n being sequence ack - 1 - n
+	unsigned short ack;
+	unsigned short padding;
+	unsigned int   ack_bits;
+
+	// the newest tick we have, see SPECTATE_HAS_BASELINE
+	unsigned int baseline_tick;
+
+	// how long the newest snapshot sat with us before this went out, in
+	// microseconds, and the send_time that came with it. the sender
+	// gets its round trip time out of these
+	unsigned int       hold_time;
+	unsigned long long echo_time;
+} net_spectate_t;
+
+// this is the packet associated with NETPACKET_SNAPSHOT. the sequence
+// in the header counts up for every snapshot sent to a spectator, and
+// is what gets acked. it usually needs a couple of fragments when it's
+// a keyframe
+typedef struct net_snapshot_t
+{
+	net_header_t header;
+
+	unsigned int  tick;
+	unsigned int  baseline_tick; // the tick the data is a delta from, if it's a delta
+	unsigned char kind;          // REC_RECORD_KEYFRAME or REC_RECORD_DELTA
+	unsigned char padding[7];
+
+	unsigned long long send_time; // the sender's OS_GetHiresTime(), see net_spectate_t
+
+	// Rec_EncodeFrame's output, only the part of this that's used gets sent
+	unsigned char data[REC_MAX_FRAME_SIZE];
+} net_snapshot_t;
+
+// ------------------------------------------------------------------
+// the spectator
+
+typedef struct spectate_stats_t
+{
+	bool     subscribed;          // snapshots are coming in
+	uint32_t tick;                // the newest one
+	uint64_t snapshots_received;
+	uint64_t keyframes_received;
+	uint64_t snapshots_stale;     // arrived after a newer one, so they were of no use
+	uint64_t snapshots_orphaned;  // deltas from a frame we didn't have (anymore)
+	net_stats_t      net;
+	fragment_stats_t fragments;
+} spectate_stats_t;
+
+typedef struct spectate_client_t spectate_client_t;
+
+// creates a socket, and starts asking the broadcast at host:port for
+// snapshots. networking has to be initialized already (see Net_Init).
+// the impairment can be NULL, see netimpair.h. returns NULL on failure
+spectate_client_t *Spectate_Connect(char *host, int port, struct net_impairment_t *impairment);
+
+// tells the broadcast we're leaving, and closes the socket
+void Spectate_Disconnect(spectate_client_t *client);
+
+// takes in whatever arrived, and lets the broadcast know what we have.
+// returns the newest frame if a newer one came in since the last call,
+// NULL otherwise. the frame stays valid until the next call
+const rec_frame_t *Spectate_Poll(spectate_client_t *client);
+
+// for waiting on with a poll set (see Net_Poll), when there's a lot of
+// spectators in one process
+net_socket_t Spectate_GetSocket(spectate_client_t *client);
+
+void Spectate_GetStats(spectate_client_t *client, spectate_stats_t *stats);
@@ -0,0 +1,243 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "timerwheel.h"
+
+// ------------------------------------------------------------------
+// timerwheel.c: every node is in exactly one list: the free list, one
+// of the slots, or the expired list. the lists are doubly linked by
+// index, and each node remembers which list it's in, so it can be 
+// unlinked without searching for it.
+
+
+enum
+{
+	LIST_FREE    = 0,
+	LIST_EXPIRED = 1,
+	LIST_SLOTS   = 2, // slot s of level l is list LIST_SLOTS + l*TIMERWHEEL_SLOT_COUNT + s
+};
+
+enum { SLOT_MASK = TIMERWHEEL_SLOT_COUNT - 1 };
+
+// the furthest out a timer can be put, anything further gets clamped
+static const uint32_t g_max_ticks = (1u << (TIMERWHEEL_LEVEL_COUNT*TIMERWHEEL_SLOT_BITS)) - 1;
+
+static uint16_t *TimerWheel_GetListHead(timer_wheel_t *wheel, uint16_t list)
+{
+	if (list == LIST_FREE)
+		return &wheel->free;
+
+	if (list == LIST_EXPIRED)
+		return &wheel->expired;
+
+	uint16_t slot = (uint16_t)(list - LIST_SLOTS);
+	return &wheel->slots[slot / TIMERWHEEL_SLOT_COUNT][slot % TIMERWHEEL_SLOT_COUNT];
+}
+
+static void TimerWheel_Link(timer_wheel_t *wheel, uint16_t index, uint16_t list)
+{
+	uint16_t *head = TimerWheel_GetListHead(wheel, list);
+
+	timer_node_t *node = &wheel->nodes[index];
+	node->list = list;
+	node->prev = 0;
+	node->next = *head;
+
+	if (*head)
+		wheel->nodes[*head].prev = index;
+
+	*head = index;
+}
+
+static void TimerWheel_Unlink(timer_wheel_t *wheel, uint16_t index)
+{
+	timer_node_t *node = &wheel->nodes[index];
+
+	if (node->prev)
+		wheel->nodes[node->prev].next = node->next;
+	else
+		*TimerWheel_GetListHead(wheel, node->list) = node->next;
+
+	if (node->next)
+		wheel->nodes[node->next].prev = node->prev;
+
+	node->next = 0;
+	node->prev = 0;
+}
+
+static void TimerWheel_Free(timer_wheel_t *wheel, uint16_t index)
+{
+	TimerWheel_Unlink(wheel, index);
+
+	// makes any handles to this timer stale
+	wheel->nodes[index].generation += 1;
+
+	TimerWheel_Link(wheel, index, LIST_FREE);
+}
+
+// puts the node in the slot its expire tick belongs in, as seen from
+// wheel->now
+static void TimerWheel_Place(timer_wheel_t *wheel, uint16_t index)
+{
+	timer_node_t *node = &wheel->nodes[index];
+
+	uint32_t expire = node->expire_tick;
+	uint32_t delta  = expire - wheel->now;
+
+	// it's overdue, so it goes in the first slot to be processed
+	if ((int32_t)delta < 0)
+	{
+		expire = wheel->now;
+		delta  = 0;
+	}
+
+	int level = 0;
+	while (level < TIMERWHEEL_LEVEL_COUNT - 1 && delta >= (1u << ((level + 1)*TIMERWHEEL_SLOT_BITS)))
+	{
+		level += 1;
+	}
+
+	uint32_t slot = (expire >> (level*TIMERWHEEL_SLOT_BITS)) & SLOT_MASK;
+
+	TimerWheel_Link(wheel, index, (uint16_t)(LIST_SLOTS + level*TIMERWHEEL_SLOT_COUNT + slot));
+}
+
+// ------------------------------------------------------------------
+
+void TimerWheel_Init(timer_wheel_t *wheel, uint32_t tick)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = tick;
+
+	// node 0 is never used, so that 0 can mean "no node"
+	for (uint16_t i = TIMERWHEEL_CAPACITY - 1; i > 0; i--)
+	{
+		TimerWheel_Link(wheel, i, LIST_FREE);
+	}
+}
+
+timer_handle_t TimerWheel_Add(timer_wheel_t *wheel, uint32_t ticks, int kind, uint32_t userdata)
+{
+	timer_handle_t result = { 0 };
+
+	uint16_t index = wheel->free;
+
+	if (!index)
+	{
+		assert(!"Ran out of timers!\n");
+		return result;
+	}
+
+	if (ticks > g_max_ticks)
+		ticks = g_max_ticks;
+
+	TimerWheel_Unlink(wheel, index);
+
+	timer_node_t *node = &wheel->nodes[index];
+	node->expire_tick = wheel->now - 1 + ticks;
+	node->kind        = kind;
+	node->userdata    = userdata;
+
+	TimerWheel_Place(wheel, index);
+
+	result.index      = index;
+	result.generation = node->generation;
+
+	return result;
+}
+
+static bool TimerWheel_IsLive(timer_wheel_t *wheel, timer_handle_t handle)
+{
+	if (handle.index == 0 || handle.index >= TIMERWHEEL_CAPACITY)
+		return false;
+
+	timer_node_t *node = &wheel->nodes[handle.index];
+	return node->list != LIST_FREE && node->generation == handle.generation;
+}
+
+bool TimerWheel_Cancel(timer_wheel_t *wheel, timer_handle_t handle)
+{
+	if (!TimerWheel_IsLive(wheel, handle))
+		return false;
+
+	// this works the same for timers that have fired but haven't been 
+	// popped yet, so they won't be
+	TimerWheel_Free(wheel, handle.index);
+	return true;
+}
+
+bool TimerWheel_IsPending(timer_wheel_t *wheel, timer_handle_t handle)
+{
+	return TimerWheel_IsLive(wheel, handle) && wheel->nodes[handle.index].list != LIST_EXPIRED;
+}
+
+// spreads the timers in a slot of a higher level out over the levels
+// below it. returns the slot, so the caller knows whether this level 
+// came around too
+static uint32_t TimerWheel_Cascade(timer_wheel_t *wheel, int level)
+{
+	uint32_t slot = (wheel->now >> (level*TIMERWHEEL_SLOT_BITS)) & SLOT_MASK;
+
+	uint16_t *head = &wheel->slots[level][slot];
+
+	while (*head)
+	{
+		uint16_t index = *head;
+		TimerWheel_Unlink(wheel, index);
+		TimerWheel_Place(wheel, index);
+	}
+
+	return slot;
+}
+
+void TimerWheel_Advance(timer_wheel_t *wheel, uint32_t tick)
+{
+	while ((int32_t)(tick - wheel->now) >= 0)
+	{
+		uint32_t slot = wheel->now & SLOT_MASK;
+
+		if (slot == 0)
+		{
+			for (int level = 1; level < TIMERWHEEL_LEVEL_COUNT; level++)
+			{
+				if (TimerWheel_Cascade(wheel, level) != 0)
+					break;
+			}
+		}
+
+		uint16_t *head = &wheel->slots[0][slot];
+
+		while (*head)
+		{
+			uint16_t index = *head;
+			TimerWheel_Unlink(wheel, index);
+			TimerWheel_Link(wheel, index, LIST_EXPIRED);
+		}
+
+		wheel->now += 1;
+	}
+}
+
+bool TimerWheel_PopExpired(timer_wheel_t *wheel, timer_event_t *event)
+{
+	uint16_t index = wheel->expired;
+
+	if (!index)
+		return false;
+
+	timer_node_t *node = &wheel->nodes[index];
+
+	event->handle.index      = index;
+	event->handle.generation = node->generation;
+	event->kind              = node->kind;
+	event->userdata          = node->userdata;
+
+	TimerWheel_Free(wheel, index);
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+// timerwheel.h: a hierarchical timing wheel, for when there's a lot
+// of things that need to happen some number of ticks from now. adding,
+// cancelling and firing a timer are all O(1), and ticks where nothing
+// happens cost next to nothing, as opposed to counting down every 
+// timer every tick.
+//
+// the wheel has 4 levels of 64 slots. level 0 has a slot for each of
+// the next 64 ticks, level 1 a slot for each of the 64 spans of 64 
+// ticks after that, and so on. whenever level 0 comes around, the next
+// slot of level 1 gets spread out over level 0, and so on up. timers
+// further out than 64^4 ticks just get put at the very end.
+//
+// timers live in a fixed pool, and are referred to by handles. a 
+// handle to a timer that has fired or been cancelled is stale, and 
+// safely does nothing.
+
+enum
+{
+	TIMERWHEEL_LEVEL_COUNT = 4,
+	TIMERWHEEL_SLOT_BITS   = 6,
+	TIMERWHEEL_SLOT_COUNT  = 1 << TIMERWHEEL_SLOT_BITS,
+};
+
+// the most timers that can be pending at once
+enum { TIMERWHEEL_CAPACITY = 512 };
+
+typedef struct timer_handle_t
+{
+	uint16_t index; // 0 is never a valid timer, so a zeroed handle is a stale one
+	uint16_t generation;
+} timer_handle_t;
+
+static inline bool TimerWheel_HandlesMatch(timer_handle_t a, timer_handle_t b)
+{
+	return a.index == b.index && a.generation == b.generation;
+}
+
+// what a timer gives back when it fires. kind and userdata are 
+// whatever was passed to TimerWheel_Add
+typedef struct timer_event_t
+{
+	timer_handle_t handle;
+	int            kind;
+	uint32_t       userdata;
+} timer_event_t;
+
+typedef struct timer_node_t
+{
+	uint16_t generation;
+	uint16_t next, prev; // 0 is the end of the list
+	uint16_t list;       // which list the node is in, see timerwheel.c
+
+	uint32_t expire_tick;
+
+	int      kind;
+	uint32_t userdata;
+} timer_node_t;
+
+typedef struct timer_wheel_t
+{
+	uint32_t now;  // the next tick that hasn't been processed yet
+	uint16_t free; // first free node
+
+	uint16_t slots[TIMERWHEEL_LEVEL_COUNT][TIMERWHEEL_SLOT_COUNT];
+	uint16_t expired; // timers that fired, but haven't been handed out yet
+
+	timer_node_t nodes[TIMERWHEEL_CAPACITY];
+} timer_wheel_t;
+
+// tick is the tick that TimerWheel_Advance will be called with first
+void TimerWheel_Init(timer_wheel_t *wheel, uint32_t tick);
+
+// starts a timer that fires when the wheel gets advanced to the tick
+// ticks from the last one it was advanced to. returns a stale handle
+// if the pool has run out
+timer_handle_t TimerWheel_Add(timer_wheel_t *wheel, uint32_t ticks, int kind, uint32_t userdata);
+
+// returns false if the timer had already fired or been cancelled
+bool TimerWheel_Cancel(timer_wheel_t *wheel, timer_handle_t handle);
+
+// returns whether the timer hasn't fired or been cancelled yet
+bool TimerWheel_IsPending(timer_wheel_t *wheel, timer_handle_t handle);
+
+// processes every tick up to and including this one. the timers that
+// fired can then be taken out with TimerWheel_PopExpired
+void TimerWheel_Advance(timer_wheel_t *wheel, uint32_t tick);
+
+// returns false once there are no more fired timers. timers that are
+// added while popping go into the wheel as usual, so they fire in the
+// next call to TimerWheel_Advance at the earliest
+bool TimerWheel_PopExpired(timer_wheel_t *wheel, timer_event_t *event);
@@ -28,6 +28,13 @@
 #define ARRAY_COUNT(arr) (sizeof(arr) / sizeof((arr)[0]))
 #define SWAP(t, a, b) do { t __t = a; a = b; b = __t; } while(0)
 
+// every thread gets its own copy of a variable declared with this
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 static inline float Lerp(float a, float b, float t)
 {
 	return (1.0f - t)*a + t*b;
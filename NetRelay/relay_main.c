@@ -0,0 +1,234 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "netimpair.h"
+#include "logger.h"
+#include "os.h"
+#include "spectate.h"
+#include "sv_broadcast.h"
+
+// ------------------------------------------------------------------
+// relay_main.c: entry point for the spectator relay. it subscribes to
+// a broadcast upstream (the server's -spectate_port, or another
+// relay), and broadcasts what it gets to spectators of its own, with
+// their own deltas and budgets, see spectate.h. relays can be chained
+// as deep as you like, every hop just adds its own delay.
+//
+// usage: NetRelay [-upstream host:port] [-port N] [-max_viewers N]
+//                 [-rate N] [-duration seconds] [impairment flags]
+//
+// the impairment flags (see netimpair.h) only affect the spectators'
+// side, the upstream side is left alone.
+
+
+// ------------------------------------------------------------------
+// constants
+
+// where the server's broadcast is, by default
+enum { UPSTREAM_PORT = 4952 };
+
+// where ours is, by default
+enum { PORT = 4953 };
+
+// ------------------------------------------------------------------
+// reporting
+
+static void Relay_Report(spectate_client_t *upstream, sv_broadcast_t *broadcast,
+						 spectate_stats_t *last_upstream, sv_broadcast_stats_t *last_broadcast, double interval)
+{
+	spectate_stats_t     upstream_stats;
+	sv_broadcast_stats_t broadcast_stats;
+
+	Spectate_GetStats(upstream, &upstream_stats);
+	Broadcast_GetStats(broadcast, &broadcast_stats);
+
+	double snapshots_in  = (double)(upstream_stats.snapshots_received - last_upstream->snapshots_received);
+	double snapshots_out = (double)(broadcast_stats.snapshots_sent    - last_broadcast->snapshots_sent);
+	double keyframes_out = (double)(broadcast_stats.keyframes_sent    - last_broadcast->keyframes_sent);
+	double skipped       = (double)(broadcast_stats.snapshots_skipped - last_broadcast->snapshots_skipped);
+	double encodes       = (double)(broadcast_stats.encodes           - last_broadcast->encodes);
+
+	// how many snapshots got to share somebody else's encoding
+	double shared = snapshots_out > 0.0 ? 1.0 - encodes / snapshots_out : 0.0;
+	if (shared < 0.0) shared = 0.0;
+
+	if (upstream_stats.subscribed)
+	{
+		printf("spectators: %5d | upstream: tick %u, %5.1f snapshots/s, %6.2f kB/s | out: %7.1f snapshots/s (%.1f keyframes, %.1f held back), %8.2f kB/s, %3.0f%% shared\n",
+			   broadcast_stats.viewer_count,
+			   upstream_stats.tick,
+			   snapshots_in / interval,
+			   (double)upstream_stats.net.bytes_in_per_second / 1024.0,
+			   snapshots_out / interval,
+			   keyframes_out / interval,
+			   skipped / interval,
+			   (double)broadcast_stats.net.bytes_out_per_second / 1024.0,
+			   100.0*shared);
+	}
+	else
+	{
+		printf("spectators: %5d | waiting for upstream...\n", broadcast_stats.viewer_count);
+	}
+
+	*last_upstream  = upstream_stats;
+	*last_broadcast = broadcast_stats;
+}
+
+// ------------------------------------------------------------------
+// main loop
+
+int main(int argc, char **argv)
+{
+	char  *upstream_host  = "localhost";
+	int    upstream_port  = UPSTREAM_PORT;
+	int    port           = PORT;
+	int    max_viewers    = 1024;
+	double snapshot_rate  = 30.0;
+	double duration       = 0.0; // 0 runs forever
+
+	net_impair_settings_t impair_settings = { 0 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		char *arg  = argv[i];
+		char *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "-upstream") == 0 && next)
+		{
+			for (char *c = next; *c; c++)
+			{
+				if (*c == ':')
+				{
+					*c = 0;
+					upstream_port = atoi(c + 1);
+				}
+			}
+			upstream_host = next;
+			i++;
+		}
+		else if (strcmp(arg, "-port") == 0 && next)
+		{
+			port = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-max_viewers") == 0 && next)
+		{
+			max_viewers = atoi(next);
+			i++;
+		}
+		else if (strcmp(arg, "-rate") == 0 && next)
+		{
+			// snapshots per second, 0 passes on everything from upstream
+			snapshot_rate = atof(next);
+			i++;
+		}
+		else if (strcmp(arg, "-duration") == 0 && next)
+		{
+			duration = atof(next);
+			i++;
+		}
+		else if (Impair_ParseArg(&impair_settings, argc, argv, &i))
+		{
+			// makes the network worse on purpose, see netimpair.h
+		}
+		else
+		{
+			fprintf(stderr, "Unknown argument '%s'\n", arg);
+		}
+	}
+
+	if (max_viewers < 1)
+		max_viewers = 1;
+
+	Log_Init();
+
+	Impair_PrintSettings(&impair_settings);
+
+	if (Net_Init() != 0)
+	{
+		fprintf(stderr, "Failed to initialize networking\n");
+		return 1;
+	}
+
+	net_impairment_t *impairment = Impair_Create(&impair_settings);
+
+	sv_broadcast_t *broadcast = Broadcast_Create(port, max_viewers, snapshot_rate, impairment);
+
+	if (!broadcast)
+		return 1;
+
+	spectate_client_t *upstream = Spectate_Connect(upstream_host, upstream_port, NULL);
+
+	if (!upstream)
+		return 1;
+
+	net_poll_set_t poll_set;
+
+	if (Net_CreatePollSet(&poll_set, 2) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	Net_AddToPollSet(&poll_set, Spectate_GetSocket(upstream));
+	Net_AddToPollSet(&poll_set, Broadcast_GetSocket(broadcast));
+
+	printf("Relaying %s:%d to port %d, for up to %d spectators at %g snapshots a second\n",
+		   upstream_host, upstream_port, port, max_viewers, snapshot_rate);
+
+	spectate_stats_t     last_upstream  = { 0 };
+	sv_broadcast_stats_t last_broadcast = { 0 };
+
+	os_time_t start_time  = OS_GetHiresTime();
+	os_time_t report_time = start_time;
+
+	for (;;)
+	{
+		os_time_t now = OS_GetHiresTime();
+
+		if (duration > 0.0 && OS_GetSecondsElapsed(start_time, now) >= duration)
+			break;
+
+		// whatever is newest goes straight on, frames that got skipped over
+		// on the way here just never existed as far as our spectators know
+		const rec_frame_t *frame = Spectate_Poll(upstream);
+
+		if (frame)
+			Broadcast_Publish(broadcast, frame);
+
+		Broadcast_ProcessPackets(broadcast);
+
+		double report_interval = OS_GetSecondsElapsed(report_time, now);
+
+		if (report_interval >= 1.0)
+		{
+			Relay_Report(upstream, broadcast, &last_upstream, &last_broadcast, report_interval);
+			report_time = now;
+		}
+
+		// the keepalives and timeouts don't need better than this
+		Net_Poll(&poll_set, 10);
+	}
+
+	Spectate_Disconnect(upstream);
+	Broadcast_Destroy(broadcast);
+
+	Net_DestroyPollSet(&poll_set);
+	Net_Exit();
+
+	Impair_Destroy(impairment);
+	Log_Exit();
+
+	return 0;
+}
@@ -0,0 +1,529 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "net.h"
+#include "os.h"
+#include "metrics.h"
+#include "logger.h"
+#include "sv_server.h"
+#include "sv_simulation.h"
+#include "sv_admin.h"
+
+// ------------------------------------------------------------------
+// sv_admin.c: the simulation thread and the admin thread share exactly
+// one thing, the published status, which is guarded by a version
+// number (a seqlock). the simulation thread makes the version odd,
+// writes, and makes it even again, without ever waiting on anyone. the
+// admin thread copies the status out, and if the version was odd or
+// changed while it was copying, it just tries again.
+
+
+// ------------------------------------------------------------------
+// the published status
+
+typedef struct admin_client_t
+{
+	unsigned char player_id;
+	bool          disconnecting;
+	char          name[NET_USERNAME_MAX_SIZE];
+	char          address[NETADDR_STR_SIZE];
+
+	float rtt;
+	float rtt_min;
+	float jitter;
+	float loss;          // of the client's packets to us
+	float snapshot_loss; // of our world states to the client
+	float budget;        // bytes per second
+	float input_lead;
+
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	uint32_t snapshots_sent;
+	uint32_t snapshots_skipped;
+	uint32_t input_underflows;
+	uint32_t input_overflows;
+} admin_client_t;
+
+typedef struct admin_status_t
+{
+	os_time_t   publish_time;
+	uint32_t    tick;
+	int         entity_count;
+	int         client_count;
+	net_stats_t net;
+
+	admin_client_t clients[MAX_CLIENT_COUNT];
+} admin_status_t;
+
+// how often the simulation thread copies out the status, in seconds
+static double g_publish_interval = 0.1;
+
+static os_time_t         g_last_publish_time;
+static volatile uint32_t g_status_version;
+static admin_status_t    g_status;
+
+void Admin_Publish(void)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	if (g_last_publish_time && OS_GetSecondsElapsed(g_last_publish_time, now) < g_publish_interval)
+		return;
+
+	g_last_publish_time = now;
+
+	// the stats get worked out whether anybody's listening or not, so
+	// the rates cover the same window either way
+	net_stats_t net;
+	SV_GetNetStats(&net);
+
+	OS_AtomicAdd32(&g_status_version, 1);
+
+	admin_status_t *status = &g_status;
+	status->publish_time = now;
+	status->tick         = Sim_GetTick();
+	status->entity_count = E_GetCount();
+	status->client_count = (int)g_client_count;
+	status->net          = net;
+
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t    *client = &g_clients[i];
+		admin_client_t *dst    = &status->clients[i];
+
+		dst->player_id     = client->player_id;
+		dst->disconnecting = client->disconnecting;
+
+		memcpy(dst->name, client->name, sizeof(dst->name));
+		dst->name[sizeof(dst->name) - 1] = 0;
+
+		Net_StringFromNetAddr(dst->address, sizeof(dst->address), client->address);
+
+		dst->rtt               = client->link.rtt;
+		dst->rtt_min           = client->link.rtt_min;
+		dst->jitter            = client->link.jitter;
+		dst->loss              = client->link.loss;
+		dst->snapshot_loss     = client->rate.loss;
+		dst->budget            = client->rate.budget;
+		dst->input_lead        = client->input_lead;
+		dst->bytes_sent        = client->rate.bytes_sent;
+		dst->bytes_received    = client->rate.bytes_received;
+		dst->snapshots_sent    = client->rate.snapshots_sent;
+		dst->snapshots_skipped = client->rate.snapshots_skipped;
+		dst->input_underflows  = client->input_queue.underflows;
+		dst->input_overflows   = client->input_queue.overflows;
+	}
+
+	OS_AtomicAdd32(&g_status_version, 1);
+}
+
+static bool Admin_ReadStatus(admin_status_t *status)
+{
+	for (int attempt = 0; attempt < 100; attempt++)
+	{
+		uint32_t version = OS_AtomicLoad32(&g_status_version);
+
+		if (version & 1)
+		{
+			OS_Sleep(0);
+			continue;
+		}
+
+		memcpy(status, &g_status, sizeof(*status));
+
+		if (OS_AtomicLoad32(&g_status_version) == version)
+			return true;
+	}
+
+	return false;
+}
+
+// ------------------------------------------------------------------
+// building responses
+
+enum { ADMIN_RESPONSE_CAPACITY = 64*1024 };
+
+typedef struct admin_text_t
+{
+	size_t size;
+	char   data[ADMIN_RESPONSE_CAPACITY];
+} admin_text_t;
+
+static void Admin_Print(admin_text_t *text, const char *format, ...)
+{
+	size_t space = sizeof(text->data) - text->size;
+
+	va_list args;
+	va_start(args, format);
+	int count = vsnprintf(&text->data[text->size], space, format, args);
+	va_end(args);
+
+	// a response that doesn't fit gets cut off
+	if (count > 0)
+		text->size += ((size_t)count < space) ? (size_t)count : space - 1;
+}
+
+// names come straight from clients, so they can't be trusted to not
+// mess up the quotes around label values
+static void Admin_PrintLabelValue(admin_text_t *text, const char *value)
+{
+	for (const char *at = value; *at; at++)
+	{
+		switch (*at)
+		{
+			case '\\': Admin_Print(text, "\\\\"); break;
+			case '"':  Admin_Print(text, "\\\""); break;
+			case '\n': Admin_Print(text, "\\n");  break;
+			default:   Admin_Print(text, "%c", *at); break;
+		}
+	}
+}
+
+static void Admin_PrintClientMetric(admin_text_t *text, const admin_status_t *status, const char *name, const char *type,
+									size_t offset, bool is_float)
+{
+	Admin_Print(text, "# TYPE netgame_client_%s %s\n", name, type);
+
+	for (int i = 0; i < status->client_count; i++)
+	{
+		const admin_client_t *client = &status->clients[i];
+
+		Admin_Print(text, "netgame_client_%s{player=\"%d\",name=\"", name, client->player_id);
+		Admin_PrintLabelValue(text, client->name);
+		Admin_Print(text, "\"} ");
+
+		const unsigned char *field = (const unsigned char *)client + offset;
+
+		if (is_float)
+		{
+			float value;
+			memcpy(&value, field, sizeof(value));
+			Admin_Print(text, "%g\n", (double)value);
+		}
+		else
+		{
+			uint64_t value;
+			memcpy(&value, field, sizeof(value));
+			Admin_Print(text, "%llu\n", (unsigned long long)value);
+		}
+	}
+}
+
+static void Admin_WriteMetrics(admin_text_t *text, const admin_status_t *status, const metrics_snapshot_t *metrics)
+{
+	Admin_Print(text, "# TYPE netgame_tick counter\nnetgame_tick %u\n", status->tick);
+	Admin_Print(text, "# TYPE netgame_clients gauge\nnetgame_clients %d\n", status->client_count);
+	Admin_Print(text, "# TYPE netgame_entities gauge\nnetgame_entities %d\n", status->entity_count);
+
+	const net_stats_t *net = &status->net;
+
+	Admin_Print(text, "# TYPE netgame_net_bytes_in counter\nnetgame_net_bytes_in %llu\n",       (unsigned long long)net->totals.bytes_in);
+	Admin_Print(text, "# TYPE netgame_net_bytes_out counter\nnetgame_net_bytes_out %llu\n",     (unsigned long long)net->totals.bytes_out);
+	Admin_Print(text, "# TYPE netgame_net_packets_in counter\nnetgame_net_packets_in %llu\n",   (unsigned long long)net->totals.packets_in);
+	Admin_Print(text, "# TYPE netgame_net_packets_out counter\nnetgame_net_packets_out %llu\n", (unsigned long long)net->totals.packets_out);
+	Admin_Print(text, "# TYPE netgame_net_bytes_in_per_second gauge\nnetgame_net_bytes_in_per_second %g\n",   (double)net->bytes_in_per_second);
+	Admin_Print(text, "# TYPE netgame_net_bytes_out_per_second gauge\nnetgame_net_bytes_out_per_second %g\n", (double)net->bytes_out_per_second);
+
+	// per client, all of the floats are plain ratios or in seconds
+	Admin_PrintClientMetric(text, status, "rtt_seconds",           "gauge",   offsetof(admin_client_t, rtt),            true);
+	Admin_PrintClientMetric(text, status, "rtt_min_seconds",       "gauge",   offsetof(admin_client_t, rtt_min),        true);
+	Admin_PrintClientMetric(text, status, "jitter_seconds",        "gauge",   offsetof(admin_client_t, jitter),         true);
+	Admin_PrintClientMetric(text, status, "loss_ratio",            "gauge",   offsetof(admin_client_t, loss),           true);
+	Admin_PrintClientMetric(text, status, "snapshot_loss_ratio",   "gauge",   offsetof(admin_client_t, snapshot_loss),  true);
+	Admin_PrintClientMetric(text, status, "budget_bytes_per_second", "gauge", offsetof(admin_client_t, budget),         true);
+	Admin_PrintClientMetric(text, status, "input_lead_seconds",    "gauge",   offsetof(admin_client_t, input_lead),     true);
+	Admin_PrintClientMetric(text, status, "bytes_sent",            "counter", offsetof(admin_client_t, bytes_sent),     false);
+	Admin_PrintClientMetric(text, status, "bytes_received",        "counter", offsetof(admin_client_t, bytes_received), false);
+
+	log_stats_t log;
+	Log_GetStats(&log);
+
+	Admin_Print(text, "# TYPE netgame_log_written counter\nnetgame_log_written %llu\n",       (unsigned long long)log.written);
+	Admin_Print(text, "# TYPE netgame_log_dropped counter\nnetgame_log_dropped %llu\n",       (unsigned long long)log.dropped);
+	Admin_Print(text, "# TYPE netgame_log_suppressed counter\nnetgame_log_suppressed %llu\n", (unsigned long long)log.suppressed);
+
+	for (int i = 0; i < metrics->counter_count; i++)
+	{
+		const metrics_counter_value_t *counter = &metrics->counters[i];
+
+		Admin_Print(text, "# TYPE netgame_%s counter\nnetgame_%s %llu\n",
+					counter->name, counter->name, (unsigned long long)counter->value);
+	}
+
+	for (int i = 0; i < metrics->histogram_count; i++)
+	{
+		const metrics_histogram_summary_t *h = &metrics->histograms[i];
+
+		Admin_Print(text, "# TYPE netgame_%s summary\n", h->name);
+		Admin_Print(text, "netgame_%s{quantile=\"0.5\"} %llu\n",   h->name, (unsigned long long)h->p50);
+		Admin_Print(text, "netgame_%s{quantile=\"0.9\"} %llu\n",   h->name, (unsigned long long)h->p90);
+		Admin_Print(text, "netgame_%s{quantile=\"0.99\"} %llu\n",  h->name, (unsigned long long)h->p99);
+		Admin_Print(text, "netgame_%s{quantile=\"0.999\"} %llu\n", h->name, (unsigned long long)h->p999);
+		Admin_Print(text, "netgame_%s_sum %llu\n",   h->name, (unsigned long long)h->sum);
+		Admin_Print(text, "netgame_%s_count %llu\n", h->name, (unsigned long long)h->count);
+		Admin_Print(text, "# TYPE netgame_%s_max gauge\nnetgame_%s_max %llu\n", h->name, h->name, (unsigned long long)h->max);
+	}
+}
+
+static void Admin_WriteStatus(admin_text_t *text, const admin_status_t *status, const metrics_snapshot_t *metrics)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	Admin_Print(text, "tick:     %u (as of %.0f ms ago)\n", status->tick, 1000.0*OS_GetSecondsElapsed(status->publish_time, now));
+	Admin_Print(text, "clients:  %d\n", status->client_count);
+	Admin_Print(text, "entities: %d\n", status->entity_count);
+	Admin_Print(text, "traffic:  %.1f KB/s in, %.1f KB/s out\n",
+				(double)status->net.bytes_in_per_second / 1024.0, (double)status->net.bytes_out_per_second / 1024.0);
+
+	for (int i = 0; i < metrics->histogram_count; i++)
+	{
+		const metrics_histogram_summary_t *h = &metrics->histograms[i];
+
+		Admin_Print(text, "%s: p50 %llu, p99 %llu, p999 %llu, max %llu (%llu samples)\n", h->name,
+					(unsigned long long)h->p50, (unsigned long long)h->p99, (unsigned long long)h->p999,
+					(unsigned long long)h->max, (unsigned long long)h->count);
+	}
+}
+
+static void Admin_WriteClients(admin_text_t *text, const admin_status_t *status)
+{
+	Admin_Print(text, "%-3s %-16s %-16s %8s %8s %6s %6s %10s %8s %10s\n",
+				"id", "name", "address", "rtt ms", "jitter", "loss", "sloss", "budget", "lead ms", "skipped");
+
+	for (int i = 0; i < status->client_count; i++)
+	{
+		const admin_client_t *client = &status->clients[i];
+
+		Admin_Print(text, "%-3d %-16.16s %-16s %8.1f %8.1f %5.1f%% %5.1f%% %8.0fKB %8.1f %10u%s\n",
+					client->player_id, client->name, client->address,
+					1000.0*(double)client->rtt, 1000.0*(double)client->jitter,
+					100.0*(double)client->loss, 100.0*(double)client->snapshot_loss,
+					(double)client->budget / 1024.0, 1000.0*(double)client->input_lead,
+					client->snapshots_skipped, client->disconnecting ? " (disconnecting)" : "");
+	}
+}
+
+static void Admin_WriteHelp(admin_text_t *text)
+{
+	Admin_Print(text,
+		"metrics    everything, in the prometheus text format\n"
+		"status     tick timing, client and entity counts, traffic\n"
+		"clients    a line per client with its connection's stats\n"
+		"help       this list\n");
+}
+
+// ------------------------------------------------------------------
+// handling connections
+
+// only the admin thread touches these
+static admin_status_t     g_read_status;
+static metrics_snapshot_t g_read_metrics;
+static admin_text_t       g_response;
+
+// how long a connection gets to send its request and take its response
+static unsigned g_connection_timeout_ms = 1000;
+
+static void Admin_HandleConnection(net_socket_t sock)
+{
+	char request[2048];
+	size_t request_size = 0;
+
+	// read until the end of the first line for commands, or the end of the
+	// headers for HTTP, so that the request is all gone by the time the
+	// socket gets closed. closing with unread data makes windows reset the
+	// connection, which can take the response with it
+	for (;;)
+	{
+		int count = Net_RecvStream(sock, &request[request_size], sizeof(request) - 1 - request_size);
+
+		if (count <= 0)
+			break;
+
+		request_size += (size_t)count;
+		request[request_size] = 0;
+
+		bool is_http = (strncmp(request, "GET ", 4) == 0);
+
+		if (is_http ? strstr(request, "\r\n\r\n") != NULL : strchr(request, '\n') != NULL)
+			break;
+
+		if (request_size >= sizeof(request) - 1)
+			break;
+	}
+
+	if (request_size == 0)
+		return;
+
+	request[request_size] = 0;
+
+	// pick the command out of the request
+
+	bool  is_http = false;
+	char *command = request;
+
+	if (strncmp(request, "GET ", 4) == 0)
+	{
+		is_http = true;
+		command = request + 4;
+
+		if (*command == '/')
+			command += 1;
+	}
+
+	size_t command_size = strcspn(command, is_http ? " ?\r\n" : " \t\r\n");
+	command[command_size] = 0;
+
+	// and answer it
+
+	bool found = true;
+
+	g_response.size = 0;
+
+	bool has_status = Admin_ReadStatus(&g_read_status);
+	Metrics_GetSnapshot(&g_read_metrics);
+
+	if (!has_status)
+	{
+		Admin_Print(&g_response, "the server is too busy to say, try again\n");
+	}
+	else if (strcmp(command, "metrics") == 0)
+	{
+		Admin_WriteMetrics(&g_response, &g_read_status, &g_read_metrics);
+	}
+	else if (strcmp(command, "status") == 0)
+	{
+		Admin_WriteStatus(&g_response, &g_read_status, &g_read_metrics);
+	}
+	else if (strcmp(command, "clients") == 0)
+	{
+		Admin_WriteClients(&g_response, &g_read_status);
+	}
+	else if (strcmp(command, "help") == 0 || (is_http && command_size == 0))
+	{
+		Admin_WriteHelp(&g_response);
+	}
+	else
+	{
+		found = false;
+		Admin_Print(&g_response, "unknown command '%s', try 'help'\n", command);
+	}
+
+	if (is_http)
+	{
+		char header[256];
+		int header_size = snprintf(header, sizeof(header),
+								   "HTTP/1.0 %s\r\n"
+								   "Content-Type: text/plain; version=0.0.4\r\n"
+								   "Content-Length: %zu\r\n"
+								   "Connection: close\r\n"
+								   "\r\n",
+								   !found ? "404 Not Found" : has_status ? "200 OK" : "503 Service Unavailable",
+								   g_response.size);
+
+		if (Net_SendStream(sock, header, (size_t)header_size) != 0)
+			return;
+	}
+
+	Net_SendStream(sock, g_response.data, g_response.size);
+}
+
+// ------------------------------------------------------------------
+// the admin thread
+
+static net_socket_t      g_listen_socket = { INVALID_SOCKET_VALUE };
+static net_poll_set_t    g_poll_set;
+static os_thread_t       g_admin_thread;
+static volatile uint32_t g_admin_running;
+
+static int Admin_ThreadProc(void *userdata)
+{
+	(void)userdata;
+
+	while (OS_AtomicLoad32(&g_admin_running))
+	{
+		// wake up every now and then to see if we should stop
+		int ready = Net_Poll(&g_poll_set, 100);
+
+		if (ready < 0)
+		{
+			OS_Sleep(100);
+			continue;
+		}
+
+		if (ready == 0)
+			continue;
+
+		for (;;)
+		{
+			net_addr_t   address;
+			net_socket_t sock = Net_AcceptConnection(g_listen_socket, &address, g_connection_timeout_ms);
+
+			if (sock.value == INVALID_SOCKET_VALUE)
+				break;
+
+			Admin_HandleConnection(sock);
+			Net_CloseSocket(sock);
+		}
+	}
+
+	return 0;
+}
+
+int Admin_Start(int port)
+{
+	net_addr_t addr = Net_GetAddr("127.0.0.1", port);
+
+	g_listen_socket = Net_CreateListenSocket(addr);
+
+	if (g_listen_socket.value == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "Admin_Start: failed to listen on port %d\n", port);
+		return -1;
+	}
+
+	if (Net_CreatePollSet(&g_poll_set, 1) != 0)
+	{
+		fprintf(stderr, "Admin_Start: failed to create poll set\n");
+		Net_CloseSocket(g_listen_socket);
+		return -1;
+	}
+
+	Net_AddToPollSet(&g_poll_set, g_listen_socket);
+
+	OS_AtomicStore32(&g_admin_running, 1);
+
+	g_admin_thread = OS_CreateThread(Admin_ThreadProc, NULL);
+	if (!g_admin_thread.value)
+	{
+		fprintf(stderr, "Admin_Start: failed to start admin thread\n");
+		OS_AtomicStore32(&g_admin_running, 0);
+		Net_DestroyPollSet(&g_poll_set);
+		Net_CloseSocket(g_listen_socket);
+		return -1;
+	}
+
+	printf("Admin endpoint listening on 127.0.0.1:%d\n", port);
+	return 0;
+}
+
+void Admin_Stop(void)
+{
+	if (!OS_AtomicLoad32(&g_admin_running))
+		return;
+
+	OS_AtomicStore32(&g_admin_running, 0);
+	OS_JoinThread(g_admin_thread);
+
+	Net_DestroyPollSet(&g_poll_set);
+	Net_CloseSocket(g_listen_socket);
+}
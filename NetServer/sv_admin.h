@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+// sv_admin.h: a local TCP endpoint for monitoring to scrape, which also
+// answers a few read-only questions about the server. it runs on its
+// own thread, and only ever looks at a copy of the server's state that
+// the simulation thread publishes a few times a second, so nothing it
+// does can hold up a tick.
+//
+// connect, send a line, get the answer, and the connection gets closed.
+// the line is either one of these commands, or an HTTP GET for the
+// same thing (GET /metrics), so both netcat and prometheus work:
+//
+//     metrics    everything, in the prometheus text format
+//     status     tick timing, client and entity counts, traffic
+//     clients    a line per client with its connection's stats
+//     help       this list
+
+// starts listening on 127.0.0.1 at the given port. returns 0 on
+// success, the server is fine to keep running without it if it fails
+int  Admin_Start(int port);
+void Admin_Stop(void);
+
+// to be called by the simulation thread at the end of every tick. it
+// only copies anything out every so often
+void Admin_Publish(void);
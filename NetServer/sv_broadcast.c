@@ -0,0 +1,587 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "os.h"
+#include "net.h"
+#include "netlink.h"
+#include "fragment.h"
+#include "siphash.h"
+#include "logger.h"
+#include "spectate.h"
+#include "sv_rate.h"
+#include "sv_broadcast.h"
+
+// ------------------------------------------------------------------
+// sv_broadcast.c: viewers live in a packed array, and get found by
+// address through a little open addressing table of indices into it,
+// which gets rebuilt whenever a viewer leaves. leaving is rare next to
+// the acks that come in every snapshot.
+
+
+typedef struct broadcast_viewer_t
+{
+	net_addr_t address;
+	os_time_t  last_packet_time;
+
+	bool     has_baseline;
+	uint32_t baseline_tick; // the newest tick the viewer said it has
+
+	unsigned short sequence; // of the next snapshot
+	unsigned short fragmented_packet_id;
+
+	net_link_t link;
+	sv_rate_t  rate;
+} broadcast_viewer_t;
+
+// a snapshot of the current frame, encoded from one particular baseline
+typedef struct broadcast_encoding_t
+{
+	bool     keyframe;
+	uint32_t baseline_tick;
+	size_t   packet_size;
+
+	net_snapshot_t packet;
+} broadcast_encoding_t;
+
+struct sv_broadcast_t
+{
+	net_context_t net;
+	net_socket_t  socket;
+
+	// the secret that cookies are hashed with, the same scheme as the
+	// server's connect handshake, see sv_server.c
+	siphash_key_t cookie_key;
+	os_time_t     cookie_epoch;
+
+	int                 viewer_count;
+	int                 max_viewers;
+	broadcast_viewer_t *viewers;
+
+	uint32_t table_mask;
+	int32_t *table; // index into viewers, -1 for an empty entry
+
+	os_time_t snapshot_interval; // 0 sends every frame
+	os_time_t next_send_time;
+	os_time_t last_timeout_check_time;
+
+	// the frames that went out, newest at newest_frame
+	uint32_t    frame_count;
+	uint32_t    newest_frame;
+	rec_frame_t frames[BROADCAST_HISTORY_SIZE];
+
+	int                  encoding_count; // for the newest frame
+	broadcast_encoding_t encodings[BROADCAST_CACHE_SIZE];
+	broadcast_encoding_t scratch;        // for when the cache is full
+
+	sv_broadcast_stats_t stats;
+};
+
+enum { BROADCAST_MAX_PACKET_SIZE = 8192 };
+
+// how long a cookie stays valid, in seconds, like the server's
+static double g_cookie_lifetime = 10.0;
+
+// ------------------------------------------------------------------
+// finding viewers by address
+
+static uint32_t Broadcast_HashAddress(net_addr_t address)
+{
+	uint32_t hash = address.addr*2654435761u;
+	hash ^= (uint32_t)address.port*40503u;
+	return hash ^ (hash >> 15);
+}
+
+static void Broadcast_RebuildTable(sv_broadcast_t *broadcast)
+{
+	for (uint32_t i = 0; i <= broadcast->table_mask; i++)
+		broadcast->table[i] = -1;
+
+	for (int i = 0; i < broadcast->viewer_count; i++)
+	{
+		uint32_t slot = Broadcast_HashAddress(broadcast->viewers[i].address) & broadcast->table_mask;
+
+		while (broadcast->table[slot] >= 0)
+			slot = (slot + 1) & broadcast->table_mask;
+
+		broadcast->table[slot] = i;
+	}
+}
+
+static broadcast_viewer_t *Broadcast_GetViewer(sv_broadcast_t *broadcast, net_addr_t address)
+{
+	uint32_t slot = Broadcast_HashAddress(address) & broadcast->table_mask;
+
+	// the table is never more than half full, so this always runs into
+	// an empty entry eventually
+	while (broadcast->table[slot] >= 0)
+	{
+		broadcast_viewer_t *viewer = &broadcast->viewers[broadcast->table[slot]];
+
+		if (Net_AddrMatch(viewer->address, address))
+			return viewer;
+
+		slot = (slot + 1) & broadcast->table_mask;
+	}
+
+	return NULL;
+}
+
+static broadcast_viewer_t *Broadcast_AddViewer(sv_broadcast_t *broadcast, net_addr_t address, os_time_t now)
+{
+	if (broadcast->viewer_count >= broadcast->max_viewers)
+	{
+		broadcast->stats.viewers_rejected += 1;
+		return NULL;
+	}
+
+	int index = broadcast->viewer_count++;
+
+	broadcast_viewer_t *viewer = &broadcast->viewers[index];
+	memset(viewer, 0, sizeof(*viewer));
+
+	viewer->address          = address;
+	viewer->last_packet_time = now;
+
+	Link_Init(&viewer->link);
+	Rate_Init(&viewer->rate, now);
+
+	uint32_t slot = Broadcast_HashAddress(address) & broadcast->table_mask;
+
+	while (broadcast->table[slot] >= 0)
+		slot = (slot + 1) & broadcast->table_mask;
+
+	broadcast->table[slot] = index;
+
+	char viewer_address[NETADDR_STR_SIZE];
+	Net_StringFromNetAddr(viewer_address, sizeof(viewer_address), address);
+
+	LOG_INFO("Spectator subscribed from %s:%u (%d watching)\n", viewer_address, address.port, broadcast->viewer_count);
+
+	return viewer;
+}
+
+static void Broadcast_RemoveViewer(sv_broadcast_t *broadcast, broadcast_viewer_t *viewer)
+{
+	char viewer_address[NETADDR_STR_SIZE];
+	Net_StringFromNetAddr(viewer_address, sizeof(viewer_address), viewer->address);
+
+	*viewer = broadcast->viewers[--broadcast->viewer_count];
+
+	Broadcast_RebuildTable(broadcast);
+
+	LOG_INFO("Spectator left: %s (%d watching)\n", viewer_address, broadcast->viewer_count);
+}
+
+// ------------------------------------------------------------------
+
+sv_broadcast_t *Broadcast_Create(int port, int max_viewers, double snapshot_rate, struct net_impairment_t *impairment)
+{
+	if (max_viewers < 1)
+		max_viewers = 1;
+
+	sv_broadcast_t *broadcast = calloc(1, sizeof(sv_broadcast_t));
+
+	if (!broadcast)
+		return NULL;
+
+	broadcast->socket.value = INVALID_SOCKET_VALUE;
+
+	uint32_t table_size = 2;
+	while (table_size < 2*(uint32_t)max_viewers)
+		table_size *= 2;
+
+	broadcast->max_viewers = max_viewers;
+	broadcast->viewers     = calloc((size_t)max_viewers, sizeof(broadcast_viewer_t));
+	broadcast->table       = calloc(table_size, sizeof(int32_t));
+	broadcast->table_mask  = table_size - 1;
+
+	if (!broadcast->viewers || !broadcast->table)
+	{
+		fprintf(stderr, "Broadcast_Create: out of memory\n");
+		Broadcast_Destroy(broadcast);
+		return NULL;
+	}
+
+	Broadcast_RebuildTable(broadcast);
+
+	if (OS_GetRandomBytes(&broadcast->cookie_key, sizeof(broadcast->cookie_key)) != 0)
+	{
+		fprintf(stderr, "Broadcast_Create: failed to generate the cookie key\n");
+		Broadcast_Destroy(broadcast);
+		return NULL;
+	}
+
+	Net_InitContext(&broadcast->net, impairment);
+
+	broadcast->socket = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
+
+	if (broadcast->socket.value == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "Broadcast_Create: failed to create socket\n");
+		Broadcast_Destroy(broadcast);
+		return NULL;
+	}
+
+	if (Net_BindSocket(broadcast->socket, Net_GetPassiveAddr(port)) != 0)
+	{
+		fprintf(stderr, "Broadcast_Create: failed to bind socket to port %d\n", port);
+		Broadcast_Destroy(broadcast);
+		return NULL;
+	}
+
+	broadcast->cookie_epoch = OS_GetHiresTime();
+
+	if (snapshot_rate > 0.0)
+		broadcast->snapshot_interval = OS_HiresTimeFromSeconds(1.0 / snapshot_rate);
+
+	return broadcast;
+}
+
+void Broadcast_Destroy(sv_broadcast_t *broadcast)
+{
+	if (!broadcast)
+		return;
+
+	if (broadcast->socket.value != INVALID_SOCKET_VALUE)
+		Net_CloseSocket(broadcast->socket);
+
+	free(broadcast->viewers);
+	free(broadcast->table);
+	free(broadcast);
+}
+
+net_socket_t Broadcast_GetSocket(sv_broadcast_t *broadcast)
+{
+	return broadcast->socket;
+}
+
+void Broadcast_GetStats(sv_broadcast_t *broadcast, sv_broadcast_stats_t *stats)
+{
+	broadcast->stats.viewer_count = broadcast->viewer_count;
+	Net_GetStats(&broadcast->net, &broadcast->stats.net);
+
+	*stats = broadcast->stats;
+}
+
+// ------------------------------------------------------------------
+// subscribing
+
+static uint64_t Broadcast_ComputeCookie(sv_broadcast_t *broadcast, net_addr_t address, uint32_t window)
+{
+	unsigned char input[12];
+	memcpy(&input[0], &address.family, 2);
+	memcpy(&input[2], &address.port,   2);
+	memcpy(&input[4], &address.addr,   4);
+	memcpy(&input[8], &window,         4);
+
+	return SipHash_Compute(&broadcast->cookie_key, input, sizeof(input));
+}
+
+static uint32_t Broadcast_GetCookieWindow(sv_broadcast_t *broadcast, os_time_t now)
+{
+	double seconds = OS_GetSecondsElapsed(broadcast->cookie_epoch, now);
+	return (uint32_t)(seconds / g_cookie_lifetime);
+}
+
+static bool Broadcast_CheckCookie(sv_broadcast_t *broadcast, net_addr_t address, uint64_t cookie, os_time_t now)
+{
+	uint32_t window = Broadcast_GetCookieWindow(broadcast, now);
+
+	if (cookie == Broadcast_ComputeCookie(broadcast, address, window))
+		return true;
+
+	if (window > 0 && cookie == Broadcast_ComputeCookie(broadcast, address, window - 1))
+		return true;
+
+	return false;
+}
+
+static void Broadcast_ProcessSpectate(sv_broadcast_t *broadcast, net_addr_t address, net_spectate_t *spectate, size_t datagram_size, os_time_t now)
+{
+	if (spectate->protocol_id      != NET_PROTOCOL_ID ||
+		spectate->protocol_version != NET_PROTOCOL_VERSION)
+	{
+		return;
+	}
+
+	broadcast_viewer_t *viewer = Broadcast_GetViewer(broadcast, address);
+
+	if (!viewer)
+	{
+		// a viewer that's leaving and that we don't know about anyway can
+		// just go
+		if (spectate->flags & SPECTATE_LEAVING)
+			return;
+
+		if (!Broadcast_CheckCookie(broadcast, address, spectate->cookie, now))
+		{
+			// the challenge is smaller than the spectate packet, same as for
+			// connecting to the server
+			net_challenge_t challenge = {
+				.header = {
+					.kind = NETPACKET_CHALLENGE,
+				},
+				.cookie = Broadcast_ComputeCookie(broadcast, address, Broadcast_GetCookieWindow(broadcast, now)),
+			};
+
+			Net_SendPacket(&broadcast->net, broadcast->socket, address, &challenge, sizeof(challenge));
+			return;
+		}
+
+		// if we're full, they'll have to keep trying
+		viewer = Broadcast_AddViewer(broadcast, address, now);
+
+		if (!viewer)
+			return;
+	}
+
+	if (spectate->flags & SPECTATE_LEAVING)
+	{
+		Broadcast_RemoveViewer(broadcast, viewer);
+		return;
+	}
+
+	viewer->last_packet_time = now;
+
+	Rate_OnDatagramReceived(&viewer->rate, datagram_size);
+
+	if (spectate->echo_time)
+	{
+		float rtt = (float)OS_GetSecondsElapsed(spectate->echo_time, now) - (float)spectate->hold_time / 1000000.0f;
+
+		if (rtt >= 0.0f && rtt < 10.0f)
+			Link_AddRttSample(&viewer->link, rtt);
+	}
+
+	if (spectate->flags & SPECTATE_HAS_ACKS)
+		Rate_OnAcks(&viewer->rate, spectate->ack, spectate->ack_bits, &viewer->link, now);
+
+	if (spectate->flags & SPECTATE_HAS_BASELINE)
+	{
+		// acks can arrive out of order, the baseline only moves forward
+		if (!viewer->has_baseline || (int32_t)(spectate->baseline_tick - viewer->baseline_tick) > 0)
+		{
+			viewer->has_baseline  = true;
+			viewer->baseline_tick = spectate->baseline_tick;
+		}
+	}
+}
+
+void Broadcast_ProcessPackets(sv_broadcast_t *broadcast)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	for (;;)
+	{
+		alignas(16) char buffer[BROADCAST_MAX_PACKET_SIZE];
+
+		net_addr_t address;
+		int result = Net_RecvPacket(&broadcast->net, broadcast->socket, buffer, sizeof(buffer), &address);
+
+		if (result <= 0)
+			break;
+
+		net_header_t *header = (net_header_t *)buffer;
+
+		// spectate packets are all a viewer ever sends
+		if ((size_t)result >= sizeof(net_spectate_t) && header->kind == NETPACKET_SPECTATE)
+			Broadcast_ProcessSpectate(broadcast, address, (net_spectate_t *)header, (size_t)result, now);
+	}
+
+	// once a second is plenty for something that takes SPECTATE_TIMEOUT
+	if (OS_GetSecondsElapsed(broadcast->last_timeout_check_time, now) >= 1.0)
+	{
+		broadcast->last_timeout_check_time = now;
+
+		for (int i = 0; i < broadcast->viewer_count; i++)
+		{
+			broadcast_viewer_t *viewer = &broadcast->viewers[i];
+
+			if (OS_GetSecondsElapsed(viewer->last_packet_time, now) > SPECTATE_TIMEOUT)
+			{
+				// the last viewer moves into this spot, so look at it again
+				Broadcast_RemoveViewer(broadcast, viewer);
+				i--;
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------
+// sending snapshots
+
+static const rec_frame_t *Broadcast_FindFrame(sv_broadcast_t *broadcast, uint32_t tick)
+{
+	for (uint32_t i = 0; i < broadcast->frame_count; i++)
+	{
+		if (broadcast->frames[i].tick == tick)
+			return &broadcast->frames[i];
+	}
+
+	return NULL;
+}
+
+static const rec_frame_t *Broadcast_GetOldestFrame(sv_broadcast_t *broadcast)
+{
+	if (broadcast->frame_count < BROADCAST_HISTORY_SIZE)
+		return &broadcast->frames[0];
+
+	return &broadcast->frames[(broadcast->newest_frame + 1) % BROADCAST_HISTORY_SIZE];
+}
+
+// returns the newest frame encoded from the baseline, or as a keyframe
+// if the baseline is NULL. viewers with the same baseline share it
+static broadcast_encoding_t *Broadcast_GetEncoding(sv_broadcast_t *broadcast, const rec_frame_t *baseline)
+{
+	bool     keyframe      = baseline == NULL;
+	uint32_t baseline_tick = baseline ? baseline->tick : 0;
+
+	for (int i = 0; i < broadcast->encoding_count; i++)
+	{
+		broadcast_encoding_t *encoding = &broadcast->encodings[i];
+
+		if (encoding->keyframe == keyframe && encoding->baseline_tick == baseline_tick)
+			return encoding;
+	}
+
+	broadcast_encoding_t *encoding = &broadcast->scratch;
+
+	if (broadcast->encoding_count < BROADCAST_CACHE_SIZE)
+		encoding = &broadcast->encodings[broadcast->encoding_count++];
+
+	const rec_frame_t *frame = &broadcast->frames[broadcast->newest_frame];
+
+	size_t data_size = Rec_EncodeFrame(baseline, frame, encoding->packet.data, sizeof(encoding->packet.data));
+
+	broadcast->stats.encodes += 1;
+
+	encoding->keyframe      = keyframe;
+	encoding->baseline_tick = baseline_tick;
+	encoding->packet_size   = data_size ? offsetof(net_snapshot_t, data) + data_size : 0;
+
+	encoding->packet.header.kind   = NETPACKET_SNAPSHOT;
+	encoding->packet.tick          = frame->tick;
+	encoding->packet.baseline_tick = baseline_tick;
+	encoding->packet.kind          = (unsigned char)(keyframe ? REC_RECORD_KEYFRAME : REC_RECORD_DELTA);
+
+	return encoding;
+}
+
+static void Broadcast_SendPacket(sv_broadcast_t *broadcast, broadcast_viewer_t *viewer, void *packet, size_t packet_size)
+{
+	int fragment_count = Fragment_GetCount(packet_size);
+
+	if (fragment_count == 1)
+	{
+		int bytes_sent = Net_SendPacket(&broadcast->net, broadcast->socket, viewer->address, packet, packet_size);
+
+		if (bytes_sent > 0)
+			Rate_OnDatagramSent(&viewer->rate, (size_t)bytes_sent);
+	}
+	else if (ALWAYS(fragment_count <= NET_MAX_FRAGMENT_COUNT))
+	{
+		unsigned short packet_id = viewer->fragmented_packet_id++;
+
+		for (int i = 0; i < fragment_count; i++)
+		{
+			net_fragment_t fragment;
+			size_t fragment_size = Fragment_Write(&fragment, packet_id, i, packet, packet_size);
+
+			int bytes_sent = Net_SendPacket(&broadcast->net, broadcast->socket, viewer->address, &fragment, fragment_size);
+
+			if (bytes_sent > 0)
+				Rate_OnDatagramSent(&viewer->rate, (size_t)bytes_sent);
+		}
+	}
+}
+
+static void Broadcast_SendSnapshot(sv_broadcast_t *broadcast, broadcast_viewer_t *viewer, os_time_t now)
+{
+	// a viewer further behind than the history goes, or that just got
+	// here, starts over from a keyframe
+	const rec_frame_t *baseline = NULL;
+
+	if (viewer->has_baseline)
+		baseline = Broadcast_FindFrame(broadcast, viewer->baseline_tick);
+
+	broadcast_encoding_t *encoding = Broadcast_GetEncoding(broadcast, baseline);
+
+	if (NEVER(encoding->packet_size == 0))
+		return;
+
+	if (!Rate_CanSendSnapshot(&viewer->rate, encoding->packet_size, 1, now))
+	{
+		broadcast->stats.snapshots_skipped += 1;
+		return;
+	}
+
+	encoding->packet.header.sequence = viewer->sequence;
+	encoding->packet.send_time       = now;
+
+	Broadcast_SendPacket(broadcast, viewer, &encoding->packet, encoding->packet_size);
+	Rate_OnSnapshotSent(&viewer->rate, viewer->sequence);
+
+	viewer->sequence += 1;
+
+	broadcast->stats.snapshots_sent += 1;
+
+	if (encoding->keyframe)
+		broadcast->stats.keyframes_sent += 1;
+}
+
+void Broadcast_Publish(sv_broadcast_t *broadcast, const rec_frame_t *frame)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	if (broadcast->frame_count > 0 &&
+		(int32_t)(frame->tick - broadcast->frames[broadcast->newest_frame].tick) <= 0)
+	{
+		// going back further than anything we still have means whatever is
+		// upstream of us started over, so we do too
+		if ((int32_t)(frame->tick - Broadcast_GetOldestFrame(broadcast)->tick) >= 0)
+			return;
+
+		broadcast->frame_count  = 0;
+		broadcast->newest_frame = 0;
+
+		for (int i = 0; i < broadcast->viewer_count; i++)
+			broadcast->viewers[i].has_baseline = false;
+	}
+
+	if (broadcast->snapshot_interval)
+	{
+		// frames that come in from upstream at the same rate as ours
+		// jitter around the time they're due, so they get some slack
+		if (now + broadcast->snapshot_interval / 4 < broadcast->next_send_time)
+			return;
+
+		// if we fell way behind, don't try to make up for it with a burst
+		if (now > broadcast->next_send_time + broadcast->snapshot_interval)
+			broadcast->next_send_time = now;
+
+		broadcast->next_send_time += broadcast->snapshot_interval;
+	}
+
+	// only frames that go out get kept, since only those can be baselines
+	if (broadcast->frame_count > 0)
+		broadcast->newest_frame = (broadcast->newest_frame + 1) % BROADCAST_HISTORY_SIZE;
+
+	if (broadcast->frame_count < BROADCAST_HISTORY_SIZE)
+		broadcast->frame_count += 1;
+
+	broadcast->frames[broadcast->newest_frame] = *frame;
+	broadcast->encoding_count = 0;
+
+	for (int i = 0; i < broadcast->viewer_count; i++)
+		Broadcast_SendSnapshot(broadcast, &broadcast->viewers[i], now);
+}
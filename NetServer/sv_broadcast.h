@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "net.h"
+#include "recording.h"
+
+// ------------------------------------------------------------------
+// sv_broadcast.h: the sending end of spectating (see spectate.h). a
+// broadcast gets handed the world every tick, and sends it on to
+// whoever subscribed, on a port of its own. the game server runs one
+// for relays to subscribe to, and a relay (NetRelay) runs one for
+// spectators, and other relays, to subscribe to in turn.
+//
+// every viewer gets its own deltas, from whichever frame it last said
+// it has, and its own bandwidth budget (see sv_rate.h). viewers that
+// are in step with each other have the same baseline, so a snapshot
+// only gets encoded once for all of them. the frames a viewer could
+// have are the last BROADCAST_HISTORY_SIZE that went out, a viewer
+// further behind than that gets a keyframe.
+
+// how many sent frames are kept around as baselines, about 4.5
+// kilobytes each
+enum { BROADCAST_HISTORY_SIZE = 128 };
+
+// how many different baselines get their encoded snapshot kept around
+// for other viewers, per frame
+enum { BROADCAST_CACHE_SIZE = 8 };
+
+typedef struct sv_broadcast_t sv_broadcast_t;
+
+typedef struct sv_broadcast_stats_t
+{
+	int      viewer_count;
+	uint64_t viewers_rejected;  // turned away because the broadcast was full
+	uint64_t snapshots_sent;
+	uint64_t keyframes_sent;
+	uint64_t snapshots_skipped; // held back by the viewer's budget
+	uint64_t encodes;           // snapshots that had to be encoded, the rest came out of the cache
+	net_stats_t net;
+} sv_broadcast_stats_t;
+
+// binds to the port and starts taking subscriptions from up to
+// max_viewers at once. frames go out at most snapshot_rate times a
+// second, 0 sends every frame that gets published. networking has to
+// be initialized already (see Net_Init). the impairment can be NULL,
+// see netimpair.h. returns NULL on failure
+sv_broadcast_t *Broadcast_Create(int port, int max_viewers, double snapshot_rate, struct net_impairment_t *impairment);
+void            Broadcast_Destroy(sv_broadcast_t *broadcast);
+
+// takes in the spectate packets that arrived, and drops viewers that
+// went quiet
+void Broadcast_ProcessPackets(sv_broadcast_t *broadcast);
+
+// hands over the world as of a new tick. unless it isn't time for the
+// next snapshot yet, it gets sent to every viewer whose budget allows.
+// frames that aren't newer than the last one are ignored
+void Broadcast_Publish(sv_broadcast_t *broadcast, const rec_frame_t *frame);
+
+// for waiting on with a poll set (see Net_Poll)
+net_socket_t Broadcast_GetSocket(sv_broadcast_t *broadcast);
+
+void Broadcast_GetStats(sv_broadcast_t *broadcast, sv_broadcast_stats_t *stats);
@@ -0,0 +1,147 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+#include <math.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "sv_simulation.h"
+#include "sv_history.h"
+
+// ------------------------------------------------------------------
+// sv_history.c: the history is a ring of ticks, and each tick stores
+// its entities as separate arrays of ids and positions rather than a
+// copy of sv_entity_t. a hit test only touches the ids and positions
+// of a single tick (or two, when interpolating), which keeps it to a
+// couple of cache lines per target, and the whole thing to a fixed
+// ~100kB.
+
+
+typedef struct sv_history_t
+{
+	uint32_t recorded_count; // how many ticks have been recorded, up to HISTORY_TICK_COUNT
+	uint32_t newest_tick;
+
+	uint32_t ticks[HISTORY_TICK_COUNT]; // the tick each slot was recorded at
+
+	int   ids[HISTORY_TICK_COUNT][MAX_ENTITY_COUNT]; // 0 if there was no entity in that slot
+	float x  [HISTORY_TICK_COUNT][MAX_ENTITY_COUNT];
+	float y  [HISTORY_TICK_COUNT][MAX_ENTITY_COUNT];
+} sv_history_t;
+
+static sv_history_t g_history;
+
+void History_Record(uint32_t tick, const sv_entity_t *entities)
+{
+	size_t slot = tick % HISTORY_TICK_COUNT;
+
+	g_history.ticks[slot] = tick;
+	g_history.newest_tick = tick;
+
+	if (g_history.recorded_count < HISTORY_TICK_COUNT)
+		g_history.recorded_count += 1;
+
+	int   *ids = g_history.ids[slot];
+	float *x   = g_history.x  [slot];
+	float *y   = g_history.y  [slot];
+
+	ids[INVALID_ENTITY_INDEX] = 0;
+
+	for (size_t i = MIN_ENTITY_INDEX; i <= MAX_ENTITY_INDEX; i++)
+	{
+		const sv_entity_t *e = &entities[i];
+
+		ids[i] = ENTITY_ID_VALID(e->id) ? e->id.value : 0;
+		x  [i] = e->x;
+		y  [i] = e->y;
+	}
+}
+
+float History_GetMaxRewindTicks(void)
+{
+	if (g_history.recorded_count == 0)
+		return 0.0f;
+
+	return (float)(g_history.recorded_count - 1);
+}
+
+// returns the slot for the tick this many ticks before the newest,
+// or -1 if it's missing (if ticks got skipped, somehow)
+static int History_GetSlot(uint32_t ticks_back)
+{
+	uint32_t tick = g_history.newest_tick - ticks_back;
+	size_t   slot = tick % HISTORY_TICK_COUNT;
+
+	if (g_history.ticks[slot] != tick)
+		return -1;
+
+	return (int)slot;
+}
+
+sv_rewind_t History_Rewind(float ticks_back)
+{
+	sv_rewind_t result = { 0 };
+
+	if (g_history.recorded_count == 0)
+		return result;
+
+	float max_ticks_back = History_GetMaxRewindTicks();
+
+	if (ticks_back > max_ticks_back) ticks_back = max_ticks_back;
+	if (ticks_back < 0.0f)           ticks_back = 0.0f;
+
+	uint32_t newer_back = (uint32_t)floorf(ticks_back);
+	uint32_t older_back = (uint32_t)ceilf(ticks_back);
+
+	int slot_a = History_GetSlot(older_back);
+	int slot_b = History_GetSlot(newer_back);
+
+	if (slot_a < 0 || slot_b < 0)
+		return result;
+
+	result.valid  = true;
+	result.slot_a = (size_t)slot_a;
+	result.slot_b = (size_t)slot_b;
+	result.t      = (float)older_back - ticks_back;
+
+	return result;
+}
+
+bool History_GetPosition(const sv_rewind_t *rewind, net_entity_id_t id, float *x, float *y)
+{
+	if (!rewind->valid || !ENTITY_ID_VALID(id))
+		return false;
+
+	size_t a = rewind->slot_a;
+	size_t b = rewind->slot_b;
+	short  i = id.index;
+
+	bool in_a = (g_history.ids[a][i] == id.value);
+	bool in_b = (g_history.ids[b][i] == id.value);
+
+	if (in_a && in_b)
+	{
+		*x = Lerp(g_history.x[a][i], g_history.x[b][i], rewind->t);
+		*y = Lerp(g_history.y[a][i], g_history.y[b][i], rewind->t);
+	}
+	else if (in_a)
+	{
+		*x = g_history.x[a][i];
+		*y = g_history.y[a][i];
+	}
+	else if (in_b)
+	{
+		*x = g_history.x[b][i];
+		*y = g_history.y[b][i];
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
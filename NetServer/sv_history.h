@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+
+// ------------------------------------------------------------------
+// sv_history.h: remembers where every entity was for the last few
+// ticks, so hit tests can be done against the positions a shooter
+// actually saw on their screen rather than where things are now on
+// the server, which is about a round trip further along.
+
+typedef struct sv_entity_t sv_entity_t;
+
+// at 120 ticks per second this is about half a second of history
+enum { HISTORY_TICK_COUNT = 64 }; // must be a power of two
+
+// a view into the history at some point between two recorded ticks
+typedef struct sv_rewind_t
+{
+	bool   valid;
+	size_t slot_a; // the older of the two ticks
+	size_t slot_b; // the newer of the two ticks
+	float  t;      // how far from a to b
+} sv_rewind_t;
+
+// to be called once per tick, after the entities have moved
+void History_Record(uint32_t tick, const sv_entity_t *entities);
+
+// the amount of ticks that can be rewound, at most
+float History_GetMaxRewindTicks(void);
+
+// gets a view of the world as it was this many ticks before the most
+// recently recorded tick. if the history doesn't go back that far,
+// it gets clamped
+sv_rewind_t History_Rewind(float ticks_back);
+
+// gets the position of the entity at the time of the rewind. returns
+// false if the entity didn't exist back then
+bool History_GetPosition(const sv_rewind_t *rewind, net_entity_id_t id, float *x, float *y);
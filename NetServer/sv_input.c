@@ -0,0 +1,197 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+#include <math.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "os.h"
+#include "sv_input.h"
+
+// ------------------------------------------------------------------
+// sv_input.c: implements the input jitter buffer
+
+
+// the target depth is clamped to this range
+enum { MIN_TARGET_DEPTH = 1, MAX_TARGET_DEPTH = 8 };
+
+// how many extra inputs beyond the target depth we tolerate before
+// consuming two at once to catch up
+enum { OVERFLOW_SLACK = 2 };
+
+static const float g_arrival_jitter_alpha = 1.0f / 16.0f;
+
+void Input_Init(sv_input_queue_t *queue)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->target_depth = MIN_TARGET_DEPTH;
+}
+
+int Input_GetDepth(sv_input_queue_t *queue)
+{
+	if (!queue->has_newest)
+		return 0;
+
+	int depth = (short)(queue->newest_sequence - queue->next_sequence) + 1;
+	return depth > 0 ? depth : 0;
+}
+
+static void Input_UpdateTargetDepth(sv_input_queue_t *queue, os_time_t arrival_time, double seconds_per_tick)
+{
+	if (queue->last_arrival_time)
+	{
+		// inputs are sent once per tick, so anything other than one tick 
+		// between arrivals is jitter
+		double interval  = OS_GetSecondsElapsed(queue->last_arrival_time, arrival_time);
+		float  deviation = (float)fabs(interval - seconds_per_tick);
+
+		queue->arrival_jitter += g_arrival_jitter_alpha*(deviation - queue->arrival_jitter);
+	}
+
+	queue->last_arrival_time = arrival_time;
+
+	int target_depth = MIN_TARGET_DEPTH + (int)ceil(2.0*queue->arrival_jitter / seconds_per_tick);
+
+	if (target_depth > MAX_TARGET_DEPTH)
+		target_depth = MAX_TARGET_DEPTH;
+
+	queue->target_depth = target_depth;
+}
+
+void Input_Push(sv_input_queue_t *queue, const sv_input_t *input, double seconds_per_tick)
+{
+	if (!queue->started)
+	{
+		// until we start consuming, just keep track of the oldest input we've
+		// got so that's where we start off
+		if (!queue->has_newest || (short)(input->sequence - queue->next_sequence) < 0)
+			queue->next_sequence = input->sequence;
+	}
+
+	short delta = (short)(input->sequence - queue->next_sequence);
+
+	if (delta < 0)
+	{
+		queue->late += 1;
+		return;
+	}
+
+	if (delta >= INPUT_QUEUE_SIZE)
+	{
+		// this is so far ahead of what we're consuming that it doesn't fit in
+		// the queue (the client stalled, or jumped ahead). there's no point in
+		// holding on to the old inputs, so start over from this one
+		memset(queue->valid, 0, sizeof(queue->valid));
+
+		queue->overflows    += 1;
+		queue->next_sequence = input->sequence;
+		queue->has_newest    = false;
+		queue->started       = false;
+	}
+
+	size_t index = input->sequence % INPUT_QUEUE_SIZE;
+
+	if (queue->valid[index] && queue->inputs[index].sequence == input->sequence)
+	{
+		queue->duplicates += 1;
+		return;
+	}
+
+	queue->valid [index] = true;
+	queue->inputs[index] = *input;
+
+	if (!queue->has_newest || (short)(input->sequence - queue->newest_sequence) > 0)
+	{
+		queue->has_newest      = true;
+		queue->newest_sequence = input->sequence;
+
+		// only in-order arrivals say anything useful about jitter
+		Input_UpdateTargetDepth(queue, input->arrival_time, seconds_per_tick);
+	}
+}
+
+bool Input_IsMissing(sv_input_queue_t *queue, unsigned short sequence)
+{
+	if (!queue->has_newest)
+		return true;
+
+	short delta = (short)(sequence - queue->next_sequence);
+
+	// before the queue starts, older inputs just move the start back
+	if (delta < 0 && queue->started)
+		return false;
+
+	if (delta >= INPUT_QUEUE_SIZE)
+		return false;
+
+	size_t index = sequence % INPUT_QUEUE_SIZE;
+	return !(queue->valid[index] && queue->inputs[index].sequence == sequence);
+}
+
+// pops the next input off the queue. if it never arrived but the queue
+// has enough inputs beyond it that it's unlikely to still show up, it
+// gets skipped over. returns false if there is nothing to consume
+static bool Input_Pop(sv_input_queue_t *queue, sv_input_t *result)
+{
+	int depth = Input_GetDepth(queue);
+
+	while (depth > 0)
+	{
+		size_t index = queue->next_sequence % INPUT_QUEUE_SIZE;
+
+		bool present = (queue->valid[index] && queue->inputs[index].sequence == queue->next_sequence);
+
+		if (!present && depth <= queue->target_depth)
+		{
+			// it might still be on its way
+			return false;
+		}
+
+		queue->valid[index]   = false;
+		queue->next_sequence += 1;
+
+		depth -= 1;
+
+		if (present)
+		{
+			*result = queue->inputs[index];
+			return true;
+		}
+
+		queue->skipped += 1;
+	}
+
+	return false;
+}
+
+int Input_Consume(sv_input_queue_t *queue, sv_input_t inputs[2])
+{
+	if (!queue->started)
+	{
+		// let the queue fill up before we start eating away at it
+		if (Input_GetDepth(queue) < queue->target_depth)
+			return 0;
+
+		queue->started = true;
+	}
+
+	if (!Input_Pop(queue, &inputs[0]))
+	{
+		queue->underflows += 1;
+		return 0;
+	}
+
+	if (Input_GetDepth(queue) > queue->target_depth + OVERFLOW_SLACK)
+	{
+		if (Input_Pop(queue, &inputs[1]))
+		{
+			queue->overflows += 1;
+			return 2;
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+
+// ------------------------------------------------------------------
+// sv_input.h: a small jitter buffer for client inputs. clients send
+// one input per tick, but the network doesn't deliver them one per
+// tick, so inputs get queued up by sequence number and the simulation
+// takes exactly one off the queue every tick. that way no button
+// presses get lost when two inputs show up in the same tick, and a 
+// late input doesn't make the previous one count twice.
+
+typedef struct sv_input_t
+{
+	unsigned short sequence;
+
+	uint32_t btn_down;
+	float    mouse_x, mouse_y;
+
+	os_time_t arrival_time;
+} sv_input_t;
+
+enum { INPUT_QUEUE_SIZE = 32 }; // must be a power of two
+
+typedef struct sv_input_queue_t
+{
+	bool started;     // whether the queue has filled up to the target depth yet
+	bool has_newest;
+
+	unsigned short next_sequence;   // the sequence of the next input to be consumed
+	unsigned short newest_sequence; // the newest sequence we have received
+
+	// inputs live at the index of their sequence number modulo the size
+	bool       valid [INPUT_QUEUE_SIZE];
+	sv_input_t inputs[INPUT_QUEUE_SIZE];
+
+	// the queue tries to stay this deep, which adapts to the jitter
+	// in the arrival times of the inputs
+	int       target_depth;
+	float     arrival_jitter;
+	os_time_t last_arrival_time;
+
+	// stats
+	uint32_t underflows; // ticks where we had to repeat the previous input
+	uint32_t overflows;  // ticks where we consumed two inputs to catch up
+	uint32_t skipped;    // inputs that never arrived and were skipped over
+	uint32_t recovered;  // inputs whose own packet was lost, but that made it as part of a later one
+	uint32_t late;       // inputs that arrived after they were already consumed or skipped
+	uint32_t duplicates;
+} sv_input_queue_t;
+
+void Input_Init(sv_input_queue_t *queue);
+
+// queues up a received input. seconds_per_tick is used to work out
+// how jittery the arrival times are
+void Input_Push(sv_input_queue_t *queue, const sv_input_t *input, double seconds_per_tick);
+
+// returns whether the input with this sequence number would still be
+// useful, meaning it isn't in the queue yet and hasn't been consumed or
+// skipped over. input packets repeat the last few inputs, so this is 
+// how the server picks out the ones it missed
+bool Input_IsMissing(sv_input_queue_t *queue, unsigned short sequence);
+
+// takes inputs off the queue for the current tick. returns how many
+// inputs to apply, in order:
+// 0: the queue ran dry (or hasn't started yet), repeat the last input
+// 1: the normal case
+// 2: the queue is running too deep, both inputs get applied so that 
+//    none of their button presses get lost
+int Input_Consume(sv_input_queue_t *queue, sv_input_t inputs[2]);
+
+// the amount of ticks worth of input currently queued up
+int Input_GetDepth(sv_input_queue_t *queue);
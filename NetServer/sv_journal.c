@@ -0,0 +1,284 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "sv_journal.h"
+
+// ------------------------------------------------------------------
+// sv_journal.c: records get packed into a little buffer and handed to
+// stdio, which has a big buffer of its own. only the simulation ever
+// writes to the journal, so unlike the capture, there's no lock.
+
+
+struct sv_journal_t
+{
+	FILE *file;
+
+	double   seconds_per_tick;
+	uint32_t ticks_since_flush;
+};
+
+// how much stdio buffers up before it writes to the file
+enum { JOURNAL_FILE_BUFFER_SIZE = 1 << 20 };
+
+enum
+{
+	JOURNAL_HEADER_SIZE      = 32,
+	JOURNAL_EVENT_SIZE       = 6,
+	JOURNAL_TICK_HEADER_SIZE = 14,
+	JOURNAL_INPUT_SIZE       = 21,
+};
+
+static unsigned char *Journal_Put(unsigned char *at, const void *value, size_t size)
+{
+	memcpy(at, value, size);
+	return at + size;
+}
+
+static const unsigned char *Journal_Get(const unsigned char *at, void *value, size_t size)
+{
+	memcpy(value, at, size);
+	return at + size;
+}
+
+// ------------------------------------------------------------------
+// writing
+
+sv_journal_t *Journal_Create(const char *path, const journal_settings_t *settings)
+{
+	sv_journal_t *journal = calloc(1, sizeof(sv_journal_t));
+
+	if (!journal)
+		return NULL;
+
+	journal->file = fopen(path, "wb");
+
+	if (!journal->file)
+	{
+		fprintf(stderr, "Journal_Create: failed to open '%s' for writing\n", path);
+		free(journal);
+		return NULL;
+	}
+
+	setvbuf(journal->file, NULL, _IOFBF, JOURNAL_FILE_BUFFER_SIZE);
+
+	journal->seconds_per_tick = settings->seconds_per_tick;
+
+	uint32_t magic   = JOURNAL_MAGIC;
+	uint32_t version = JOURNAL_VERSION;
+
+	unsigned char header[JOURNAL_HEADER_SIZE];
+
+	unsigned char *at = header;
+	at = Journal_Put(at, &magic,   sizeof(magic));
+	at = Journal_Put(at, &version, sizeof(version));
+	at = Journal_Put(at, &settings->seed,             sizeof(settings->seed));
+	at = Journal_Put(at, &settings->seconds_per_tick, sizeof(settings->seconds_per_tick));
+	at = Journal_Put(at, &settings->client_timeout,   sizeof(settings->client_timeout));
+
+	fwrite(header, 1, sizeof(header), journal->file);
+	fflush(journal->file);
+
+	return journal;
+}
+
+void Journal_Destroy(sv_journal_t *journal)
+{
+	if (!journal)
+		return;
+
+	fclose(journal->file);
+	free(journal);
+}
+
+void Journal_WriteEvent(sv_journal_t *journal, const journal_event_t *event)
+{
+	unsigned char record[JOURNAL_EVENT_SIZE];
+
+	unsigned char *at = record;
+	*at++ = (unsigned char)event->kind;
+	*at++ = event->player_id;
+	at = Journal_Put(at, &event->timeout_ticks, sizeof(event->timeout_ticks));
+
+	fwrite(record, 1, sizeof(record), journal->file);
+}
+
+void Journal_WriteTick(sv_journal_t *journal, const journal_tick_t *tick)
+{
+	if (NEVER(tick->input_count < 0 || tick->input_count > MAX_CLIENT_COUNT))
+		return;
+
+	unsigned char record[JOURNAL_TICK_HEADER_SIZE + MAX_CLIENT_COUNT*JOURNAL_INPUT_SIZE];
+
+	unsigned char *at = record;
+	*at++ = JOURNAL_RECORD_TICK;
+	at = Journal_Put(at, &tick->tick, sizeof(tick->tick));
+	at = Journal_Put(at, &tick->hash, sizeof(tick->hash));
+	*at++ = (unsigned char)tick->input_count;
+
+	for (int i = 0; i < tick->input_count; i++)
+	{
+		const journal_input_t *input = &tick->inputs[i];
+
+		*at++ = input->player_id;
+		at = Journal_Put(at, &input->btn_down,     sizeof(input->btn_down));
+		at = Journal_Put(at, &input->btn_pressed,  sizeof(input->btn_pressed));
+		at = Journal_Put(at, &input->mouse_x,      sizeof(input->mouse_x));
+		at = Journal_Put(at, &input->mouse_y,      sizeof(input->mouse_y));
+		at = Journal_Put(at, &input->rewind_ticks, sizeof(input->rewind_ticks));
+	}
+
+	fwrite(record, 1, (size_t)(at - record), journal->file);
+
+	journal->ticks_since_flush += 1;
+
+	if ((double)journal->ticks_since_flush*journal->seconds_per_tick >= 1.0)
+	{
+		fflush(journal->file);
+		journal->ticks_since_flush = 0;
+	}
+}
+
+// ------------------------------------------------------------------
+// reading
+
+int Journal_OpenReader(journal_reader_t *reader, const char *path)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->file = fopen(path, "rb");
+
+	if (!reader->file)
+	{
+		fprintf(stderr, "Journal_OpenReader: failed to open '%s'\n", path);
+		return -1;
+	}
+
+	unsigned char header[JOURNAL_HEADER_SIZE];
+
+	uint32_t magic   = 0;
+	uint32_t version = 0;
+
+	if (fread(header, 1, sizeof(header), reader->file) == sizeof(header))
+	{
+		const unsigned char *at = header;
+		at = Journal_Get(at, &magic,   sizeof(magic));
+		at = Journal_Get(at, &version, sizeof(version));
+		at = Journal_Get(at, &reader->settings.seed,             sizeof(reader->settings.seed));
+		at = Journal_Get(at, &reader->settings.seconds_per_tick, sizeof(reader->settings.seconds_per_tick));
+		at = Journal_Get(at, &reader->settings.client_timeout,   sizeof(reader->settings.client_timeout));
+	}
+
+	if (magic != JOURNAL_MAGIC)
+	{
+		fprintf(stderr, "Journal_OpenReader: '%s' isn't a journal\n", path);
+		Journal_CloseReader(reader);
+		return -1;
+	}
+
+	if (version != JOURNAL_VERSION)
+	{
+		fprintf(stderr, "Journal_OpenReader: '%s' is version %u, but we only know version %d\n", path, version, JOURNAL_VERSION);
+		Journal_CloseReader(reader);
+		return -1;
+	}
+
+	if (reader->settings.seconds_per_tick <= 0.0)
+	{
+		fprintf(stderr, "Journal_OpenReader: '%s' has a bogus tick duration\n", path);
+		Journal_CloseReader(reader);
+		return -1;
+	}
+
+	return 0;
+}
+
+void Journal_CloseReader(journal_reader_t *reader)
+{
+	if (reader->file)
+		fclose(reader->file);
+
+	reader->file = NULL;
+}
+
+journal_record_e Journal_Read(journal_reader_t *reader, journal_event_t *event, journal_tick_t *tick)
+{
+	if (!reader->file)
+		return JOURNAL_RECORD_NONE;
+
+	int kind = fgetc(reader->file);
+
+	switch (kind)
+	{
+		case JOURNAL_RECORD_JOIN:
+		case JOURNAL_RECORD_DISCONNECT:
+		case JOURNAL_RECORD_TIMEOUT:
+		{
+			unsigned char record[JOURNAL_EVENT_SIZE - 1];
+
+			if (fread(record, 1, sizeof(record), reader->file) != sizeof(record))
+				return JOURNAL_RECORD_NONE;
+
+			event->kind      = (journal_record_e)kind;
+			event->player_id = record[0];
+			Journal_Get(&record[1], &event->timeout_ticks, sizeof(event->timeout_ticks));
+		} break;
+
+		case JOURNAL_RECORD_TICK:
+		{
+			unsigned char record[JOURNAL_TICK_HEADER_SIZE - 1 + MAX_CLIENT_COUNT*JOURNAL_INPUT_SIZE];
+
+			if (fread(record, 1, JOURNAL_TICK_HEADER_SIZE - 1, reader->file) != JOURNAL_TICK_HEADER_SIZE - 1)
+				return JOURNAL_RECORD_NONE;
+
+			const unsigned char *at = record;
+			at = Journal_Get(at, &tick->tick, sizeof(tick->tick));
+			at = Journal_Get(at, &tick->hash, sizeof(tick->hash));
+			tick->input_count = *at++;
+
+			if (tick->input_count > MAX_CLIENT_COUNT)
+			{
+				fprintf(stderr, "Journal_Read: tick %u has %d inputs, which is more than there can be\n", tick->tick, tick->input_count);
+				return JOURNAL_RECORD_NONE;
+			}
+
+			size_t inputs_size = (size_t)tick->input_count*JOURNAL_INPUT_SIZE;
+
+			if (fread(record, 1, inputs_size, reader->file) != inputs_size)
+				return JOURNAL_RECORD_NONE;
+
+			at = record;
+
+			for (int i = 0; i < tick->input_count; i++)
+			{
+				journal_input_t *input = &tick->inputs[i];
+
+				input->player_id = *at++;
+				at = Journal_Get(at, &input->btn_down,     sizeof(input->btn_down));
+				at = Journal_Get(at, &input->btn_pressed,  sizeof(input->btn_pressed));
+				at = Journal_Get(at, &input->mouse_x,      sizeof(input->mouse_x));
+				at = Journal_Get(at, &input->mouse_y,      sizeof(input->mouse_y));
+				at = Journal_Get(at, &input->rewind_ticks, sizeof(input->rewind_ticks));
+			}
+		} break;
+
+		default:
+		{
+			// EOF, or a record we don't know, in which case there's no way
+			// of telling how long it is
+			if (kind != EOF)
+				fprintf(stderr, "Journal_Read: unknown record kind %d, stopping there\n", kind);
+
+			return JOURNAL_RECORD_NONE;
+		}
+	}
+
+	return (journal_record_e)kind;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+
+// ------------------------------------------------------------------
+// sv_journal.h: a record of everything the simulation took in from the
+// outside world, so a match can be simulated again without the network.
+// with the random numbers coming from a seed (see Sim_SetSeed), all that
+// is left to write down is:
+//
+//     joins:       a client got through the handshake, and got spawned
+//     disconnects: a client said goodbye
+//     timeouts:    whether a client's timeout timer dropped them when it
+//                  fired, or how many ticks it got pushed back by, since
+//                  that's down to when their last packet arrived
+//     ticks:       the buttons and mouse position every client ended up
+//                  with after taking inputs off their queue, and how far
+//                  their bullets would get rewound, in the order of
+//                  g_clients. and a hash of the world after the tick
+//
+// in the order they happened. everything else the simulation does
+// follows from those, so as long as the same build runs it on the same
+// kind of machine, the world comes out the same, down to the last bit.
+// the hashes are there to check that it did, and to find the tick where
+// it stopped doing so.
+//
+// since it's only good for the same build anyway, everything gets
+// written in native byte order.
+
+#define JOURNAL_MAGIC 0x4E524A4Eu // "NJRN"
+
+enum { JOURNAL_VERSION = 1 };
+
+// the things that went into the simulation when the journal was
+// started, which the re-simulation has to start off with too
+typedef struct journal_settings_t
+{
+	uint64_t seed;
+	double   seconds_per_tick;
+	double   client_timeout;
+} journal_settings_t;
+
+typedef enum journal_record_e
+{
+	JOURNAL_RECORD_NONE,
+	JOURNAL_RECORD_JOIN,
+	JOURNAL_RECORD_DISCONNECT,
+	JOURNAL_RECORD_TIMEOUT,
+	JOURNAL_RECORD_TICK,
+} journal_record_e;
+
+// a join, disconnect or timeout
+typedef struct journal_event_t
+{
+	journal_record_e kind;
+	unsigned char    player_id;
+	uint32_t         timeout_ticks; // for timeouts: 0 if they got dropped
+} journal_event_t;
+
+typedef struct journal_input_t
+{
+	unsigned char player_id;
+
+	uint32_t btn_down;
+	uint32_t btn_pressed;
+	float    mouse_x, mouse_y;
+
+	float    rewind_ticks;
+} journal_input_t;
+
+typedef struct journal_tick_t
+{
+	uint32_t tick;
+	uint64_t hash; // Sim_HashWorld, after the tick
+
+	int             input_count;
+	journal_input_t inputs[MAX_CLIENT_COUNT];
+} journal_tick_t;
+
+// ------------------------------------------------------------------
+// writing
+
+typedef struct sv_journal_t sv_journal_t;
+
+// returns NULL if the file can't be opened
+sv_journal_t *Journal_Create(const char *path, const journal_settings_t *settings);
+void          Journal_Destroy(sv_journal_t *journal);
+
+void Journal_WriteEvent(sv_journal_t *journal, const journal_event_t *event);
+
+// the file gets flushed about once a second's worth of ticks, so a
+// server that gets killed loses at most that much
+void Journal_WriteTick(sv_journal_t *journal, const journal_tick_t *tick);
+
+// ------------------------------------------------------------------
+// reading
+
+typedef struct journal_reader_t
+{
+	FILE              *file;
+	journal_settings_t settings;
+} journal_reader_t;
+
+// returns 0 on success, or -1 if the file can't be opened or isn't a
+// journal
+int  Journal_OpenReader(journal_reader_t *reader, const char *path);
+void Journal_CloseReader(journal_reader_t *reader);
+
+// reads the next record into event or tick, depending on what kind it
+// is, and returns the kind. returns JOURNAL_RECORD_NONE at the end of
+// the file, or if the last record was cut off
+journal_record_e Journal_Read(journal_reader_t *reader, journal_event_t *event, journal_tick_t *tick);
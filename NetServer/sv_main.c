@@ -2,6 +2,7 @@
 // standard library includes
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -13,9 +14,16 @@
 #include "protocol.h"
 #include "util.h"
 #include "net.h"
+#include "netimpair.h"
 #include "os.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "logger.h"
 #include "sv_simulation.h"
 #include "sv_server.h"
+#include "sv_admin.h"
+#include "sv_broadcast.h"
+#include "sv_sender.h"
 
 // ------------------------------------------------------------------
 // sv_main.c: entry point for the server application
@@ -26,11 +34,26 @@
 
 enum { PORT = 4950 };
 
+// the admin endpoint listens on this port on 127.0.0.1, see sv_admin.h
+enum { ADMIN_PORT = 4951 };
+
+// relays (NetRelay) subscribe to the spectator broadcast on this port,
+// see sv_broadcast.h. it's meant for a handful of relays that take care
+// of the actual spectators, not for spectators themselves
+enum 
+{ 
+	SPECTATE_PORT       = 4952,
+	SPECTATE_MAX_RELAYS = 8,
+};
+
 // the "framerate" of the serverside simulation
 static int    g_tickrate = 120;
 
+// how many snapshots a second go out to relays
+static double g_spectate_rate = 60.0;
+
 // if clients go off-grid for longer than this many seconds, we 
-// consider them disconnected. (TODO: reimplement!)
+// consider them disconnected
 static double g_client_timeout_time = 10.0;
 
 // ------------------------------------------------------------------
@@ -38,7 +61,21 @@ static double g_client_timeout_time = 10.0;
 
 int main(int argc, char **argv)
 {
-	bool local_session = false;
+	bool  local_session  = false;
+	float max_rewind     = 0.2f;
+	int   admin_port     = ADMIN_PORT;
+	int   spectate_port  = SPECTATE_PORT;
+	bool  trace_overruns = false;
+	bool  threaded_send  = false;
+
+	net_impair_settings_t impair_settings = { 0 };
+
+	char *capture_path = NULL;
+	char *journal_path = NULL;
+	char *record_path  = NULL;
+
+	bool     has_seed = false;
+	uint64_t seed     = 0;
 
 	for (int i = 1; i < argc; i++)
 	{
@@ -46,36 +83,200 @@ int main(int argc, char **argv)
 		{
 			local_session = true;
 		}
+		else if (strcmp(argv[i], "-max_rewind") == 0 && i + 1 < argc)
+		{
+			// in milliseconds
+			max_rewind = (float)atof(argv[++i]) / 1000.0f;
+		}
+		else if (strcmp(argv[i], "-admin_port") == 0 && i + 1 < argc)
+		{
+			// 0 turns the admin endpoint off
+			admin_port = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-spectate_port") == 0 && i + 1 < argc)
+		{
+			// 0 turns the spectator broadcast off
+			spectate_port = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-threaded_send") == 0)
+		{
+			// builds and sends the world states on the sender thread, rather
+			// than at the end of the tick, see sv_sender.h. it takes work off
+			// the tick, but costs a datagram per client per tick
+			threaded_send = true;
+		}
+		else if (strcmp(argv[i], "-trace_overruns") == 0)
+		{
+			// writes a chrome trace of the last couple of seconds whenever a
+			// tick takes longer than it should, see profiler.h
+			trace_overruns = true;
+		}
+		else if (strcmp(argv[i], "-capture") == 0 && i + 1 < argc)
+		{
+			// records all traffic to a file that NetBench -replay can play
+			// back, see netcapture.h
+			capture_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-journal") == 0 && i + 1 < argc)
+		{
+			// records everything that goes into the simulation, so that the
+			// match can be run again with NetBench -resim, see sv_journal.h
+			journal_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc)
+		{
+			// writes the world after every tick to a file that NetGame 
+			// -replay can play back, see recording.h
+			record_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+		{
+			has_seed = true;
+			seed     = strtoull(argv[++i], NULL, 10);
+		}
+		else if (Impair_ParseArg(&impair_settings, argc, argv, &i))
+		{
+			// makes the network worse on purpose, see netimpair.h
+		}
 		else
 		{
 			fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
 		}
 	}
 
-	SV_Init(PORT);
+	// from here on, whatever gets logged during a tick gets written out
+	// on the logger thread
+	Log_Init();
+
+	Profiler_Init("netserver");
+	Profiler_SetThreadName("main");
+	Profiler_SetOverrunCapture(trace_overruns, 2.0);
+
+	Impair_PrintSettings(&impair_settings);
+
+	net_impairment_t *impairment = Impair_Create(&impair_settings);
+
+	SV_Init(PORT, impairment);
+
+	if (capture_path)
+		SV_StartCapture(capture_path);
+
+	if (admin_port != 0)
+		Admin_Start(admin_port);
+
+	sv_broadcast_t *broadcast = NULL;
+
+	if (spectate_port != 0)
+	{
+		broadcast = Broadcast_Create(spectate_port, SPECTATE_MAX_RELAYS, g_spectate_rate, NULL);
+
+		if (broadcast)
+			printf("Broadcasting to spectators on port %d\n", spectate_port);
+	}
+
+	double    seconds_per_tick = 1.0 / (double)g_tickrate;
+	os_time_t tick_duration    = OS_HiresTimeFromSeconds(seconds_per_tick);
+	os_time_t next_tick_time   = OS_GetHiresTime() + tick_duration;
+
+	// every match is different, unless asked otherwise
+	if (!has_seed && OS_GetRandomBytes(&seed, sizeof(seed)) != 0)
+		seed = (uint64_t)OS_GetHiresTime();
 
-	double tick_timer = 0.0;
-	double seconds_per_tick = 1.0 / (double)g_tickrate;
+	Sim_Init(seconds_per_tick);
+	Sim_SetSeed(seed);
+	Sim_SetMaxRewind(max_rewind);
+	Sim_SetClientTimeout(g_client_timeout_time);
 
-	os_time_t start_time = OS_GetHiresTime();
+	printf("Simulation seed: %llu\n", (unsigned long long)seed);
 
-	for (;;)
+	if (journal_path)
+		Sim_StartJournal(journal_path);
+
+	if (record_path)
+		Sim_StartRecording(record_path);
+
+	// the world states get built and sent on a thread of their own, so
+	// that doesn't hold up the next tick. off by default, because those
+	// world states can't share a datagram with anything else
+	if (threaded_send)
+		Sender_StartThread();
+
+	metrics_histogram_t tick_time = Metrics_RegisterHistogram("tick_time_us");
+
+	// about 4.5 kilobytes, so it doesn't go on the stack
+	static rec_frame_t spectate_frame;
+
+	// ctrl+c stops the server after the tick it's on, so that the files it
+	// writes get finished properly. without that, they'd have no index
+	OS_CatchQuit();
+
+	while (!OS_QuitRequested())
 	{
 		// TODO: How to make this less busy-waity?
 
-		if (tick_timer >= seconds_per_tick)
+		// packets get processed while we wait for the next tick, rather than 
+		// all at once at the start of it, so that we know when they arrived.
+		// that's how we can tell clients how long their inputs sat in the
+		// input queue
+		SV_ProcessPackets();
+
+		if (broadcast)
+			Broadcast_ProcessPackets(broadcast);
+
+		os_time_t now = OS_GetHiresTime();
+
+		if (now >= next_tick_time)
 		{
-			SV_ProcessPackets();
+			TIMED_BLOCK_BEGIN(Tick);
 
 			Sim_Run((float)seconds_per_tick);
-			tick_timer -= seconds_per_tick;
-		}
 
-		os_time_t end_time = OS_GetHiresTime();
-		tick_timer += OS_GetSecondsElapsed(start_time, end_time);
+			if (broadcast)
+			{
+				TIMED_BLOCK_BEGIN(Broadcast_Publish);
+				Sim_GetFrame(&spectate_frame);
+				Broadcast_Publish(broadcast, &spectate_frame);
+				TIMED_BLOCK_END(Broadcast_Publish);
+			}
+
+			TIMED_BLOCK_BEGIN(SV_SendPings);
+			SV_SendPings();
+			TIMED_BLOCK_END(SV_SendPings);
+
+			TIMED_BLOCK_BEGIN(SV_FlushPackets);
+			SV_FlushPackets();
+			TIMED_BLOCK_END(SV_FlushPackets);
+
+			Admin_Publish();
+
+			TIMED_BLOCK_END(Tick);
+
+			os_time_t end_time = OS_GetHiresTime();
+
+			Metrics_RecordTime(tick_time, now, end_time);
+			Profiler_EndFrame(OS_GetSecondsElapsed(now, end_time), seconds_per_tick);
 
-		SWAP(os_time_t, start_time, end_time);
+			next_tick_time += tick_duration;
+		}
 	}
 
-	// SV_Exit();
+	printf("Shutting down\n");
+
+	// the sender still has world states to send, so it goes before the
+	// socket does
+	Sender_StopThread();
+
+	Sim_StopRecording();
+	Sim_StopJournal();
+
+	Broadcast_Destroy(broadcast);
+	Admin_Stop();
+
+	SV_Exit();
+	Impair_Destroy(impairment);
+
+	Profiler_Exit();
+	Log_Exit();
+
+	return 0;
 }
\ No newline at end of file
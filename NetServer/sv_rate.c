@@ -0,0 +1,191 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "util.h"
+#include "os.h"
+#include "sv_rate.h"
+
+// ------------------------------------------------------------------
+// sv_rate.c: implements the per client bandwidth budget
+
+
+// every datagram costs this much on top of its contents
+enum { UDP_IP_HEADER_SIZE = 28 };
+
+// the budget always stays in this range, in bytes per second. even at
+// the minimum, a few world states a second still get through
+static const float g_min_budget     = 16.0f*1024.0f;
+static const float g_max_budget     = 2048.0f*1024.0f;
+static const float g_initial_budget = 64.0f*1024.0f;
+
+// growth per period once out of slow start, and the cut on congestion
+static const float g_additive_increase       = 8.0f*1024.0f;
+static const float g_multiplicative_decrease = 0.7f;
+static const float g_slow_start_growth       = 1.5f;
+
+// more loss than this in a period counts as congestion
+static const float g_loss_threshold = 0.02f;
+
+// periods are a round trip long, but at least this long, in seconds
+static const float g_min_period = 0.1f;
+
+// the bucket can hold this many seconds worth of budget, or two full
+// world states, whichever is more. that smooths out the world states
+// without letting a long quiet stretch turn into a big burst
+static const float g_burst_seconds   = 0.05f;
+static const float g_min_burst_bytes = 8192.0f;
+
+void Rate_Init(sv_rate_t *rate, os_time_t now)
+{
+	memset(rate, 0, sizeof(*rate));
+
+	rate->budget     = g_initial_budget;
+	rate->tokens     = g_min_burst_bytes;
+	rate->slow_start = true;
+
+	rate->last_refill_time  = now;
+	rate->period_start_time = now;
+}
+
+static void Rate_Refill(sv_rate_t *rate, os_time_t now)
+{
+	float elapsed = (float)OS_GetSecondsElapsed(rate->last_refill_time, now);
+	rate->last_refill_time = now;
+
+	float capacity = rate->budget*g_burst_seconds;
+	if (capacity < g_min_burst_bytes)
+		capacity = g_min_burst_bytes;
+
+	rate->tokens += elapsed*rate->budget;
+	if (rate->tokens > capacity)
+		rate->tokens = capacity;
+}
+
+bool Rate_CanSendSnapshot(sv_rate_t *rate, size_t size, int datagram_count, os_time_t now)
+{
+	Rate_Refill(rate, now);
+
+	if (rate->tokens < (float)(size + (size_t)datagram_count*UDP_IP_HEADER_SIZE))
+	{
+		rate->snapshots_skipped += 1;
+		rate->period_limited     = true;
+		return false;
+	}
+
+	return true;
+}
+
+void Rate_OnSnapshotSent(sv_rate_t *rate, unsigned short sequence)
+{
+	sv_rate_sent_t *sent = &rate->sent[sequence % RATE_SENT_COUNT];
+
+	// if whatever was here before is still pending, the acks stopped
+	// coming a long time ago
+	if (sent->pending)
+		rate->period_lost += 1;
+
+	sent->sequence = sequence;
+	sent->pending  = true;
+
+	rate->snapshots_sent += 1;
+}
+
+void Rate_OnDatagramSent(sv_rate_t *rate, size_t size)
+{
+	// the tokens can go negative, things like ping replies don't get
+	// held back, but they still have to be paid for
+	rate->tokens     -= (float)(size + UDP_IP_HEADER_SIZE);
+	rate->bytes_sent += size + UDP_IP_HEADER_SIZE;
+}
+
+void Rate_OnDatagramReceived(sv_rate_t *rate, size_t size)
+{
+	rate->bytes_received += size + UDP_IP_HEADER_SIZE;
+}
+
+static void Rate_Ack(sv_rate_t *rate, unsigned short sequence)
+{
+	sv_rate_sent_t *sent = &rate->sent[sequence % RATE_SENT_COUNT];
+
+	if (sent->pending && sent->sequence == sequence)
+	{
+		sent->pending = false;
+		rate->period_delivered += 1;
+	}
+}
+
+static void Rate_EndPeriod(sv_rate_t *rate, const net_link_t *link, os_time_t now)
+{
+	uint32_t resolved = rate->period_delivered + rate->period_lost;
+
+	rate->loss = resolved ? (float)rate->period_lost / (float)resolved : 0.0f;
+
+	// a round trip time well above the best we've seen means our packets
+	// are sitting in a queue somewhere, which is where loss comes from
+	// next if we keep going
+	bool queueing = link->rtt_sample_count > 0 && 
+					link->rtt > 1.5f*link->rtt_min + 0.02f;
+
+	if (rate->loss > g_loss_threshold || queueing)
+	{
+		rate->budget    *= g_multiplicative_decrease;
+		rate->slow_start = false;
+	}
+	else if (rate->period_limited)
+	{
+		// only grow if the budget is what's holding us back, otherwise it
+		// would grow forever on a client that never uses it
+		if (rate->slow_start)
+			rate->budget *= g_slow_start_growth;
+		else
+			rate->budget += g_additive_increase;
+	}
+
+	if (rate->budget < g_min_budget) rate->budget = g_min_budget;
+	if (rate->budget > g_max_budget) rate->budget = g_max_budget;
+
+	rate->period_start_time = now;
+	rate->period_delivered  = 0;
+	rate->period_lost       = 0;
+	rate->period_limited    = false;
+}
+
+void Rate_OnAcks(sv_rate_t *rate, unsigned short ack, uint32_t ack_bits, const net_link_t *link, os_time_t now)
+{
+	Rate_Ack(rate, ack);
+
+	for (int i = 0; i < 32; i++)
+	{
+		if (ack_bits & (1u << i))
+			Rate_Ack(rate, (unsigned short)(ack - 1 - i));
+	}
+
+	if (!rate->has_ack || (short)(ack - rate->newest_ack) > 0)
+	{
+		rate->has_ack    = true;
+		rate->newest_ack = ack;
+	}
+
+	// anything that has fallen off the end of the ack bits without being
+	// acked isn't going to be
+	for (size_t i = 0; i < RATE_SENT_COUNT; i++)
+	{
+		sv_rate_sent_t *sent = &rate->sent[i];
+
+		if (sent->pending && (short)(rate->newest_ack - sent->sequence) > 32)
+		{
+			sent->pending = false;
+			rate->period_lost += 1;
+		}
+	}
+
+	float period = link->rtt > g_min_period ? link->rtt : g_min_period;
+
+	if (OS_GetSecondsElapsed(rate->period_start_time, now) >= period)
+		Rate_EndPeriod(rate, link, now);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "os.h"
+#include "netlink.h"
+
+// ------------------------------------------------------------------
+// sv_rate.h: keeps the server from sending a client more than its
+// connection can take. every client gets a budget in bytes per second,
+// which works like TCP's congestion window: it grows slowly while the
+// client keeps up, and gets cut hard when world states start getting
+// lost or the round trip time starts climbing (which means they're
+// piling up in a queue somewhere). the budget is enforced with a token
+// bucket, and world states that don't fit just don't get sent.
+//
+// loss is worked out from the acks that come back in the client's
+// reliable blocks, which cover every world state, see channel.h.
+
+// how many sent world states are remembered, waiting on their ack
+enum { RATE_SENT_COUNT = 64 }; // must be a power of two
+
+typedef struct sv_rate_sent_t
+{
+	unsigned short sequence;
+	bool           pending; // sent, but neither acked nor given up on
+} sv_rate_sent_t;
+
+typedef struct sv_rate_t
+{
+	float budget;      // bytes per second
+	float tokens;      // bytes that can be sent right now
+	bool  slow_start;  // the budget grows fast until the first sign of congestion
+
+	os_time_t last_refill_time;
+
+	// the budget gets adjusted once per period, which is about a round trip
+	os_time_t period_start_time;
+	uint32_t  period_delivered;
+	uint32_t  period_lost;
+	bool      period_limited; // whether the budget held anything back this period
+
+	bool           has_ack;
+	unsigned short newest_ack;
+	sv_rate_sent_t sent[RATE_SENT_COUNT];
+
+	// stats
+	float    loss;              // ratio of world states lost last period
+	uint64_t bytes_sent;        // including UDP/IP headers
+	uint64_t bytes_received;
+	uint32_t snapshots_sent;
+	uint32_t snapshots_skipped; // held back because they didn't fit in the budget
+} sv_rate_t;
+
+void Rate_Init(sv_rate_t *rate, os_time_t now);
+
+// returns whether a world state fits in the budget right now, size being
+// all of its datagrams added up. if it doesn't, it counts as skipped
+bool Rate_CanSendSnapshot(sv_rate_t *rate, size_t size, int datagram_count, os_time_t now);
+
+// to be called for every world state that does get sent
+void Rate_OnSnapshotSent(sv_rate_t *rate, unsigned short sequence);
+
+// to be called for every datagram sent to or received from the client
+void Rate_OnDatagramSent    (sv_rate_t *rate, size_t size);
+void Rate_OnDatagramReceived(sv_rate_t *rate, size_t size);
+
+// takes in the client's acks for our world states, see the peer_ack
+// fields in net_channel_t, and adjusts the budget once a period is up
+void Rate_OnAcks(sv_rate_t *rate, unsigned short ack, uint32_t ack_bits, const net_link_t *link, os_time_t now);
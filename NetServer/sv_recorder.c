@@ -0,0 +1,331 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "os.h"
+#include "util.h"
+#include "sv_recorder.h"
+
+// ------------------------------------------------------------------
+// sv_recorder.c: there's only ever the simulation putting frames into
+// the ring and the recorder thread taking them out, so the ring is just
+// two counters, each only ever moved by one side.
+
+
+struct sv_recorder_t
+{
+	// shared between the simulation and the recorder thread
+	volatile uint32_t write_position; // only moved by the simulation
+	volatile uint32_t read_position;  // only moved by the recorder thread
+	volatile uint32_t running;
+	volatile uint64_t dropped;
+
+	rec_frame_t ring[REC_RING_SIZE];
+
+	os_thread_t thread;
+
+	// only touched by the recorder thread, until it's done
+	FILE    *file;
+	uint64_t offset; // where the next record goes
+
+	uint32_t keyframe_interval;
+
+	bool        has_frame;
+	rec_frame_t last_frame; // the frame the next delta is from
+
+	uint32_t  first_tick;
+	uint32_t  last_tick;
+	uint32_t  base_slot;
+	uint32_t  keyframe_count;
+	uint32_t  keyframe_capacity;
+	uint64_t *keyframes;
+
+	unsigned char record[REC_RECORD_HEADER_SIZE + REC_MAX_FRAME_SIZE];
+};
+
+// how much stdio buffers up before it writes to the file
+enum { RECORDER_FILE_BUFFER_SIZE = 1 << 20 };
+
+static unsigned char *Recorder_Put(unsigned char *at, const void *value, size_t size)
+{
+	memcpy(at, value, size);
+	return at + size;
+}
+
+static void Recorder_Write(sv_recorder_t *recorder, const void *data, size_t size)
+{
+	fwrite(data, 1, size, recorder->file);
+	recorder->offset += size;
+}
+
+static void Recorder_WriteRecordHeader(sv_recorder_t *recorder, rec_record_kind_e kind, uint32_t payload_size)
+{
+	unsigned char header[REC_RECORD_HEADER_SIZE] = { 0 };
+	memcpy(header, &payload_size, sizeof(payload_size));
+	header[4] = (unsigned char)kind;
+
+	Recorder_Write(recorder, header, sizeof(header));
+}
+
+// ------------------------------------------------------------------
+// the keyframe index
+
+static void Recorder_AddKeyframe(sv_recorder_t *recorder, uint32_t slot, uint64_t offset)
+{
+	if (recorder->keyframe_count == 0)
+		recorder->base_slot = slot;
+
+	uint32_t count = slot - recorder->base_slot + 1;
+
+	if (count > recorder->keyframe_capacity)
+	{
+		uint32_t new_capacity = recorder->keyframe_capacity ? recorder->keyframe_capacity : 256;
+		while (new_capacity < count)
+			new_capacity *= 2;
+
+		uint64_t *keyframes = realloc(recorder->keyframes, (size_t)new_capacity*sizeof(uint64_t));
+
+		// the file is still fine without an index, the reader can build
+		// one by walking it
+		if (!keyframes)
+			return;
+
+		recorder->keyframes         = keyframes;
+		recorder->keyframe_capacity = new_capacity;
+	}
+
+	// intervals that got skipped over fall back on the keyframe before
+	while (recorder->keyframe_count + 1 < count)
+	{
+		recorder->keyframes[recorder->keyframe_count] = recorder->keyframes[recorder->keyframe_count - 1];
+		recorder->keyframe_count += 1;
+	}
+
+	recorder->keyframes[recorder->keyframe_count++] = offset;
+}
+
+static void Recorder_WriteIndex(sv_recorder_t *recorder)
+{
+	if (recorder->keyframe_count == 0)
+		return;
+
+	uint64_t index_offset = recorder->offset;
+	uint32_t padding      = 0;
+
+	size_t offsets_size = (size_t)recorder->keyframe_count*sizeof(uint64_t);
+
+	Recorder_WriteRecordHeader(recorder, REC_RECORD_INDEX, (uint32_t)(REC_INDEX_HEADER_SIZE + offsets_size));
+
+	unsigned char header[REC_INDEX_HEADER_SIZE];
+
+	unsigned char *at = header;
+	at = Recorder_Put(at, &recorder->first_tick,     sizeof(recorder->first_tick));
+	at = Recorder_Put(at, &recorder->last_tick,      sizeof(recorder->last_tick));
+	at = Recorder_Put(at, &recorder->keyframe_count, sizeof(recorder->keyframe_count));
+	at = Recorder_Put(at, &padding,                  sizeof(padding));
+
+	Recorder_Write(recorder, header, sizeof(header));
+	Recorder_Write(recorder, recorder->keyframes, offsets_size);
+
+	uint32_t      magic = REC_END_MAGIC;
+	unsigned char footer[REC_FOOTER_SIZE];
+
+	at = footer;
+	at = Recorder_Put(at, &index_offset, sizeof(index_offset));
+	at = Recorder_Put(at, &magic,        sizeof(magic));
+	at = Recorder_Put(at, &padding,      sizeof(padding));
+
+	Recorder_Write(recorder, footer, sizeof(footer));
+}
+
+// ------------------------------------------------------------------
+// the recorder thread
+
+static void Recorder_WriteFrame(sv_recorder_t *recorder, const rec_frame_t *frame)
+{
+	// the index needs the ticks to only ever go up
+	if (NEVER(recorder->has_frame && frame->tick <= recorder->last_tick))
+		return;
+
+	// a frame from an interval that doesn't have its keyframe yet becomes
+	// the keyframe, which is usually the first frame of the interval, but
+	// not if that one got dropped
+	uint32_t slot = frame->tick / recorder->keyframe_interval;
+
+	bool keyframe = !recorder->has_frame || slot != recorder->last_tick / recorder->keyframe_interval;
+
+	const rec_frame_t *from = keyframe ? NULL : &recorder->last_frame;
+
+	unsigned char *payload      = recorder->record + REC_RECORD_HEADER_SIZE;
+	size_t         payload_size = Rec_EncodeFrame(from, frame, payload, REC_MAX_FRAME_SIZE);
+
+	if (NEVER(payload_size == 0))
+		return;
+
+	if (!recorder->has_frame)
+		recorder->first_tick = frame->tick;
+
+	if (keyframe)
+		Recorder_AddKeyframe(recorder, slot, recorder->offset);
+
+	uint32_t       size = (uint32_t)payload_size;
+	unsigned char *at   = recorder->record;
+	memset(at, 0, REC_RECORD_HEADER_SIZE);
+	memcpy(at, &size, sizeof(size));
+	at[4] = (unsigned char)(keyframe ? REC_RECORD_KEYFRAME : REC_RECORD_DELTA);
+
+	Recorder_Write(recorder, recorder->record, REC_RECORD_HEADER_SIZE + payload_size);
+
+	// once a keyframe's worth, whoever is watching the file gets to see
+	// what's new
+	if (keyframe)
+		fflush(recorder->file);
+
+	recorder->has_frame  = true;
+	recorder->last_tick  = frame->tick;
+	recorder->last_frame = *frame;
+}
+
+static int Recorder_ThreadProc(void *userdata)
+{
+	sv_recorder_t *recorder = userdata;
+
+	uint32_t read_position = OS_AtomicLoad32(&recorder->read_position);
+
+	for (;;)
+	{
+		// checked before draining, so that every frame that got in before
+		// Recorder_Destroy still gets written
+		bool running = OS_AtomicLoad32(&recorder->running) != 0;
+
+		uint32_t write_position = OS_AtomicLoad32(&recorder->write_position);
+		uint32_t written        = 0;
+
+		while (read_position != write_position)
+		{
+			Recorder_WriteFrame(recorder, &recorder->ring[read_position % REC_RING_SIZE]);
+
+			read_position += 1;
+			written       += 1;
+
+			OS_AtomicStore32(&recorder->read_position, read_position);
+		}
+
+		if (!running)
+			break;
+
+		if (written == 0)
+			OS_Sleep(5);
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------
+
+sv_recorder_t *Recorder_Create(const char *path, double seconds_per_tick)
+{
+	sv_recorder_t *recorder = calloc(1, sizeof(sv_recorder_t));
+
+	if (!recorder)
+		return NULL;
+
+	recorder->file = fopen(path, "wb");
+
+	if (!recorder->file)
+	{
+		fprintf(stderr, "Recorder_Create: failed to open '%s' for writing\n", path);
+		free(recorder);
+		return NULL;
+	}
+
+	setvbuf(recorder->file, NULL, _IOFBF, RECORDER_FILE_BUFFER_SIZE);
+
+	recorder->keyframe_interval = (uint32_t)(REC_KEYFRAME_SECONDS / seconds_per_tick + 0.5);
+
+	if (recorder->keyframe_interval == 0)
+		recorder->keyframe_interval = 1;
+
+	uint32_t magic      = REC_MAGIC;
+	uint32_t version    = REC_VERSION;
+	uint32_t padding    = 0;
+	uint64_t start_time = (uint64_t)time(NULL);
+
+	unsigned char header[REC_HEADER_SIZE];
+
+	unsigned char *at = header;
+	at = Recorder_Put(at, &magic,                       sizeof(magic));
+	at = Recorder_Put(at, &version,                     sizeof(version));
+	at = Recorder_Put(at, &seconds_per_tick,            sizeof(seconds_per_tick));
+	at = Recorder_Put(at, &recorder->keyframe_interval, sizeof(recorder->keyframe_interval));
+	at = Recorder_Put(at, &padding,                     sizeof(padding));
+	at = Recorder_Put(at, &start_time,                  sizeof(start_time));
+
+	Recorder_Write(recorder, header, sizeof(header));
+	fflush(recorder->file);
+
+	OS_AtomicStore32(&recorder->running, 1);
+
+	recorder->thread = OS_CreateThread(Recorder_ThreadProc, recorder);
+
+	if (!recorder->thread.value)
+	{
+		fprintf(stderr, "Recorder_Create: failed to start the recorder thread\n");
+		fclose(recorder->file);
+		free(recorder);
+		return NULL;
+	}
+
+	return recorder;
+}
+
+void Recorder_Destroy(sv_recorder_t *recorder)
+{
+	if (!recorder)
+		return;
+
+	OS_AtomicStore32(&recorder->running, 0);
+	OS_JoinThread(recorder->thread);
+
+	Recorder_WriteIndex(recorder);
+
+	uint64_t dropped = OS_AtomicLoad64(&recorder->dropped);
+
+	if (dropped > 0)
+		fprintf(stderr, "Recorder_Destroy: %llu frames got dropped, the recorder couldn't keep up\n", (unsigned long long)dropped);
+
+	fclose(recorder->file);
+	free(recorder->keyframes);
+	free(recorder);
+}
+
+rec_frame_t *Recorder_BeginFrame(sv_recorder_t *recorder)
+{
+	uint32_t write_position = recorder->write_position;
+	uint32_t read_position  = OS_AtomicLoad32(&recorder->read_position);
+
+	if (write_position - read_position >= REC_RING_SIZE)
+	{
+		OS_AtomicAdd64(&recorder->dropped, 1);
+		return NULL;
+	}
+
+	return &recorder->ring[write_position % REC_RING_SIZE];
+}
+
+void Recorder_EndFrame(sv_recorder_t *recorder)
+{
+	OS_AtomicStore32(&recorder->write_position, recorder->write_position + 1);
+}
+
+uint64_t Recorder_GetDroppedCount(sv_recorder_t *recorder)
+{
+	return OS_AtomicLoad64(&recorder->dropped);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "recording.h"
+
+// ------------------------------------------------------------------
+// sv_recorder.h: writes a recording (see recording.h) of the world,
+// without the simulation ever waiting on the disk. every tick the
+// simulation puts its frame into a ring, and a thread of the recorder's
+// own takes the frames out, encodes them and writes them out.
+//
+// the ring has room for REC_RING_SIZE frames, and that's all the memory
+// the recorder uses besides the keyframe index, which is 8 bytes for
+// every REC_KEYFRAME_SECONDS. when the disk can't keep up and the ring
+// is full, frames get dropped and counted. a dropped frame just makes
+// for a gap in the recording, the delta after it is from whatever frame
+// made it in before.
+
+// the frames in the ring, about 4.5 kilobytes each
+enum { REC_RING_SIZE = 64 };
+
+typedef struct sv_recorder_t sv_recorder_t;
+
+// opens the file, writes the header and starts the thread. returns NULL
+// on failure
+sv_recorder_t *Recorder_Create(const char *path, double seconds_per_tick);
+
+// writes out whatever is still in the ring, and the keyframe index, and
+// closes the file
+void Recorder_Destroy(sv_recorder_t *recorder);
+
+// the frame to fill in for this tick, or NULL if the ring is full, in
+// which case the frame is dropped. a frame that was handed out has to
+// be passed to Recorder_EndFrame before the next call. only one thread
+// is allowed to record frames
+rec_frame_t *Recorder_BeginFrame(sv_recorder_t *recorder);
+void         Recorder_EndFrame(sv_recorder_t *recorder);
+
+// frames dropped because the ring was full
+uint64_t Recorder_GetDroppedCount(sv_recorder_t *recorder);
@@ -0,0 +1,200 @@
+// ------------------------------------------------------------------
+// standard library includes
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// internal includes
+
+#include "protocol.h"
+#include "util.h"
+#include "os.h"
+#include "profiler.h"
+#include "sv_server.h"
+#include "sv_sender.h"
+
+// ------------------------------------------------------------------
+// sv_sender.c: the ring works just like the recorder's (see
+// sv_recorder.c), two counters that are each only ever moved by one
+// side. the only difference is that the sender sleeps on a semaphore
+// rather than checking back every so often, because a world state that
+// waits on the sender waking up is a world state that arrives late.
+
+
+// shared between the simulation and the sender thread
+static volatile uint32_t g_write_position; // only moved by the simulation
+static volatile uint32_t g_read_position;  // only moved by the sender thread
+static volatile uint32_t g_sender_running;
+
+static sv_world_buffer_t g_buffers[SENDER_BUFFER_COUNT];
+
+static os_thread_t    g_sender_thread;
+static os_semaphore_t g_sender_wakeup; // signalled for every buffer that gets handed over
+
+// only touched by whoever is doing the sending, which is either the
+// sender thread, or the simulation if there isn't one
+static net_world_state_t g_packet;
+
+// only touched by the simulation, see Sender_SendNow
+static net_world_state_t g_packet_now;
+
+// ------------------------------------------------------------------
+// sending
+
+static void Sender_SendBuffer(const sv_world_buffer_t *buffer, net_world_state_t *packet)
+{
+	TIMED_BLOCK_BEGIN(Sender_SendBuffer);
+
+	// the part that's the same for everyone only gets copied in once
+	packet->header.kind  = NETPACKET_WORLD_STATE;
+	packet->server_tick  = buffer->server_tick;
+	packet->player_count = buffer->player_count;
+
+	memcpy(packet->players,     buffer->players,  sizeof(packet->players));
+	memcpy(packet->world_state, buffer->entities, sizeof(packet->world_state));
+
+	for (int i = 0; i < buffer->client_count; i++)
+	{
+		const sv_sender_client_t *client = &buffer->clients[i];
+
+		packet->header.sequence  = client->sequence;
+		packet->client_id        = client->client_id;
+		packet->input_lead       = client->input_lead;
+		packet->input_underflows = client->input_underflows;
+		packet->input_overflows  = client->input_overflows;
+
+		memcpy(packet->reliable, client->reliable, client->reliable_size);
+
+		size_t packet_size = offsetof(net_world_state_t, reliable) + client->reliable_size;
+
+		// a world state that fails to send is no different from one that
+		// got lost on the way, the client's acks will say so
+		if (client->client)
+			SV_SendPacket(client->client, packet, packet_size);
+		else
+			SV_SendPacketNow(client->address, client->packet_id, packet, packet_size);
+	}
+
+	TIMED_BLOCK_END(Sender_SendBuffer);
+}
+
+static int Sender_ThreadProc(void *userdata)
+{
+	(void)userdata;
+
+	Profiler_SetThreadName("sender");
+
+	uint32_t read_position = OS_AtomicLoad32(&g_read_position);
+
+	for (;;)
+	{
+		// checked before draining, so that every buffer that got handed
+		// over before Sender_StopThread still gets sent
+		bool running = OS_AtomicLoad32(&g_sender_running) != 0;
+
+		uint32_t write_position = OS_AtomicLoad32(&g_write_position);
+
+		while (read_position != write_position)
+		{
+			Sender_SendBuffer(&g_buffers[read_position % SENDER_BUFFER_COUNT], &g_packet);
+
+			read_position += 1;
+			OS_AtomicStore32(&g_read_position, read_position);
+		}
+
+		if (!running)
+			break;
+
+		// a signal that comes in between looking at the write position
+		// and getting here isn't lost, it just means no sleeping
+		OS_WaitSemaphore(g_sender_wakeup, 100);
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------
+
+int Sender_StartThread(void)
+{
+	if (OS_AtomicLoad32(&g_sender_running))
+		return 0;
+
+	g_sender_wakeup = OS_CreateSemaphore(0);
+
+	if (!g_sender_wakeup.value)
+	{
+		fprintf(stderr, "Sender_StartThread: failed to create the semaphore\n");
+		return -1;
+	}
+
+	OS_AtomicStore32(&g_sender_running, 1);
+
+	g_sender_thread = OS_CreateThread(Sender_ThreadProc, NULL);
+
+	if (!g_sender_thread.value)
+	{
+		fprintf(stderr, "Sender_StartThread: failed to start the sender thread\n");
+		OS_AtomicStore32(&g_sender_running, 0);
+		OS_DestroySemaphore(g_sender_wakeup);
+		return -1;
+	}
+
+	return 0;
+}
+
+void Sender_StopThread(void)
+{
+	if (!OS_AtomicLoad32(&g_sender_running))
+		return;
+
+	OS_AtomicStore32(&g_sender_running, 0);
+	OS_SignalSemaphore(g_sender_wakeup);
+	OS_JoinThread(g_sender_thread);
+
+	OS_DestroySemaphore(g_sender_wakeup);
+
+	g_sender_thread.value = 0;
+	g_sender_wakeup.value = 0;
+}
+
+bool Sender_IsThreaded(void)
+{
+	return g_sender_thread.value != 0;
+}
+
+sv_world_buffer_t *Sender_BeginTick(void)
+{
+	uint32_t write_position = g_write_position;
+	uint32_t read_position  = OS_AtomicLoad32(&g_read_position);
+
+	if (write_position - read_position >= SENDER_BUFFER_COUNT)
+		return NULL;
+
+	return &g_buffers[write_position % SENDER_BUFFER_COUNT];
+}
+
+void Sender_EndTick(void)
+{
+	uint32_t write_position = g_write_position;
+
+	if (!g_sender_thread.value)
+	{
+		// nobody to hand it over to, so it goes out right here
+		Sender_SendBuffer(&g_buffers[write_position % SENDER_BUFFER_COUNT], &g_packet);
+
+		OS_AtomicStore32(&g_write_position, write_position + 1);
+		OS_AtomicStore32(&g_read_position,  write_position + 1);
+		return;
+	}
+
+	OS_AtomicStore32(&g_write_position, write_position + 1);
+	OS_SignalSemaphore(g_sender_wakeup);
+}
+
+void Sender_SendNow(const sv_world_buffer_t *buffer)
+{
+	Sender_SendBuffer(buffer, &g_packet_now);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ------------------------------------------------------------------
+
+#include "protocol.h"
+#include "net.h"
+
+// ------------------------------------------------------------------
+// sv_sender.h: builds the world states and sends them, off the tick.
+// at the end of every tick the simulation takes a buffer, copies the
+// world into it once, along with the bits that are different for every
+// client (their sequence, their reliable block and so on), and hands
+// it over. a thread of the sender's own then turns the buffer into a
+// world state for every client and sends them, while the simulation is
+// already busy with the next tick.
+//
+// the buffers are a ring of SENDER_BUFFER_COUNT, so the simulation can
+// fill one while the sender works through another, with one to spare
+// for when the sender runs a little late. a buffer is never touched by
+// the simulation again once it's handed over. if the sender is so far
+// behind that they're all taken, the tick's world states don't go out
+// at all, which to the clients is the same as their rate limit holding
+// them back (see sv_rate.h).
+//
+// without the thread, handing over a buffer sends it right away, on the
+// simulation's thread. that's the default (NetServer -threaded_send
+// starts the thread), and it's how NetBench runs it, since its clock
+// only moves when it says so. world states sent on the simulation's
+// thread go through the client's bundle like any other packet, so the
+// last fragment still shares a datagram with whatever else goes out at
+// the end of the tick (like a ping). the sender thread can't touch the
+// bundles, so its world states go out on their own, which is a datagram
+// more per client per tick. until the thread can be handed the rest of
+// the client's bundle, it's only worth it when the tick itself is what
+// needs to get faster.
+
+enum { SENDER_BUFFER_COUNT = 3 };
+
+typedef struct sv_client_t sv_client_t;
+
+// what's different about the world state for every client
+typedef struct sv_sender_client_t
+{
+	net_addr_t address;
+
+	// only for world states sent on the simulation's thread, which go
+	// through the client's bundle. NULL for the sender thread's, which
+	// were paid for up front with SV_ReservePacket
+	sv_client_t *client;
+
+	unsigned short sequence;  // the world state's sequence, see net_world_state_t
+	unsigned short packet_id; // for its fragments, see SV_ReservePacket
+
+	net_entity_id_t client_id;
+
+	float          input_lead;
+	unsigned short input_underflows;
+	unsigned short input_overflows;
+
+	uint32_t      reliable_size;
+	unsigned char reliable[NET_RELIABLE_BLOCK_SIZE];
+} sv_sender_client_t;
+
+// a tick's worth of world states, about 20 kilobytes
+typedef struct sv_world_buffer_t
+{
+	unsigned int server_tick;
+
+	unsigned           player_count;
+	net_player_t       players[MAX_CLIENT_COUNT];
+	net_entity_state_t entities[MAX_ENTITY_COUNT];
+
+	// the clients that get a world state out of this tick
+	int                client_count;
+	sv_sender_client_t clients[MAX_CLIENT_COUNT];
+} sv_world_buffer_t;
+
+// starts the sender thread, until then (and if it fails) the world
+// states get sent on the simulation's thread. returns 0 on success
+int  Sender_StartThread(void);
+
+// whether the world states handed over with Sender_EndTick go out on the
+// sender thread
+bool Sender_IsThreaded(void);
+
+// sends whatever is still in the ring, and stops the thread
+void Sender_StopThread(void);
+
+// the buffer to fill in for this tick, or NULL if they're all taken, in
+// which case nobody gets a world state this tick. a buffer that was
+// handed out has to be passed on with Sender_EndTick before the next
+// call. only the simulation's thread gets to call these
+sv_world_buffer_t *Sender_BeginTick(void);
+void               Sender_EndTick(void);
+
+// sends a buffer that isn't one of the ring's right away, on the calling
+// thread, for the odd world state that can't wait for the end of the
+// tick (like a new client's first). only the simulation's thread gets
+// to call this
+void Sender_SendNow(const sv_world_buffer_t *buffer);
@@ -12,7 +12,14 @@
 // internal includes
 
 #include "protocol.h"
+#include "util.h"
 #include "net.h"
+#include "netcapture.h"
+#include "fragment.h"
+#include "siphash.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "logger.h"
 #include "os.h"
 #include "sv_simulation.h"
 #include "sv_server.h"
@@ -26,12 +33,21 @@
 // ------------------------------------------------------------------
 // initialization and all that
 
-static net_socket_t g_socket = { INVALID_SOCKET_VALUE };
+static net_context_t g_net;
+static net_socket_t  g_socket = { INVALID_SOCKET_VALUE };
 static int g_max_message_size;
 
-int SV_Init(int port)
+// the secret that connect cookies are hashed with, see SV_ComputeCookie
+static siphash_key_t g_cookie_key;
+static os_time_t     g_cookie_epoch;
+
+static metrics_histogram_t g_packet_time; // how long it takes to process a datagram, in microseconds
+static metrics_histogram_t g_client_rtt;  // every round trip time sample of every client, in microseconds
+
+int SV_Init(int port, net_impairment_t *impairment)
 {
 	Net_Init();
+	Net_InitContext(&g_net, impairment);
 
 	net_addr_t addr = Net_GetPassiveAddr(port);
 	g_socket = Net_CreateSocket(CREATESOCKET_NONBLOCKING);
@@ -48,55 +64,123 @@ int SV_Init(int port)
 		return -1;
 	}
 
+	if (OS_GetRandomBytes(&g_cookie_key, sizeof(g_cookie_key)) != 0)
+	{
+		fprintf(stderr, "SV_Init: failed to generate the cookie key\n");
+		return -1;
+	}
+
+	g_cookie_epoch = OS_GetHiresTime();
+
+	g_packet_time = Metrics_RegisterHistogram("packet_process_us");
+	g_client_rtt  = Metrics_RegisterHistogram("client_rtt_us");
+
 	g_max_message_size = Net_GetMaxMessageSize(g_socket);
 
+	if (g_max_message_size < NET_MAX_DATAGRAM_SIZE)
+		fprintf(stderr, "SV_Init: the socket's max message size (%d) is smaller than our datagrams (%d)\n", g_max_message_size, NET_MAX_DATAGRAM_SIZE);
+
 	printf("Server initialized.\n");
 	return 0;
 }
 
 void SV_Exit(void)
 {
+	Capture_Destroy(g_net.capture);
+	g_net.capture = NULL;
+
 	Net_Exit();
 }
 
+int SV_StartCapture(const char *path)
+{
+	if (g_net.capture)
+		return -1;
+
+	g_net.capture = Capture_Create(path);
+
+	if (!g_net.capture)
+		return -1;
+
+	printf("Capturing traffic to '%s'\n", path);
+	return 0;
+}
+
+void SV_GetNetStats(net_stats_t *stats)
+{
+	Net_GetStats(&g_net, stats);
+}
+
 // ------------------------------------------------------------------
 // client management
 
 size_t      g_client_count;
 sv_client_t g_clients[MAX_CLIENT_COUNT];
 
-sv_client_t *SV_GetClientForAddress(net_addr_t address)
+// player ids are handed out separately from the index into g_clients,
+// because the index changes when other clients leave
+static unsigned char SV_AllocatePlayerId(void)
 {
-	sv_client_t *result = NULL;
+	for (unsigned char id = 0; id < MAX_CLIENT_COUNT; id++)
+	{
+		bool taken = false;
+
+		for (size_t i = 0; i < g_client_count; i++)
+		{
+			if (g_clients[i].player_id == id)
+			{
+				taken = true;
+				break;
+			}
+		}
+
+		if (!taken)
+			return id;
+	}
+
+	assert(!"Ran out of player ids, but there should be as many as there are client slots!\n");
+	return NET_INVALID_PLAYER_ID;
+}
 
+sv_client_t *SV_GetClientForAddress(net_addr_t address)
+{
 	for (size_t i = 0; i < g_client_count; i++)
 	{
 		sv_client_t *client = &g_clients[i];
 
 		if (memcmp(&client->address, &address, sizeof(address)) == 0)
 		{
-			result = client;
-			result->new_connection = false;
-			break;
+			client->new_connection = false;
+			return client;
 		}
 	}
 
-	if (!result)
-	{
-		if (g_client_count < MAX_CLIENT_COUNT)
-		{
-			result = &g_clients[g_client_count++];
-			memset(result, 0, sizeof(*result));
+	return NULL;
+}
 
-			result->new_connection = true;
-			result->address = address;
+sv_client_t *SV_AddClient(net_addr_t address)
+{
+	if (g_client_count >= MAX_CLIENT_COUNT)
+		return NULL;
 
-			char client_address[NETADDR_STR_SIZE];
-			Net_StringFromNetAddr(client_address, sizeof(client_address), result->address);
+	unsigned char player_id = SV_AllocatePlayerId();
 
-			fprintf(stdout, "Received new client connection from %s:%u\n", client_address, result->address.port);
-		}
-	}
+	sv_client_t *result = &g_clients[g_client_count++];
+	memset(result, 0, sizeof(*result));
+
+	result->player_id = player_id;
+
+	Input_Init(&result->input_queue);
+	Channel_Init(&result->channel);
+	Rate_Init(&result->rate, OS_GetHiresTime());
+
+	result->new_connection = true;
+	result->address = address;
+
+	char client_address[NETADDR_STR_SIZE];
+	Net_StringFromNetAddr(client_address, sizeof(client_address), result->address);
+
+	LOG_INFO("Received new client connection from %s:%u\n", client_address, result->address.port);
 
 	return result;
 }
@@ -114,6 +198,19 @@ sv_client_t *SV_GetClientForEntity(sv_entity_t *e)
 	return NULL;
 }
 
+sv_client_t *SV_GetClientForPlayerId(unsigned char player_id)
+{
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t *client = &g_clients[i];
+		if (client->player_id == player_id)
+		{
+			return client;
+		}
+	}
+	return NULL;
+}
+
 void SV_ForgetClient(sv_client_t *client)
 {
 	if (!client) return;
@@ -124,12 +221,20 @@ void SV_ForgetClient(sv_client_t *client)
 		{
 			if (client == &g_clients[i])
 			{
+				net_msg_player_left_t message = {
+					.kind      = NETMSG_PLAYER_LEFT,
+					.player_id = client->player_id,
+				};
+
 				g_clients[i] = g_clients[--g_client_count];
 
+				// the client is gone now, so this only goes to everyone else
+				SV_SendMessageToAllClients(&message, sizeof(message));
+
 				char client_address[NETADDR_STR_SIZE];
 				Net_StringFromNetAddr(client_address, sizeof(client_address), client->address);
 
-				fprintf(stderr, "Client disconnected: %s:%d\n", client_address, client->address.port);
+				LOG_ERROR("Client disconnected: %s:%d\n", client_address, client->address.port);
 
 				break;
 			}
@@ -144,17 +249,20 @@ void SV_ForgetClient(sv_client_t *client)
 // ------------------------------------------------------------------
 // sending and receiving packets
 
-sv_client_t *SV_ReceivePacket(char *buffer, size_t buffer_size, size_t *packet_size)
+sv_client_t *SV_ReceivePacket(char *buffer, size_t buffer_size, size_t *packet_size, net_addr_t *address)
 {
-	net_addr_t addr;
-	int result = Net_RecvPacket(g_socket, buffer, buffer_size, &addr);
+	int result = Net_RecvPacket(&g_net, g_socket, buffer, buffer_size, address);
 
 	if (result > 0)
 	{
-		sv_client_t *client = SV_GetClientForAddress(addr);
-		client->last_packet_time = OS_GetHiresTime();
-
 		*packet_size = (size_t)result;
+
+		// this comes back NULL if the sender isn't connected (yet)
+		sv_client_t *client = SV_GetClientForAddress(*address);
+
+		if (client)
+			client->last_packet_time = OS_GetHiresTime();
+
 		return client;
 	}
 
@@ -162,12 +270,77 @@ sv_client_t *SV_ReceivePacket(char *buffer, size_t buffer_size, size_t *packet_s
 	return NULL;
 }
 
+static bool SV_SendDatagram(sv_client_t *client, void *datagram, size_t datagram_size)
+{
+	int bytes_sent = Net_SendPacket(&g_net, g_socket, client->address, datagram, datagram_size);
+
+	if (bytes_sent > 0)
+		Rate_OnDatagramSent(&client->rate, (size_t)bytes_sent);
+
+	return bytes_sent > 0 && (size_t)bytes_sent == datagram_size;
+}
+
+static bool SV_FlushClient(sv_client_t *client)
+{
+	bool result = true;
+
+	size_t datagram_size;
+	void *datagram = Bundle_GetDatagram(&client->send_bundle, &datagram_size);
+
+	if (datagram)
+		result = SV_SendDatagram(client, datagram, datagram_size);
+
+	Bundle_Clear(&client->send_bundle);
+	return result;
+}
+
+// failing to send the bundle when it fills up gets reported for 
+// whichever packet happened to be the last straw
+static bool SV_QueueDatagram(sv_client_t *client, void *datagram, size_t datagram_size)
+{
+	if (datagram_size > BUNDLE_MAX_PACKET_SIZE)
+	{
+		// too big to share, keep the order the same by sending what's
+		// queued up first
+		bool result = SV_FlushClient(client);
+		result &= SV_SendDatagram(client, datagram, datagram_size);
+		return result;
+	}
+
+	bool result = true;
+
+	if (!Bundle_Add(&client->send_bundle, datagram, datagram_size))
+	{
+		result = SV_FlushClient(client);
+
+		if (!Bundle_Add(&client->send_bundle, datagram, datagram_size))
+			assert(!"A packet small enough for a bundle didn't fit in an empty one!\n");
+	}
+
+	return result;
+}
+
 bool SV_SendPacket(sv_client_t *client, void *packet, size_t packet_size)
 {
-	if (packet_size <= g_max_message_size)
+	int fragment_count = Fragment_GetCount(packet_size);
+
+	if (fragment_count == 1)
 	{
-		int bytes_sent = Net_SendPacket(g_socket, client->address, packet, packet_size);
-		return bytes_sent == packet_size;
+		return SV_QueueDatagram(client, packet, packet_size);
+	}
+	else if (fragment_count <= NET_MAX_FRAGMENT_COUNT)
+	{
+		unsigned short packet_id = client->fragmented_packet_id++;
+
+		bool result = true;
+		for (int i = 0; i < fragment_count; i++)
+		{
+			net_fragment_t fragment;
+			size_t fragment_size = Fragment_Write(&fragment, packet_id, i, packet, packet_size);
+
+			result &= SV_QueueDatagram(client, &fragment, fragment_size);
+		}
+		return result;
 	}
 	else
 	{
@@ -186,28 +359,238 @@ bool SV_SendPacketToAllClients(void *packet, size_t packet_size)
 	return result;
 }
 
+void SV_FlushPackets(void)
+{
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		SV_FlushClient(&g_clients[i]);
+	}
+}
+
+size_t SV_GetPacketSendSize(size_t packet_size, int *datagram_count)
+{
+	int fragment_count = Fragment_GetCount(packet_size);
+	*datagram_count = fragment_count;
+
+	if (fragment_count == 1)
+		return packet_size;
+
+	// every fragment has its own header on top of its piece of the packet
+	return packet_size + (size_t)fragment_count*offsetof(net_fragment_t, data);
+}
+
+unsigned short SV_ReservePacket(sv_client_t *client, size_t packet_size)
+{
+	int fragment_count = Fragment_GetCount(packet_size);
+
+	if (fragment_count == 1)
+	{
+		Rate_OnDatagramSent(&client->rate, packet_size);
+		return 0;
+	}
+
+	// the same datagrams Fragment_Write is going to make out of it
+	for (int i = 0; i < fragment_count; i++)
+	{
+		size_t size = packet_size - (size_t)i*NET_FRAGMENT_DATA_SIZE;
+
+		if (size > NET_FRAGMENT_DATA_SIZE)
+			size = NET_FRAGMENT_DATA_SIZE;
+
+		Rate_OnDatagramSent(&client->rate, offsetof(net_fragment_t, data) + size);
+	}
+
+	return client->fragmented_packet_id++;
+}
+
+bool SV_SendPacketNow(net_addr_t address, unsigned short packet_id, void *packet, size_t packet_size)
+{
+	int fragment_count = Fragment_GetCount(packet_size);
+
+	if (fragment_count == 1)
+		return Net_SendPacket(&g_net, g_socket, address, packet, packet_size) == (int)packet_size;
+
+	if (NEVER(fragment_count > NET_MAX_FRAGMENT_COUNT))
+		return false;
+
+	bool result = true;
+	for (int i = 0; i < fragment_count; i++)
+	{
+		net_fragment_t fragment;
+		size_t fragment_size = Fragment_Write(&fragment, packet_id, i, packet, packet_size);
+
+		result &= Net_SendPacket(&g_net, g_socket, address, &fragment, fragment_size) == (int)fragment_size;
+	}
+	return result;
+}
+
+bool SV_SendMessage(sv_client_t *client, const void *message, size_t message_size)
+{
+	if (Channel_Send(&client->channel, message, message_size))
+		return true;
+
+	client->too_far_behind = true;
+	return false;
+}
+
+void SV_SendMessageToAllClients(const void *message, size_t message_size)
+{
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		SV_SendMessage(&g_clients[i], message, message_size);
+	}
+}
+
+// ------------------------------------------------------------------
+// the handshake
+//
+// an address that isn't connected has to send a connect packet, get a
+// challenge with a cookie back, and send a connect packet with that
+// cookie in it, before we allocate anything for it. the cookie is a
+// keyed hash of the address and the current time window, so we can
+// check it without having to remember who we sent which cookie. a 
+// spoofed address never gets to see its cookie, so it can't get in,
+// and all it ever costs us is a hash and a reply smaller than the 
+// packet that asked for it
+
+// how long a cookie stays valid, in seconds. a cookie from the
+// previous window is still accepted, so it's valid for at least this 
+// long, and at most twice that
+static double g_cookie_lifetime = 10.0;
+
+// see SV_SetAcceptAnyCookie
+static bool g_accept_any_cookie;
+
+void SV_SetAcceptAnyCookie(bool accept)
+{
+	g_accept_any_cookie = accept;
+}
+
+static uint64_t SV_ComputeCookie(net_addr_t address, uint32_t window)
+{
+	unsigned char input[12];
+	memcpy(&input[0], &address.family, 2);
+	memcpy(&input[2], &address.port,   2);
+	memcpy(&input[4], &address.addr,   4);
+	memcpy(&input[8], &window,         4);
+
+	return SipHash_Compute(&g_cookie_key, input, sizeof(input));
+}
+
+static uint32_t SV_GetCookieWindow(void)
+{
+	double seconds = OS_GetSecondsElapsed(g_cookie_epoch, OS_GetHiresTime());
+	return (uint32_t)(seconds / g_cookie_lifetime);
+}
+
+static bool SV_CheckCookie(net_addr_t address, uint64_t cookie)
+{
+	if (g_accept_any_cookie)
+		return true;
+
+	uint32_t window = SV_GetCookieWindow();
+
+	if (cookie == SV_ComputeCookie(address, window))
+		return true;
+
+	if (window > 0 && cookie == SV_ComputeCookie(address, window - 1))
+		return true;
+
+	return false;
+}
+
+// handles a datagram from an address that isn't connected. returns the
+// new client if the datagram completed the handshake
+static sv_client_t *SV_ProcessConnectionless(net_addr_t address, char *buffer, size_t buffer_size)
+{
+	bundle_reader_t reader;
+	Bundle_BeginRead(&reader, buffer, buffer_size);
+
+	net_header_t *header;
+	size_t packet_size;
+
+	while (Bundle_Next(&reader, &header, &packet_size))
+	{
+		// nothing else is any of our business until they're connected
+		if (header->kind != NETPACKET_CONNECT || packet_size < sizeof(net_connect_t))
+			continue;
+
+		net_connect_t *connect = (net_connect_t *)header;
+
+		if (connect->protocol_id      != NET_PROTOCOL_ID ||
+			connect->protocol_version != NET_PROTOCOL_VERSION)
+		{
+			continue;
+		}
+
+		if (SV_CheckCookie(address, connect->cookie))
+		{
+			// if the server is full, they'll have to keep trying
+			return SV_AddClient(address);
+		}
+
+		net_challenge_t challenge = {
+			.header = {
+				.kind = NETPACKET_CHALLENGE,
+			},
+			.cookie = SV_ComputeCookie(address, SV_GetCookieWindow()),
+		};
+
+		// not bundled, since there's no client to keep a bundle for
+		Net_SendPacket(&g_net, g_socket, address, &challenge, sizeof(challenge));
+
+		// one challenge per datagram is plenty
+		break;
+	}
+
+	return NULL;
+}
+
 // ------------------------------------------------------------------
 // processing packets
 
 enum { MAX_PACKET_SIZE = 8192 };
 
+static void SV_ProcessPing(sv_client_t *client, net_ping_t *ping)
+{
+	if (ping->is_reply)
+	{
+		// it's one of ours coming back
+		os_time_t now = OS_GetHiresTime();
+		Link_AddRttSample(&client->link, (float)OS_GetSecondsElapsed(ping->send_time, now));
+		Metrics_RecordTime(g_client_rtt, ping->send_time, now);
+	}
+	else
+	{
+		// the reply sits in the bundle until the end of the tick, so the
+		// client's rtt includes up to a tick of waiting. that's fine, it
+		// would have waited that long for the world state anyway
+		ping->is_reply = 1;
+		SV_SendPacket(client, ping, sizeof(*ping));
+	}
+}
+
 static void SV_ProcessPacket(sv_client_t *client, char *buffer, size_t buffer_size)
 {
-	net_header_t *header = (net_header_t *)buffer;
+	// the packets get handled right where they are in the buffer, bundled
+	// up or not
+	bundle_reader_t reader;
+	Bundle_BeginRead(&reader, buffer, buffer_size);
 
-	Sim_ProcessPacket(client, header);
-	switch (header->kind)
-	{
-		case NETPACKET_CLIENT_DISCONNECTED:
-		{
-			Sim_ProcessPacket(client, header);
-			SV_ForgetClient(client);
-		} break;
+	net_header_t *header;
+	size_t packet_size;
 
-		case NETPACKET_PING:
+	while (Bundle_Next(&reader, &header, &packet_size))
+	{
+		Sim_ProcessPacket(client, header, packet_size);
+		switch (header->kind)
 		{
-			SV_SendPacket(client, buffer, buffer_size);
-		} break;
+			case NETPACKET_PING:
+			{
+				if (packet_size >= sizeof(net_ping_t))
+					SV_ProcessPing(client, (net_ping_t *)header);
+			} break;
+		}
 	}
 
 	client->new_connection = false;
@@ -220,7 +603,8 @@ void SV_ProcessPackets(void)
 		alignas(16) char buffer[MAX_PACKET_SIZE];
 
 		size_t packet_size;
-		sv_client_t *client = SV_ReceivePacket(buffer, sizeof(buffer), &packet_size);
+		net_addr_t address;
+		sv_client_t *client = SV_ReceivePacket(buffer, sizeof(buffer), &packet_size, &address);
 
 		if (packet_size == 0)
 		{
@@ -230,6 +614,57 @@ void SV_ProcessPackets(void)
 			break;
 		}
 
+		if (!client)
+		{
+			client = SV_ProcessConnectionless(address, buffer, packet_size);
+
+			if (!client)
+				continue;
+
+			client->last_packet_time = OS_GetHiresTime();
+		}
+
+		Rate_OnDatagramReceived(&client->rate, packet_size);
+
+		os_time_t start_time = OS_GetHiresTime();
+		TIMED_BLOCK_BEGIN(SV_ProcessPacket);
+
 		SV_ProcessPacket(client, buffer, packet_size);
+
+		TIMED_BLOCK_END(SV_ProcessPacket);
+		Metrics_RecordTime(g_packet_time, start_time, OS_GetHiresTime());
+	}
+}
+
+// ------------------------------------------------------------------
+// pinging clients
+
+// how often clients get pinged, in seconds
+static double g_ping_interval = 0.1;
+
+void SV_SendPings(void)
+{
+	os_time_t now = OS_GetHiresTime();
+
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t *client = &g_clients[i];
+
+		if (client->last_ping_time && 
+			OS_GetSecondsElapsed(client->last_ping_time, now) < g_ping_interval)
+		{
+			continue;
+		}
+
+		client->last_ping_time = now;
+
+		net_ping_t ping = {
+			.header = {
+				.kind = NETPACKET_PING,
+			},
+			.send_time = now,
+		};
+
+		SV_SendPacket(client, &ping, sizeof(ping));
 	}
 }
@@ -6,6 +6,13 @@
 // ------------------------------------------------------------------
 
 #include "net.h"
+#include "netimpair.h"
+#include "netlink.h"
+#include "channel.h"
+#include "bundle.h"
+#include "timerwheel.h"
+#include "sv_input.h"
+#include "sv_rate.h"
 
 // ------------------------------------------------------------------
 // sv_server.h: abstraction layer to avoid unnecessarily detailed
@@ -23,9 +30,34 @@ typedef struct sv_client_t
 	net_addr_t address;
 
 	uint64_t last_packet_time;
+	uint64_t last_ping_time;
+
+	net_link_t link; // round trip time, jitter and loss of this client's connection
+	sv_rate_t  rate; // how many bytes per second this client's connection can take
+
+	unsigned short world_state_sequence; // sequence number of the most recently sent world state
+	unsigned short fragmented_packet_id; // counts up for every packet that had to be split into fragments
+
+	bundle_writer_t send_bundle; // packets waiting to go out at the end of the tick
+
+	unsigned char player_id; // stays the same for as long as the client is connected
+	net_channel_t channel;   // reliable messages to and from this client
+
+	// clients that said goodbye stick around for a little bit, so the 
+	// ack for their goodbye has a chance to make it back to them
+	bool disconnecting;
+
+	// a reliable message didn't fit in their channel, see SV_SendMessage
+	bool too_far_behind;
+
+	// timers in the simulation's timer wheel. when one fires, it only
+	// counts if it's still the one in here
+	timer_handle_t timeout_timer;
+	timer_handle_t respawn_timer;
+	timer_handle_t forget_timer;
 
 	// the username of the client
-	char name[32];
+	char name[NET_USERNAME_MAX_SIZE];
 
 	// if I was being more thorough architecturally I would have
 	// clients associated with some other "player" struct managed 
@@ -33,15 +65,15 @@ typedef struct sv_client_t
 	// networking and not gameplay-related details
 	sv_entity_t *entity;
 
-	unsigned short last_sequence; // sequence number of the most recently handled input packet
+	sv_input_queue_t input_queue;
+
+	float input_lead; // how long the input used for the last tick was queued up, in seconds
 
 	uint32_t btn_pressed;
 	uint32_t btn_down;
 	uint32_t btn_released;
 
 	float mouse_x, mouse_y;
-
-	float respawn_timer;
 } sv_client_t;
 
 // ------------------------------------------------------------------
@@ -54,15 +86,69 @@ typedef struct sv_client_t
 extern size_t	   g_client_count;
 extern sv_client_t g_clients[];
 
-int  SV_Init(int port);
+// the impairment is for testing how the game holds up on a bad
+// network, see netimpair.h. normally it's NULL
+int  SV_Init(int port, net_impairment_t *impairment);
 void SV_Exit(void);
 
+// writes every datagram the server sends or receives to a capture file,
+// see netcapture.h. it gets closed by SV_Exit. returns 0 on success
+int  SV_StartCapture(const char *path);
+
+// lets any connect packet through the handshake, whatever its cookie.
+// this is only for replaying captures, where the cookies were handed
+// out by a different server, with a different key
+void SV_SetAcceptAnyCookie(bool accept);
+
+// traffic stats for everything the server sends and receives
+void SV_GetNetStats(net_stats_t *stats);
+
+// returns NULL if the address isn't connected, clients only get added
+// once they've made it through the handshake in SV_ProcessPackets
 sv_client_t *SV_GetClientForAddress(net_addr_t address);
+
+// adds a client that has made it through the handshake, or, when
+// re-simulating a journal, one that did back then. returns NULL if the
+// server is full
+sv_client_t *SV_AddClient(net_addr_t address);
+
 sv_client_t *SV_GetClientForEntity(sv_entity_t *e);
+sv_client_t *SV_GetClientForPlayerId(unsigned char player_id);
 void SV_ForgetClient(sv_client_t *client);
 
-sv_client_t *SV_ReceivePacket(char *buffer, size_t buffer_size, size_t *packet_size);
+sv_client_t *SV_ReceivePacket(char *buffer, size_t buffer_size, size_t *packet_size, net_addr_t *address);
+
+// packets don't get sent right away, they get bundled up per client
+// and go out when SV_FlushPackets is called, once per tick
 bool SV_SendPacket(sv_client_t *client, void *packet, size_t packet_size);
 bool SV_SendPacketToAllClients(void *packet, size_t packet_size);
+void SV_FlushPackets(void);
+
+// how many bytes a packet comes out to once it's been split into
+// fragments, if it had to be, and into how many datagrams
+size_t SV_GetPacketSendSize(size_t packet_size, int *datagram_count);
+
+// for packets that get sent later, from another thread, without the
+// client (world states, see sv_sender.h). SV_ReservePacket pays for the
+// packet out of the client's budget and hands out its fragment packet
+// id, on the simulation thread. SV_SendPacketNow then sends it to the
+// address right away, skipping the bundle, and is safe to call from
+// any thread
+unsigned short SV_ReservePacket(sv_client_t *client, size_t packet_size);
+bool           SV_SendPacketNow(net_addr_t address, unsigned short packet_id, void *packet, size_t packet_size);
+
+// queues up a reliable message for the client, see channel.h. if it
+// doesn't fit, because the client hasn't acked anything in ages, it
+// can't just be skipped, or the client would never find out. instead
+// the client gets marked as too_far_behind, and the simulation
+// disconnects them. returns false if that happened
+bool SV_SendMessage(sv_client_t *client, const void *message, size_t message_size);
+
+// queues up a reliable message for every client, like SV_SendMessage
+void SV_SendMessageToAllClients(const void *message, size_t message_size);
 
 void SV_ProcessPackets(void);
+
+// pings every client that hasn't been pinged in a while, to keep 
+// their round trip time estimates up to date
+void SV_SendPings(void);
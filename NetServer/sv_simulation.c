@@ -14,8 +14,18 @@
 
 #include "protocol.h"
 #include "net.h"
+#include "netinput.h"
+#include "os.h"
 #include "util.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "logger.h"
 #include "sv_server.h"
+#include "sv_input.h"
+#include "sv_history.h"
+#include "sv_journal.h"
+#include "sv_recorder.h"
+#include "sv_sender.h"
 #include "sv_simulation.h"
 
 // ------------------------------------------------------------------
@@ -23,6 +33,197 @@
 // gameplay code is in this file.
 
 
+// ------------------------------------------------------------------
+// timers
+//
+// everything that happens some amount of time from now goes through
+// the timer wheel, rather than every entity and client counting down
+// timers of their own every tick
+
+typedef enum sim_timer_e
+{
+	SIMTIMER_ENTITY_LIFETIME, // userdata is the entity id
+	SIMTIMER_RESPAWN,         // userdata is the player id, same for the rest
+	SIMTIMER_CLIENT_TIMEOUT,
+	SIMTIMER_CLIENT_FORGET,
+} sim_timer_e;
+
+static timer_wheel_t g_timers;
+
+static double g_client_timeout = 10.0; // in seconds
+
+void Sim_SetClientTimeout(double seconds)
+{
+	g_client_timeout = seconds;
+}
+
+// ------------------------------------------------------------------
+// tick timing
+
+static uint32_t g_tick; // the tick that the next call to Sim_Run simulates
+static double   g_seconds_per_tick;
+
+// ------------------------------------------------------------------
+// metrics
+
+static metrics_histogram_t g_snapshot_size;
+static metrics_counter_t   g_snapshots_sent;
+static metrics_counter_t   g_snapshots_held_back; // by the client's rate limit
+static metrics_counter_t   g_snapshots_dropped;   // because the sender was too far behind
+
+void Sim_Init(double seconds_per_tick)
+{
+	g_seconds_per_tick = seconds_per_tick;
+
+	TimerWheel_Init(&g_timers, g_tick);
+
+	g_snapshot_size       = Metrics_RegisterHistogram("snapshot_size_bytes");
+	g_snapshots_sent      = Metrics_RegisterCounter("snapshots_sent");
+	g_snapshots_held_back = Metrics_RegisterCounter("snapshots_held_back");
+	g_snapshots_dropped   = Metrics_RegisterCounter("snapshots_dropped");
+}
+
+uint32_t Sim_GetTick(void)
+{
+	return g_tick;
+}
+
+// ------------------------------------------------------------------
+// random numbers
+//
+// everything random in the simulation has to come from here, so that
+// the seed is all it takes to get the same numbers out again
+
+static uint64_t g_seed;
+static uint64_t g_random_state;
+
+void Sim_SetSeed(uint64_t seed)
+{
+	g_seed         = seed;
+	g_random_state = seed;
+}
+
+// splitmix64
+static uint64_t Sim_Random(void)
+{
+	uint64_t z = (g_random_state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// returns a number from 0 up to, but not including, range
+static int Sim_RandomInt(int range)
+{
+	return (int)(Sim_Random() % (uint64_t)range);
+}
+
+// ------------------------------------------------------------------
+// deterministic mode, see sv_journal.h
+
+static sv_journal_t  *g_journal;
+static journal_tick_t g_journal_tick; // the tick that's being recorded
+
+// once anything has been re-simulated, there are no real clients to
+// send anything to
+static bool g_replaying;
+
+// only set during Sim_ReplayTick, this is where the inputs and timeouts
+// come from instead of the clients
+static const journal_tick_t  *g_replay_tick;
+static const journal_event_t *g_replay_timeouts;
+static int                    g_replay_timeout_count;
+static int                    g_replay_timeout_index;
+
+static void Sim_WriteEvent(journal_record_e kind, sv_client_t *client, uint32_t timeout_ticks)
+{
+	if (!g_journal)
+		return;
+
+	journal_event_t event = {
+		.kind          = kind,
+		.player_id     = client->player_id,
+		.timeout_ticks = timeout_ticks,
+	};
+	Journal_WriteEvent(g_journal, &event);
+}
+
+int Sim_StartJournal(const char *path)
+{
+	if (g_journal)
+		return -1;
+
+	if (g_tick != 0 || g_client_count != 0)
+	{
+		fprintf(stderr, "Sim_StartJournal: the journal has to be started before anything happens\n");
+		return -1;
+	}
+
+	journal_settings_t settings = {
+		.seed             = g_seed,
+		.seconds_per_tick = g_seconds_per_tick,
+		.client_timeout   = g_client_timeout,
+	};
+
+	g_journal = Journal_Create(path, &settings);
+
+	if (!g_journal)
+		return -1;
+
+	printf("Writing the simulation journal to '%s'\n", path);
+	return 0;
+}
+
+void Sim_StopJournal(void)
+{
+	Journal_Destroy(g_journal);
+	g_journal = NULL;
+}
+
+// FNV-1a
+static uint64_t Sim_Hash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+static uint32_t Sim_TicksFromSeconds(double seconds)
+{
+	return (uint32_t)ceil(seconds / g_seconds_per_tick);
+}
+
+// ------------------------------------------------------------------
+// recording, see sv_recorder.h
+
+static sv_recorder_t *g_recorder;
+
+int Sim_StartRecording(const char *path)
+{
+	if (g_recorder)
+		return -1;
+
+	g_recorder = Recorder_Create(path, g_seconds_per_tick);
+
+	if (!g_recorder)
+		return -1;
+
+	printf("Recording the match to '%s'\n", path);
+	return 0;
+}
+
+void Sim_StopRecording(void)
+{
+	Recorder_Destroy(g_recorder);
+	g_recorder = NULL;
+}
+
 // ------------------------------------------------------------------
 // entity management
 
@@ -41,6 +242,19 @@ sv_entity_t *E_FromId(net_entity_id_t id)
 	return result;
 }
 
+int E_GetCount(void)
+{
+	int count = 0;
+
+	for (size_t i = MIN_ENTITY_INDEX; i <= MAX_ENTITY_INDEX; i++)
+	{
+		if (ENTITY_ID_VALID(g_entities[i].id))
+			count += 1;
+	}
+
+	return count;
+}
+
 sv_entity_t *E_Spawn(void)
 {
 	short index = 0;
@@ -77,11 +291,19 @@ sv_entity_t *E_Spawn(void)
 
 void E_Destroy(sv_entity_t *e)
 {
-	// disassociate the entity from the client
+	// disassociate the entity from the client, who gets a new one in
+	// 5 seconds
 	sv_client_t *client = SV_GetClientForEntity(e);
 
 	if (client)
+	{
 		client->entity = NULL;
+
+		TimerWheel_Cancel(&g_timers, client->respawn_timer);
+		client->respawn_timer = TimerWheel_Add(&g_timers, Sim_TicksFromSeconds(5.0), SIMTIMER_RESPAWN, client->player_id);
+	}
+
+	TimerWheel_Cancel(&g_timers, e->lifetime_timer);
 	
 	// and destroy the entity
 	e->id.index = INVALID_ENTITY_INDEX;
@@ -92,6 +314,45 @@ void E_Destroy(sv_entity_t *e)
 	e->id.generation += 1;
 }
 
+uint64_t Sim_HashWorld(void)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (size_t i = MIN_ENTITY_INDEX; i <= MAX_ENTITY_INDEX; i++)
+	{
+		sv_entity_t *e = &g_entities[i];
+
+		if (!ENTITY_ID_VALID(e->id))
+			continue;
+
+		int parent = e->parent ? e->parent->id.value : 0;
+
+		hash = Sim_Hash(hash, &e->id.value,     sizeof(e->id.value));
+		hash = Sim_Hash(hash, &parent,          sizeof(parent));
+		hash = Sim_Hash(hash, &e->flags,        sizeof(e->flags));
+		hash = Sim_Hash(hash, &e->x,            sizeof(e->x));
+		hash = Sim_Hash(hash, &e->y,            sizeof(e->y));
+		hash = Sim_Hash(hash, &e->dx,           sizeof(e->dx));
+		hash = Sim_Hash(hash, &e->dy,           sizeof(e->dy));
+		hash = Sim_Hash(hash, &e->size,         sizeof(e->size));
+		hash = Sim_Hash(hash, &e->rewind_ticks, sizeof(e->rewind_ticks));
+	}
+
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t *client = &g_clients[i];
+
+		int entity = client->entity ? client->entity->id.value : 0;
+
+		hash = Sim_Hash(hash, &client->player_id,     sizeof(client->player_id));
+		hash = Sim_Hash(hash, &entity,                sizeof(entity));
+		hash = Sim_Hash(hash, &client->disconnecting, sizeof(client->disconnecting));
+		hash = Sim_Hash(hash, &client->btn_down,      sizeof(client->btn_down));
+	}
+
+	return hash;
+}
+
 static sv_entity_t *Sim_SpawnPlayer(sv_client_t *client)
 {
 	// just spawn players somewhere in some area around the origin
@@ -105,8 +366,8 @@ static sv_entity_t *Sim_SpawnPlayer(sv_client_t *client)
 	int game_field_w = 300;
 	int game_field_h = 200;
 
-	int x = 20 + rand() % (game_field_w - 40) - game_field_w / 2;
-	int y = 20 + rand() % (game_field_h - 40) - game_field_h / 2;
+	int x = 20 + Sim_RandomInt(game_field_w - 40) - game_field_w / 2;
+	int y = 20 + Sim_RandomInt(game_field_h - 40) - game_field_h / 2;
 
 	client->entity = E_Spawn();
 	client->entity->x = (float)x;
@@ -117,42 +378,202 @@ static sv_entity_t *Sim_SpawnPlayer(sv_client_t *client)
 }
 
 // ------------------------------------------------------------------
-// entity related netcode
+// lag compensation
+//
+// by the time a shot gets to us, the shooter was looking at a world
+// state that is a round trip old, and then their input sat in the
+// input queue for a bit. so hits get tested against where the targets
+// were back then, according to the position history.
+
+static float g_max_rewind = 0.2f; // in seconds
+
+// extra delay on top of the round trip for the client displaying world
+// states. the client shows the newest world state as soon as it comes
+// in (and extrapolates it), so there's none for now. if the client ever
+// starts buffering world states to interpolate between them, this 
+// should be that buffer's delay
+static float g_interp_delay = 0.0f;
+
+void Sim_SetMaxRewind(float seconds)
+{
+	g_max_rewind = seconds > 0.0f ? seconds : 0.0f;
+}
 
-static unsigned short g_world_state_sequence;
+static float Sim_GetRewindTicks(sv_client_t *client)
+{
+	float input_wait = client->input_lead > 0.0f ? client->input_lead : 0.0f;
+	float rewind     = client->link.rtt + input_wait + g_interp_delay;
 
-static void Sim_SendWorldState(sv_client_t *client)
+	if (rewind > g_max_rewind)
+		rewind = g_max_rewind;
+
+	return rewind / (float)g_seconds_per_tick;
+}
+
+// ------------------------------------------------------------------
+// entity related netcode
+
+// fills in the bits of the world state that are only for this client,
+// the sender puts it together with the rest, see sv_sender.h
+static void Sim_PrepareWorldState(sv_client_t *client, sv_sender_client_t *out, bool threaded)
 {
-	net_world_state_t packet = {
-		.header = {
-			.kind     = NETPACKET_WORLD_STATE,
-			.sequence = ++g_world_state_sequence,
-		},
-		/* world state initialized down below */
-	};
+	out->address = client->address;
+
+	// the sequence is per client, so clients can tell from gaps in the 
+	// sequence how many world states they missed
+	out->sequence = ++client->world_state_sequence;
+
+	out->client_id.value = 0;
 
 	if (client->entity)
-		packet.client_id = client->entity->id;
+		out->client_id = client->entity->id;
+
+	out->input_lead       = client->input_lead;
+	out->input_underflows = (unsigned short)client->input_queue.underflows;
+	out->input_overflows  = (unsigned short)client->input_queue.overflows;
+
+	out->reliable_size = (uint32_t)Channel_WriteBlock(&client->channel, out->sequence, client->link.rtt, 
+													  out->reliable, sizeof(out->reliable));
+
+	Rate_OnSnapshotSent(&client->rate, out->sequence);
+
+	size_t packet_size = offsetof(net_world_state_t, reliable) + out->reliable_size;
+
+	// on the sender thread, it's paid for now, even though it goes out a
+	// little later. otherwise it goes through the client's bundle, and
+	// gets paid for when that's flushed
+	if (threaded)
+	{
+		out->client    = NULL;
+		out->packet_id = SV_ReservePacket(client, packet_size);
+	}
+	else
+	{
+		out->client    = client;
+		out->packet_id = 0;
+	}
+
+	Metrics_Record(g_snapshot_size, packet_size);
+	Metrics_Add(g_snapshots_sent, 1);
+}
+
+// the part of the world state that's the same for everyone
+static void Sim_FillWorldBuffer(sv_world_buffer_t *buffer)
+{
+	// Sim_Run has already moved on to the next tick by the time it sends
+	// out the world state
+	buffer->server_tick  = g_tick - 1;
+	buffer->player_count = (unsigned)g_client_count;
+
+	memset(buffer->players, 0, sizeof(buffer->players));
 
 	for (size_t i = 0; i < g_client_count; i++)
 	{
-		sv_client_t *sv_client = &g_clients[i];
-		net_player_t *player = &packet.players[i];
-		memcpy(player->name, sv_client->name, NET_USERNAME_MAX_SIZE);
+		sv_client_t  *sv_client = &g_clients[i];
+		net_player_t *player    = &buffer->players[i];
+		player->player_id = sv_client->player_id;
 
 		if (sv_client->entity)
 			player->entity = sv_client->entity->id;
 	}
 
-	packet.player_count = (unsigned)g_client_count;
+	for (size_t i = 0; i < MAX_ENTITY_COUNT; i++)
+	{
+		sv_entity_t        *e     = &g_entities[i];
+		net_entity_state_t *state = &buffer->entities[i];
 
-	for (size_t i = MIN_ENTITY_INDEX; i <= MAX_ENTITY_INDEX; i++)
+		if (ENTITY_ID_VALID(e->id))
+		{
+			state->id   = e->id;
+			state->x    = e->x;
+			state->y    = e->y;
+			state->dx   = e->dx;
+			state->dy   = e->dy;
+			state->size = e->size;
+		}
+		else
+		{
+			memset(state, 0, sizeof(*state));
+		}
+	}
+}
+
+// for a world state that can't wait for the end of the tick
+static void Sim_SendWorldState(sv_client_t *client)
+{
+	// about 20 kilobytes, so it doesn't go on the stack
+	static sv_world_buffer_t buffer;
+
+	Sim_FillWorldBuffer(&buffer);
+
+	buffer.client_count = 1;
+	Sim_PrepareWorldState(client, &buffer.clients[0], false);
+
+	Sender_SendNow(&buffer);
+}
+
+static void Sim_SendWorldStates(os_time_t tick_time)
+{
+	sv_world_buffer_t *buffer = Sender_BeginTick();
+
+	// the sender is too far behind, nobody gets this tick
+	if (!buffer)
 	{
-		sv_entity_t *e = &g_entities[i];
+		Metrics_Add(g_snapshots_dropped, g_client_count);
+		return;
+	}
+
+	Sim_FillWorldBuffer(buffer);
+
+	// as far as their connections can take it. the ones that can't take
+	// it all just see fewer world states, which is better than seeing all
+	// of them late
+	buffer->client_count = 0;
+
+	bool threaded = Sender_IsThreaded();
+
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t *client = &g_clients[i];
+
+		// the whole thing, as it's going to go out: reliable block, fragment
+		// headers and all
+		size_t reliable_size = Channel_GetBlockSize(&client->channel, client->link.rtt, NET_RELIABLE_BLOCK_SIZE);
+
+		int    datagram_count;
+		size_t send_size = SV_GetPacketSendSize(offsetof(net_world_state_t, reliable) + reliable_size, &datagram_count);
+
+		if (Rate_CanSendSnapshot(&client->rate, send_size, datagram_count, tick_time))
+			Sim_PrepareWorldState(client, &buffer->clients[buffer->client_count++], threaded);
+		else
+			Metrics_Add(g_snapshots_held_back, 1);
+	}
+
+	Sender_EndTick();
+}
+
+void Sim_GetFrame(rec_frame_t *frame)
+{
+	frame->tick         = g_tick - 1;
+	frame->player_count = (int)g_client_count;
+
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t  *client = &g_clients[i];
+		rec_player_t *player = &frame->players[i];
+
+		player->player_id    = client->player_id;
+		player->entity.value = client->entity ? client->entity->id.value : 0;
+		memcpy(player->name, client->name, NET_USERNAME_MAX_SIZE);
+	}
+
+	for (size_t i = 0; i < MAX_ENTITY_COUNT; i++)
+	{
+		sv_entity_t        *e     = &g_entities[i];
+		net_entity_state_t *state = &frame->entities[i];
 
 		if (ENTITY_ID_VALID(e->id))
 		{
-			net_entity_state_t *state = &packet.world_state[i];
 			state->id   = e->id;
 			state->x    = e->x;
 			state->y    = e->y;
@@ -160,64 +581,422 @@ static void Sim_SendWorldState(sv_client_t *client)
 			state->dy   = e->dy;
 			state->size = e->size;
 		}
+		else
+		{
+			memset(state, 0, sizeof(*state));
+		}
+	}
+}
+
+static void Sim_RecordFrame(void)
+{
+	rec_frame_t *frame = Recorder_BeginFrame(g_recorder);
+
+	// the recorder is behind, this tick won't be in the recording
+	if (!frame)
+		return;
+
+	Sim_GetFrame(frame);
+
+	Recorder_EndFrame(g_recorder);
+}
+
+// ------------------------------------------------------------------
+// reliable messages
+
+static void Sim_SendPlayerJoined(sv_client_t *to_client, sv_client_t *joined_client)
+{
+	net_msg_player_joined_t message = {
+		.kind      = NETMSG_PLAYER_JOINED,
+		.player_id = joined_client->player_id,
+	};
+	memcpy(message.name, joined_client->name, NET_USERNAME_MAX_SIZE);
+
+	if (to_client)
+		SV_SendMessage(to_client, &message, sizeof(message));
+	else
+		SV_SendMessageToAllClients(&message, sizeof(message));
+}
+
+static void Sim_JoinClient(sv_client_t *client)
+{
+	Sim_SpawnPlayer(client);
+
+	client->timeout_timer = TimerWheel_Add(&g_timers, Sim_TicksFromSeconds(g_client_timeout), SIMTIMER_CLIENT_TIMEOUT, client->player_id);
+
+	Sim_WriteEvent(JOURNAL_RECORD_JOIN, client, 0);
+
+	if (g_replaying)
+		return;
+
+	// tell the new client about everyone who is already here
+	for (size_t i = 0; i < g_client_count; i++)
+	{
+		sv_client_t *other = &g_clients[i];
+
+		if (other != client && other->name[0])
+			Sim_SendPlayerJoined(client, other);
 	}
 
-	SV_SendPacket(client, &packet, sizeof(packet));
+	Sim_SendWorldState(client);
 }
 
-void Sim_ProcessPacket(sv_client_t *client, net_header_t *header)
+static void Sim_DisconnectClient(sv_client_t *client)
 {
+	if (client->disconnecting)
+		return;
+
+	client->disconnecting = true;
+	client->forget_timer  = TimerWheel_Add(&g_timers, Sim_TicksFromSeconds(1.0), SIMTIMER_CLIENT_FORGET, client->player_id);
+
+	if (client->entity)
+		E_Destroy(client->entity);
+
+	Sim_WriteEvent(JOURNAL_RECORD_DISCONNECT, client, 0);
+}
+
+static void Sim_ProcessMessages(sv_client_t *client)
+{
+	net_message_t message;
+	while (Channel_Receive(&client->channel, &message))
+	{
+		switch (message.kind)
+		{
+			case NETMSG_DISCONNECT:
+			{
+				Sim_DisconnectClient(client);
+			} break;
+		}
+	}
+}
+
+void Sim_ProcessPacket(sv_client_t *client, net_header_t *header, size_t packet_size)
+{
+	// the connect packet that got them in can be bundled up with others,
+	// which all come through here before SV_ProcessPacket clears the flag,
+	// and they should only get spawned once
 	if (client->new_connection)
 	{
-		Sim_SpawnPlayer(client);
-		Sim_SendWorldState(client);
+		Sim_JoinClient(client);
+		client->new_connection = false;
 	}
 
 	switch (header->kind)
 	{
 		case NETPACKET_INPUT:
 		{
+			if (packet_size < offsetof(net_input_t, reliable))
+				break;
+
 			net_input_t *packet = (net_input_t *)header;
 
-			if (Net_AcceptSequenceNumber(client->last_sequence, packet->header.sequence))
+			Link_AddSequence(&client->link, packet->header.sequence);
+
+			if (Channel_ReadBlock(&client->channel, packet->header.sequence, 
+								  packet->reliable, packet_size - offsetof(net_input_t, reliable)))
 			{
-				client->last_sequence = packet->header.sequence;
+				// the acks in there say which world states made it, which is
+				// how the bandwidth budget finds out about loss
+				Rate_OnAcks(&client->rate, client->channel.peer_ack, client->channel.peer_ack_bits, 
+							&client->link, OS_GetHiresTime());
 
-				uint32_t changes = client->btn_down ^ packet->btn_down;
-				client->btn_pressed  |= changes &  packet->btn_down;
-				client->btn_released |= changes & ~packet->btn_down;
-				client->btn_down      = packet->btn_down;
+				Sim_ProcessMessages(client);
+			}
 
-				client->mouse_x = packet->mouse_x;
-				client->mouse_y = packet->mouse_y;
+			net_input_frame_t frames[NET_INPUT_HISTORY_COUNT];
+			int frame_count = NetInput_ReadPacket(packet, frames);
 
-				memcpy(client->name, packet->name, NET_USERNAME_MAX_SIZE);
-			}
-			else
+			os_time_t arrival_time = OS_GetHiresTime();
+
+			// inputs don't get applied right away, they get queued up so that
+			// Sim_Run can take exactly one of them each tick. the newest frame
+			// goes in first, it's the only one whose arrival time means anything
+			// for the jitter estimate
+			for (int i = 0; i < frame_count; i++)
 			{
-				// fprintf(stderr, "Discarded out-of-order or duplicate input packet\n");
+				unsigned short sequence = (unsigned short)(packet->header.sequence - i);
+
+				// the older frames are only interesting if their own packet got lost
+				if (i > 0 && !Input_IsMissing(&client->input_queue, sequence))
+					continue;
+
+				sv_input_t input = {
+					.sequence     = sequence,
+					.btn_down     = frames[i].btn_down,
+					.mouse_x      = frames[i].mouse_x,
+					.mouse_y      = frames[i].mouse_y,
+					.arrival_time = arrival_time,
+				};
+				Input_Push(&client->input_queue, &input, g_seconds_per_tick);
+
+				if (i > 0)
+					client->input_queue.recovered += 1;
 			}
 		} break;
 
-		case NETPACKET_CLIENT_DISCONNECTED:
+		case NETPACKET_CONNECT:
 		{
-			if (client->entity)
+			if (packet_size < sizeof(net_connect_t))
+				break;
+
+			net_connect_t *packet = (net_connect_t *)header;
+
+			// the client keeps sending this until it hears back from us, so 
+			// only tell everyone if the name actually changed
+			char name[NET_USERNAME_MAX_SIZE];
+			memcpy(name, packet->name, NET_USERNAME_MAX_SIZE);
+			name[NET_USERNAME_MAX_SIZE - 1] = 0;
+
+			if (strcmp(name, client->name) != 0)
 			{
-				E_Destroy(client->entity);
+				memcpy(client->name, name, NET_USERNAME_MAX_SIZE);
+				Sim_SendPlayerJoined(NULL, client);
 			}
 		} break;
 	}
 }
 
+// ------------------------------------------------------------------
+// consuming client inputs
+
+static void Sim_ApplyInput(sv_client_t *client, sv_input_t *input)
+{
+	// pressed and released accumulate, so applying two inputs in one tick
+	// doesn't lose any presses
+	uint32_t changes = client->btn_down ^ input->btn_down;
+	client->btn_pressed  |= changes &  input->btn_down;
+	client->btn_released |= changes & ~input->btn_down;
+	client->btn_down      = input->btn_down;
+
+	client->mouse_x = input->mouse_x;
+	client->mouse_y = input->mouse_y;
+}
+
+static void Sim_ConsumeInputs(sv_client_t *client, os_time_t tick_time)
+{
+	sv_input_t inputs[2];
+	int input_count = Input_Consume(&client->input_queue, inputs);
+
+	// if there was no input, the client's buttons stay as they were
+	for (int i = 0; i < input_count; i++)
+	{
+		Sim_ApplyInput(client, &inputs[i]);
+	}
+
+	if (input_count > 0)
+	{
+		client->input_lead = (float)OS_GetSecondsElapsed(inputs[0].arrival_time, tick_time);
+	}
+	else
+	{
+		// the input for this tick didn't make it in time. we don't know how 
+		// late it's going to be, but at least a tick
+		client->input_lead = -(float)g_seconds_per_tick;
+	}
+}
+
+// when re-simulating, the journal says what the client ended up with
+// instead. returns the rewind ticks for the client's bullets
+static float Sim_ReplayInput(sv_client_t *client, size_t index)
+{
+	if (index >= (size_t)g_replay_tick->input_count || g_replay_tick->inputs[index].player_id != client->player_id)
+	{
+		LOG_ERROR("Sim_ReplayInput: the journal has no input for player %u on tick %u\n", client->player_id, g_tick);
+		client->btn_pressed = 0;
+		return 0.0f;
+	}
+
+	const journal_input_t *input = &g_replay_tick->inputs[index];
+
+	client->btn_down    = input->btn_down;
+	client->btn_pressed = input->btn_pressed;
+	client->mouse_x     = input->mouse_x;
+	client->mouse_y     = input->mouse_y;
+
+	return input->rewind_ticks;
+}
+
+// ------------------------------------------------------------------
+// firing timers
+
+// returns how many ticks from now to check again, or 0 if the client
+// has timed out. that depends on when their last packet arrived, so 
+// when re-simulating, the journal knows
+static uint32_t Sim_CheckTimeout(sv_client_t *client, os_time_t tick_time)
+{
+	uint32_t ticks = 0;
+
+	if (g_replay_tick)
+	{
+		if (g_replay_timeout_index < g_replay_timeout_count && 
+			g_replay_timeouts[g_replay_timeout_index].player_id == client->player_id)
+		{
+			ticks = g_replay_timeouts[g_replay_timeout_index++].timeout_ticks;
+		}
+		else
+		{
+			LOG_ERROR("Sim_CheckTimeout: the journal has no timeout for player %u on tick %u\n", client->player_id, g_tick);
+			ticks = Sim_TicksFromSeconds(g_client_timeout);
+		}
+	}
+	else
+	{
+		// the timer doesn't get pushed back with every packet, instead
+		// it checks when it fires whether there's been one since
+		double silence = OS_GetSecondsElapsed(client->last_packet_time, tick_time);
+
+		if (silence < g_client_timeout)
+			ticks = Sim_TicksFromSeconds(g_client_timeout - silence);
+	}
+
+	Sim_WriteEvent(JOURNAL_RECORD_TIMEOUT, client, ticks);
+
+	return ticks;
+}
+
+static void Sim_DropClient(sv_client_t *client)
+{
+	if (client->entity)
+		E_Destroy(client->entity);
+
+	TimerWheel_Cancel(&g_timers, client->timeout_timer);
+	TimerWheel_Cancel(&g_timers, client->respawn_timer);
+	TimerWheel_Cancel(&g_timers, client->forget_timer);
+
+	SV_ForgetClient(client);
+}
+
+static void Sim_ProcessTimers(os_time_t tick_time)
+{
+	TimerWheel_Advance(&g_timers, g_tick);
+
+	timer_event_t event;
+	while (TimerWheel_PopExpired(&g_timers, &event))
+	{
+		if (event.kind == SIMTIMER_ENTITY_LIFETIME)
+		{
+			net_entity_id_t id = { .value = (int)event.userdata };
+
+			sv_entity_t *e = E_FromId(id);
+			if (e)
+				E_Destroy(e);
+
+			continue;
+		}
+
+		// the client might be long gone, or have been replaced by one
+		// that got the same player id, so check it's still their timer
+		sv_client_t *client = SV_GetClientForPlayerId((unsigned char)event.userdata);
+
+		if (!client)
+			continue;
+
+		switch (event.kind)
+		{
+			case SIMTIMER_RESPAWN:
+			{
+				if (TimerWheel_HandlesMatch(event.handle, client->respawn_timer) && 
+					!client->entity && !client->disconnecting)
+				{
+					Sim_SpawnPlayer(client);
+				}
+			} break;
+
+			case SIMTIMER_CLIENT_TIMEOUT:
+			{
+				if (!TimerWheel_HandlesMatch(event.handle, client->timeout_timer))
+					break;
+
+				uint32_t ticks = Sim_CheckTimeout(client, tick_time);
+
+				if (ticks == 0)
+				{
+					LOG_INFO("%s timed out\n", client->name[0] ? client->name : "A client");
+					Sim_DropClient(client);
+				}
+				else
+				{
+					client->timeout_timer = TimerWheel_Add(&g_timers, ticks, SIMTIMER_CLIENT_TIMEOUT, client->player_id);
+				}
+			} break;
+
+			case SIMTIMER_CLIENT_FORGET:
+			{
+				// they said goodbye a while ago
+				if (TimerWheel_HandlesMatch(event.handle, client->forget_timer))
+					Sim_DropClient(client);
+			} break;
+		}
+	}
+}
+
 // ------------------------------------------------------------------
 // the main loop for the simulation
 
 void Sim_Run(float dt)
 {
+	TIMED_BLOCK_BEGIN(Sim_Run);
+
+	os_time_t tick_time = OS_GetHiresTime();
+
+	// clients that missed a reliable message would never get it, so they
+	// have to go. when replaying, the journal's disconnect records take
+	// care of that, the replayed clients never ack anything
+	if (!g_replaying)
+	{
+		for (size_t i = 0; i < g_client_count; i++)
+		{
+			sv_client_t *client = &g_clients[i];
+
+			if (client->too_far_behind && !client->disconnecting)
+			{
+				LOG_INFO("%s is too far behind on reliable messages, disconnecting them\n", client->name[0] ? client->name : "A client");
+				Sim_DisconnectClient(client);
+			}
+		}
+	}
+
+	TIMED_BLOCK_BEGIN(Sim_ProcessTimers);
+	Sim_ProcessTimers(tick_time);
+	TIMED_BLOCK_END(Sim_ProcessTimers);
+
+	TIMED_BLOCK_BEGIN(Sim_UpdateClients);
+
+	g_journal_tick.input_count = (int)g_client_count;
+
 	for (size_t i = 0; i < g_client_count; i++)
 	{
 		sv_client_t *client = &g_clients[i];
 
+		float rewind_ticks;
+
+		if (g_replay_tick)
+		{
+			rewind_ticks = Sim_ReplayInput(client, i);
+		}
+		else
+		{
+			Sim_ConsumeInputs(client, tick_time);
+			rewind_ticks = Sim_GetRewindTicks(client);
+		}
+
+		if (g_journal)
+		{
+			journal_input_t *input = &g_journal_tick.inputs[i];
+			input->player_id    = client->player_id;
+			input->btn_down     = client->btn_down;
+			input->btn_pressed  = client->btn_pressed;
+			input->mouse_x      = client->mouse_x;
+			input->mouse_y      = client->mouse_y;
+			input->rewind_ticks = rewind_ticks;
+		}
+
+		// they're on their way out, so no respawning
+		if (client->disconnecting)
+			continue;
+
+		// dead clients don't need anything here, E_Destroy has set up a 
+		// timer to respawn them
 		if (client->entity)
 		{
 			sv_entity_t *e = client->entity;
@@ -261,39 +1040,28 @@ void Sim_Run(float dt)
 					bullet->y        = e->y;
 					bullet->dx       = mouse_dx;
 					bullet->dy       = mouse_dy;
-					bullet->lifetime = 2.0f;
 					bullet->size     = 4.0f;
+
+					bullet->lifetime_timer = TimerWheel_Add(&g_timers, Sim_TicksFromSeconds(2.0), SIMTIMER_ENTITY_LIFETIME, (uint32_t)bullet->id.value);
+
+					bullet->rewind_ticks = rewind_ticks;
 				}
 			}
 
 			if (client->btn_down & NETBTN_KILL)
 				E_Destroy(e);
 		}
-		else
-		{
-			// if the client is dead, they should respawn after 5 seconds
-
-			if (client->respawn_timer > 0.0f)
-			{
-				client->respawn_timer -= dt;
-				if (client->respawn_timer <= 0.0f)
-				{
-					client->respawn_timer = 0.0f;
-					Sim_SpawnPlayer(client);
-				}
-			}
-			else
-			{
-				client->respawn_timer = 5.0f;
-			}
-		}
 
 		client->btn_pressed  = 0;
 		client->btn_released = 0;
 	}
 
+	TIMED_BLOCK_END(Sim_UpdateClients);
+
 	// simulate entities
-	
+
+	TIMED_BLOCK_BEGIN(Sim_UpdateEntities);
+
 	for (size_t i = MIN_ENTITY_INDEX; i <= MAX_ENTITY_INDEX; i++)
 	{
 		sv_entity_t *e = &g_entities[i];
@@ -305,6 +1073,10 @@ void Sim_Run(float dt)
 
 		if (e->flags & EFLAG_HURTS)
 		{
+			// the history's newest tick is the previous tick, which is what 
+			// the entities look like before they move this tick
+			sv_rewind_t rewind = History_Rewind(e->rewind_ticks);
+
 			for (size_t j = MIN_ENTITY_INDEX; j <= MAX_ENTITY_INDEX; j++)
 			{
 				if (i == j) 
@@ -318,9 +1090,17 @@ void Sim_Run(float dt)
 				if (other_e == e->parent)
 					continue;
 
+				// if the other entity wasn't around back then, the best we can
+				// do is test against where it is now
+				float other_x = other_e->x;
+				float other_y = other_e->y;
+
+				if (e->rewind_ticks > 0.0f)
+					History_GetPosition(&rewind, other_e->id, &other_x, &other_y);
+
 				float radius = 0.5f*e->size + 0.5f*other_e->size;
-				if (fabsf(e->x - other_e->x) <= radius &&
-					fabsf(e->y - other_e->y) <= radius)
+				if (fabsf(e->x - other_x) <= radius &&
+					fabsf(e->y - other_y) <= radius)
 				{
 					// they collide!
 
@@ -330,7 +1110,14 @@ void Sim_Run(float dt)
 						sv_client_t *other_client  = SV_GetClientForEntity(other_e);
 						if (parent_client && other_client)
 						{
-							printf("%s obliterated %s!\n", parent_client->name, other_client->name);
+							LOG_INFO("%s obliterated %s!\n", parent_client->name, other_client->name);
+
+							net_msg_kill_t message = {
+								.kind      = NETMSG_KILL,
+								.killer_id = parent_client->player_id,
+								.victim_id = other_client->player_id,
+							};
+							SV_SendMessageToAllClients(&message, sizeof(message));
 						}
 					}
 
@@ -340,28 +1127,114 @@ void Sim_Run(float dt)
 			}
 		}
 
-		// if the entity had a limited lifespan, handle that
-
-		if (e->lifetime > 0.0f)
-		{
-			e->lifetime -= dt;
-			if (e->lifetime <= 0.0f)
-			{
-				E_Destroy(e);
-			}
-		}
-
 		// integrate physics
 
 		e->x += dt*e->dx;
 		e->y += dt*e->dy;
 	}
 
-	// send world state out to the clients
+	TIMED_BLOCK_END(Sim_UpdateEntities);
 
-	for (size_t i = 0; i < g_client_count; i++)
+	TIMED_BLOCK_BEGIN(History_Record);
+	History_Record(g_tick, g_entities);
+	TIMED_BLOCK_END(History_Record);
+
+	if (g_journal)
 	{
-		sv_client_t *client = &g_clients[i];
-		Sim_SendWorldState(client);
+		g_journal_tick.tick = g_tick;
+		g_journal_tick.hash = Sim_HashWorld();
+		Journal_WriteTick(g_journal, &g_journal_tick);
+	}
+
+	g_tick += 1;
+
+	// the recorder thread does the encoding and the writing, all that
+	// happens here is a copy of the world into its ring
+	if (g_recorder)
+	{
+		TIMED_BLOCK_BEGIN(Sim_RecordFrame);
+		Sim_RecordFrame();
+		TIMED_BLOCK_END(Sim_RecordFrame);
+	}
+
+	// hand the world over to the sender, which builds the world states
+	// and sends them out to the clients while we get on with the next
+	// tick. when re-simulating, there's nobody to send them to
+
+	if (!g_replaying)
+	{
+		TIMED_BLOCK_BEGIN(Sim_SendWorldStates);
+		Sim_SendWorldStates(tick_time);
+		TIMED_BLOCK_END(Sim_SendWorldStates);
+	}
+
+	TIMED_BLOCK_END(Sim_Run);
+}
+
+// ------------------------------------------------------------------
+// re-simulating
+
+void Sim_ReplayJoin(unsigned char player_id)
+{
+	g_replaying = true;
+
+	// the address is only there for the log, and to tell clients apart
+	net_addr_t address = {
+		.family = 2, // AF_INET
+		.port   = player_id,
+	};
+
+	sv_client_t *client = SV_AddClient(address);
+
+	if (!client)
+	{
+		LOG_ERROR("Sim_ReplayJoin: no room for player %u\n", player_id);
+		return;
+	}
+
+	// the ids get handed out the same way every time, so if they don't
+	// match, things went off the rails before this
+	if (client->player_id != player_id)
+		LOG_ERROR("Sim_ReplayJoin: player %u joined as player %u\n", player_id, client->player_id);
+
+	snprintf(client->name, sizeof(client->name), "player%u", client->player_id);
+
+	client->new_connection = false;
+
+	Sim_JoinClient(client);
+}
+
+void Sim_ReplayDisconnect(unsigned char player_id)
+{
+	sv_client_t *client = SV_GetClientForPlayerId(player_id);
+
+	if (!client)
+	{
+		LOG_ERROR("Sim_ReplayDisconnect: there is no player %u\n", player_id);
+		return;
 	}
+
+	Sim_DisconnectClient(client);
+}
+
+uint64_t Sim_ReplayTick(float dt, const journal_tick_t *tick, const journal_event_t *timeouts, int timeout_count)
+{
+	g_replaying = true;
+
+	if (tick->tick != g_tick)
+		LOG_ERROR("Sim_ReplayTick: the journal has tick %u where tick %u should be\n", tick->tick, g_tick);
+
+	g_replay_tick          = tick;
+	g_replay_timeouts      = timeouts;
+	g_replay_timeout_count = timeout_count;
+	g_replay_timeout_index = 0;
+
+	Sim_Run(dt);
+
+	if (g_replay_timeout_index != g_replay_timeout_count)
+		LOG_ERROR("Sim_ReplayTick: %d timeouts in the journal never fired on tick %u\n", g_replay_timeout_count - g_replay_timeout_index, tick->tick);
+
+	g_replay_tick = NULL;
+
+	return Sim_HashWorld();
 }
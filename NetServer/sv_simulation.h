@@ -1,10 +1,15 @@
 #pragma once
 
+#include "timerwheel.h"
+
 // ------------------------------------------------------------------
 // sv_simulation.h: actual gameplay code stuff
 
 typedef struct sv_client_t sv_client_t;
 typedef struct net_header_t net_header_t;
+typedef struct journal_tick_t journal_tick_t;
+typedef struct journal_event_t journal_event_t;
+typedef struct rec_frame_t rec_frame_t;
 
 enum
 {
@@ -26,7 +31,11 @@ typedef struct sv_entity_t
 
 	float size;
 
-	float lifetime;
+	timer_handle_t lifetime_timer; // destroys the entity when it fires, if it's set
+
+	// for bullets: how many ticks into the past their hits get tested,
+	// to match what the shooter saw when they fired
+	float rewind_ticks;
 } sv_entity_t;
 
 // ------------------------------------------------------------------
@@ -35,5 +44,66 @@ sv_entity_t *E_FromId(net_entity_id_t id);
 sv_entity_t *E_Spawn(void);
 void         E_Destroy(sv_entity_t *entity);
 
-void Sim_ProcessPacket(sv_client_t *client, net_header_t *packet);
+// the amount of entities that currently exist
+int E_GetCount(void);
+
+// must be called before anything else, with the time between calls
+// to Sim_Run
+void Sim_Init(double seconds_per_tick);
+
+// the tick that the next call to Sim_Run simulates
+uint32_t Sim_GetTick(void);
+
+// hit tests never get rewound further into the past than this, so 
+// players with terrible connections can't hit people who have long
+// since moved to safety. 0 turns lag compensation off entirely
+void Sim_SetMaxRewind(float seconds);
+
+// clients we haven't heard from in this many seconds get dropped
+void Sim_SetClientTimeout(double seconds);
+
+void Sim_ProcessPacket(sv_client_t *client, net_header_t *packet, size_t packet_size);
 void Sim_Run(float dt);
+
+// ------------------------------------------------------------------
+// deterministic mode, see sv_journal.h
+
+// all the random numbers in the simulation come from this seed. it
+// should be set right after Sim_Init
+void Sim_SetSeed(uint64_t seed);
+
+// starts writing down everything that goes into the simulation, so it
+// can be run again with the Sim_Replay functions. has to be called
+// after all the Sim_Set functions, and before the first tick. returns
+// 0 on success
+int  Sim_StartJournal(const char *path);
+void Sim_StopJournal(void);
+
+// a hash of the world as it is right now, the same world always gets
+// the same hash
+uint64_t Sim_HashWorld(void);
+
+// instead of clients and their packets, these run the simulation off a
+// journal, one record at a time and in the same order. once they've been
+// called, the simulation stops sending anything to anyone
+void Sim_ReplayJoin(unsigned char player_id);
+void Sim_ReplayDisconnect(unsigned char player_id);
+
+// runs one tick, with the inputs from the tick's record and the timeout
+// records that came before it. returns the world hash after the tick,
+// to check against the tick's record
+uint64_t Sim_ReplayTick(float dt, const journal_tick_t *tick, const journal_event_t *timeouts, int timeout_count);
+
+// ------------------------------------------------------------------
+// recording, see sv_recorder.h
+
+// starts writing the world after every tick to a recording, which
+// NetGame -replay can play back. returns 0 on success
+int  Sim_StartRecording(const char *path);
+
+// writes out the rest of the recording and its index
+void Sim_StopRecording(void);
+
+// fills in the world as of the last tick, the way it goes into a
+// recording, and out to spectators (see sv_broadcast.h)
+void Sim_GetFrame(rec_frame_t *frame);